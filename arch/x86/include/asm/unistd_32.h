@@ -354,10 +354,14 @@
 #define __NR_setns		346
 #define __NR_process_vm_readv	347
 #define __NR_process_vm_writev	348
+#define __NR_io_uring_setup	349
+#define __NR_io_uring_enter	350
+#define __NR_io_uring_register	351
+#define __NR_getdents_plus	352
 
 #ifdef __KERNEL__
 
-#define NR_syscalls 349
+#define NR_syscalls 353
 
 #define __ARCH_WANT_IPC_PARSE_VERSION
 #define __ARCH_WANT_OLD_READDIR
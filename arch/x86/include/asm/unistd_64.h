@@ -686,6 +686,14 @@ __SYSCALL(__NR_getcpu, sys_getcpu)
 __SYSCALL(__NR_process_vm_readv, sys_process_vm_readv)
 #define __NR_process_vm_writev			311
 __SYSCALL(__NR_process_vm_writev, sys_process_vm_writev)
+#define __NR_io_uring_setup			312
+__SYSCALL(__NR_io_uring_setup, sys_io_uring_setup)
+#define __NR_io_uring_enter			313
+__SYSCALL(__NR_io_uring_enter, sys_io_uring_enter)
+#define __NR_io_uring_register			314
+__SYSCALL(__NR_io_uring_register, sys_io_uring_register)
+#define __NR_getdents_plus			315
+__SYSCALL(__NR_getdents_plus, sys_getdents_plus)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
@@ -0,0 +1,2872 @@
+/*
+ *  BFQ, or Budget Fair Queueing, disk scheduler.
+ *
+ *  Based on the CFQ disk scheduler. Instead of time slices, every queue
+ *  is assigned a budget, measured in sectors, and queues are served in
+ *  the order given by B-WF2Q+, a budget-based variant of the WF2Q+ fair
+ *  queueing algorithm. A queue keeps the device until it exhausts its
+ *  budget, runs out of requests or hits its budget timeout, so fairness
+ *  is guaranteed in terms of service rather than of device time.
+ *
+ *  See Documentation/block/bfq-iosched.txt
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/jiffies.h>
+#include <linux/rbtree.h>
+#include <linux/ioprio.h>
+#include <linux/ktime.h>
+#include <linux/idr.h>
+#include <linux/blktrace_api.h>
+
+/*
+ * tunables
+ */
+/* max requests dispatched from the in-service queue in one round */
+static const int bfq_quantum = 4;
+static const int bfq_fifo_expire[2] = { HZ / 4, HZ / 8 };
+/* maximum backwards seek, in KiB */
+static const int bfq_back_max = 16 * 1024;
+/* penalty of a backwards seek */
+static const int bfq_back_penalty = 2;
+static int bfq_slice_idle = HZ / 125;
+/* budget timeouts, i.e. max time a queue may keep the device */
+static const int bfq_timeout_sync = HZ / 8;
+static int bfq_timeout_async = HZ / 25;
+/* max requests dispatched from an async queue per budget */
+static const int bfq_max_budget_async_rq = 4;
+/* max budget, in sectors, used until the device peak rate is known */
+static const int bfq_default_max_budget = 16 * 1024;
+/* async service is charged this many times its size */
+static const int bfq_async_charge_factor = 10;
+
+/* weight-raising: multiplier and durations */
+static const int bfq_wr_coeff = 20;
+static const int bfq_wr_rt_max_time = HZ * 3 / 10;	/* 300 ms */
+static const int bfq_wr_min_idle_time = 2 * HZ;
+/* max rate, in sectors/sec, of a soft real-time queue */
+static const int bfq_wr_max_softrt_rate = 7000;
+
+/*
+ * idle-class queues are served at least once every this many jiffies
+ */
+#define BFQ_CL_IDLE_TIMEOUT	(HZ / 5)
+
+/*
+ * below this threshold, we consider thinktime immediate
+ */
+#define BFQ_MIN_TT		(2)
+
+#define BFQ_HW_QUEUE_MIN	(5)
+
+/* fixed point shift for virtual times and for the peak rate */
+#define WFQ_SERVICE_SHIFT	22
+#define BFQ_RATE_SHIFT		16
+
+/* budgets shorter than this, in usecs, don't contribute to peak rate */
+#define BFQ_MIN_RATE_SAMPLE	20000
+/* number of budgets after which the max budget is autotuned */
+#define BFQ_BUDGETS_AUTOTUNE	16
+
+#define BFQ_WEIGHT_CONVERSION_COEFF	10
+#define BFQ_MAX_WEIGHT		(IOPRIO_BE_NR * BFQ_WEIGHT_CONVERSION_COEFF)
+/* raised weights must still fit the unsigned short entity weight */
+#define BFQ_MAX_WR_COEFF	(USHRT_MAX / BFQ_MAX_WEIGHT)
+
+#define BFQQ_SEEK_THR		(sector_t)(8 * 100)
+#define BFQQ_SECT_THR_NONROT	(sector_t)(2 * 32)
+#define BFQQ_SEEKY(bfqq)	(hweight32(bfqq->seek_history) > 32/8)
+
+#define RQ_CIC(rq)		\
+	((struct bfq_io_context *) (rq)->elevator_private[0])
+#define RQ_BFQQ(rq)		(struct bfq_queue *) ((rq)->elevator_private[1])
+
+static struct kmem_cache *bfq_pool;
+static struct kmem_cache *bfq_ioc_pool;
+
+static DEFINE_PER_CPU(unsigned long, bfq_ioc_count);
+static struct completion *ioc_gone;
+static DEFINE_SPINLOCK(ioc_gone_lock);
+
+static DEFINE_SPINLOCK(cic_index_lock);
+static DEFINE_IDA(cic_index_ida);
+
+#define BFQ_IOPRIO_CLASSES	3
+#define bfq_class_idle(bfqq)	((bfqq)->ioprio_class == IOPRIO_CLASS_IDLE)
+#define bfq_class_rt(bfqq)	((bfqq)->ioprio_class == IOPRIO_CLASS_RT)
+
+#define sample_valid(samples)	((samples) > 80)
+
+/*
+ * One service tree per io priority class. Backlogged queues that are not
+ * in service are kept in ->active, ordered by virtual finish time. Every
+ * node also caches the minimum virtual start time of its subtree, so the
+ * eligible queue with the smallest finish time is found in O(log N).
+ */
+struct bfq_service_tree {
+	struct rb_root active;
+	/* virtual time of the tree */
+	u64 vtime;
+	/* sum of the weights of the backlogged queues */
+	unsigned long wsum;
+	unsigned int count;
+};
+
+/*
+ * Per process-grouping structure
+ */
+struct bfq_queue {
+	/* reference count */
+	int ref;
+	/* various state flags, see below */
+	unsigned int flags;
+	/* parent bfq_data */
+	struct bfq_data *bfqd;
+
+	/* service tree member, ordered by ->finish */
+	struct rb_node rb_node;
+	/* B-WF2Q+ virtual timestamps */
+	u64 start, finish;
+	/* min ->start in the subtree rooted at this node */
+	u64 min_start;
+	/* weight and class the queue is accounted with in its tree */
+	unsigned short weight;
+	unsigned short st_class;
+
+	/* sectors served in the current budget */
+	unsigned long service;
+	/* current budget, in sectors */
+	unsigned long budget;
+	/* budget to be assigned next, as learned by budget feedback */
+	unsigned long max_budget;
+	/* jiffies when the current budget expires */
+	unsigned long budget_timeout;
+
+	/* sorted list of pending requests */
+	struct rb_root sort_list;
+	/* if fifo isn't expired, next request to serve */
+	struct request *next_rq;
+	/* requests queued in sort_list */
+	int queued[2];
+	/* currently allocated requests */
+	int allocated[2];
+	/* fifo list of requests in sort_list */
+	struct list_head fifo;
+	/* number of requests that are on the dispatch list or inside driver */
+	int dispatched;
+	/* requests dispatched in the current budget */
+	int budget_dispatch;
+
+	/* io prio of this group */
+	unsigned short ioprio, org_ioprio;
+	unsigned short ioprio_class, org_ioprio_class;
+
+	sector_t last_request_pos;
+	u32 seek_history;
+
+	/* weight-raising state, see bfq_add_bfqq_busy() */
+	unsigned int wr_coeff;
+	unsigned long wr_start;
+	unsigned long wr_cur_max_time;
+	unsigned long last_idle_bklogged;
+	unsigned long service_from_backlogged;
+	unsigned long soft_rt_next_start;
+
+	pid_t pid;
+};
+
+enum bfqq_expiration {
+	BFQ_BFQQ_TOO_IDLE = 0,		/* queue has been idling too long */
+	BFQ_BFQQ_BUDGET_TIMEOUT,	/* budget took too long to be used */
+	BFQ_BFQQ_BUDGET_EXHAUSTED,	/* budget consumed */
+	BFQ_BFQQ_NO_MORE_REQUESTS,	/* the queue has no more requests */
+};
+
+/*
+ * Per block device queue structure
+ */
+struct bfq_data {
+	struct request_queue *queue;
+
+	struct bfq_service_tree service_tree[BFQ_IOPRIO_CLASSES];
+
+	unsigned int busy_queues;
+
+	int rq_in_driver;
+	int sync_flight;
+
+	/*
+	 * queue-depth detection
+	 */
+	int rq_queued;
+	int hw_tag;
+	int hw_tag_est_depth;
+	unsigned int hw_tag_samples;
+
+	/*
+	 * idle window management
+	 */
+	struct timer_list idle_slice_timer;
+	struct work_struct unplug_work;
+
+	struct bfq_queue *active_queue;
+	struct bfq_io_context *active_cic;
+
+	sector_t last_position;
+
+	/*
+	 * peak rate estimation and max budget autotuning
+	 */
+	ktime_t last_budget_start;
+	ktime_t last_idling_start;
+	/* sectors per usec, shifted left by BFQ_RATE_SHIFT */
+	u64 peak_rate;
+	int peak_rate_samples;
+	int budgets_assigned;
+	unsigned long bfq_max_budget;
+
+	unsigned long bfq_class_idle_last_service;
+
+	/*
+	 * async queue for each priority case
+	 */
+	struct bfq_queue *async_bfqq[2][IOPRIO_BE_NR];
+	struct bfq_queue *async_idle_bfqq;
+
+	/*
+	 * tunables, see top of file
+	 */
+	unsigned int bfq_quantum;
+	unsigned int bfq_fifo_expire[2];
+	unsigned int bfq_back_penalty;
+	unsigned int bfq_back_max;
+	unsigned int bfq_slice_idle;
+	unsigned int bfq_timeout[2];
+	unsigned int bfq_max_budget_async_rq;
+	unsigned int bfq_user_max_budget;
+	unsigned int bfq_low_latency;
+	unsigned int bfq_wr_coeff;
+	unsigned int bfq_wr_max_time;
+	unsigned int bfq_wr_rt_max_time;
+	unsigned int bfq_wr_min_idle_time;
+	unsigned int bfq_wr_max_softrt_rate;
+
+	unsigned int cic_index;
+	struct list_head cic_list;
+
+	/*
+	 * Fallback dummy bfqq for extreme OOM conditions
+	 */
+	struct bfq_queue oom_bfqq;
+};
+
+enum bfqq_state_flags {
+	BFQ_BFQQ_FLAG_busy = 0,		/* has requests or is in service */
+	BFQ_BFQQ_FLAG_wait_request,	/* waiting for a request */
+	BFQ_BFQQ_FLAG_must_alloc,	/* must be allowed rq alloc */
+	BFQ_BFQQ_FLAG_fifo_expire,	/* FIFO checked in this budget */
+	BFQ_BFQQ_FLAG_idle_window,	/* idling enabled */
+	BFQ_BFQQ_FLAG_prio_changed,	/* task priority has changed */
+	BFQ_BFQQ_FLAG_sync,		/* synchronous queue */
+	BFQ_BFQQ_FLAG_budget_new,	/* no request dispatched in budget */
+	BFQ_BFQQ_FLAG_softrt_update,	/* may update soft_rt_next_start */
+};
+
+#define BFQ_BFQQ_FNS(name)						\
+static inline void bfq_mark_bfqq_##name(struct bfq_queue *bfqq)		\
+{									\
+	(bfqq)->flags |= (1 << BFQ_BFQQ_FLAG_##name);			\
+}									\
+static inline void bfq_clear_bfqq_##name(struct bfq_queue *bfqq)	\
+{									\
+	(bfqq)->flags &= ~(1 << BFQ_BFQQ_FLAG_##name);			\
+}									\
+static inline int bfq_bfqq_##name(const struct bfq_queue *bfqq)		\
+{									\
+	return ((bfqq)->flags & (1 << BFQ_BFQQ_FLAG_##name)) != 0;	\
+}
+
+BFQ_BFQQ_FNS(busy);
+BFQ_BFQQ_FNS(wait_request);
+BFQ_BFQQ_FNS(must_alloc);
+BFQ_BFQQ_FNS(fifo_expire);
+BFQ_BFQQ_FNS(idle_window);
+BFQ_BFQQ_FNS(prio_changed);
+BFQ_BFQQ_FNS(sync);
+BFQ_BFQQ_FNS(budget_new);
+BFQ_BFQQ_FNS(softrt_update);
+#undef BFQ_BFQQ_FNS
+
+#define bfq_log_bfqq(bfqd, bfqq, fmt, args...)	\
+	blk_add_trace_msg((bfqd)->queue, "bfq%d%c " fmt, (bfqq)->pid, \
+			bfq_bfqq_sync((bfqq)) ? 'S' : 'A', ##args)
+#define bfq_log(bfqd, fmt, args...)	\
+	blk_add_trace_msg((bfqd)->queue, "bfq " fmt, ##args)
+
+static void bfq_dispatch_insert(struct request_queue *, struct request *);
+static struct bfq_queue *bfq_get_queue(struct bfq_data *, bool,
+				       struct io_context *, gfp_t);
+static struct bfq_io_context *bfq_cic_lookup(struct bfq_data *,
+						struct io_context *);
+static void bfq_put_queue(struct bfq_queue *bfqq);
+
+static inline struct bfq_queue *cic_to_bfqq(struct bfq_io_context *cic,
+					    bool is_sync)
+{
+	return cic->bfqq[is_sync];
+}
+
+static inline void cic_set_bfqq(struct bfq_io_context *cic,
+				struct bfq_queue *bfqq, bool is_sync)
+{
+	cic->bfqq[is_sync] = bfqq;
+}
+
+#define CIC_DEAD_KEY	1ul
+#define CIC_DEAD_INDEX_SHIFT	1
+
+static inline void *bfqd_dead_key(struct bfq_data *bfqd)
+{
+	return (void *)(bfqd->cic_index << CIC_DEAD_INDEX_SHIFT | CIC_DEAD_KEY);
+}
+
+static inline struct bfq_data *cic_to_bfqd(struct bfq_io_context *cic)
+{
+	struct bfq_data *bfqd = cic->key;
+
+	if (unlikely((unsigned long) bfqd & CIC_DEAD_KEY))
+		return NULL;
+
+	return bfqd;
+}
+
+/*
+ * We regard a request as SYNC, if it's either a read or has the SYNC bit
+ * set (in which case it could also be direct WRITE).
+ */
+static inline bool bfq_bio_sync(struct bio *bio)
+{
+	return bio_data_dir(bio) == READ || (bio->bi_rw & REQ_SYNC);
+}
+
+/*
+ * scheduler run of queue, if there are requests pending and no one in the
+ * driver that will restart queueing
+ */
+static inline void bfq_schedule_dispatch(struct bfq_data *bfqd)
+{
+	if (bfqd->busy_queues) {
+		bfq_log(bfqd, "schedule dispatch");
+		kblockd_schedule_work(bfqd->queue, &bfqd->unplug_work);
+	}
+}
+
+/*
+ * Budget and weight helpers
+ */
+static inline unsigned long bfq_min_budget(struct bfq_data *bfqd)
+{
+	return bfqd->bfq_max_budget / 32;
+}
+
+static inline unsigned long bfq_bfqq_budget_left(struct bfq_queue *bfqq)
+{
+	if (bfqq->service >= bfqq->budget)
+		return 0;
+	return bfqq->budget - bfqq->service;
+}
+
+static inline unsigned short bfq_ioprio_to_weight(int ioprio)
+{
+	WARN_ON(ioprio < 0 || ioprio >= IOPRIO_BE_NR);
+	return (IOPRIO_BE_NR - ioprio) * BFQ_WEIGHT_CONVERSION_COEFF;
+}
+
+static inline unsigned short bfq_bfqq_weight(struct bfq_queue *bfqq)
+{
+	return bfq_ioprio_to_weight(bfqq->ioprio) * bfqq->wr_coeff;
+}
+
+static inline int bfq_bfqq_class_idx(struct bfq_queue *bfqq)
+{
+	if (bfq_class_rt(bfqq))
+		return 0;
+	if (bfq_class_idle(bfqq))
+		return 2;
+	return 1;
+}
+
+/*
+ * Length of the weight-raising period of interactive queues. Defaults to
+ * roughly the time needed to load a large application from cold cache.
+ */
+static unsigned long bfq_wr_duration(struct bfq_data *bfqd)
+{
+	if (bfqd->bfq_wr_max_time)
+		return bfqd->bfq_wr_max_time;
+
+	return blk_queue_nonrot(bfqd->queue) ? 2 * HZ : 6 * HZ;
+}
+
+/*
+ * Service charged to a queue for a request: async I/O is charged more
+ * than its size, so that writeback cannot steal bandwidth from readers.
+ */
+static inline unsigned long bfq_serv_to_charge(struct request *rq,
+					       struct bfq_queue *bfqq)
+{
+	if (bfq_bfqq_sync(bfqq) || bfqq->wr_coeff > 1)
+		return blk_rq_sectors(rq);
+
+	return blk_rq_sectors(rq) * bfq_async_charge_factor;
+}
+
+/*
+ * Virtual time arithmetic. Timestamps are compared with wrapping
+ * arithmetic, like the other vtime-based schedulers in the tree.
+ */
+static inline u64 bfq_delta(unsigned long service, unsigned long weight)
+{
+	u64 d = (u64)service << WFQ_SERVICE_SHIFT;
+
+	do_div(d, weight);
+	return d;
+}
+
+static inline int bfq_gt(u64 a, u64 b)
+{
+	return (s64)(a - b) > 0;
+}
+
+static inline u64 bfq_min_vtime(u64 a, u64 b)
+{
+	return bfq_gt(a, b) ? b : a;
+}
+
+/*
+ * Lifted from AS - choose which of rq1 and rq2 that is best served now.
+ * We choose the request that is closest to the head right now. Distance
+ * behind the head is penalized and only allowed to a certain extent.
+ */
+static struct request *
+bfq_choose_req(struct bfq_data *bfqd, struct request *rq1, struct request *rq2, sector_t last)
+{
+	sector_t s1, s2, d1 = 0, d2 = 0;
+	unsigned long back_max;
+#define BFQ_RQ1_WRAP	0x01 /* request 1 wraps */
+#define BFQ_RQ2_WRAP	0x02 /* request 2 wraps */
+	unsigned wrap = 0; /* bit mask: requests behind the disk head? */
+
+	if (rq1 == NULL || rq1 == rq2)
+		return rq2;
+	if (rq2 == NULL)
+		return rq1;
+
+	if (rq_is_sync(rq1) != rq_is_sync(rq2))
+		return rq_is_sync(rq1) ? rq1 : rq2;
+
+	if ((rq1->cmd_flags ^ rq2->cmd_flags) & REQ_PRIO)
+		return rq1->cmd_flags & REQ_PRIO ? rq1 : rq2;
+
+	s1 = blk_rq_pos(rq1);
+	s2 = blk_rq_pos(rq2);
+
+	/*
+	 * by definition, 1KiB is 2 sectors
+	 */
+	back_max = bfqd->bfq_back_max * 2;
+
+	/*
+	 * Strict one way elevator _except_ in the case where we allow
+	 * short backward seeks which are biased as twice the cost of a
+	 * similar forward seek.
+	 */
+	if (s1 >= last)
+		d1 = s1 - last;
+	else if (s1 + back_max >= last)
+		d1 = (last - s1) * bfqd->bfq_back_penalty;
+	else
+		wrap |= BFQ_RQ1_WRAP;
+
+	if (s2 >= last)
+		d2 = s2 - last;
+	else if (s2 + back_max >= last)
+		d2 = (last - s2) * bfqd->bfq_back_penalty;
+	else
+		wrap |= BFQ_RQ2_WRAP;
+
+	switch (wrap) {
+	case 0: /* common case: rq1 and rq2 not wrapped */
+		if (d1 < d2)
+			return rq1;
+		else if (d2 < d1)
+			return rq2;
+		else {
+			if (s1 >= s2)
+				return rq1;
+			else
+				return rq2;
+		}
+
+	case BFQ_RQ2_WRAP:
+		return rq1;
+	case BFQ_RQ1_WRAP:
+		return rq2;
+	case (BFQ_RQ1_WRAP|BFQ_RQ2_WRAP): /* both rqs wrapped */
+	default:
+		/*
+		 * Since both rqs are wrapped,
+		 * start with the one that's further behind head
+		 * (--> only *one* back seek required),
+		 * since back seek takes more time than forward.
+		 */
+		if (s1 <= s2)
+			return rq1;
+		else
+			return rq2;
+	}
+}
+
+/*
+ * would be nice to take fifo expire time into account as well
+ */
+static struct request *
+bfq_find_next_rq(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+		  struct request *last)
+{
+	struct rb_node *rbnext = rb_next(&last->rb_node);
+	struct rb_node *rbprev = rb_prev(&last->rb_node);
+	struct request *next = NULL, *prev = NULL;
+
+	BUG_ON(RB_EMPTY_NODE(&last->rb_node));
+
+	if (rbprev)
+		prev = rb_entry_rq(rbprev);
+
+	if (rbnext)
+		next = rb_entry_rq(rbnext);
+	else {
+		rbnext = rb_first(&bfqq->sort_list);
+		if (rbnext && rbnext != &last->rb_node)
+			next = rb_entry_rq(rbnext);
+	}
+
+	return bfq_choose_req(bfqd, next, prev, blk_rq_pos(last));
+}
+
+/*
+ * B-WF2Q+ service tree. ->active is ordered by finish time and augmented
+ * with the minimum start time of every subtree.
+ */
+static void bfq_update_min_start(struct rb_node *node, void *unused)
+{
+	struct bfq_queue *bfqq = rb_entry(node, struct bfq_queue, rb_node);
+	struct bfq_queue *child;
+
+	bfqq->min_start = bfqq->start;
+	if (node->rb_left) {
+		child = rb_entry(node->rb_left, struct bfq_queue, rb_node);
+		bfqq->min_start = bfq_min_vtime(bfqq->min_start,
+						child->min_start);
+	}
+	if (node->rb_right) {
+		child = rb_entry(node->rb_right, struct bfq_queue, rb_node);
+		bfqq->min_start = bfq_min_vtime(bfqq->min_start,
+						child->min_start);
+	}
+}
+
+static void bfq_st_insert(struct bfq_service_tree *st, struct bfq_queue *bfqq)
+{
+	struct rb_node **p = &st->active.rb_node;
+	struct rb_node *parent = NULL;
+	struct bfq_queue *__bfqq;
+
+	while (*p) {
+		parent = *p;
+		__bfqq = rb_entry(parent, struct bfq_queue, rb_node);
+
+		if (bfq_gt(__bfqq->finish, bfqq->finish))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&bfqq->rb_node, parent, p);
+	rb_insert_color(&bfqq->rb_node, &st->active);
+	rb_augment_insert(&bfqq->rb_node, bfq_update_min_start, NULL);
+	st->count++;
+}
+
+static void bfq_st_erase(struct bfq_service_tree *st, struct bfq_queue *bfqq)
+{
+	struct rb_node *deepest;
+
+	BUG_ON(RB_EMPTY_NODE(&bfqq->rb_node));
+
+	deepest = rb_augment_erase_begin(&bfqq->rb_node);
+	rb_erase(&bfqq->rb_node, &st->active);
+	rb_augment_erase_end(deepest, bfq_update_min_start, NULL);
+	RB_CLEAR_NODE(&bfqq->rb_node);
+	st->count--;
+}
+
+/*
+ * If no queue is eligible, i.e. all start times are in the future, jump
+ * the virtual time forward to the smallest start time.
+ */
+static void bfq_update_vtime(struct bfq_service_tree *st)
+{
+	struct bfq_queue *root;
+
+	if (RB_EMPTY_ROOT(&st->active))
+		return;
+
+	root = rb_entry(st->active.rb_node, struct bfq_queue, rb_node);
+	if (bfq_gt(root->min_start, st->vtime))
+		st->vtime = root->min_start;
+}
+
+/*
+ * Find the eligible queue (start <= vtime) with the smallest finish time.
+ */
+static struct bfq_queue *bfq_first_active(struct bfq_service_tree *st)
+{
+	struct rb_node *node = st->active.rb_node;
+	struct bfq_queue *bfqq, *first = NULL;
+
+	while (node) {
+		bfqq = rb_entry(node, struct bfq_queue, rb_node);
+left:
+		if (!bfq_gt(bfqq->start, st->vtime))
+			first = bfqq;
+
+		if (node->rb_left) {
+			bfqq = rb_entry(node->rb_left, struct bfq_queue,
+					rb_node);
+			if (!bfq_gt(bfqq->min_start, st->vtime)) {
+				node = node->rb_left;
+				goto left;
+			}
+		}
+		if (first)
+			break;
+		node = node->rb_right;
+	}
+
+	return first;
+}
+
+/*
+ * Put a backlogged queue on its service tree, with a new budget.
+ */
+static void bfq_activate_bfqq(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	struct bfq_service_tree *st;
+
+	bfqq->st_class = bfq_bfqq_class_idx(bfqq);
+	bfqq->weight = bfq_bfqq_weight(bfqq);
+	st = &bfqd->service_tree[bfqq->st_class];
+
+	/*
+	 * A queue that has been idle long enough restarts from the current
+	 * virtual time; one that comes back before its finish time was
+	 * reached is not allowed to gain anything by having been idle.
+	 */
+	if (bfq_gt(st->vtime, bfqq->finish))
+		bfqq->start = st->vtime;
+	else
+		bfqq->start = bfqq->finish;
+
+	bfqq->budget = bfqq->max_budget;
+	if (bfqq->next_rq)
+		bfqq->budget = max(bfqq->budget,
+				   bfq_serv_to_charge(bfqq->next_rq, bfqq));
+	bfqq->finish = bfqq->start + bfq_delta(bfqq->budget, bfqq->weight);
+
+	st->wsum += bfqq->weight;
+	bfq_st_insert(st, bfqq);
+}
+
+/*
+ * Remove a queue from the weight sum of its tree. The queue must not be
+ * on the active tree (either in service or being deactivated).
+ */
+static void bfq_forget_bfqq(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	struct bfq_service_tree *st = &bfqd->service_tree[bfqq->st_class];
+
+	BUG_ON(st->wsum < bfqq->weight);
+	st->wsum -= bfqq->weight;
+}
+
+static void bfq_bfqq_served(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+			    unsigned long served)
+{
+	struct bfq_service_tree *st = &bfqd->service_tree[bfqq->st_class];
+
+	bfqq->service += served;
+	bfqq->service_from_backlogged += served;
+	if (st->wsum)
+		st->vtime += bfq_delta(served, st->wsum);
+
+	bfq_log_bfqq(bfqd, bfqq, "served %lu/%lu", bfqq->service,
+		     bfqq->budget);
+}
+
+/*
+ * Select the next queue to serve: RT before BE before IDLE, with the
+ * idle class getting a turn every BFQ_CL_IDLE_TIMEOUT.
+ */
+static struct bfq_queue *bfq_get_next_queue(struct bfq_data *bfqd)
+{
+	struct bfq_service_tree *st;
+	struct bfq_queue *bfqq;
+	int class_idx = 0, i;
+
+	if (!RB_EMPTY_ROOT(&bfqd->service_tree[2].active) &&
+	    time_is_before_jiffies(bfqd->bfq_class_idle_last_service +
+				   BFQ_CL_IDLE_TIMEOUT))
+		class_idx = 2;
+
+	for (i = 0; i < BFQ_IOPRIO_CLASSES; i++) {
+		st = &bfqd->service_tree[(class_idx + i) % BFQ_IOPRIO_CLASSES];
+		bfq_update_vtime(st);
+		bfqq = bfq_first_active(st);
+		if (bfqq) {
+			bfq_st_erase(st, bfqq);
+			return bfqq;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Add a queue to the set of backlogged queues, checking whether it
+ * deserves weight raising:
+ *
+ * - a sync queue that has been idle for a long time is assumed to belong
+ *   to an interactive task (e.g. an application being started) and gets
+ *   its weight raised for bfq_wr_duration();
+ * - a sync queue that becomes backlogged again only after having been
+ *   served at a rate below bfq_wr_max_softrt_rate is assumed to be soft
+ *   real-time (e.g. a media player) and gets a short raising period,
+ *   renewed as long as it keeps the same pattern.
+ */
+static void bfq_add_bfqq_busy(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	bool idle_for_long_time, soft_rt;
+
+	BUG_ON(bfq_bfqq_busy(bfqq));
+
+	/* a raising period may have run out while the queue was idle */
+	if (bfqq->wr_coeff > 1 &&
+	    time_is_before_jiffies(bfqq->wr_start + bfqq->wr_cur_max_time))
+		bfqq->wr_coeff = 1;
+
+	idle_for_long_time = time_is_before_jiffies(bfqq->budget_timeout +
+						bfqd->bfq_wr_min_idle_time);
+	soft_rt = bfqd->bfq_wr_max_softrt_rate > 0 && !idle_for_long_time &&
+		time_is_before_jiffies(bfqq->soft_rt_next_start);
+
+	if (bfqd->bfq_low_latency && bfq_bfqq_sync(bfqq) &&
+	    !bfq_class_idle(bfqq) && (idle_for_long_time || soft_rt)) {
+		if (bfqq->wr_coeff == 1 || idle_for_long_time ||
+		    bfqq->wr_cur_max_time == bfqd->bfq_wr_rt_max_time) {
+			bfqq->wr_coeff = bfqd->bfq_wr_coeff;
+			bfqq->wr_start = jiffies;
+			bfqq->wr_cur_max_time = idle_for_long_time ?
+				bfq_wr_duration(bfqd) :
+				bfqd->bfq_wr_rt_max_time;
+			bfq_log_bfqq(bfqd, bfqq, "wrais starting at %lu, "
+				     "duration %u", bfqq->wr_start,
+				     jiffies_to_msecs(bfqq->wr_cur_max_time));
+		}
+	}
+
+	bfqq->last_idle_bklogged = jiffies;
+	bfqq->service_from_backlogged = 0;
+	bfq_clear_bfqq_softrt_update(bfqq);
+
+	bfq_mark_bfqq_busy(bfqq);
+	bfqd->busy_queues++;
+
+	bfq_activate_bfqq(bfqd, bfqq);
+}
+
+static void bfq_del_bfqq_busy(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+			      bool on_tree)
+{
+	BUG_ON(!bfq_bfqq_busy(bfqq));
+
+	bfq_log_bfqq(bfqd, bfqq, "del from busy");
+
+	if (on_tree)
+		bfq_st_erase(&bfqd->service_tree[bfqq->st_class], bfqq);
+	bfq_forget_bfqq(bfqd, bfqq);
+
+	bfq_clear_bfqq_busy(bfqq);
+	BUG_ON(!bfqd->busy_queues);
+	bfqd->busy_queues--;
+}
+
+static void bfq_end_wr(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	bfq_log_bfqq(bfqd, bfqq, "wrais ending");
+	bfqq->wr_coeff = 1;
+	bfqq->wr_cur_max_time = 0;
+}
+
+/*
+ * rb tree support functions
+ */
+static void bfq_del_rq_rb(struct request *rq)
+{
+	struct bfq_queue *bfqq = RQ_BFQQ(rq);
+	struct bfq_data *bfqd = bfqq->bfqd;
+	const int sync = rq_is_sync(rq);
+
+	BUG_ON(!bfqq->queued[sync]);
+	bfqq->queued[sync]--;
+
+	elv_rb_del(&bfqq->sort_list, rq);
+
+	/*
+	 * The in-service queue is deactivated when it expires; any other
+	 * queue leaves its tree as soon as it has nothing left to do.
+	 */
+	if (RB_EMPTY_ROOT(&bfqq->sort_list) && bfq_bfqq_busy(bfqq) &&
+	    bfqq != bfqd->active_queue)
+		bfq_del_bfqq_busy(bfqd, bfqq, true);
+}
+
+static void bfq_add_rq_rb(struct request *rq)
+{
+	struct bfq_queue *bfqq = RQ_BFQQ(rq);
+	struct bfq_data *bfqd = bfqq->bfqd;
+
+	bfqq->queued[rq_is_sync(rq)]++;
+
+	elv_rb_add(&bfqq->sort_list, rq);
+
+	/*
+	 * check if this request is a better next-serve candidate
+	 */
+	bfqq->next_rq = bfq_choose_req(bfqd, bfqq->next_rq, rq,
+				       bfqd->last_position);
+	BUG_ON(!bfqq->next_rq);
+
+	if (!bfq_bfqq_busy(bfqq))
+		bfq_add_bfqq_busy(bfqd, bfqq);
+}
+
+static void bfq_reposition_rq_rb(struct bfq_queue *bfqq, struct request *rq)
+{
+	elv_rb_del(&bfqq->sort_list, rq);
+	bfqq->queued[rq_is_sync(rq)]--;
+	bfq_add_rq_rb(rq);
+}
+
+static struct request *
+bfq_find_rq_fmerge(struct bfq_data *bfqd, struct bio *bio)
+{
+	struct task_struct *tsk = current;
+	struct bfq_io_context *cic;
+	struct bfq_queue *bfqq;
+
+	cic = bfq_cic_lookup(bfqd, tsk->io_context);
+	if (!cic)
+		return NULL;
+
+	bfqq = cic_to_bfqq(cic, bfq_bio_sync(bio));
+	if (bfqq) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		return elv_rb_find(&bfqq->sort_list, sector);
+	}
+
+	return NULL;
+}
+
+static void bfq_activate_request(struct request_queue *q, struct request *rq)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+
+	bfqd->rq_in_driver++;
+	bfq_log_bfqq(bfqd, RQ_BFQQ(rq), "activate rq, drv=%d",
+						bfqd->rq_in_driver);
+
+	bfqd->last_position = blk_rq_pos(rq) + blk_rq_sectors(rq);
+}
+
+static void bfq_deactivate_request(struct request_queue *q, struct request *rq)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+
+	WARN_ON(!bfqd->rq_in_driver);
+	bfqd->rq_in_driver--;
+	bfq_log_bfqq(bfqd, RQ_BFQQ(rq), "deactivate rq, drv=%d",
+						bfqd->rq_in_driver);
+}
+
+static void bfq_remove_request(struct request *rq)
+{
+	struct bfq_queue *bfqq = RQ_BFQQ(rq);
+
+	if (bfqq->next_rq == rq)
+		bfqq->next_rq = bfq_find_next_rq(bfqq->bfqd, bfqq, rq);
+
+	list_del_init(&rq->queuelist);
+	bfq_del_rq_rb(rq);
+
+	bfqq->bfqd->rq_queued--;
+	if (RB_EMPTY_ROOT(&bfqq->sort_list))
+		bfqq->next_rq = NULL;
+}
+
+static int bfq_merge(struct request_queue *q, struct request **req,
+		     struct bio *bio)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+	struct request *__rq;
+
+	__rq = bfq_find_rq_fmerge(bfqd, bio);
+	if (__rq && elv_rq_merge_ok(__rq, bio)) {
+		*req = __rq;
+		return ELEVATOR_FRONT_MERGE;
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void bfq_merged_request(struct request_queue *q, struct request *req,
+			       int type)
+{
+	if (type == ELEVATOR_FRONT_MERGE) {
+		struct bfq_queue *bfqq = RQ_BFQQ(req);
+
+		bfq_reposition_rq_rb(bfqq, req);
+	}
+}
+
+static void
+bfq_merged_requests(struct request_queue *q, struct request *rq,
+		    struct request *next)
+{
+	struct bfq_queue *bfqq = RQ_BFQQ(rq);
+	/*
+	 * reposition in fifo if next is older than rq
+	 */
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist) &&
+	    time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
+		list_move(&rq->queuelist, &next->queuelist);
+		rq_set_fifo_time(rq, rq_fifo_time(next));
+	}
+
+	if (bfqq->next_rq == next)
+		bfqq->next_rq = rq;
+	bfq_remove_request(next);
+}
+
+static int bfq_allow_merge(struct request_queue *q, struct request *rq,
+			   struct bio *bio)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+	struct bfq_io_context *cic;
+	struct bfq_queue *bfqq;
+
+	/*
+	 * Disallow merge of a sync bio into an async request.
+	 */
+	if (bfq_bio_sync(bio) && !rq_is_sync(rq))
+		return false;
+
+	/*
+	 * Lookup the bfqq that this bio will be queued with. Allow
+	 * merge only if rq is queued there.
+	 */
+	cic = bfq_cic_lookup(bfqd, current->io_context);
+	if (!cic)
+		return false;
+
+	bfqq = cic_to_bfqq(cic, bfq_bio_sync(bio));
+	return bfqq == RQ_BFQQ(rq);
+}
+
+static void __bfq_set_active_queue(struct bfq_data *bfqd,
+				   struct bfq_queue *bfqq)
+{
+	if (bfqq) {
+		bfq_log_bfqq(bfqd, bfqq, "set_active budget %lu",
+			     bfqq->budget);
+		bfqq->service = 0;
+		bfqq->budget_dispatch = 0;
+
+		bfq_clear_bfqq_wait_request(bfqq);
+		bfq_clear_bfqq_must_alloc(bfqq);
+		bfq_clear_bfqq_fifo_expire(bfqq);
+		bfq_mark_bfqq_budget_new(bfqq);
+
+		if (bfq_class_idle(bfqq))
+			bfqd->bfq_class_idle_last_service = jiffies;
+
+		bfqd->budgets_assigned++;
+		del_timer(&bfqd->idle_slice_timer);
+	}
+
+	bfqd->active_queue = bfqq;
+}
+
+/*
+ * Get and set a new active queue for service.
+ */
+static struct bfq_queue *bfq_set_active_queue(struct bfq_data *bfqd)
+{
+	struct bfq_queue *bfqq = bfq_get_next_queue(bfqd);
+
+	__bfq_set_active_queue(bfqd, bfqq);
+	return bfqq;
+}
+
+/*
+ * Estimate the peak rate of the device from the service received by
+ * sync queues that kept it busy long enough, and derive the maximum
+ * budget from it, i.e. the number of sectors the device can transfer
+ * within a sync budget timeout. Returns true if bfqq was served at a
+ * rate much lower than the peak one, i.e. if it is slow (seeky).
+ */
+static bool bfq_update_peak_rate(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+				 bool compensate)
+{
+	u64 bw, usecs, expected;
+	ktime_t delta;
+
+	if (!bfq_bfqq_sync(bfqq) || bfq_bfqq_budget_new(bfqq))
+		return false;
+
+	if (compensate)
+		delta = bfqd->last_idling_start;
+	else
+		delta = ktime_get();
+	delta = ktime_sub(delta, bfqd->last_budget_start);
+	usecs = ktime_to_us(delta);
+
+	/* don't trust short or bogus samples */
+	if (usecs < 100 || usecs >= UINT_MAX)
+		return false;
+
+	bw = (u64)bfqq->service << BFQ_RATE_SHIFT;
+	do_div(bw, (unsigned long)usecs);
+
+	if (usecs > BFQ_MIN_RATE_SAMPLE && bw > bfqd->peak_rate) {
+		bfqd->peak_rate = (bfqd->peak_rate * 7 + bw) / 8;
+		bfqd->peak_rate_samples++;
+		bfq_log(bfqd, "new peak_rate %llu", bfqd->peak_rate);
+
+		if (!bfqd->bfq_user_max_budget &&
+		    bfqd->budgets_assigned >= BFQ_BUDGETS_AUTOTUNE) {
+			expected = bfqd->peak_rate * 1000 *
+				jiffies_to_msecs(bfqd->bfq_timeout[BLK_RW_SYNC]);
+			expected >>= BFQ_RATE_SHIFT;
+			bfqd->bfq_max_budget = max_t(unsigned long, expected,
+						     bfq_default_max_budget / 32);
+			bfq_log(bfqd, "max_budget %lu", bfqd->bfq_max_budget);
+		}
+	}
+
+	if (!bfqd->peak_rate_samples || usecs <= BFQ_MIN_RATE_SAMPLE)
+		return false;
+
+	return bw < bfqd->peak_rate / 2;
+}
+
+/*
+ * Budget feedback: compute the budget bfqq will receive the next time it
+ * is backlogged, based on how its last budget ended.
+ */
+static void bfq_recalc_budget(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+			      enum bfqq_expiration reason)
+{
+	unsigned long budget = bfqq->max_budget;
+	unsigned long min_budget = bfq_min_budget(bfqd);
+
+	if (!bfq_bfqq_sync(bfqq)) {
+		budget = bfqd->bfq_max_budget;
+		goto out;
+	}
+
+	switch (reason) {
+	case BFQ_BFQQ_TOO_IDLE:
+		/*
+		 * The process thought too long: it is probably not
+		 * interested in a large budget.
+		 */
+		if (budget > 5 * min_budget)
+			budget -= 4 * min_budget;
+		else
+			budget = min_budget;
+		break;
+	case BFQ_BFQQ_BUDGET_TIMEOUT:
+		/*
+		 * The device was slow for this queue; a larger budget gives
+		 * it the chance to boost the throughput when it is
+		 * sequential, and costs nothing when it is seeky since it
+		 * is charged for the whole budget anyway.
+		 */
+		budget = min(budget * 2, bfqd->bfq_max_budget);
+		break;
+	case BFQ_BFQQ_BUDGET_EXHAUSTED:
+		/*
+		 * Queue still has requests and consumed its budget
+		 * quickly: it is greedy, so increase its budget.
+		 */
+		budget = min(budget * 4, bfqd->bfq_max_budget);
+		break;
+	case BFQ_BFQQ_NO_MORE_REQUESTS:
+		/*
+		 * Budget just as large as the service it needed.
+		 */
+		budget = max(bfqq->service, min_budget);
+		break;
+	}
+out:
+	bfqq->max_budget = max(min(budget, bfqd->bfq_max_budget), min_budget);
+	bfq_log_bfqq(bfqd, bfqq, "recalc_budget: next %lu", bfqq->max_budget);
+}
+
+/*
+ * Instant when a soft real-time queue may become backlogged again and
+ * still be considered soft real-time: its service, received since it
+ * last became backlogged, must fit at bfq_wr_max_softrt_rate.
+ */
+static unsigned long bfq_bfqq_softrt_next_start(struct bfq_data *bfqd,
+						struct bfq_queue *bfqq)
+{
+	return max(bfqq->last_idle_bklogged +
+		   HZ * bfqq->service_from_backlogged /
+		   bfqd->bfq_wr_max_softrt_rate,
+		   jiffies + bfqd->bfq_slice_idle + 4);
+}
+
+/*
+ * current bfqq has finished its budget (or was too idle), charge it for
+ * the service received and either requeue it or remove it from the
+ * backlogged set.
+ */
+static void
+__bfq_bfqq_expire(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	bfq_log_bfqq(bfqd, bfqq, "expire service=%lu", bfqq->service);
+
+	if (bfq_bfqq_wait_request(bfqq))
+		del_timer(&bfqd->idle_slice_timer);
+	bfq_clear_bfqq_wait_request(bfqq);
+
+	/*
+	 * the queue is charged only for what it actually received
+	 */
+	bfqq->finish = bfqq->start + bfq_delta(bfqq->service, bfqq->weight);
+
+	if (bfqq == bfqd->active_queue) {
+		bfqd->active_queue = NULL;
+		if (bfqd->active_cic) {
+			put_io_context(bfqd->active_cic->ioc);
+			bfqd->active_cic = NULL;
+		}
+	}
+
+	if (RB_EMPTY_ROOT(&bfqq->sort_list)) {
+		bfq_del_bfqq_busy(bfqd, bfqq, false);
+	} else {
+		/*
+		 * still backlogged: requeue with a new budget starting where
+		 * the last one actually finished. Weight and class changes
+		 * take effect here.
+		 */
+		bfq_forget_bfqq(bfqd, bfqq);
+		bfq_activate_bfqq(bfqd, bfqq);
+	}
+	bfqq->service = 0;
+}
+
+static void bfq_bfqq_expire(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+			    bool compensate, enum bfqq_expiration reason)
+{
+	bool slow;
+
+	BUG_ON(bfqq != bfqd->active_queue);
+
+	slow = bfq_update_peak_rate(bfqd, bfqq, compensate);
+
+	/*
+	 * A sync queue that times out while receiving service at a low
+	 * rate is charged for its whole budget, otherwise seeky processes
+	 * would get an unfair share of the device time.
+	 */
+	if (bfq_bfqq_sync(bfqq) && reason == BFQ_BFQQ_BUDGET_TIMEOUT && slow &&
+	    bfqq->wr_coeff == 1)
+		bfqq->service = max(bfqq->service, bfqq->budget);
+
+	/*
+	 * A soft real-time queue empties itself quickly; remember when it
+	 * may come back without losing that status.
+	 */
+	if (bfq_bfqq_sync(bfqq) && bfq_bfqq_softrt_update(bfqq) &&
+	    RB_EMPTY_ROOT(&bfqq->sort_list) && bfqd->bfq_wr_max_softrt_rate &&
+	    (reason == BFQ_BFQQ_NO_MORE_REQUESTS ||
+	     reason == BFQ_BFQQ_TOO_IDLE))
+		bfqq->soft_rt_next_start =
+			bfq_bfqq_softrt_next_start(bfqd, bfqq);
+
+	bfq_log_bfqq(bfqd, bfqq, "expire (%d, slow %d)", reason, slow);
+
+	bfq_recalc_budget(bfqd, bfqq, reason);
+	__bfq_bfqq_expire(bfqd, bfqq);
+}
+
+/*
+ * Budget timeout is not checked until the first request of the budget has
+ * been dispatched.
+ */
+static inline bool bfq_bfqq_budget_timeout(struct bfq_queue *bfqq)
+{
+	if (bfq_bfqq_budget_new(bfqq))
+		return false;
+	return time_after(jiffies, bfqq->budget_timeout);
+}
+
+/*
+ * Idling is worth it only for sync queues of processes that issue
+ * their next request quickly. On non-rotational, queueing devices it
+ * only costs throughput, except for weight-raised queues whose latency
+ * guarantees would otherwise be lost.
+ */
+static bool bfq_bfqq_must_idle(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	if (!RB_EMPTY_ROOT(&bfqq->sort_list) || !bfqd->bfq_slice_idle ||
+	    !bfq_bfqq_sync(bfqq) || !bfq_bfqq_idle_window(bfqq))
+		return false;
+
+	if (blk_queue_nonrot(bfqd->queue) && bfqd->hw_tag)
+		return bfqq->wr_coeff > 1;
+
+	return true;
+}
+
+static void bfq_arm_slice_timer(struct bfq_data *bfqd)
+{
+	struct bfq_queue *bfqq = bfqd->active_queue;
+	struct bfq_io_context *cic;
+	unsigned long sl;
+
+	WARN_ON(!RB_EMPTY_ROOT(&bfqq->sort_list));
+
+	/*
+	 * still active requests from this queue, don't idle
+	 */
+	if (bfqq->dispatched)
+		return;
+
+	/*
+	 * task has exited, don't wait
+	 */
+	cic = bfqd->active_cic;
+	if (!cic || !atomic_read(&cic->ioc->nr_tasks))
+		return;
+
+	bfq_mark_bfqq_wait_request(bfqq);
+
+	/*
+	 * Seeky processes gain little from idling, but waiting briefly
+	 * still avoids losing their share to a concurrent greedy queue.
+	 */
+	sl = bfqd->bfq_slice_idle;
+	if (BFQQ_SEEKY(bfqq) && bfqq->wr_coeff == 1)
+		sl = min(sl, msecs_to_jiffies(BFQ_MIN_TT));
+
+	bfqd->last_idling_start = ktime_get();
+	mod_timer(&bfqd->idle_slice_timer, jiffies + sl);
+	bfq_log(bfqd, "arm idle: %u ms", jiffies_to_msecs(sl));
+}
+
+/*
+ * Move request from internal lists to the request queue dispatch list.
+ */
+static void bfq_dispatch_insert(struct request_queue *q, struct request *rq)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+	struct bfq_queue *bfqq = RQ_BFQQ(rq);
+
+	bfq_log_bfqq(bfqd, bfqq, "dispatch_insert");
+
+	bfqq->next_rq = bfq_find_next_rq(bfqd, bfqq, rq);
+	bfq_remove_request(rq);
+	bfqq->dispatched++;
+	elv_dispatch_sort(q, rq);
+
+	if (bfq_bfqq_sync(bfqq))
+		bfqd->sync_flight++;
+}
+
+/*
+ * return expired entry, or NULL to just start from scratch in rbtree
+ */
+static struct request *bfq_check_fifo(struct bfq_queue *bfqq)
+{
+	struct request *rq = NULL;
+
+	if (bfq_bfqq_fifo_expire(bfqq))
+		return NULL;
+
+	bfq_mark_bfqq_fifo_expire(bfqq);
+
+	if (list_empty(&bfqq->fifo))
+		return NULL;
+
+	rq = rq_entry_fifo(bfqq->fifo.next);
+	if (time_before(jiffies, rq_fifo_time(rq)))
+		rq = NULL;
+
+	bfq_log_bfqq(bfqq->bfqd, bfqq, "fifo=%p", rq);
+	return rq;
+}
+
+/*
+ * Select a queue for service. If we have a current active queue,
+ * check whether to continue servicing it, or retrieve and set a new one.
+ */
+static struct bfq_queue *bfq_select_queue(struct bfq_data *bfqd)
+{
+	struct bfq_queue *bfqq;
+	struct request *next_rq;
+	enum bfqq_expiration reason = BFQ_BFQQ_BUDGET_TIMEOUT;
+
+	bfqq = bfqd->active_queue;
+	if (!bfqq)
+		goto new_queue;
+
+	bfq_log_bfqq(bfqd, bfqq, "select_queue: already active queue");
+
+	if (bfq_bfqq_budget_timeout(bfqq) &&
+	    !bfq_bfqq_must_idle(bfqd, bfqq))
+		goto expire;
+
+	next_rq = bfqq->next_rq;
+	if (next_rq) {
+		/*
+		 * The queue has requests: serve it unless the next request
+		 * does not fit in what is left of the budget.
+		 */
+		if (bfq_serv_to_charge(next_rq, bfqq) >
+		    bfq_bfqq_budget_left(bfqq)) {
+			reason = BFQ_BFQQ_BUDGET_EXHAUSTED;
+			goto expire;
+		}
+
+		if (timer_pending(&bfqd->idle_slice_timer)) {
+			del_timer(&bfqd->idle_slice_timer);
+			bfq_clear_bfqq_wait_request(bfqq);
+		}
+		goto keep_queue;
+	}
+
+	/*
+	 * No requests pending. If the active queue still has requests in
+	 * flight or is idling, wait: it may issue a new request soon.
+	 */
+	if (timer_pending(&bfqd->idle_slice_timer) ||
+	    (bfqq->dispatched && bfq_bfqq_must_idle(bfqd, bfqq))) {
+		bfqq = NULL;
+		goto keep_queue;
+	}
+
+	reason = BFQ_BFQQ_NO_MORE_REQUESTS;
+expire:
+	bfq_bfqq_expire(bfqd, bfqq, false, reason);
+new_queue:
+	bfqq = bfq_set_active_queue(bfqd);
+	bfq_log(bfqd, "select_queue: new queue %d returned",
+		bfqq ? bfqq->pid : 0);
+keep_queue:
+	return bfqq;
+}
+
+/*
+ * Start, renew or end the weight raising of a queue being served.
+ */
+static void bfq_update_wr_data(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	if (bfqq->wr_coeff == 1)
+		return;
+
+	/* processes doing lots of seeks are not interactive */
+	if (BFQQ_SEEKY(bfqq) && bfqq->wr_cur_max_time != bfqd->bfq_wr_rt_max_time)
+		bfq_end_wr(bfqd, bfqq);
+	else if (time_is_before_jiffies(bfqq->wr_start +
+					bfqq->wr_cur_max_time))
+		bfq_end_wr(bfqd, bfqq);
+	else if (!bfqd->bfq_low_latency)
+		bfq_end_wr(bfqd, bfqq);
+}
+
+/*
+ * Dispatch one request from bfqq, moving it to the request queue
+ * dispatch list.
+ */
+static bool bfq_dispatch_request(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	struct request *rq;
+	unsigned long service_to_charge;
+
+	BUG_ON(RB_EMPTY_ROOT(&bfqq->sort_list));
+
+	/*
+	 * follow expired path, else get first next available
+	 */
+	rq = bfq_check_fifo(bfqq);
+	if (!rq)
+		rq = bfqq->next_rq;
+	service_to_charge = bfq_serv_to_charge(rq, bfqq);
+
+	if (service_to_charge > bfq_bfqq_budget_left(bfqq)) {
+		/*
+		 * Only possible if the fifo picked a request that is
+		 * larger than what is left: serve it and expire.
+		 */
+		bfqq->budget = bfqq->service + service_to_charge;
+	}
+
+	if (bfq_bfqq_budget_new(bfqq)) {
+		unsigned long timeout = bfqd->bfq_timeout[bfq_bfqq_sync(bfqq)];
+
+		/* interactive queues may need more time to use their budget */
+		if (bfqq->wr_coeff > 1 &&
+		    bfqq->wr_cur_max_time != bfqd->bfq_wr_rt_max_time)
+			timeout *= 2;
+		bfqq->budget_timeout = jiffies + timeout;
+		bfqd->last_budget_start = ktime_get();
+		bfq_clear_bfqq_budget_new(bfqq);
+	}
+
+	/*
+	 * insert request into driver dispatch list
+	 */
+	bfq_bfqq_served(bfqd, bfqq, service_to_charge);
+	bfq_dispatch_insert(bfqd->queue, rq);
+	bfq_update_wr_data(bfqd, bfqq);
+
+	if (!bfqd->active_cic) {
+		struct bfq_io_context *cic = RQ_CIC(rq);
+
+		atomic_long_inc(&cic->ioc->refcount);
+		bfqd->active_cic = cic;
+	}
+
+	bfqq->budget_dispatch++;
+
+	return true;
+}
+
+static int __bfq_forced_dispatch_bfqq(struct bfq_queue *bfqq)
+{
+	int dispatched = 0;
+
+	while (bfqq->next_rq) {
+		bfq_dispatch_insert(bfqq->bfqd->queue, bfqq->next_rq);
+		dispatched++;
+	}
+
+	BUG_ON(!list_empty(&bfqq->fifo));
+	return dispatched;
+}
+
+/*
+ * Drain our current requests. Used for barriers and when switching
+ * io schedulers on-the-fly.
+ */
+static int bfq_forced_dispatch(struct bfq_data *bfqd)
+{
+	struct bfq_queue *bfqq;
+	int dispatched = 0;
+
+	bfqq = bfqd->active_queue;
+	if (bfqq) {
+		dispatched += __bfq_forced_dispatch_bfqq(bfqq);
+		__bfq_bfqq_expire(bfqd, bfqq);
+	}
+
+	while ((bfqq = bfq_get_next_queue(bfqd)) != NULL) {
+		__bfq_set_active_queue(bfqd, bfqq);
+		dispatched += __bfq_forced_dispatch_bfqq(bfqq);
+		__bfq_bfqq_expire(bfqd, bfqq);
+	}
+
+	BUG_ON(bfqd->busy_queues);
+
+	bfq_log(bfqd, "forced_dispatch=%d", dispatched);
+	return dispatched;
+}
+
+/*
+ * Find the bfqq that we need to service and move a request from that to the
+ * dispatch list
+ */
+static int bfq_dispatch_requests(struct request_queue *q, int force)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+	struct bfq_queue *bfqq;
+	int max_dispatch;
+
+	if (!bfqd->busy_queues)
+		return 0;
+
+	if (unlikely(force))
+		return bfq_forced_dispatch(bfqd);
+
+	bfqq = bfq_select_queue(bfqd);
+	if (!bfqq)
+		return 0;
+
+	max_dispatch = bfqd->bfq_quantum;
+	if (bfq_class_idle(bfqq))
+		max_dispatch = 1;
+	if (!bfq_bfqq_sync(bfqq))
+		max_dispatch = bfqd->bfq_max_budget_async_rq;
+
+	/*
+	 * Limit the depth of the queue in service, so that requests of the
+	 * next queue do not wait behind a long train in the driver.
+	 */
+	if (bfqq->dispatched >= max_dispatch) {
+		if (bfqd->busy_queues > 1)
+			return 0;
+		if (bfqq->dispatched >= 4 * max_dispatch)
+			return 0;
+	}
+
+	/*
+	 * Don't let async I/O get in the way of sync I/O in flight.
+	 */
+	if (bfqd->sync_flight && !bfq_bfqq_sync(bfqq) &&
+	    bfqd->busy_queues > 1)
+		return 0;
+
+	bfq_clear_bfqq_wait_request(bfqq);
+
+	if (!bfq_dispatch_request(bfqd, bfqq))
+		return 0;
+
+	/*
+	 * expire an async queue immediately if it has used up its request
+	 * quota. idle queue always expire after 1 dispatch round.
+	 */
+	if (bfqd->busy_queues > 1 && ((!bfq_bfqq_sync(bfqq) &&
+	    bfqq->budget_dispatch >= bfqd->bfq_max_budget_async_rq) ||
+	    bfq_class_idle(bfqq)))
+		bfq_bfqq_expire(bfqd, bfqq, false, BFQ_BFQQ_BUDGET_EXHAUSTED);
+
+	bfq_log_bfqq(bfqd, bfqq, "dispatched a request");
+	return 1;
+}
+
+/*
+ * task holds one reference to the queue, dropped when task exits. each rq
+ * in-flight on this queue also holds a reference, dropped when rq is freed.
+ *
+ * queue lock must be held here.
+ */
+static void bfq_put_queue(struct bfq_queue *bfqq)
+{
+	struct bfq_data *bfqd = bfqq->bfqd;
+
+	BUG_ON(bfqq->ref <= 0);
+
+	bfqq->ref--;
+	if (bfqq->ref)
+		return;
+
+	bfq_log_bfqq(bfqd, bfqq, "put_queue");
+	BUG_ON(rb_first(&bfqq->sort_list));
+	BUG_ON(bfqq->allocated[READ] + bfqq->allocated[WRITE]);
+
+	if (unlikely(bfqd->active_queue == bfqq)) {
+		__bfq_bfqq_expire(bfqd, bfqq);
+		bfq_schedule_dispatch(bfqd);
+	}
+
+	BUG_ON(bfq_bfqq_busy(bfqq));
+	kmem_cache_free(bfq_pool, bfqq);
+}
+
+/*
+ * Call func for each cic attached to this ioc.
+ */
+static void
+call_for_each_cic(struct io_context *ioc,
+		  void (*func)(struct io_context *, struct bfq_io_context *))
+{
+	struct bfq_io_context *cic;
+	struct hlist_node *n;
+
+	rcu_read_lock();
+
+	hlist_for_each_entry_rcu(cic, n, &ioc->bfq_cic_list, cic_list)
+		func(ioc, cic);
+
+	rcu_read_unlock();
+}
+
+static void bfq_cic_free_rcu(struct rcu_head *head)
+{
+	struct bfq_io_context *cic;
+
+	cic = container_of(head, struct bfq_io_context, rcu_head);
+
+	kmem_cache_free(bfq_ioc_pool, cic);
+	elv_ioc_count_dec(bfq_ioc_count);
+
+	if (ioc_gone) {
+		/*
+		 * BFQ scheduler is exiting, grab exit lock and check
+		 * the pending io context count. If it hits zero,
+		 * complete ioc_gone and set it back to NULL
+		 */
+		spin_lock(&ioc_gone_lock);
+		if (ioc_gone && !elv_ioc_count_read(bfq_ioc_count)) {
+			complete(ioc_gone);
+			ioc_gone = NULL;
+		}
+		spin_unlock(&ioc_gone_lock);
+	}
+}
+
+static void bfq_cic_free(struct bfq_io_context *cic)
+{
+	call_rcu(&cic->rcu_head, bfq_cic_free_rcu);
+}
+
+static void cic_free_func(struct io_context *ioc, struct bfq_io_context *cic)
+{
+	unsigned long flags;
+	unsigned long dead_key = (unsigned long) cic->key;
+
+	BUG_ON(!(dead_key & CIC_DEAD_KEY));
+
+	spin_lock_irqsave(&ioc->lock, flags);
+	radix_tree_delete(&ioc->bfq_radix_root,
+			  dead_key >> CIC_DEAD_INDEX_SHIFT);
+	hlist_del_rcu(&cic->cic_list);
+	spin_unlock_irqrestore(&ioc->lock, flags);
+
+	bfq_cic_free(cic);
+}
+
+/*
+ * Must be called with rcu_read_lock() held or preemption otherwise disabled.
+ * Only two callers of this - ->dtor() which is called with the rcu_read_lock(),
+ * and ->trim() which is called with the task lock held
+ */
+static void bfq_free_io_context(struct io_context *ioc)
+{
+	/*
+	 * ioc->refcount is zero here, or we are called from elv_unregister(),
+	 * so no more cic's are allowed to be linked into this ioc.  So it
+	 * should be ok to iterate over the known list, we will see all cic's
+	 * since no new ones are added.
+	 */
+	call_for_each_cic(ioc, cic_free_func);
+}
+
+static void bfq_exit_bfqq(struct bfq_data *bfqd, struct bfq_queue *bfqq)
+{
+	if (unlikely(bfqq == bfqd->active_queue)) {
+		__bfq_bfqq_expire(bfqd, bfqq);
+		bfq_schedule_dispatch(bfqd);
+	}
+
+	bfq_put_queue(bfqq);
+}
+
+static void __bfq_exit_single_io_context(struct bfq_data *bfqd,
+					 struct bfq_io_context *cic)
+{
+	struct io_context *ioc = cic->ioc;
+
+	list_del_init(&cic->queue_list);
+
+	/*
+	 * Make sure dead mark is seen for dead queues
+	 */
+	smp_wmb();
+	cic->key = bfqd_dead_key(bfqd);
+
+	rcu_read_lock();
+	if (rcu_dereference(ioc->bfq_ioc_data) == cic) {
+		rcu_read_unlock();
+		spin_lock(&ioc->lock);
+		rcu_assign_pointer(ioc->bfq_ioc_data, NULL);
+		spin_unlock(&ioc->lock);
+	} else
+		rcu_read_unlock();
+
+	if (cic->bfqq[BLK_RW_ASYNC]) {
+		bfq_exit_bfqq(bfqd, cic->bfqq[BLK_RW_ASYNC]);
+		cic->bfqq[BLK_RW_ASYNC] = NULL;
+	}
+
+	if (cic->bfqq[BLK_RW_SYNC]) {
+		bfq_exit_bfqq(bfqd, cic->bfqq[BLK_RW_SYNC]);
+		cic->bfqq[BLK_RW_SYNC] = NULL;
+	}
+}
+
+static void bfq_exit_single_io_context(struct io_context *ioc,
+				       struct bfq_io_context *cic)
+{
+	struct bfq_data *bfqd = cic_to_bfqd(cic);
+
+	if (bfqd) {
+		struct request_queue *q = bfqd->queue;
+		unsigned long flags;
+
+		spin_lock_irqsave(q->queue_lock, flags);
+
+		/*
+		 * Ensure we get a fresh copy of the ->key to prevent
+		 * race between exiting task and queue
+		 */
+		smp_read_barrier_depends();
+		if (cic->key == bfqd)
+			__bfq_exit_single_io_context(bfqd, cic);
+
+		spin_unlock_irqrestore(q->queue_lock, flags);
+	}
+}
+
+/*
+ * The process that ioc belongs to has exited, we need to clean up
+ * and put the internal structures we have that belongs to that process.
+ */
+static void bfq_exit_io_context(struct io_context *ioc)
+{
+	call_for_each_cic(ioc, bfq_exit_single_io_context);
+}
+
+static struct bfq_io_context *
+bfq_alloc_io_context(struct bfq_data *bfqd, gfp_t gfp_mask)
+{
+	struct bfq_io_context *cic;
+
+	cic = kmem_cache_alloc_node(bfq_ioc_pool, gfp_mask | __GFP_ZERO,
+							bfqd->queue->node);
+	if (cic) {
+		cic->ttime.last_end_request = jiffies;
+		INIT_LIST_HEAD(&cic->queue_list);
+		INIT_HLIST_NODE(&cic->cic_list);
+		cic->dtor = bfq_free_io_context;
+		cic->exit = bfq_exit_io_context;
+		elv_ioc_count_inc(bfq_ioc_count);
+	}
+
+	return cic;
+}
+
+static void bfq_init_prio_data(struct bfq_queue *bfqq, struct io_context *ioc)
+{
+	struct task_struct *tsk = current;
+	int ioprio_class;
+
+	if (!bfq_bfqq_prio_changed(bfqq))
+		return;
+
+	ioprio_class = IOPRIO_PRIO_CLASS(ioc->ioprio);
+	switch (ioprio_class) {
+	default:
+		printk(KERN_ERR "bfq: bad prio %x\n", ioprio_class);
+	case IOPRIO_CLASS_NONE:
+		/*
+		 * no prio set, inherit CPU scheduling settings
+		 */
+		bfqq->ioprio = task_nice_ioprio(tsk);
+		bfqq->ioprio_class = task_nice_ioclass(tsk);
+		break;
+	case IOPRIO_CLASS_RT:
+		bfqq->ioprio = task_ioprio(ioc);
+		bfqq->ioprio_class = IOPRIO_CLASS_RT;
+		break;
+	case IOPRIO_CLASS_BE:
+		bfqq->ioprio = task_ioprio(ioc);
+		bfqq->ioprio_class = IOPRIO_CLASS_BE;
+		break;
+	case IOPRIO_CLASS_IDLE:
+		bfqq->ioprio_class = IOPRIO_CLASS_IDLE;
+		bfqq->ioprio = 7;
+		bfq_clear_bfqq_idle_window(bfqq);
+		break;
+	}
+
+	/*
+	 * keep track of original prio settings. The new weight and class
+	 * are picked up the next time bfqq is (re)activated.
+	 */
+	bfqq->org_ioprio = bfqq->ioprio;
+	bfqq->org_ioprio_class = bfqq->ioprio_class;
+	bfq_clear_bfqq_prio_changed(bfqq);
+}
+
+static void changed_ioprio(struct io_context *ioc, struct bfq_io_context *cic)
+{
+	struct bfq_data *bfqd = cic_to_bfqd(cic);
+	struct bfq_queue *bfqq;
+	unsigned long flags;
+
+	if (unlikely(!bfqd))
+		return;
+
+	spin_lock_irqsave(bfqd->queue->queue_lock, flags);
+
+	bfqq = cic->bfqq[BLK_RW_ASYNC];
+	if (bfqq) {
+		struct bfq_queue *new_bfqq;
+		new_bfqq = bfq_get_queue(bfqd, BLK_RW_ASYNC, cic->ioc,
+						GFP_ATOMIC);
+		if (new_bfqq) {
+			cic->bfqq[BLK_RW_ASYNC] = new_bfqq;
+			bfq_put_queue(bfqq);
+		}
+	}
+
+	bfqq = cic->bfqq[BLK_RW_SYNC];
+	if (bfqq)
+		bfq_mark_bfqq_prio_changed(bfqq);
+
+	spin_unlock_irqrestore(bfqd->queue->queue_lock, flags);
+}
+
+static void bfq_ioc_set_ioprio(struct io_context *ioc)
+{
+	call_for_each_cic(ioc, changed_ioprio);
+}
+
+static void bfq_init_bfqq(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+			  pid_t pid, bool is_sync)
+{
+	RB_CLEAR_NODE(&bfqq->rb_node);
+	INIT_LIST_HEAD(&bfqq->fifo);
+
+	bfqq->ref = 0;
+	bfqq->bfqd = bfqd;
+
+	bfq_mark_bfqq_prio_changed(bfqq);
+
+	if (is_sync) {
+		if (!bfq_class_idle(bfqq))
+			bfq_mark_bfqq_idle_window(bfqq);
+		bfq_mark_bfqq_sync(bfqq);
+	}
+	bfqq->pid = pid;
+
+	bfqq->max_budget = bfqd->bfq_max_budget;
+	bfqq->wr_coeff = 1;
+
+	/*
+	 * A new queue looks like one that has been idle for long: if it
+	 * belongs to a newly started interactive application, it gets
+	 * weight-raised. It cannot be soft real-time yet.
+	 */
+	bfqq->budget_timeout = jiffies - bfqd->bfq_wr_min_idle_time - 1;
+	bfqq->soft_rt_next_start = jiffies + (ULONG_MAX >> 1);
+}
+
+static struct bfq_queue *
+bfq_find_alloc_queue(struct bfq_data *bfqd, bool is_sync,
+		     struct io_context *ioc, gfp_t gfp_mask)
+{
+	struct bfq_queue *bfqq, *new_bfqq = NULL;
+	struct bfq_io_context *cic;
+
+retry:
+	cic = bfq_cic_lookup(bfqd, ioc);
+	/* cic always exists here */
+	bfqq = cic_to_bfqq(cic, is_sync);
+
+	/*
+	 * Always try a new alloc if we fell back to the OOM bfqq
+	 * originally, since it should just be a temporary situation.
+	 */
+	if (!bfqq || bfqq == &bfqd->oom_bfqq) {
+		bfqq = NULL;
+		if (new_bfqq) {
+			bfqq = new_bfqq;
+			new_bfqq = NULL;
+		} else if (gfp_mask & __GFP_WAIT) {
+			spin_unlock_irq(bfqd->queue->queue_lock);
+			new_bfqq = kmem_cache_alloc_node(bfq_pool,
+					gfp_mask | __GFP_ZERO,
+					bfqd->queue->node);
+			spin_lock_irq(bfqd->queue->queue_lock);
+			if (new_bfqq)
+				goto retry;
+		} else {
+			bfqq = kmem_cache_alloc_node(bfq_pool,
+					gfp_mask | __GFP_ZERO,
+					bfqd->queue->node);
+		}
+
+		if (bfqq) {
+			bfq_init_bfqq(bfqd, bfqq, current->pid, is_sync);
+			bfq_init_prio_data(bfqq, ioc);
+			bfq_log_bfqq(bfqd, bfqq, "alloced");
+		} else
+			bfqq = &bfqd->oom_bfqq;
+	}
+
+	if (new_bfqq)
+		kmem_cache_free(bfq_pool, new_bfqq);
+
+	return bfqq;
+}
+
+static struct bfq_queue **
+bfq_async_queue_prio(struct bfq_data *bfqd, int ioprio_class, int ioprio)
+{
+	switch (ioprio_class) {
+	case IOPRIO_CLASS_RT:
+		return &bfqd->async_bfqq[0][ioprio];
+	case IOPRIO_CLASS_BE:
+		return &bfqd->async_bfqq[1][ioprio];
+	case IOPRIO_CLASS_IDLE:
+		return &bfqd->async_idle_bfqq;
+	default:
+		BUG();
+	}
+}
+
+static struct bfq_queue *
+bfq_get_queue(struct bfq_data *bfqd, bool is_sync, struct io_context *ioc,
+	      gfp_t gfp_mask)
+{
+	const int ioprio = task_ioprio(ioc);
+	const int ioprio_class = task_ioprio_class(ioc);
+	struct bfq_queue **async_bfqq = NULL;
+	struct bfq_queue *bfqq = NULL;
+
+	if (!is_sync) {
+		async_bfqq = bfq_async_queue_prio(bfqd, ioprio_class, ioprio);
+		bfqq = *async_bfqq;
+	}
+
+	if (!bfqq)
+		bfqq = bfq_find_alloc_queue(bfqd, is_sync, ioc, gfp_mask);
+
+	/*
+	 * pin the queue now that it's allocated, scheduler exit will prune it
+	 */
+	if (!is_sync && !(*async_bfqq)) {
+		bfqq->ref++;
+		*async_bfqq = bfqq;
+	}
+
+	bfqq->ref++;
+	return bfqq;
+}
+
+/*
+ * We drop bfq io contexts lazily, so we may find a dead one.
+ */
+static void
+bfq_drop_dead_cic(struct bfq_data *bfqd, struct io_context *ioc,
+		  struct bfq_io_context *cic)
+{
+	unsigned long flags;
+
+	WARN_ON(!list_empty(&cic->queue_list));
+	BUG_ON(cic->key != bfqd_dead_key(bfqd));
+
+	spin_lock_irqsave(&ioc->lock, flags);
+
+	BUG_ON(rcu_dereference_check(ioc->bfq_ioc_data,
+		lockdep_is_held(&ioc->lock)) == cic);
+
+	radix_tree_delete(&ioc->bfq_radix_root, bfqd->cic_index);
+	hlist_del_rcu(&cic->cic_list);
+	spin_unlock_irqrestore(&ioc->lock, flags);
+
+	bfq_cic_free(cic);
+}
+
+static struct bfq_io_context *
+bfq_cic_lookup(struct bfq_data *bfqd, struct io_context *ioc)
+{
+	struct bfq_io_context *cic;
+	unsigned long flags;
+
+	if (unlikely(!ioc))
+		return NULL;
+
+	rcu_read_lock();
+
+	/*
+	 * we maintain a last-hit cache, to avoid browsing over the tree
+	 */
+	cic = rcu_dereference(ioc->bfq_ioc_data);
+	if (cic && cic->key == bfqd) {
+		rcu_read_unlock();
+		return cic;
+	}
+
+	do {
+		cic = radix_tree_lookup(&ioc->bfq_radix_root, bfqd->cic_index);
+		rcu_read_unlock();
+		if (!cic)
+			break;
+		if (unlikely(cic->key != bfqd)) {
+			bfq_drop_dead_cic(bfqd, ioc, cic);
+			rcu_read_lock();
+			continue;
+		}
+
+		spin_lock_irqsave(&ioc->lock, flags);
+		rcu_assign_pointer(ioc->bfq_ioc_data, cic);
+		spin_unlock_irqrestore(&ioc->lock, flags);
+		break;
+	} while (1);
+
+	return cic;
+}
+
+/*
+ * Add cic into ioc, using bfqd as the search key. This enables us to lookup
+ * the process specific bfq io context when entered from the block layer.
+ * Also adds the cic to a per-bfqd list, used when this queue is removed.
+ */
+static int bfq_cic_link(struct bfq_data *bfqd, struct io_context *ioc,
+			struct bfq_io_context *cic, gfp_t gfp_mask)
+{
+	unsigned long flags;
+	int ret;
+
+	ret = radix_tree_preload(gfp_mask);
+	if (!ret) {
+		cic->ioc = ioc;
+		cic->key = bfqd;
+
+		spin_lock_irqsave(&ioc->lock, flags);
+		ret = radix_tree_insert(&ioc->bfq_radix_root,
+						bfqd->cic_index, cic);
+		if (!ret)
+			hlist_add_head_rcu(&cic->cic_list, &ioc->bfq_cic_list);
+		spin_unlock_irqrestore(&ioc->lock, flags);
+
+		radix_tree_preload_end();
+
+		if (!ret) {
+			spin_lock_irqsave(bfqd->queue->queue_lock, flags);
+			list_add(&cic->queue_list, &bfqd->cic_list);
+			spin_unlock_irqrestore(bfqd->queue->queue_lock, flags);
+		}
+	}
+
+	if (ret)
+		printk(KERN_ERR "bfq: cic link failed!\n");
+
+	return ret;
+}
+
+/*
+ * Setup general io context and bfq io context. There can be several bfq
+ * io contexts per general io context, if this process is doing io to more
+ * than one device managed by bfq.
+ */
+static struct bfq_io_context *
+bfq_get_io_context(struct bfq_data *bfqd, gfp_t gfp_mask)
+{
+	struct io_context *ioc = NULL;
+	struct bfq_io_context *cic;
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	ioc = get_io_context(gfp_mask, bfqd->queue->node);
+	if (!ioc)
+		return NULL;
+
+	cic = bfq_cic_lookup(bfqd, ioc);
+	if (cic)
+		goto out;
+
+	cic = bfq_alloc_io_context(bfqd, gfp_mask);
+	if (cic == NULL)
+		goto err;
+
+	if (bfq_cic_link(bfqd, ioc, cic, gfp_mask))
+		goto err_free;
+
+out:
+	smp_read_barrier_depends();
+	if (unlikely(test_and_clear_bit(IOC_BFQ_IOPRIO_CHANGED,
+				       &ioc->ioprio_changed)))
+		bfq_ioc_set_ioprio(ioc);
+
+	return cic;
+err_free:
+	bfq_cic_free(cic);
+err:
+	put_io_context(ioc);
+	return NULL;
+}
+
+static void
+bfq_update_io_thinktime(struct bfq_data *bfqd, struct bfq_io_context *cic)
+{
+	unsigned long elapsed = jiffies - cic->ttime.last_end_request;
+	unsigned long ttime = min(elapsed, 2UL * bfqd->bfq_slice_idle);
+
+	cic->ttime.ttime_samples = (7*cic->ttime.ttime_samples + 256) / 8;
+	cic->ttime.ttime_total = (7*cic->ttime.ttime_total + 256*ttime) / 8;
+	cic->ttime.ttime_mean = (cic->ttime.ttime_total + 128) /
+				cic->ttime.ttime_samples;
+}
+
+static void
+bfq_update_io_seektime(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+		       struct request *rq)
+{
+	sector_t sdist = 0;
+	sector_t n_sec = blk_rq_sectors(rq);
+	if (bfqq->last_request_pos) {
+		if (bfqq->last_request_pos < blk_rq_pos(rq))
+			sdist = blk_rq_pos(rq) - bfqq->last_request_pos;
+		else
+			sdist = bfqq->last_request_pos - blk_rq_pos(rq);
+	}
+
+	bfqq->seek_history <<= 1;
+	if (blk_queue_nonrot(bfqd->queue))
+		bfqq->seek_history |= (n_sec < BFQQ_SECT_THR_NONROT);
+	else
+		bfqq->seek_history |= (sdist > BFQQ_SEEK_THR);
+}
+
+/*
+ * Disable idle window if the process thinks too long or seeks so much that
+ * it doesn't matter
+ */
+static void
+bfq_update_idle_window(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+		       struct bfq_io_context *cic)
+{
+	int old_idle, enable_idle;
+
+	/*
+	 * Don't idle for async or idle io prio class
+	 */
+	if (!bfq_bfqq_sync(bfqq) || bfq_class_idle(bfqq))
+		return;
+
+	enable_idle = old_idle = bfq_bfqq_idle_window(bfqq);
+
+	if (bfqq->next_rq && (bfqq->next_rq->cmd_flags & REQ_NOIDLE))
+		enable_idle = 0;
+	else if (!atomic_read(&cic->ioc->nr_tasks) || !bfqd->bfq_slice_idle ||
+	    (bfqd->hw_tag && BFQQ_SEEKY(bfqq) && bfqq->wr_coeff == 1))
+		enable_idle = 0;
+	else if (sample_valid(cic->ttime.ttime_samples)) {
+		if (cic->ttime.ttime_mean > bfqd->bfq_slice_idle)
+			enable_idle = 0;
+		else
+			enable_idle = 1;
+	}
+
+	if (old_idle != enable_idle) {
+		bfq_log_bfqq(bfqd, bfqq, "idle=%d", enable_idle);
+		if (enable_idle)
+			bfq_mark_bfqq_idle_window(bfqq);
+		else
+			bfq_clear_bfqq_idle_window(bfqq);
+	}
+}
+
+/*
+ * Called when a new fs request (rq) is added (to bfqq). Check if there's
+ * something we should do about it
+ */
+static void
+bfq_rq_enqueued(struct bfq_data *bfqd, struct bfq_queue *bfqq,
+		struct request *rq)
+{
+	struct bfq_io_context *cic = RQ_CIC(rq);
+
+	bfqd->rq_queued++;
+
+	if (bfq_bfqq_sync(bfqq))
+		bfq_update_io_thinktime(bfqd, cic);
+	bfq_update_io_seektime(bfqd, bfqq, rq);
+	bfq_update_idle_window(bfqd, bfqq, cic);
+
+	bfqq->last_request_pos = blk_rq_pos(rq) + blk_rq_sectors(rq);
+
+	if (bfqq == bfqd->active_queue && bfq_bfqq_wait_request(bfqq)) {
+		/*
+		 * The queue we were idling for issued a request. Let it
+		 * rip right away if the request is large enough, or if
+		 * other queues are waiting; otherwise give it a chance to
+		 * be merged with the following ones, like CFQ does.
+		 */
+		if (blk_rq_bytes(rq) > PAGE_CACHE_SIZE ||
+		    bfqd->busy_queues > 1) {
+			del_timer(&bfqd->idle_slice_timer);
+			bfq_clear_bfqq_wait_request(bfqq);
+			__blk_run_queue(bfqd->queue);
+		}
+	}
+}
+
+static void bfq_insert_request(struct request_queue *q, struct request *rq)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+	struct bfq_queue *bfqq = RQ_BFQQ(rq);
+
+	bfq_log_bfqq(bfqd, bfqq, "insert_request");
+	bfq_init_prio_data(bfqq, RQ_CIC(rq)->ioc);
+
+	rq_set_fifo_time(rq, jiffies + bfqd->bfq_fifo_expire[rq_is_sync(rq)]);
+	list_add_tail(&rq->queuelist, &bfqq->fifo);
+	bfq_add_rq_rb(rq);
+	bfq_rq_enqueued(bfqd, bfqq, rq);
+}
+
+/*
+ * Update hw_tag based on peak queue depth over 50 samples under
+ * sufficient load.
+ */
+static void bfq_update_hw_tag(struct bfq_data *bfqd)
+{
+	struct bfq_queue *bfqq = bfqd->active_queue;
+
+	if (bfqd->rq_in_driver > bfqd->hw_tag_est_depth)
+		bfqd->hw_tag_est_depth = bfqd->rq_in_driver;
+
+	if (bfqd->hw_tag == 1)
+		return;
+
+	if (bfqd->rq_queued <= BFQ_HW_QUEUE_MIN &&
+	    bfqd->rq_in_driver <= BFQ_HW_QUEUE_MIN)
+		return;
+
+	/*
+	 * If active queue hasn't enough requests and can idle, bfq might not
+	 * dispatch sufficient requests to hardware. Don't zero hw_tag in this
+	 * case
+	 */
+	if (bfqq && bfq_bfqq_idle_window(bfqq) &&
+	    bfqq->dispatched + bfqq->queued[0] + bfqq->queued[1] <
+	    BFQ_HW_QUEUE_MIN && bfqd->rq_in_driver < BFQ_HW_QUEUE_MIN)
+		return;
+
+	if (bfqd->hw_tag_samples++ < 50)
+		return;
+
+	if (bfqd->hw_tag_est_depth >= BFQ_HW_QUEUE_MIN)
+		bfqd->hw_tag = 1;
+	else
+		bfqd->hw_tag = 0;
+}
+
+static void bfq_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct bfq_queue *bfqq = RQ_BFQQ(rq);
+	struct bfq_data *bfqd = bfqq->bfqd;
+	const int sync = rq_is_sync(rq);
+
+	bfq_log_bfqq(bfqd, bfqq, "complete rqnoidle %d",
+		     !!(rq->cmd_flags & REQ_NOIDLE));
+
+	bfq_update_hw_tag(bfqd);
+
+	WARN_ON(!bfqd->rq_in_driver);
+	WARN_ON(!bfqq->dispatched);
+	bfqd->rq_in_driver--;
+	bfqq->dispatched--;
+
+	if (bfq_bfqq_sync(bfqq))
+		bfqd->sync_flight--;
+
+	if (sync) {
+		RQ_CIC(rq)->ttime.last_end_request = jiffies;
+		bfq_mark_bfqq_softrt_update(bfqq);
+	}
+
+	/*
+	 * If this is the active queue, check if it needs to be expired,
+	 * or if we want to idle in case it has no pending requests.
+	 */
+	if (bfqd->active_queue == bfqq) {
+		if (bfq_bfqq_budget_new(bfqq))
+			goto out;
+
+		if (bfq_bfqq_must_idle(bfqd, bfqq)) {
+			if (bfq_bfqq_budget_timeout(bfqq))
+				bfq_bfqq_expire(bfqd, bfqq, false,
+						BFQ_BFQQ_BUDGET_TIMEOUT);
+			else
+				bfq_arm_slice_timer(bfqd);
+		} else if (bfq_bfqq_budget_timeout(bfqq))
+			bfq_bfqq_expire(bfqd, bfqq, false,
+					BFQ_BFQQ_BUDGET_TIMEOUT);
+		else if (RB_EMPTY_ROOT(&bfqq->sort_list) && !bfqq->dispatched)
+			bfq_bfqq_expire(bfqd, bfqq, false,
+					BFQ_BFQQ_NO_MORE_REQUESTS);
+	}
+out:
+	if (!bfqd->rq_in_driver)
+		bfq_schedule_dispatch(bfqd);
+}
+
+static int bfq_may_queue(struct request_queue *q, int rw)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+	struct task_struct *tsk = current;
+	struct bfq_io_context *cic;
+	struct bfq_queue *bfqq;
+
+	/*
+	 * don't force setup of a queue from here, as a call to may_queue
+	 * does not necessarily imply that a request actually will be queued.
+	 * so just lookup a possibly existing queue, or return 'may queue'
+	 * if that fails
+	 */
+	cic = bfq_cic_lookup(bfqd, tsk->io_context);
+	if (!cic)
+		return ELV_MQUEUE_MAY;
+
+	bfqq = cic_to_bfqq(cic, rw_is_sync(rw));
+	if (bfqq) {
+		bfq_init_prio_data(bfqq, cic->ioc);
+
+		if (bfq_bfqq_wait_request(bfqq) &&
+		    !bfq_bfqq_must_alloc(bfqq)) {
+			bfq_mark_bfqq_must_alloc(bfqq);
+			return ELV_MQUEUE_MUST;
+		}
+	}
+
+	return ELV_MQUEUE_MAY;
+}
+
+/*
+ * queue lock held here
+ */
+static void bfq_put_request(struct request *rq)
+{
+	struct bfq_queue *bfqq = RQ_BFQQ(rq);
+
+	if (bfqq) {
+		const int rw = rq_data_dir(rq);
+
+		BUG_ON(!bfqq->allocated[rw]);
+		bfqq->allocated[rw]--;
+
+		put_io_context(RQ_CIC(rq)->ioc);
+
+		rq->elevator_private[0] = NULL;
+		rq->elevator_private[1] = NULL;
+
+		bfq_put_queue(bfqq);
+	}
+}
+
+/*
+ * Allocate bfq data structures associated with this request.
+ */
+static int
+bfq_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
+{
+	struct bfq_data *bfqd = q->elevator->elevator_data;
+	struct bfq_io_context *cic;
+	const int rw = rq_data_dir(rq);
+	const bool is_sync = rq_is_sync(rq);
+	struct bfq_queue *bfqq;
+	unsigned long flags;
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	cic = bfq_get_io_context(bfqd, gfp_mask);
+
+	spin_lock_irqsave(q->queue_lock, flags);
+
+	if (!cic)
+		goto queue_fail;
+
+	bfqq = cic_to_bfqq(cic, is_sync);
+	if (!bfqq || bfqq == &bfqd->oom_bfqq) {
+		bfqq = bfq_get_queue(bfqd, is_sync, cic->ioc, gfp_mask);
+		cic_set_bfqq(cic, bfqq, is_sync);
+	}
+
+	bfqq->allocated[rw]++;
+
+	bfqq->ref++;
+	rq->elevator_private[0] = cic;
+	rq->elevator_private[1] = bfqq;
+	spin_unlock_irqrestore(q->queue_lock, flags);
+	return 0;
+
+queue_fail:
+	bfq_schedule_dispatch(bfqd);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+	bfq_log(bfqd, "set_request fail");
+	return 1;
+}
+
+static void bfq_kick_queue(struct work_struct *work)
+{
+	struct bfq_data *bfqd =
+		container_of(work, struct bfq_data, unplug_work);
+	struct request_queue *q = bfqd->queue;
+
+	spin_lock_irq(q->queue_lock);
+	__blk_run_queue(bfqd->queue);
+	spin_unlock_irq(q->queue_lock);
+}
+
+/*
+ * Timer running if the active_queue is currently idling
+ */
+static void bfq_idle_slice_timer(unsigned long data)
+{
+	struct bfq_data *bfqd = (struct bfq_data *) data;
+	struct bfq_queue *bfqq;
+	unsigned long flags;
+	enum bfqq_expiration reason;
+
+	bfq_log(bfqd, "idle timer fired");
+
+	spin_lock_irqsave(bfqd->queue->queue_lock, flags);
+
+	bfqq = bfqd->active_queue;
+	if (bfqq) {
+		/*
+		 * not expired and it has a request pending, let it dispatch
+		 */
+		if (!RB_EMPTY_ROOT(&bfqq->sort_list))
+			goto out_kick;
+
+		if (bfq_bfqq_budget_timeout(bfqq))
+			reason = BFQ_BFQQ_BUDGET_TIMEOUT;
+		else
+			reason = BFQ_BFQQ_TOO_IDLE;
+
+		/*
+		 * the idling time is not charged to the queue: compute its
+		 * rate as of when it started idling.
+		 */
+		bfq_bfqq_expire(bfqd, bfqq, true, reason);
+	}
+out_kick:
+	bfq_schedule_dispatch(bfqd);
+	spin_unlock_irqrestore(bfqd->queue->queue_lock, flags);
+}
+
+static void bfq_shutdown_timer_wq(struct bfq_data *bfqd)
+{
+	del_timer_sync(&bfqd->idle_slice_timer);
+	cancel_work_sync(&bfqd->unplug_work);
+}
+
+static void bfq_put_async_queues(struct bfq_data *bfqd)
+{
+	int i;
+
+	for (i = 0; i < IOPRIO_BE_NR; i++) {
+		if (bfqd->async_bfqq[0][i])
+			bfq_put_queue(bfqd->async_bfqq[0][i]);
+		if (bfqd->async_bfqq[1][i])
+			bfq_put_queue(bfqd->async_bfqq[1][i]);
+	}
+
+	if (bfqd->async_idle_bfqq)
+		bfq_put_queue(bfqd->async_idle_bfqq);
+}
+
+static void bfq_exit_queue(struct elevator_queue *e)
+{
+	struct bfq_data *bfqd = e->elevator_data;
+	struct request_queue *q = bfqd->queue;
+
+	bfq_shutdown_timer_wq(bfqd);
+
+	spin_lock_irq(q->queue_lock);
+
+	if (bfqd->active_queue)
+		__bfq_bfqq_expire(bfqd, bfqd->active_queue);
+
+	while (!list_empty(&bfqd->cic_list)) {
+		struct bfq_io_context *cic = list_entry(bfqd->cic_list.next,
+							struct bfq_io_context,
+							queue_list);
+
+		__bfq_exit_single_io_context(bfqd, cic);
+	}
+
+	bfq_put_async_queues(bfqd);
+
+	spin_unlock_irq(q->queue_lock);
+
+	bfq_shutdown_timer_wq(bfqd);
+
+	spin_lock(&cic_index_lock);
+	ida_remove(&cic_index_ida, bfqd->cic_index);
+	spin_unlock(&cic_index_lock);
+
+	kfree(bfqd);
+}
+
+static int bfq_alloc_cic_index(void)
+{
+	int index, error;
+
+	do {
+		if (!ida_pre_get(&cic_index_ida, GFP_KERNEL))
+			return -ENOMEM;
+
+		spin_lock(&cic_index_lock);
+		error = ida_get_new(&cic_index_ida, &index);
+		spin_unlock(&cic_index_lock);
+		if (error && error != -EAGAIN)
+			return error;
+	} while (error);
+
+	return index;
+}
+
+static void *bfq_init_queue(struct request_queue *q)
+{
+	struct bfq_data *bfqd;
+	int i;
+
+	i = bfq_alloc_cic_index();
+	if (i < 0)
+		return NULL;
+
+	bfqd = kmalloc_node(sizeof(*bfqd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!bfqd) {
+		spin_lock(&cic_index_lock);
+		ida_remove(&cic_index_ida, i);
+		spin_unlock(&cic_index_lock);
+		return NULL;
+	}
+
+	/*
+	 * Don't need take queue_lock in the routine, since we are
+	 * initializing the ioscheduler, and nobody is using bfqd
+	 */
+	bfqd->cic_index = i;
+
+	for (i = 0; i < BFQ_IOPRIO_CLASSES; i++)
+		bfqd->service_tree[i].active = RB_ROOT;
+
+	bfqd->bfq_max_budget = bfq_default_max_budget;
+
+	/*
+	 * Our fallback bfqq if bfq_find_alloc_queue() runs into OOM issues.
+	 * Grab a permanent reference to it, so that the normal code flow
+	 * will not attempt to free it.
+	 */
+	bfq_init_bfqq(bfqd, &bfqd->oom_bfqq, 1, 0);
+	bfqd->oom_bfqq.ref++;
+	bfqd->oom_bfqq.ioprio = IOPRIO_NORM;
+	bfqd->oom_bfqq.ioprio_class = IOPRIO_CLASS_BE;
+	bfq_clear_bfqq_prio_changed(&bfqd->oom_bfqq);
+
+	INIT_LIST_HEAD(&bfqd->cic_list);
+
+	bfqd->queue = q;
+
+	init_timer(&bfqd->idle_slice_timer);
+	bfqd->idle_slice_timer.function = bfq_idle_slice_timer;
+	bfqd->idle_slice_timer.data = (unsigned long) bfqd;
+
+	INIT_WORK(&bfqd->unplug_work, bfq_kick_queue);
+
+	bfqd->bfq_quantum = bfq_quantum;
+	bfqd->bfq_fifo_expire[0] = bfq_fifo_expire[0];
+	bfqd->bfq_fifo_expire[1] = bfq_fifo_expire[1];
+	bfqd->bfq_back_max = bfq_back_max;
+	bfqd->bfq_back_penalty = bfq_back_penalty;
+	bfqd->bfq_slice_idle = bfq_slice_idle;
+	bfqd->bfq_timeout[BLK_RW_ASYNC] = bfq_timeout_async;
+	bfqd->bfq_timeout[BLK_RW_SYNC] = bfq_timeout_sync;
+	bfqd->bfq_max_budget_async_rq = bfq_max_budget_async_rq;
+	bfqd->bfq_user_max_budget = 0;
+
+	bfqd->bfq_low_latency = 1;
+	bfqd->bfq_wr_coeff = bfq_wr_coeff;
+	bfqd->bfq_wr_max_time = 0;
+	bfqd->bfq_wr_rt_max_time = bfq_wr_rt_max_time;
+	bfqd->bfq_wr_min_idle_time = bfq_wr_min_idle_time;
+	bfqd->bfq_wr_max_softrt_rate = bfq_wr_max_softrt_rate;
+
+	bfqd->hw_tag = -1;
+	return bfqd;
+}
+
+static void bfq_slab_kill(void)
+{
+	/*
+	 * Caller already ensured that pending RCU callbacks are completed,
+	 * so we should have no busy allocations at this point.
+	 */
+	if (bfq_pool)
+		kmem_cache_destroy(bfq_pool);
+	if (bfq_ioc_pool)
+		kmem_cache_destroy(bfq_ioc_pool);
+}
+
+static int __init bfq_slab_setup(void)
+{
+	bfq_pool = KMEM_CACHE(bfq_queue, 0);
+	if (!bfq_pool)
+		goto fail;
+
+	bfq_ioc_pool = KMEM_CACHE(bfq_io_context, 0);
+	if (!bfq_ioc_pool)
+		goto fail;
+
+	return 0;
+fail:
+	bfq_slab_kill();
+	return -ENOMEM;
+}
+
+/*
+ * sysfs parts below -->
+ */
+static ssize_t
+bfq_var_show(unsigned int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+bfq_var_store(unsigned int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtoul(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct bfq_data *bfqd = e->elevator_data;			\
+	unsigned int __data = __VAR;					\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return bfq_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(bfq_quantum_show, bfqd->bfq_quantum, 0);
+SHOW_FUNCTION(bfq_fifo_expire_sync_show, bfqd->bfq_fifo_expire[1], 1);
+SHOW_FUNCTION(bfq_fifo_expire_async_show, bfqd->bfq_fifo_expire[0], 1);
+SHOW_FUNCTION(bfq_back_seek_max_show, bfqd->bfq_back_max, 0);
+SHOW_FUNCTION(bfq_back_seek_penalty_show, bfqd->bfq_back_penalty, 0);
+SHOW_FUNCTION(bfq_slice_idle_show, bfqd->bfq_slice_idle, 1);
+SHOW_FUNCTION(bfq_max_budget_show, bfqd->bfq_user_max_budget, 0);
+SHOW_FUNCTION(bfq_max_budget_async_rq_show, bfqd->bfq_max_budget_async_rq, 0);
+SHOW_FUNCTION(bfq_timeout_sync_show, bfqd->bfq_timeout[BLK_RW_SYNC], 1);
+SHOW_FUNCTION(bfq_timeout_async_show, bfqd->bfq_timeout[BLK_RW_ASYNC], 1);
+SHOW_FUNCTION(bfq_low_latency_show, bfqd->bfq_low_latency, 0);
+SHOW_FUNCTION(bfq_wr_coeff_show, bfqd->bfq_wr_coeff, 0);
+SHOW_FUNCTION(bfq_wr_max_time_show, bfq_wr_duration(bfqd), 1);
+SHOW_FUNCTION(bfq_wr_rt_max_time_show, bfqd->bfq_wr_rt_max_time, 1);
+SHOW_FUNCTION(bfq_wr_min_idle_time_show, bfqd->bfq_wr_min_idle_time, 1);
+SHOW_FUNCTION(bfq_wr_max_softrt_rate_show, bfqd->bfq_wr_max_softrt_rate, 0);
+SHOW_FUNCTION(bfq_peak_rate_show, (bfqd->peak_rate * USEC_PER_SEC) >>
+	      BFQ_RATE_SHIFT, 0);
+SHOW_FUNCTION(bfq_cur_max_budget_show, bfqd->bfq_max_budget, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct bfq_data *bfqd = e->elevator_data;			\
+	unsigned int __data;						\
+	int ret = bfq_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(bfq_quantum_store, &bfqd->bfq_quantum, 1, UINT_MAX, 0);
+STORE_FUNCTION(bfq_fifo_expire_sync_store, &bfqd->bfq_fifo_expire[1], 1,
+		UINT_MAX, 1);
+STORE_FUNCTION(bfq_fifo_expire_async_store, &bfqd->bfq_fifo_expire[0], 1,
+		UINT_MAX, 1);
+STORE_FUNCTION(bfq_back_seek_max_store, &bfqd->bfq_back_max, 0, UINT_MAX, 0);
+STORE_FUNCTION(bfq_back_seek_penalty_store, &bfqd->bfq_back_penalty, 1,
+		UINT_MAX, 0);
+STORE_FUNCTION(bfq_slice_idle_store, &bfqd->bfq_slice_idle, 0, UINT_MAX, 1);
+STORE_FUNCTION(bfq_max_budget_async_rq_store, &bfqd->bfq_max_budget_async_rq,
+		1, UINT_MAX, 0);
+STORE_FUNCTION(bfq_timeout_async_store, &bfqd->bfq_timeout[BLK_RW_ASYNC], 0,
+		UINT_MAX, 1);
+STORE_FUNCTION(bfq_wr_coeff_store, &bfqd->bfq_wr_coeff, 1,
+		BFQ_MAX_WR_COEFF, 0);
+STORE_FUNCTION(bfq_wr_max_time_store, &bfqd->bfq_wr_max_time, 0, UINT_MAX, 1);
+STORE_FUNCTION(bfq_wr_rt_max_time_store, &bfqd->bfq_wr_rt_max_time, 0,
+		UINT_MAX, 1);
+STORE_FUNCTION(bfq_wr_min_idle_time_store, &bfqd->bfq_wr_min_idle_time, 0,
+		UINT_MAX, 1);
+STORE_FUNCTION(bfq_wr_max_softrt_rate_store, &bfqd->bfq_wr_max_softrt_rate, 0,
+		UINT_MAX, 0);
+#undef STORE_FUNCTION
+
+/*
+ * Writing 0 to max_budget turns autotuning from the peak rate back on.
+ */
+static ssize_t bfq_max_budget_store(struct elevator_queue *e,
+				    const char *page, size_t count)
+{
+	struct bfq_data *bfqd = e->elevator_data;
+	unsigned int __data;
+	int ret = bfq_var_store(&__data, (page), count);
+
+	bfqd->bfq_user_max_budget = __data;
+	if (__data)
+		bfqd->bfq_max_budget = __data;
+	else if (!bfqd->peak_rate_samples)
+		bfqd->bfq_max_budget = bfq_default_max_budget;
+	return ret;
+}
+
+static ssize_t bfq_timeout_sync_store(struct elevator_queue *e,
+				      const char *page, size_t count)
+{
+	struct bfq_data *bfqd = e->elevator_data;
+	unsigned int __data;
+	int ret = bfq_var_store(&__data, (page), count);
+
+	if (__data < 1)
+		__data = 1;
+	bfqd->bfq_timeout[BLK_RW_SYNC] = msecs_to_jiffies(__data);
+	/* the autotuned max budget depends on the sync timeout */
+	if (!bfqd->bfq_user_max_budget)
+		bfqd->peak_rate_samples = 0;
+	return ret;
+}
+
+static ssize_t bfq_low_latency_store(struct elevator_queue *e,
+				     const char *page, size_t count)
+{
+	struct bfq_data *bfqd = e->elevator_data;
+	unsigned int __data;
+	int ret = bfq_var_store(&__data, (page), count);
+
+	if (__data > 1)
+		__data = 1;
+	/* raised queues lose their raising at their next dispatch */
+	bfqd->bfq_low_latency = __data;
+	return ret;
+}
+
+#define BFQ_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, bfq_##name##_show, bfq_##name##_store)
+#define BFQ_ATTR_RO(name) \
+	__ATTR(name, S_IRUGO, bfq_##name##_show, NULL)
+
+static struct elv_fs_entry bfq_attrs[] = {
+	BFQ_ATTR(quantum),
+	BFQ_ATTR(fifo_expire_sync),
+	BFQ_ATTR(fifo_expire_async),
+	BFQ_ATTR(back_seek_max),
+	BFQ_ATTR(back_seek_penalty),
+	BFQ_ATTR(slice_idle),
+	BFQ_ATTR(max_budget),
+	BFQ_ATTR(max_budget_async_rq),
+	BFQ_ATTR(timeout_sync),
+	BFQ_ATTR(timeout_async),
+	BFQ_ATTR(low_latency),
+	BFQ_ATTR(wr_coeff),
+	BFQ_ATTR(wr_max_time),
+	BFQ_ATTR(wr_rt_max_time),
+	BFQ_ATTR(wr_min_idle_time),
+	BFQ_ATTR(wr_max_softrt_rate),
+	BFQ_ATTR_RO(peak_rate),
+	BFQ_ATTR_RO(cur_max_budget),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_bfq = {
+	.ops = {
+		.elevator_merge_fn = 		bfq_merge,
+		.elevator_merged_fn =		bfq_merged_request,
+		.elevator_merge_req_fn =	bfq_merged_requests,
+		.elevator_allow_merge_fn =	bfq_allow_merge,
+		.elevator_dispatch_fn =		bfq_dispatch_requests,
+		.elevator_add_req_fn =		bfq_insert_request,
+		.elevator_activate_req_fn =	bfq_activate_request,
+		.elevator_deactivate_req_fn =	bfq_deactivate_request,
+		.elevator_completed_req_fn =	bfq_completed_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_set_req_fn =		bfq_set_request,
+		.elevator_put_req_fn =		bfq_put_request,
+		.elevator_may_queue_fn =	bfq_may_queue,
+		.elevator_init_fn =		bfq_init_queue,
+		.elevator_exit_fn =		bfq_exit_queue,
+		.trim =				bfq_free_io_context,
+	},
+	.elevator_attrs =	bfq_attrs,
+	.elevator_name =	"bfq",
+	.elevator_owner =	THIS_MODULE,
+};
+
+static int __init bfq_init(void)
+{
+	/*
+	 * could be 0 on HZ < 1000 setups
+	 */
+	if (!bfq_slice_idle)
+		bfq_slice_idle = 1;
+	if (!bfq_timeout_async)
+		bfq_timeout_async = 1;
+
+	if (bfq_slab_setup())
+		return -ENOMEM;
+
+	elv_register(&iosched_bfq);
+
+	return 0;
+}
+
+static void __exit bfq_exit(void)
+{
+	DECLARE_COMPLETION_ONSTACK(all_gone);
+	elv_unregister(&iosched_bfq);
+	ioc_gone = &all_gone;
+	/* ioc_gone's update must be visible before reading ioc_count */
+	smp_wmb();
+
+	/*
+	 * this also protects us from entering bfq_slab_kill() with
+	 * pending RCU callbacks
+	 */
+	if (elv_ioc_count_read(bfq_ioc_count))
+		wait_for_completion(&all_gone);
+	ida_destroy(&cic_index_ida);
+	bfq_slab_kill();
+}
+
+module_init(bfq_init);
+module_exit(bfq_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Budget Fair Queueing IO scheduler");
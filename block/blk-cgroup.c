@@ -18,6 +18,7 @@
 #include <linux/blkdev.h>
 #include <linux/slab.h>
 #include "blk-cgroup.h"
+#include "blk.h"
 #include <linux/genhd.h>
 
 #define MAX_KEY_LEN 100
@@ -439,6 +440,17 @@ void blkiocg_update_completion_stats(struct blkio_group *blkg,
 }
 EXPORT_SYMBOL_GPL(blkiocg_update_completion_stats);
 
+/*
+ * Completion latency histograms are per cpu and don't need the stats lock,
+ * blk_lat_stats_add() is safe from any context.
+ */
+void blkiocg_update_latency_stats(struct blkio_group *blkg,
+				  struct request *rq)
+{
+	blk_lat_stats_add(&blkg->stats_cpu->lat, rq, sched_clock());
+}
+EXPORT_SYMBOL_GPL(blkiocg_update_latency_stats);
+
 /*  Merged stats are per cpu.  */
 void blkiocg_update_io_merged_stats(struct blkio_group *blkg, bool direction,
 					bool sync)
@@ -569,6 +581,7 @@ static void blkio_reset_stats_cpu(struct blkio_group *blkg)
 			for (k = 0; k < BLKIO_STAT_TOTAL; k++)
 				stats_cpu->stat_arr_cpu[j][k] = 0;
 	}
+	blk_lat_stats_reset(&blkg->stats_cpu->lat);
 }
 
 static int
@@ -1165,6 +1178,34 @@ static void blkio_read_policy_node_files(struct cftype *cft,
 	}
 }
 
+static int blkio_read_latency_hist(struct cftype *cft,
+			struct blkio_cgroup *blkcg, struct seq_file *m)
+{
+	struct blkio_group *blkg;
+	struct hlist_node *n;
+	char key_str[MAX_KEY_LEN];
+	char *buf;
+
+	buf = (char *)__get_free_page(GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(blkg, n, &blkcg->blkg_list, blkcg_node) {
+		if (!blkg->dev || !cftype_blkg_same_policy(cft, blkg))
+			continue;
+		snprintf(key_str, sizeof(key_str), "%d:%d ",
+			 MAJOR(blkg->dev), MINOR(blkg->dev));
+		blk_lat_stats_show(&blkg->stats_cpu->lat, key_str, buf,
+				   PAGE_SIZE);
+		seq_puts(m, buf);
+	}
+	rcu_read_unlock();
+
+	free_page((unsigned long)buf);
+	return 0;
+}
+
 static int blkiocg_file_read(struct cgroup *cgrp, struct cftype *cft,
 				struct seq_file *m)
 {
@@ -1180,6 +1221,8 @@ static int blkiocg_file_read(struct cgroup *cgrp, struct cftype *cft,
 		case BLKIO_PROP_weight_device:
 			blkio_read_policy_node_files(cft, blkcg, m);
 			return 0;
+		case BLKIO_PROP_io_latency_hist:
+			return blkio_read_latency_hist(cft, blkcg, m);
 		default:
 			BUG();
 		}
@@ -1446,6 +1489,12 @@ struct cftype blkio_files[] = {
 				BLKIO_PROP_io_queued),
 		.read_map = blkiocg_file_read_map,
 	},
+	{
+		.name = "io_latency_hist",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_PROP,
+				BLKIO_PROP_io_latency_hist),
+		.read_seq_string = blkiocg_file_read,
+	},
 	{
 		.name = "reset_stats",
 		.write_u64 = blkiocg_reset_stats,
@@ -29,6 +29,7 @@
 #include <linux/fault-inject.h>
 #include <linux/list_sort.h>
 #include <linux/delay.h>
+#include <linux/hash.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
@@ -443,6 +444,24 @@ static int blk_init_free_list(struct request_queue *q)
 	if (!rl->rq_pool)
 		return -ENOMEM;
 
+	/*
+	 * Preallocate the default number of requests, so that the steady
+	 * state does not hit the slab. This is only an optimization, the
+	 * queue works from the mempool alone if the allocation fails.
+	 */
+	rl->rqs = kzalloc_node(BLKDEV_MAX_RQ * sizeof(struct request),
+			       GFP_KERNEL | __GFP_NOWARN, q->node);
+	rl->rq_map = kzalloc_node(BITS_TO_LONGS(BLKDEV_MAX_RQ) *
+				  sizeof(unsigned long), GFP_KERNEL, q->node);
+	if (rl->rqs && rl->rq_map) {
+		rl->rq_depth = BLKDEV_MAX_RQ;
+	} else {
+		kfree(rl->rqs);
+		kfree(rl->rq_map);
+		rl->rqs = NULL;
+		rl->rq_map = NULL;
+	}
+
 	return 0;
 }
 
@@ -468,16 +487,20 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	q->backing_dev_info.capabilities = BDI_CAP_MAP_COPY;
 	q->backing_dev_info.name = "block";
 
+	q->plug_stats = alloc_percpu(struct blk_plug_stats);
+	if (!q->plug_stats)
+		goto fail_q;
+
+	q->lat_stats = alloc_percpu(struct blk_lat_stats);
+	if (!q->lat_stats)
+		goto fail_plug_stats;
+
 	err = bdi_init(&q->backing_dev_info);
-	if (err) {
-		kmem_cache_free(blk_requestq_cachep, q);
-		return NULL;
-	}
+	if (err)
+		goto fail_lat_stats;
 
-	if (blk_throtl_init(q)) {
-		kmem_cache_free(blk_requestq_cachep, q);
-		return NULL;
-	}
+	if (blk_throtl_init(q))
+		goto fail_bdi;
 
 	setup_timer(&q->backing_dev_info.laptop_mode_wb_timer,
 		    laptop_mode_timer_fn, (unsigned long) q);
@@ -500,6 +523,16 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	q->queue_lock = &q->__queue_lock;
 
 	return q;
+
+fail_bdi:
+	bdi_destroy(&q->backing_dev_info);
+fail_lat_stats:
+	free_percpu(q->lat_stats);
+fail_plug_stats:
+	free_percpu(q->plug_stats);
+fail_q:
+	kmem_cache_free(blk_requestq_cachep, q);
+	return NULL;
 }
 EXPORT_SYMBOL(blk_alloc_queue_node);
 
@@ -617,18 +650,60 @@ int blk_get_queue(struct request_queue *q)
 }
 EXPORT_SYMBOL(blk_get_queue);
 
+static inline bool blk_rq_from_pool(struct request_list *rl,
+				    struct request *rq)
+{
+	return rq >= rl->rqs && rq < rl->rqs + rl->rq_depth;
+}
+
+/*
+ * Get a request from the preallocated ones, queue lock must be held.
+ */
+static struct request *blk_rq_pool_get(struct request_list *rl)
+{
+	unsigned int tag;
+
+	if (!rl->rq_depth)
+		return NULL;
+
+	tag = find_first_zero_bit(rl->rq_map, rl->rq_depth);
+	if (tag >= rl->rq_depth) {
+		rl->rq_misses++;
+		return NULL;
+	}
+
+	set_bit(tag, rl->rq_map);
+	rl->rq_hits++;
+	return &rl->rqs[tag];
+}
+
+static void __blk_free_request(struct request_queue *q, struct request *rq)
+{
+	struct request_list *rl = &q->rq;
+
+	if (blk_rq_from_pool(rl, rq))
+		clear_bit(rq - rl->rqs, rl->rq_map);
+	else
+		mempool_free(rq, rl->rq_pool);
+}
+
 static inline void blk_free_request(struct request_queue *q, struct request *rq)
 {
 	if (rq->cmd_flags & REQ_ELVPRIV)
 		elv_put_request(q, rq);
-	mempool_free(rq, q->rq.rq_pool);
+	__blk_free_request(q, rq);
 }
 
+/*
+ * @rq is a request taken from the preallocated ones, or %NULL to allocate
+ * one from the mempool.
+ */
 static struct request *
-blk_alloc_request(struct request_queue *q, unsigned int flags, gfp_t gfp_mask)
+blk_alloc_request(struct request_queue *q, struct request *rq,
+		  unsigned int flags, gfp_t gfp_mask)
 {
-	struct request *rq = mempool_alloc(q->rq.rq_pool, gfp_mask);
-
+	if (!rq)
+		rq = mempool_alloc(q->rq.rq_pool, gfp_mask);
 	if (!rq)
 		return NULL;
 
@@ -638,7 +713,7 @@ blk_alloc_request(struct request_queue *q, unsigned int flags, gfp_t gfp_mask)
 
 	if ((flags & REQ_ELVPRIV) &&
 	    unlikely(elv_set_request(q, rq, gfp_mask))) {
-		mempool_free(rq, q->rq.rq_pool);
+		__blk_free_request(q, rq);
 		return NULL;
 	}
 
@@ -808,9 +883,11 @@ static struct request *get_request(struct request_queue *q, int rw_flags,
 
 	if (blk_queue_io_stat(q))
 		rw_flags |= REQ_IO_STAT;
+
+	rq = blk_rq_pool_get(rl);
 	spin_unlock_irq(q->queue_lock);
 
-	rq = blk_alloc_request(q, rw_flags, gfp_mask);
+	rq = blk_alloc_request(q, rq, rw_flags, gfp_mask);
 	if (unlikely(!rq)) {
 		/*
 		 * Allocation failed presumably due to memory. Undo anything
@@ -1108,6 +1185,10 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 	if (unlikely(--req->ref_count))
 		return;
 
+	/* merged away before completing, give its writeback slot back */
+	if (req->cmd_flags & REQ_WB_TRACKED)
+		wbt_done(q, req);
+
 	elv_completed_request(q, req);
 
 	/* this is a bio leak */
@@ -1226,16 +1307,42 @@ static bool bio_attempt_front_merge(struct request_queue *q,
 	return true;
 }
 
+static inline sector_t plug_rq_key(struct request *rq)
+{
+	return blk_rq_pos(rq) + blk_rq_sectors(rq);
+}
+
+static inline struct hlist_head *plug_hash_head(struct blk_plug *plug,
+						struct request_queue *q,
+						sector_t sector)
+{
+	unsigned long key = (unsigned long)q ^ (unsigned long)sector;
+
+	return &plug->hash[hash_long(key, BLK_PLUG_HASH_BITS)];
+}
+
+static void plug_rq_hash_add(struct blk_plug *plug, struct request *rq)
+{
+	if (rq_mergeable(rq))
+		hlist_add_head(&rq->hash,
+			       plug_hash_head(plug, rq->q, plug_rq_key(rq)));
+}
+
 /**
  * attempt_plug_merge - try to merge with %current's plugged list
  * @q: request_queue new bio is being queued at
  * @bio: new bio being queued
- * @request_count: out parameter for number of traversed plugged requests
  *
  * Determine whether @bio being queued on @q can be merged with a request
  * on %current's plugged list.  Returns %true if merge was successful,
  * otherwise %false.
  *
+ * Back merge candidates are looked up in the plug's hash of requests by
+ * end sector, so the cost doesn't grow with the number of plugged
+ * requests.  A front merge is only tried against the most recently
+ * plugged request; anything else is left to the elevator, and the plug
+ * list is sorted before flushing if it was built out of order.
+ *
  * This function is called without @q->queue_lock; however, elevator is
  * accessed iff there already are requests on the plugged list which in
  * turn guarantees validity of the elevator.
@@ -1244,39 +1351,39 @@ static bool bio_attempt_front_merge(struct request_queue *q,
  * elevator_bio_merged_fn() will be called without queue lock.  Elevator
  * must be ready for this.
  */
-static bool attempt_plug_merge(struct request_queue *q, struct bio *bio,
-			       unsigned int *request_count)
+static bool attempt_plug_merge(struct request_queue *q, struct bio *bio)
 {
 	struct blk_plug *plug;
+	struct hlist_node *entry;
 	struct request *rq;
-	bool ret = false;
 
 	plug = current->plug;
-	if (!plug)
-		goto out;
-	*request_count = 0;
-
-	list_for_each_entry_reverse(rq, &plug->list, queuelist) {
-		int el_ret;
-
-		(*request_count)++;
+	if (!plug || list_empty(&plug->list))
+		return false;
 
-		if (rq->q != q)
+	hlist_for_each_entry(rq, entry, plug_hash_head(plug, q, bio->bi_sector),
+			     hash) {
+		if (rq->q != q || plug_rq_key(rq) != bio->bi_sector)
 			continue;
 
-		el_ret = elv_try_merge(rq, bio);
-		if (el_ret == ELEVATOR_BACK_MERGE) {
-			ret = bio_attempt_back_merge(q, rq, bio);
-			if (ret)
-				break;
-		} else if (el_ret == ELEVATOR_FRONT_MERGE) {
-			ret = bio_attempt_front_merge(q, rq, bio);
-			if (ret)
-				break;
+		if (elv_rq_merge_ok(rq, bio) &&
+		    bio_attempt_back_merge(q, rq, bio)) {
+			/* the end sector moved, rehash */
+			hlist_del(&rq->hash);
+			plug_rq_hash_add(plug, rq);
+			goto merged;
 		}
 	}
-out:
-	return ret;
+
+	rq = list_entry_rq(plug->list.prev);
+	if (rq->q == q && elv_try_merge(rq, bio) == ELEVATOR_FRONT_MERGE &&
+	    bio_attempt_front_merge(q, rq, bio))
+		goto merged;
+
+	return false;
+merged:
+	this_cpu_inc(q->plug_stats->merges);
+	return true;
 }
 
 void init_request_from_bio(struct request *req, struct bio *bio)
@@ -1299,7 +1406,7 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	struct blk_plug *plug;
 	int el_ret, rw_flags, where = ELEVATOR_INSERT_SORT;
 	struct request *req;
-	unsigned int request_count = 0;
+	bool wb_acct;
 
 	/*
 	 * low level driver can indicate that it wants pages above a
@@ -1318,7 +1425,7 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	 * Check if we can merge with the plugged list before grabbing
 	 * any locks.
 	 */
-	if (attempt_plug_merge(q, bio, &request_count))
+	if (attempt_plug_merge(q, bio))
 		return;
 
 	spin_lock_irq(q->queue_lock);
@@ -1339,6 +1446,12 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	}
 
 get_rq:
+	/*
+	 * Async writes may have to wait for the writeback already in flight.
+	 * This drops the queue lock while sleeping.
+	 */
+	wb_acct = wbt_wait(q, bio);
+
 	/*
 	 * This sync check and mask will be re-done in init_request_from_bio(),
 	 * but we need to set it earlier to expose the sync flag to the
@@ -1354,9 +1467,13 @@ get_rq:
 	 */
 	req = get_request_wait(q, rw_flags, bio);
 	if (unlikely(!req)) {
+		if (wb_acct)
+			wbt_release(q);
 		bio_endio(bio, -ENODEV);	/* @q is dead */
 		goto out_unlock;
 	}
+	if (wb_acct)
+		req->cmd_flags |= REQ_WB_TRACKED;
 
 	/*
 	 * After dropping the lock and possibly sleeping here, our request
@@ -1374,25 +1491,25 @@ get_rq:
 		/*
 		 * If this is the first request added after a plug, fire
 		 * of a plug trace. If others have been added before, check
-		 * if we have multiple devices in this plug. If so, make a
-		 * note to sort the list before dispatch.
+		 * if we have multiple devices in this plug, or requests
+		 * going backwards. If so, make a note to sort the list
+		 * before dispatch.
 		 */
 		if (list_empty(&plug->list))
 			trace_block_plug(q);
-		else {
-			if (!plug->should_sort) {
-				struct request *__rq;
+		else if (plug->count >= BLK_MAX_REQUEST_COUNT) {
+			blk_flush_plug_list(plug, false);
+			trace_block_plug(q);
+		} else if (!plug->should_sort) {
+			struct request *__rq;
 
-				__rq = list_entry_rq(plug->list.prev);
-				if (__rq->q != q)
-					plug->should_sort = 1;
-			}
-			if (request_count >= BLK_MAX_REQUEST_COUNT) {
-				blk_flush_plug_list(plug, false);
-				trace_block_plug(q);
-			}
+			__rq = list_entry_rq(plug->list.prev);
+			if (__rq->q != q || blk_rq_pos(__rq) > blk_rq_pos(req))
+				plug->should_sort = 1;
 		}
 		list_add_tail(&req->queuelist, &plug->list);
+		plug->count++;
+		plug_rq_hash_add(plug, req);
 		drive_stat_acct(req, 1);
 	} else {
 		spin_lock_irq(q->queue_lock);
@@ -1860,6 +1977,8 @@ static void blk_account_io_done(struct request *req)
 		cpu = part_stat_lock();
 		part = req->part;
 
+		blk_lat_stats_add(req->q->lat_stats, req, sched_clock());
+
 		part_stat_inc(cpu, part, ios[rw]);
 		part_stat_add(cpu, part, ticks[rw], duration);
 		part_round_stats(cpu, part);
@@ -1978,6 +2097,7 @@ void blk_dequeue_request(struct request *rq)
 	BUG_ON(ELV_ON_HASH(rq));
 
 	list_del_init(&rq->queuelist);
+	rq->stat_bytes = blk_rq_bytes(rq);
 
 	/*
 	 * the time frame between a request being removed from the lists
@@ -2277,6 +2397,7 @@ static void blk_finish_request(struct request *req, int error)
 
 
 	blk_account_io_done(req);
+	wbt_done(req->q, req);
 
 	if (req->end_io)
 		req->end_io(req, error);
@@ -2700,11 +2821,15 @@ EXPORT_SYMBOL(kblockd_schedule_delayed_work);
 void blk_start_plug(struct blk_plug *plug)
 {
 	struct task_struct *tsk = current;
+	int i;
 
 	plug->magic = PLUG_MAGIC;
 	INIT_LIST_HEAD(&plug->list);
 	INIT_LIST_HEAD(&plug->cb_list);
 	plug->should_sort = 0;
+	plug->count = 0;
+	for (i = 0; i < BLK_PLUG_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&plug->hash[i]);
 
 	/*
 	 * If this is a nested plug, don't actually assign it. It will be
@@ -2725,7 +2850,9 @@ static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
 	struct request *rqa = container_of(a, struct request, queuelist);
 	struct request *rqb = container_of(b, struct request, queuelist);
 
-	return !(rqa->q <= rqb->q);
+	if (rqa->q != rqb->q)
+		return rqa->q > rqb->q;
+	return blk_rq_pos(rqa) > blk_rq_pos(rqb);
 }
 
 /*
@@ -2777,9 +2904,10 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 {
 	struct request_queue *q;
 	unsigned long flags;
-	struct request *rq;
+	struct request *rq, *last;
 	LIST_HEAD(list);
-	unsigned int depth;
+	LIST_HEAD(batch);
+	unsigned int depth, direct;
 
 	BUG_ON(plug->magic != PLUG_MAGIC);
 
@@ -2788,51 +2916,52 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 		return;
 
 	list_splice_init(&plug->list, &list);
+	plug->count = 0;
 
 	if (plug->should_sort) {
 		list_sort(NULL, &list, plug_rq_cmp);
 		plug->should_sort = 0;
 	}
 
-	q = NULL;
-	depth = 0;
-
 	/*
 	 * Save and disable interrupts here, to avoid doing it for every
 	 * queue lock we have to take.
 	 */
 	local_irq_save(flags);
 	while (!list_empty(&list)) {
-		rq = list_entry_rq(list.next);
-		list_del_init(&rq->queuelist);
-		BUG_ON(!rq->q);
-		if (rq->q != q) {
-			/*
-			 * This drops the queue lock
-			 */
-			if (q)
-				queue_unplugged(q, depth, from_schedule);
-			q = rq->q;
-			depth = 0;
-			spin_lock(q->queue_lock);
+		q = list_entry_rq(list.next)->q;
+		BUG_ON(!q);
+
+		/*
+		 * The requests for one queue are next to each other, hand
+		 * them over as a single batch.
+		 */
+		depth = 0;
+		last = NULL;
+		list_for_each_entry(rq, &list, queuelist) {
+			if (rq->q != q)
+				break;
+			hlist_del_init(&rq->hash);
+			last = rq;
+			depth++;
 		}
+		list_cut_position(&batch, &list, &last->queuelist);
+
+		spin_lock(q->queue_lock);
 		/*
-		 * rq is already accounted, so use raw insert
+		 * rqs are already accounted, so use raw insert
 		 */
-		if (rq->cmd_flags & (REQ_FLUSH | REQ_FUA))
-			__elv_add_request(q, rq, ELEVATOR_INSERT_FLUSH);
-		else
-			__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
+		direct = __elv_add_request_list(q, &batch);
 
-		depth++;
-	}
+		__this_cpu_inc(q->plug_stats->flushes);
+		__this_cpu_add(q->plug_stats->requests, depth);
+		__this_cpu_add(q->plug_stats->direct, direct);
 
-	/*
-	 * This drops the queue lock
-	 */
-	if (q)
+		/*
+		 * This drops the queue lock
+		 */
 		queue_unplugged(q, depth, from_schedule);
-
+	}
 	local_irq_restore(flags);
 }
 
@@ -303,8 +303,11 @@ void blk_insert_flush(struct request *rq)
 
 	/*
 	 * @policy now records what operations need to be done.  Adjust
-	 * REQ_FLUSH and FUA for the driver.
+	 * REQ_FLUSH and FUA for the driver.  The latency stats still want
+	 * to know that it waits for a flush.
 	 */
+	if (policy & (REQ_FSEQ_PREFLUSH | REQ_FSEQ_POSTFLUSH))
+		rq->stat_flush = true;
 	rq->cmd_flags &= ~REQ_FLUSH;
 	if (!(fflags & REQ_FUA))
 		rq->cmd_flags &= ~REQ_FUA;
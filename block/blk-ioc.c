@@ -27,6 +27,17 @@ static void cfq_dtor(struct io_context *ioc)
 	}
 }
 
+static void bfq_dtor(struct io_context *ioc)
+{
+	if (!hlist_empty(&ioc->bfq_cic_list)) {
+		struct bfq_io_context *cic;
+
+		cic = hlist_entry(ioc->bfq_cic_list.first,
+				  struct bfq_io_context, cic_list);
+		cic->dtor(ioc);
+	}
+}
+
 /*
  * IO Context helper functions. put_io_context() returns 1 if there are no
  * more users of this io context, 0 otherwise.
@@ -41,6 +52,7 @@ int put_io_context(struct io_context *ioc)
 	if (atomic_long_dec_and_test(&ioc->refcount)) {
 		rcu_read_lock();
 		cfq_dtor(ioc);
+		bfq_dtor(ioc);
 		rcu_read_unlock();
 
 		kmem_cache_free(iocontext_cachep, ioc);
@@ -64,6 +76,20 @@ static void cfq_exit(struct io_context *ioc)
 	rcu_read_unlock();
 }
 
+static void bfq_exit(struct io_context *ioc)
+{
+	rcu_read_lock();
+
+	if (!hlist_empty(&ioc->bfq_cic_list)) {
+		struct bfq_io_context *cic;
+
+		cic = hlist_entry(ioc->bfq_cic_list.first,
+				  struct bfq_io_context, cic_list);
+		cic->exit(ioc);
+	}
+	rcu_read_unlock();
+}
+
 /* Called by the exiting task */
 void exit_io_context(struct task_struct *task)
 {
@@ -74,8 +100,10 @@ void exit_io_context(struct task_struct *task)
 	task->io_context = NULL;
 	task_unlock(task);
 
-	if (atomic_dec_and_test(&ioc->nr_tasks))
+	if (atomic_dec_and_test(&ioc->nr_tasks)) {
 		cfq_exit(ioc);
+		bfq_exit(ioc);
+	}
 
 	put_io_context(ioc);
 }
@@ -96,6 +124,9 @@ struct io_context *alloc_io_context(gfp_t gfp_flags, int node)
 		INIT_RADIX_TREE(&ioc->radix_root, GFP_ATOMIC | __GFP_HIGH);
 		INIT_HLIST_HEAD(&ioc->cic_list);
 		ioc->ioc_data = NULL;
+		INIT_RADIX_TREE(&ioc->bfq_radix_root, GFP_ATOMIC | __GFP_HIGH);
+		INIT_HLIST_HEAD(&ioc->bfq_cic_list);
+		ioc->bfq_ioc_data = NULL;
 #if defined(CONFIG_BLK_CGROUP) || defined(CONFIG_BLK_CGROUP_MODULE)
 		ioc->cgroup_changed = 0;
 #endif
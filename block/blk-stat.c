@@ -0,0 +1,149 @@
+/*
+ * Request completion latency histograms
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+
+#include "blk.h"
+
+static const char *blk_lat_op_names[BLK_LAT_NR_OPS] = {
+	[BLK_LAT_READ]		= "read",
+	[BLK_LAT_WRITE]		= "write",
+	[BLK_LAT_DISCARD]	= "discard",
+	[BLK_LAT_FLUSH]		= "flush",
+};
+
+static const char *blk_lat_size_names[BLK_LAT_NR_SIZES] = {
+	"4k", "16k", "64k", "256k", "large",
+};
+
+static int blk_lat_op(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		return BLK_LAT_DISCARD;
+	/* REQ_FLUSH is gone by now, blk_insert_flush() strips it */
+	if (rq->stat_flush)
+		return BLK_LAT_FLUSH;
+	if (rq_data_dir(rq) == WRITE)
+		return BLK_LAT_WRITE;
+	return BLK_LAT_READ;
+}
+
+static int blk_lat_bucket(u64 nsecs)
+{
+	unsigned long usecs;
+
+	do_div(nsecs, NSEC_PER_USEC);
+	usecs = min_t(u64, nsecs, ULONG_MAX);
+
+	return min_t(int, fls_long(usecs), BLK_LAT_NR_BUCKETS - 1);
+}
+
+static int blk_lat_size(unsigned int bytes)
+{
+	int idx = 0;
+
+	/* 4k, then a class for every factor of 4 */
+	bytes = (bytes - 1) >> 12;
+	while (bytes && idx < BLK_LAT_NR_SIZES - 1) {
+		bytes >>= 2;
+		idx++;
+	}
+	return idx;
+}
+
+/**
+ * blk_lat_stats_add - account a completed request
+ * @stats: per cpu histograms to account @rq in
+ * @rq: the request
+ * @now: completion time, in sched_clock() nsecs
+ *
+ * The latency is taken from the allocation of @rq, so it includes the
+ * time spent in the I/O scheduler.  May be called from any context.
+ */
+void blk_lat_stats_add(struct blk_lat_stats __percpu *stats,
+		       struct request *rq, u64 now)
+{
+	u64 start = rq_start_time_ns(rq);
+	int op = blk_lat_op(rq);
+	int bucket;
+
+	bucket = blk_lat_bucket(time_after64(now, start) ? now - start : 0);
+
+	this_cpu_inc(stats->op[op][bucket]);
+	if ((op == BLK_LAT_READ || op == BLK_LAT_WRITE) && rq->stat_bytes)
+		this_cpu_inc(stats->size[blk_lat_size(rq->stat_bytes)][bucket]);
+}
+EXPORT_SYMBOL_GPL(blk_lat_stats_add);
+
+#define BLK_LAT_ROW_SIZE	(BLK_LAT_NR_BUCKETS * sizeof(unsigned long))
+
+static int blk_lat_row_show(struct blk_lat_stats __percpu *stats,
+			    size_t offset, const char *prefix, const char *name,
+			    char *buf, size_t size)
+{
+	int i, cpu, len;
+
+	len = scnprintf(buf, size, "%s%s", prefix, name);
+	for (i = 0; i < BLK_LAT_NR_BUCKETS; i++) {
+		unsigned long long sum = 0;
+
+		for_each_possible_cpu(cpu) {
+			unsigned long *row = (void *)per_cpu_ptr(stats, cpu) +
+					    offset;
+
+			sum += row[i];
+		}
+		len += scnprintf(buf + len, size - len, " %llu", sum);
+	}
+	len += scnprintf(buf + len, size - len, "\n");
+
+	return len;
+}
+
+/**
+ * blk_lat_stats_show - format latency histograms
+ * @stats: per cpu histograms to show
+ * @prefix: string to start every line with
+ * @buf: buffer to format into
+ * @size: size of @buf
+ *
+ * Prints one line per histogram, its name followed by the count of each
+ * bucket summed over all cpus.  Returns the number of bytes written.
+ */
+int blk_lat_stats_show(struct blk_lat_stats __percpu *stats,
+		       const char *prefix, char *buf, size_t size)
+{
+	int i, len = 0;
+
+	for (i = 0; i < BLK_LAT_NR_OPS; i++)
+		len += blk_lat_row_show(stats,
+				offsetof(struct blk_lat_stats, op) +
+				i * BLK_LAT_ROW_SIZE, prefix,
+				blk_lat_op_names[i], buf + len, size - len);
+	for (i = 0; i < BLK_LAT_NR_SIZES; i++)
+		len += blk_lat_row_show(stats,
+				offsetof(struct blk_lat_stats, size) +
+				i * BLK_LAT_ROW_SIZE, prefix,
+				blk_lat_size_names[i], buf + len, size - len);
+	return len;
+}
+EXPORT_SYMBOL_GPL(blk_lat_stats_show);
+
+/**
+ * blk_lat_stats_reset - clear latency histograms
+ * @stats: per cpu histograms to clear
+ *
+ * Requests completing meanwhile may or may not be accounted.
+ */
+void blk_lat_stats_reset(struct blk_lat_stats __percpu *stats)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(stats, cpu), 0, sizeof(struct blk_lat_stats));
+}
+EXPORT_SYMBOL_GPL(blk_lat_stats_reset);
@@ -81,6 +81,50 @@ queue_requests_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+static ssize_t queue_rq_pool_show(struct request_queue *q, char *page)
+{
+	struct request_list *rl = &q->rq;
+
+	return sprintf(page, "%u %lu %lu\n", rl->rq_depth, rl->rq_hits,
+		       rl->rq_misses);
+}
+
+static ssize_t queue_plug_stat_show(struct request_queue *q, char *page)
+{
+	unsigned long merges = 0, flushes = 0, requests = 0, direct = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_plug_stats *stats = per_cpu_ptr(q->plug_stats, cpu);
+
+		merges += stats->merges;
+		flushes += stats->flushes;
+		requests += stats->requests;
+		direct += stats->direct;
+	}
+
+	return sprintf(page, "%lu %lu %lu %lu\n", merges, flushes, requests,
+		       direct);
+}
+
+static ssize_t queue_lat_hist_show(struct request_queue *q, char *page)
+{
+	return blk_lat_stats_show(q->lat_stats, "", page, PAGE_SIZE);
+}
+
+static ssize_t
+queue_lat_hist_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret = queue_var_store(&val, page, count);
+
+	if (val)
+		return -EINVAL;
+
+	blk_lat_stats_reset(q->lat_stats);
+	return ret;
+}
+
 static ssize_t queue_ra_show(struct request_queue *q, char *page)
 {
 	unsigned long ra_kb = q->backing_dev_info.ra_pages <<
@@ -381,6 +425,35 @@ static struct queue_sysfs_entry queue_iostats_entry = {
 	.store = queue_store_iostats,
 };
 
+static struct queue_sysfs_entry queue_rq_pool_entry = {
+	.attr = {.name = "rq_pool", .mode = S_IRUGO },
+	.show = queue_rq_pool_show,
+};
+
+static struct queue_sysfs_entry queue_plug_stat_entry = {
+	.attr = {.name = "plug_stat", .mode = S_IRUGO },
+	.show = queue_plug_stat_show,
+};
+
+static struct queue_sysfs_entry queue_lat_hist_entry = {
+	.attr = {.name = "latency_hist", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_lat_hist_show,
+	.store = queue_lat_hist_store,
+};
+
+#ifdef CONFIG_BLK_WBT
+static struct queue_sysfs_entry queue_wbt_lat_entry = {
+	.attr = {.name = "wbt_lat_usec", .mode = S_IRUGO | S_IWUSR },
+	.show = wbt_lat_show,
+	.store = wbt_lat_store,
+};
+
+static struct queue_sysfs_entry queue_wbt_stat_entry = {
+	.attr = {.name = "wbt_stat", .mode = S_IRUGO },
+	.show = wbt_stat_show,
+};
+#endif
+
 static struct queue_sysfs_entry queue_random_entry = {
 	.attr = {.name = "add_random", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_show_random,
@@ -409,6 +482,13 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+	&queue_rq_pool_entry.attr,
+	&queue_plug_stat_entry.attr,
+	&queue_lat_hist_entry.attr,
+#ifdef CONFIG_BLK_WBT
+	&queue_wbt_lat_entry.attr,
+	&queue_wbt_stat_entry.attr,
+#endif
 	NULL,
 };
 
@@ -483,9 +563,12 @@ static void blk_release_queue(struct kobject *kobj)
 		elevator_exit(q->elevator);
 
 	blk_throtl_exit(q);
+	wbt_exit(q);
 
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
+	kfree(rl->rqs);
+	kfree(rl->rq_map);
 
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
@@ -494,6 +577,8 @@ static void blk_release_queue(struct kobject *kobj)
 	blk_trace_shutdown(q);
 
 	bdi_destroy(&q->backing_dev_info);
+	free_percpu(q->plug_stats);
+	free_percpu(q->lat_stats);
 	kmem_cache_free(blk_requestq_cachep, q);
 }
 
@@ -541,6 +626,9 @@ int blk_register_queue(struct gendisk *disk)
 		return ret;
 	}
 
+	/* not fatal, the queue just doesn't get throttled */
+	wbt_init(q);
+
 	return 0;
 }
 
@@ -0,0 +1,416 @@
+/*
+ * Writeback throttling based on observed read latency
+ *
+ * Buffered writeback is submitted as async writes, and left alone it
+ * fills the request queue and the device, so that reads and sync writes
+ * queue up behind it.  Here the number of async writes in flight is
+ * capped, and the cap follows the latency of reads: it is halved each
+ * monitoring window in which every read completed slower than the
+ * target, and doubled back each window in which they did not (or
+ * there were none).
+ *
+ * Reads are timed from dispatch to completion, so the I/O scheduler's
+ * own queueing doesn't count.  While reads are around, writes issued by
+ * kernel threads (the flusher threads) only get a quarter of the cap
+ * and other async writes half of it; kswapd always gets all of it, it
+ * must be able to clean pages.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/wait.h>
+
+#include "blk.h"
+
+/* unscaled limit of async writes in flight */
+#define RWB_DEF_DEPTH		16
+
+/* monitoring window */
+#define RWB_WINDOW_NSEC		(100 * NSEC_PER_MSEC)
+
+/* default read latency targets */
+#define RWB_DEF_LAT_NSEC	(75 * NSEC_PER_MSEC)
+#define RWB_NONROT_LAT_NSEC	(2 * NSEC_PER_MSEC)
+
+struct rq_wb {
+	struct request_queue *q;
+
+	u64 min_lat_nsec;		/* read latency target, 0 if off */
+	unsigned int queue_depth;	/* limit with scale_step 0 */
+	unsigned int scale_step;
+
+	/* limits for kswapd, other tasks and kernel threads */
+	unsigned int wb_max;
+	unsigned int wb_normal;
+	unsigned int wb_background;
+
+	unsigned int inflight;
+	wait_queue_head_t wait;
+
+	/* current window */
+	struct timer_list window_timer;
+	u64 win_min_read_lat;
+	unsigned int win_reads;
+	unsigned int win_writes;
+	unsigned long last_read;	/* jiffies */
+
+	/* statistics */
+	unsigned long throttled;
+	unsigned long scale_downs;
+	unsigned long scale_ups;
+	u64 last_min_read_lat;
+};
+
+static bool rwb_enabled(struct rq_wb *rwb)
+{
+	return rwb && rwb->min_lat_nsec;
+}
+
+static void rwb_calc_limits(struct rq_wb *rwb)
+{
+	unsigned int depth;
+
+	if (!rwb->min_lat_nsec) {
+		rwb->wb_max = rwb->wb_normal = rwb->wb_background = 0;
+		return;
+	}
+
+	depth = 1 + ((rwb->queue_depth - 1) >> rwb->scale_step);
+	rwb->wb_max = depth;
+	rwb->wb_normal = (depth + 1) / 2;
+	rwb->wb_background = (depth + 3) / 4;
+}
+
+static unsigned int rwb_window_jiffies(void)
+{
+	return nsecs_to_jiffies(RWB_WINDOW_NSEC) ?: 1;
+}
+
+/* which of the limits a writer gets */
+enum {
+	RWB_CLASS_KSWAPD,
+	RWB_CLASS_NORMAL,
+	RWB_CLASS_BACKGROUND,
+};
+
+static unsigned int rwb_current_class(void)
+{
+	if (current_is_kswapd())
+		return RWB_CLASS_KSWAPD;
+	if (current->flags & PF_KTHREAD)
+		return RWB_CLASS_BACKGROUND;
+	return RWB_CLASS_NORMAL;
+}
+
+static unsigned int rwb_limit(struct rq_wb *rwb, unsigned int class)
+{
+	if (class == RWB_CLASS_KSWAPD)
+		return rwb->wb_max;
+
+	/* no reads to protect lately, let writeback have the queue */
+	if (time_after(jiffies, rwb->last_read + rwb_window_jiffies()))
+		return rwb->wb_max;
+
+	if (class == RWB_CLASS_BACKGROUND)
+		return rwb->wb_background;
+	return rwb->wb_normal;
+}
+
+/*
+ * Waiters have different limits, so a wakeup goes to the first one that
+ * can take a slot, rather than to the first one queued.
+ */
+struct rwb_wait {
+	wait_queue_t wait;
+	struct rq_wb *rwb;
+	unsigned int class;
+};
+
+static int rwb_wake_function(wait_queue_t *wait, unsigned mode, int flags,
+			     void *key)
+{
+	struct rwb_wait *data = container_of(wait, struct rwb_wait, wait);
+	struct rq_wb *rwb = data->rwb;
+
+	if (rwb_enabled(rwb) && rwb->inflight >= rwb_limit(rwb, data->class))
+		return 0;
+	return autoremove_wake_function(wait, mode, flags, key);
+}
+
+static bool rwb_throttled_bio(struct bio *bio)
+{
+	const unsigned long mask = REQ_WRITE | REQ_SYNC | REQ_FLUSH |
+				   REQ_FUA | REQ_DISCARD;
+
+	return (bio->bi_rw & mask) == REQ_WRITE;
+}
+
+static void rwb_arm_timer(struct rq_wb *rwb)
+{
+	if (!timer_pending(&rwb->window_timer))
+		mod_timer(&rwb->window_timer, jiffies + rwb_window_jiffies());
+}
+
+/**
+ * wbt_wait - wait for a writeback slot
+ * @q: the queue @bio is for
+ * @bio: the bio about to get a request
+ *
+ * Async writes sleep here while the queue has as many of them in flight
+ * as the current limit allows.  Returns %true if the request for @bio
+ * must be marked with REQ_WB_TRACKED, so wbt_done() gives the slot back.
+ *
+ * Called and returns with @q->queue_lock held, which is dropped while
+ * sleeping.
+ */
+bool wbt_wait(struct request_queue *q, struct bio *bio)
+	__releases(q->queue_lock) __acquires(q->queue_lock)
+{
+	struct rq_wb *rwb = q->rq_wb;
+	struct rwb_wait data = {
+		.wait = {
+			.private	= current,
+			.func		= rwb_wake_function,
+			.task_list	= LIST_HEAD_INIT(data.wait.task_list),
+		},
+		.rwb	= rwb,
+		.class	= rwb_current_class(),
+	};
+	bool waited = false;
+
+	if (!rwb_enabled(rwb) || !rwb_throttled_bio(bio))
+		return false;
+
+	while (rwb_enabled(rwb) &&
+	       rwb->inflight >= rwb_limit(rwb, data.class)) {
+		prepare_to_wait_exclusive(&rwb->wait, &data.wait,
+					  TASK_UNINTERRUPTIBLE);
+		if (!waited) {
+			rwb->throttled++;
+			waited = true;
+		}
+		rwb_arm_timer(rwb);
+		spin_unlock_irq(q->queue_lock);
+		io_schedule();
+		spin_lock_irq(q->queue_lock);
+	}
+	finish_wait(&rwb->wait, &data.wait);
+
+	rwb->inflight++;
+	return true;
+}
+
+static void rwb_put_slot(struct rq_wb *rwb)
+{
+	rwb->inflight--;
+	if (waitqueue_active(&rwb->wait) && rwb->inflight < rwb->wb_max)
+		wake_up(&rwb->wait);
+}
+
+/**
+ * wbt_release - give back a slot no request ended up holding
+ * @q: the queue wbt_wait() was called for
+ *
+ * Called with @q->queue_lock held.
+ */
+void wbt_release(struct request_queue *q)
+{
+	rwb_put_slot(q->rq_wb);
+}
+
+/**
+ * wbt_done - account a finished or freed request
+ * @q: the queue of @rq
+ * @rq: the request
+ *
+ * Gives back the writeback slot of @rq, if it has one, and samples the
+ * latency of completed reads.  Called with @q->queue_lock held.
+ */
+void wbt_done(struct request_queue *q, struct request *rq)
+{
+	struct rq_wb *rwb = q->rq_wb;
+	u64 now, lat;
+
+	if (!rwb)
+		return;
+
+	if (rq->cmd_flags & REQ_WB_TRACKED) {
+		rq->cmd_flags &= ~REQ_WB_TRACKED;
+		rwb->win_writes++;
+		rwb_put_slot(rwb);
+		return;
+	}
+
+	if (!rwb_enabled(rwb) || rq->cmd_type != REQ_TYPE_FS ||
+	    rq_data_dir(rq) != READ || !(rq->cmd_flags & REQ_STARTED))
+		return;
+
+	now = sched_clock();
+	lat = time_after64(now, rq_io_start_time_ns(rq)) ?
+		now - rq_io_start_time_ns(rq) : 0;
+	if (!rwb->win_reads || lat < rwb->win_min_read_lat)
+		rwb->win_min_read_lat = lat;
+	rwb->win_reads++;
+	rwb->last_read = jiffies;
+	rwb_arm_timer(rwb);
+}
+
+/*
+ * End of a monitoring window: scale the limits down if every read in it
+ * missed the target while writeback was going on, back up otherwise.
+ */
+static void rwb_window_timer_fn(unsigned long data)
+{
+	struct rq_wb *rwb = (struct rq_wb *)data;
+	struct request_queue *q = rwb->q;
+	unsigned long flags;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+
+	if (!rwb_enabled(rwb))
+		goto out_unlock;
+
+	if (rwb->win_reads)
+		rwb->last_min_read_lat = rwb->win_min_read_lat;
+
+	if (rwb->win_reads && rwb->win_min_read_lat > rwb->min_lat_nsec) {
+		/* only writeback can be blamed and throttled */
+		if ((rwb->win_writes || rwb->inflight) &&
+		    (rwb->queue_depth - 1) >> rwb->scale_step) {
+			rwb->scale_step++;
+			rwb->scale_downs++;
+			rwb_calc_limits(rwb);
+		}
+	} else if (rwb->scale_step) {
+		rwb->scale_step--;
+		rwb->scale_ups++;
+		rwb_calc_limits(rwb);
+		wake_up_all(&rwb->wait);
+	}
+
+	/*
+	 * With reads gone quiet the limits go up to wb_max without anyone
+	 * putting a slot back; the wake function picks who may now run.
+	 */
+	if (!rwb->win_reads && waitqueue_active(&rwb->wait))
+		wake_up_all(&rwb->wait);
+
+	rwb->win_reads = rwb->win_writes = 0;
+
+	if (rwb->inflight || rwb->scale_step)
+		rwb_arm_timer(rwb);
+
+out_unlock:
+	spin_unlock_irqrestore(q->queue_lock, flags);
+}
+
+static void rwb_set_min_lat(struct rq_wb *rwb, u64 min_lat_nsec)
+{
+	rwb->min_lat_nsec = min_lat_nsec;
+	rwb->scale_step = 0;
+	rwb_calc_limits(rwb);
+	wake_up_all(&rwb->wait);
+}
+
+ssize_t wbt_lat_show(struct request_queue *q, char *page)
+{
+	if (!q->rq_wb)
+		return -EINVAL;
+
+	return sprintf(page, "%llu\n",
+		       div_u64(q->rq_wb->min_lat_nsec, NSEC_PER_USEC));
+}
+
+ssize_t wbt_lat_store(struct request_queue *q, const char *page,
+		      size_t count)
+{
+	unsigned long long usecs;
+	char *p = (char *) page;
+
+	if (!q->rq_wb)
+		return -EINVAL;
+
+	usecs = simple_strtoull(p, &p, 10);
+	if (p == page || usecs > ULLONG_MAX / NSEC_PER_USEC)
+		return -EINVAL;
+
+	spin_lock_irq(q->queue_lock);
+	rwb_set_min_lat(q->rq_wb, usecs * NSEC_PER_USEC);
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
+
+ssize_t wbt_stat_show(struct request_queue *q, char *page)
+{
+	struct rq_wb *rwb = q->rq_wb;
+	ssize_t ret;
+
+	if (!rwb)
+		return -EINVAL;
+
+	spin_lock_irq(q->queue_lock);
+	ret = sprintf(page, "%u %u %u %lu %lu %lu %llu\n", rwb->inflight,
+		      rwb->wb_max, rwb->scale_step, rwb->throttled,
+		      rwb->scale_downs, rwb->scale_ups,
+		      div_u64(rwb->last_min_read_lat, NSEC_PER_USEC));
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+/**
+ * wbt_init - set up writeback throttling for a queue
+ * @q: request based queue being registered
+ *
+ * The latency target defaults to 2ms for non-rotational devices and to
+ * 75ms for the others, and can be changed through wbt_lat_usec.  Queues
+ * without a request_fn never complete requests through wbt_done(), so
+ * they are not throttled.
+ */
+int wbt_init(struct request_queue *q)
+{
+	struct rq_wb *rwb;
+
+	if (!q->request_fn)
+		return -EINVAL;
+	if (q->rq_wb)
+		return 0;
+
+	rwb = kzalloc_node(sizeof(*rwb), GFP_KERNEL, q->node);
+	if (!rwb)
+		return -ENOMEM;
+
+	rwb->q = q;
+	rwb->queue_depth = RWB_DEF_DEPTH;
+	init_waitqueue_head(&rwb->wait);
+	setup_timer(&rwb->window_timer, rwb_window_timer_fn,
+		    (unsigned long)rwb);
+	rwb->last_read = jiffies - rwb_window_jiffies() - 1;
+
+	if (blk_queue_nonrot(q))
+		rwb->min_lat_nsec = RWB_NONROT_LAT_NSEC;
+	else
+		rwb->min_lat_nsec = RWB_DEF_LAT_NSEC;
+	rwb_calc_limits(rwb);
+
+	spin_lock_irq(q->queue_lock);
+	q->rq_wb = rwb;
+	spin_unlock_irq(q->queue_lock);
+	return 0;
+}
+
+void wbt_exit(struct request_queue *q)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (!rwb)
+		return;
+
+	del_timer_sync(&rwb->window_timer);
+	q->rq_wb = NULL;
+	kfree(rwb);
+}
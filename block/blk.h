@@ -21,6 +21,12 @@ void __blk_queue_free_tags(struct request_queue *q);
 bool __blk_end_bidi_request(struct request *rq, int error,
 			    unsigned int nr_bytes, unsigned int bidi_bytes);
 
+void blk_lat_stats_add(struct blk_lat_stats __percpu *stats,
+		       struct request *rq, u64 now);
+int blk_lat_stats_show(struct blk_lat_stats __percpu *stats,
+		       const char *prefix, char *buf, size_t size);
+void blk_lat_stats_reset(struct blk_lat_stats __percpu *stats);
+
 void blk_rq_timed_out_timer(unsigned long data);
 void blk_delete_timer(struct request *);
 void blk_add_timer(struct request *);
@@ -206,4 +212,25 @@ static inline void blk_throtl_exit(struct request_queue *q) { }
 static inline void blk_throtl_release(struct request_queue *q) { }
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
+#ifdef CONFIG_BLK_WBT
+extern int wbt_init(struct request_queue *q);
+extern void wbt_exit(struct request_queue *q);
+extern bool wbt_wait(struct request_queue *q, struct bio *bio);
+extern void wbt_done(struct request_queue *q, struct request *rq);
+extern void wbt_release(struct request_queue *q);
+extern ssize_t wbt_lat_show(struct request_queue *q, char *page);
+extern ssize_t wbt_lat_store(struct request_queue *q, const char *page,
+			     size_t count);
+extern ssize_t wbt_stat_show(struct request_queue *q, char *page);
+#else /* CONFIG_BLK_WBT */
+static inline int wbt_init(struct request_queue *q) { return 0; }
+static inline void wbt_exit(struct request_queue *q) { }
+static inline bool wbt_wait(struct request_queue *q, struct bio *bio)
+{
+	return false;
+}
+static inline void wbt_done(struct request_queue *q, struct request *rq) { }
+static inline void wbt_release(struct request_queue *q) { }
+#endif /* CONFIG_BLK_WBT */
+
 #endif /* BLK_INTERNAL_H */
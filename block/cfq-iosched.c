@@ -2934,7 +2934,6 @@ static void changed_ioprio(struct io_context *ioc, struct cfq_io_context *cic)
 static void cfq_ioc_set_ioprio(struct io_context *ioc)
 {
 	call_for_each_cic(ioc, changed_ioprio);
-	ioc->ioprio_changed = 0;
 }
 
 static void cfq_init_cfqq(struct cfq_data *cfqd, struct cfq_queue *cfqq,
@@ -3220,7 +3219,8 @@ cfq_get_io_context(struct cfq_data *cfqd, gfp_t gfp_mask)
 
 out:
 	smp_read_barrier_depends();
-	if (unlikely(ioc->ioprio_changed))
+	if (unlikely(test_and_clear_bit(IOC_CFQ_IOPRIO_CHANGED,
+				       &ioc->ioprio_changed)))
 		cfq_ioc_set_ioprio(ioc);
 
 #ifdef CONFIG_CFQ_GROUP_IOSCHED
@@ -3595,6 +3595,7 @@ static void cfq_completed_request(struct request_queue *q, struct request *rq)
 	cfq_blkiocg_update_completion_stats(&cfqq->cfqg->blkg,
 			rq_start_time_ns(rq), rq_io_start_time_ns(rq),
 			rq_data_dir(rq), rq_is_sync(rq));
+	cfq_blkiocg_update_latency_stats(&cfqq->cfqg->blkg, rq);
 
 	cfqd->rq_in_flight[cfq_cfqq_sync(cfqq)]--;
 
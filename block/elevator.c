@@ -717,6 +717,64 @@ void __elv_add_request(struct request_queue *q, struct request *rq, int where)
 }
 EXPORT_SYMBOL(__elv_add_request);
 
+static void elv_add_dispatch_batch(struct request_queue *q,
+				   struct list_head *batch)
+{
+	if (list_empty(batch))
+		return;
+
+	elv_drain_elevator(q);
+	list_splice_tail_init(batch, &q->queue_head);
+}
+
+/**
+ * __elv_add_request_list - insert a batch of plugged requests
+ * @q: request queue the requests are for
+ * @list: requests to insert, emptied on return
+ *
+ * Runs of requests that bypass the elevator are spliced onto the
+ * dispatch list in one go, rather than draining the elevator and
+ * running the queue for each of them as ELEVATOR_INSERT_BACK does.
+ * Everything else is inserted as __elv_add_request() would.  The
+ * caller holds the queue lock and is expected to run the queue once
+ * the whole batch is in.  Returns the number of requests that went
+ * straight to the dispatch list.
+ */
+unsigned int __elv_add_request_list(struct request_queue *q,
+				    struct list_head *list)
+{
+	LIST_HEAD(batch);
+	unsigned int direct = 0;
+	struct request *rq;
+
+	while (!list_empty(list)) {
+		rq = list_entry_rq(list->next);
+		list_del_init(&rq->queuelist);
+		rq->q = q;
+
+		if (!(rq->cmd_flags & (REQ_ELVPRIV | REQ_SOFTBARRIER |
+				       REQ_FLUSH | REQ_FUA))) {
+			trace_block_rq_insert(q, rq);
+			rq->cmd_flags |= REQ_SOFTBARRIER;
+			list_add_tail(&rq->queuelist, &batch);
+			direct++;
+			continue;
+		}
+
+		/* keep the order of the batch relative to what follows it */
+		elv_add_dispatch_batch(q, &batch);
+
+		if (rq->cmd_flags & (REQ_FLUSH | REQ_FUA))
+			__elv_add_request(q, rq, ELEVATOR_INSERT_FLUSH);
+		else
+			__elv_add_request(q, rq, ELEVATOR_INSERT_SORT_MERGE);
+	}
+	elv_add_dispatch_batch(q, &batch);
+
+	return direct;
+}
+EXPORT_SYMBOL(__elv_add_request_list);
+
 void elv_add_request(struct request_queue *q, struct request *rq, int where)
 {
 	unsigned long flags;
@@ -0,0 +1,327 @@
+/*
+ * Null block device driver.
+ *
+ * Request based block device that completes every request without
+ * transferring any data. It is meant to measure the overhead of the
+ * block layer and of the I/O schedulers, and to emulate devices of a
+ * given latency: in timer mode, requests complete completion_nsec after
+ * they have been dispatched, with at most hw_queue_depth of them in
+ * flight.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/hrtimer.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+
+enum {
+	NULL_IRQ_NONE		= 0,
+	NULL_IRQ_SOFTIRQ	= 1,
+	NULL_IRQ_TIMER		= 2,
+};
+
+struct nullb_cmd {
+	struct list_head list;
+	struct request *rq;
+	ktime_t deadline;
+};
+
+struct nullb {
+	struct list_head list;
+	unsigned int index;
+	struct request_queue *q;
+	struct gendisk *disk;
+
+	/* queue lock, also protects the command lists below */
+	spinlock_t lock;
+
+	/* timer mode: in flight commands in completion order, and free ones */
+	struct hrtimer timer;
+	struct list_head busy_cmds;
+	struct list_head free_cmds;
+	struct nullb_cmd *cmds;
+	bool stalled;
+};
+
+static LIST_HEAD(nullb_list);
+static int null_major;
+
+static int nr_devices = 2;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices to register");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size in GB");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Block size (in bytes)");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, S_IRUGO);
+MODULE_PARM_DESC(irqmode, "IRQ completion handler. 0-none, 1-softirq, 2-timer");
+
+static ulong completion_nsec = 10000;
+module_param(completion_nsec, ulong, S_IRUGO);
+MODULE_PARM_DESC(completion_nsec, "Time in ns to complete a request in hardware. Default: 10,000ns");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Queue depth for each hardware queue. Default: 64");
+
+static bool nonrot = true;
+module_param(nonrot, bool, S_IRUGO);
+MODULE_PARM_DESC(nonrot, "Register as a non-rotational device. Default: true");
+
+static enum hrtimer_restart null_cmd_timer_expired(struct hrtimer *timer)
+{
+	struct nullb *nullb = container_of(timer, struct nullb, timer);
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	struct nullb_cmd *cmd;
+	unsigned long flags;
+	s64 now;
+
+	spin_lock_irqsave(&nullb->lock, flags);
+
+	now = ktime_to_ns(ktime_get());
+	while (!list_empty(&nullb->busy_cmds)) {
+		cmd = list_first_entry(&nullb->busy_cmds, struct nullb_cmd,
+				       list);
+		if (ktime_to_ns(cmd->deadline) > now) {
+			hrtimer_set_expires(timer, cmd->deadline);
+			ret = HRTIMER_RESTART;
+			break;
+		}
+
+		list_move_tail(&cmd->list, &nullb->free_cmds);
+		__blk_end_request_all(cmd->rq, 0);
+		cmd->rq = NULL;
+	}
+
+	if (nullb->stalled && !list_empty(&nullb->free_cmds)) {
+		nullb->stalled = false;
+		blk_run_queue_async(nullb->q);
+	}
+
+	spin_unlock_irqrestore(&nullb->lock, flags);
+	return ret;
+}
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	blk_end_request_all(rq, 0);
+}
+
+/*
+ * Called with the queue lock held.
+ */
+static void null_queue_timer(struct nullb *nullb, struct request *rq)
+{
+	struct nullb_cmd *cmd;
+	bool idle = list_empty(&nullb->busy_cmds);
+
+	cmd = list_first_entry(&nullb->free_cmds, struct nullb_cmd, list);
+	list_move_tail(&cmd->list, &nullb->busy_cmds);
+	cmd->rq = rq;
+	cmd->deadline = ktime_add_ns(ktime_get(), completion_nsec);
+
+	/*
+	 * Latency is the same for all requests, so the list is kept in
+	 * completion order and the timer only tracks its head.  The timer
+	 * keeps itself going while the list is not empty, so it is armed
+	 * only when the list was.  The callback may still be running then,
+	 * having emptied the list on its way to not restarting, which
+	 * hrtimer_start() copes with.
+	 */
+	if (idle)
+		hrtimer_start(&nullb->timer, cmd->deadline, HRTIMER_MODE_ABS);
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct nullb *nullb = q->queuedata;
+	struct request *rq;
+
+	for (;;) {
+		if (irqmode == NULL_IRQ_TIMER && list_empty(&nullb->free_cmds)) {
+			nullb->stalled = true;
+			break;
+		}
+
+		rq = blk_fetch_request(q);
+		if (!rq)
+			break;
+
+		if (rq->cmd_type != REQ_TYPE_FS) {
+			__blk_end_request_all(rq, -EIO);
+			continue;
+		}
+
+		switch (irqmode) {
+		case NULL_IRQ_SOFTIRQ:
+			blk_complete_request(rq);
+			break;
+		case NULL_IRQ_TIMER:
+			null_queue_timer(nullb, rq);
+			break;
+		default:
+			__blk_end_request_all(rq, 0);
+			break;
+		}
+	}
+}
+
+static int null_open(struct block_device *bdev, fmode_t mode)
+{
+	return 0;
+}
+
+static int null_release(struct gendisk *disk, fmode_t mode)
+{
+	return 0;
+}
+
+static const struct block_device_operations null_fops = {
+	.owner =	THIS_MODULE,
+	.open =		null_open,
+	.release =	null_release,
+};
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del_init(&nullb->list);
+
+	del_gendisk(nullb->disk);
+	/*
+	 * The disk is closed, so nothing is in flight any more, but the
+	 * timer callback may still be on its way out and touch the queue.
+	 */
+	hrtimer_cancel(&nullb->timer);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	kfree(nullb->cmds);
+	kfree(nullb);
+}
+
+static int null_add_dev(unsigned int index)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+	sector_t size;
+	int i;
+
+	nullb = kzalloc(sizeof(*nullb), GFP_KERNEL);
+	if (!nullb)
+		return -ENOMEM;
+
+	nullb->index = index;
+	spin_lock_init(&nullb->lock);
+	INIT_LIST_HEAD(&nullb->busy_cmds);
+	INIT_LIST_HEAD(&nullb->free_cmds);
+	hrtimer_init(&nullb->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	nullb->timer.function = null_cmd_timer_expired;
+
+	if (irqmode == NULL_IRQ_TIMER) {
+		nullb->cmds = kcalloc(hw_queue_depth, sizeof(*nullb->cmds),
+				      GFP_KERNEL);
+		if (!nullb->cmds)
+			goto out_free_nullb;
+		for (i = 0; i < hw_queue_depth; i++)
+			list_add_tail(&nullb->cmds[i].list, &nullb->free_cmds);
+	}
+
+	nullb->q = blk_init_queue(null_request_fn, &nullb->lock);
+	if (!nullb->q)
+		goto out_free_cmds;
+
+	nullb->q->queuedata = nullb;
+	queue_flag_set_unlocked(QUEUE_FLAG_NOMERGES, nullb->q);
+	if (nonrot)
+		queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	blk_queue_softirq_done(nullb->q, null_softirq_done_fn);
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk)
+		goto out_cleanup_queue;
+
+	size = (sector_t)gb * 1024 * 1024 * 1024ULL;
+	sector_div(size, bs);
+	set_capacity(disk, size * (bs >> 9));
+
+	disk->flags |= GENHD_FL_EXT_DEVT;
+	disk->major = null_major;
+	disk->first_minor = index;
+	disk->fops = &null_fops;
+	disk->private_data = nullb;
+	disk->queue = nullb->q;
+	sprintf(disk->disk_name, "nullb%d", index);
+
+	list_add_tail(&nullb->list, &nullb_list);
+	add_disk(disk);
+	return 0;
+
+out_cleanup_queue:
+	blk_cleanup_queue(nullb->q);
+out_free_cmds:
+	kfree(nullb->cmds);
+out_free_nullb:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static int __init null_init(void)
+{
+	unsigned int i;
+
+	if (bs > PAGE_SIZE || bs < 512 || !is_power_of_2(bs)) {
+		pr_warn("null_blk: invalid block size\n");
+		pr_warn("null_blk: defaults block size to 512\n");
+		bs = 512;
+	}
+
+	if (irqmode < NULL_IRQ_NONE || irqmode > NULL_IRQ_TIMER)
+		irqmode = NULL_IRQ_SOFTIRQ;
+
+	if (hw_queue_depth < 1)
+		hw_queue_depth = 1;
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		if (null_add_dev(i)) {
+			struct nullb *nullb, *next;
+
+			list_for_each_entry_safe(nullb, next, &nullb_list, list)
+				null_del_dev(nullb);
+			unregister_blkdev(null_major, "nullb");
+			return -EINVAL;
+		}
+	}
+
+	pr_info("null: module loaded\n");
+	return 0;
+}
+
+static void __exit null_exit(void)
+{
+	struct nullb *nullb, *next;
+
+	list_for_each_entry_safe(nullb, next, &nullb_list, list)
+		null_del_dev(nullb);
+
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Null block device driver");
@@ -169,6 +169,7 @@ static void loopback_setup(struct net_device *dev)
 	dev->features 		= NETIF_F_SG | NETIF_F_FRAGLIST
 		| NETIF_F_ALL_TSO
 		| NETIF_F_UFO
+		| NETIF_F_GSO_UDP_L4
 		| NETIF_F_NO_CSUM
 		| NETIF_F_RXCSUM
 		| NETIF_F_HIGHDMA
@@ -26,6 +26,7 @@
 #include <linux/scatterlist.h>
 #include <linux/if_vlan.h>
 #include <linux/slab.h>
+#include <linux/interrupt.h>
 
 static int napi_weight = 128;
 module_param(napi_weight, int, 0444);
@@ -71,6 +72,9 @@ struct virtnet_info {
 	/* Work struct for refilling if we run low on memory. */
 	struct delayed_work refill;
 
+	/* Reaps transmitted skbs after a send queue interrupt. */
+	struct tasklet_struct tx_tasklet;
+
 	/* Chain pages by the private ptr. */
 	struct page *pages;
 
@@ -136,8 +140,8 @@ static void skb_xmit_done(struct virtqueue *svq)
 	/* Suppress further interrupts. */
 	virtqueue_disable_cb(svq);
 
-	/* We were probably waiting for more output buffers. */
-	netif_wake_queue(vi->dev);
+	/* Free what was sent where the tx lock can be taken. */
+	tasklet_schedule(&vi->tx_tasklet);
 }
 
 static void set_skb_frag(struct sk_buff *skb, struct page *page,
@@ -537,10 +541,13 @@ again:
 	return received;
 }
 
+/*
+ * Called with the tx lock held.
+ */
 static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
 	struct sk_buff *skb;
-	unsigned int len, tot_sgs = 0;
+	unsigned int len, tot_sgs = 0, pkts = 0, bytes = 0;
 	struct virtnet_stats __percpu *stats = this_cpu_ptr(vi->stats);
 
 	while ((skb = virtqueue_get_buf(vi->svq, &len)) != NULL) {
@@ -551,12 +558,29 @@ static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 		stats->tx_packets++;
 		u64_stats_update_end(&stats->syncp);
 
+		pkts++;
+		bytes += skb->len;
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		dev_kfree_skb_any(skb);
 	}
+
+	netdev_completed_queue(vi->dev, pkts, bytes);
 	return tot_sgs;
 }
 
+static void xmit_tasklet(unsigned long data)
+{
+	struct virtnet_info *vi = (struct virtnet_info *)data;
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev, 0);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	free_old_xmit_skbs(vi);
+	__netif_tx_unlock(txq);
+
+	/* We were probably waiting for more output buffers. */
+	netif_wake_queue(vi->dev);
+}
+
 static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 {
 	struct skb_vnet_hdr *hdr = skb_vnet_hdr(skb);
@@ -607,6 +631,7 @@ static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, 0);
 	int capacity;
 
 	/* Free up any pending old buffers before queueing new ones. */
@@ -632,6 +657,7 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 		kfree_skb(skb);
 		return NETDEV_TX_OK;
 	}
+	netdev_tx_sent_queue(txq, skb->len);
 	virtqueue_kick(vi->svq);
 
 	/* Don't wait up for transmitted skbs to be freed. */
@@ -640,16 +666,21 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	/* Apparently nice girls don't return TX_BUSY; stop the queue
 	 * before it gets out of hand.  Naturally, this wastes entries. */
-	if (capacity < 2+MAX_SKB_FRAGS) {
+	if (capacity < 2+MAX_SKB_FRAGS)
 		netif_stop_queue(dev);
-		if (unlikely(!virtqueue_enable_cb_delayed(vi->svq))) {
-			/* More just got used, free them then recheck. */
-			capacity += free_old_xmit_skbs(vi);
-			if (capacity >= 2+MAX_SKB_FRAGS) {
-				netif_start_queue(dev);
-				virtqueue_disable_cb(vi->svq);
-			}
-		}
+
+	/*
+	 * Whether we stopped the queue or the byte queue limit did, only
+	 * freeing sent skbs restarts it: ask for an interrupt then.
+	 */
+	if (netif_xmit_stopped(txq) &&
+	    unlikely(!virtqueue_enable_cb_delayed(vi->svq))) {
+		/* More just got used, free them then recheck. */
+		capacity += free_old_xmit_skbs(vi);
+		if (capacity >= 2+MAX_SKB_FRAGS)
+			netif_start_queue(dev);
+		if (!netif_xmit_stopped(txq))
+			virtqueue_disable_cb(vi->svq);
 	}
 
 	return NETDEV_TX_OK;
@@ -1022,6 +1053,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 		goto free;
 
 	INIT_DELAYED_WORK(&vi->refill, refill_work);
+	tasklet_init(&vi->tx_tasklet, xmit_tasklet, (unsigned long)vi);
 	sg_init_table(vi->rx_sg, ARRAY_SIZE(vi->rx_sg));
 	sg_init_table(vi->tx_sg, ARRAY_SIZE(vi->tx_sg));
 
@@ -1083,6 +1115,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 unregister:
 	unregister_netdev(dev);
 	cancel_delayed_work_sync(&vi->refill);
+	tasklet_kill(&vi->tx_tasklet);
 free_vqs:
 	vdev->config->del_vqs(vdev);
 free_stats:
@@ -1124,6 +1157,7 @@ static void __devexit virtnet_remove(struct virtio_device *vdev)
 
 	unregister_netdev(vi->dev);
 	cancel_delayed_work_sync(&vi->refill);
+	tasklet_kill(&vi->tx_tasklet);
 
 	/* Free unused buffers in both send and recv, if any. */
 	free_unused_bufs(vi);
@@ -1284,6 +1284,7 @@ static void pohmelfs_put_super(struct super_block *sb)
 	unsigned int count = 0;
 	unsigned int in_drop_list = 0;
 	struct inode *inode, *tmp;
+	int cpu;
 
 	dprintk("%s.\n", __func__);
 
@@ -1310,23 +1311,29 @@ static void pohmelfs_put_super(struct super_block *sb)
 			iput(&pi->vfs_inode);
 	}
 
-	list_for_each_entry_safe(inode, tmp, &sb->s_inodes, i_sb_list) {
-		pi = POHMELFS_I(inode);
+	for_each_possible_cpu(cpu) {
+		struct list_head *list = &per_cpu_ptr(sb->s_inodes, cpu)->list;
 
-		dprintk("%s: ino: %llu, pi: %p, inode: %p, i_count: %u.\n",
-				__func__, pi->ino, pi, inode, atomic_read(&inode->i_count));
+		list_for_each_entry_safe(inode, tmp, list, i_sb_list) {
+			pi = POHMELFS_I(inode);
 
-		/*
-		 * These are special inodes, they were created during
-		 * directory reading or lookup, and were not bound to dentry,
-		 * so they live here with reference counter being 1 and prevent
-		 * umount from succeed since it believes that they are busy.
-		 */
-		count = atomic_read(&inode->i_count);
-		if (count) {
-			list_del_init(&inode->i_sb_list);
-			while (count--)
-				iput(&pi->vfs_inode);
+			dprintk("%s: ino: %llu, pi: %p, inode: %p, i_count: %u.\n",
+					__func__, pi->ino, pi, inode,
+					atomic_read(&inode->i_count));
+
+			/*
+			 * These are special inodes, they were created during
+			 * directory reading or lookup, and were not bound to
+			 * dentry, so they live here with reference counter
+			 * being 1 and prevent umount from succeed since it
+			 * believes that they are busy.
+			 */
+			count = atomic_read(&inode->i_count);
+			if (count) {
+				list_del_init(&inode->i_sb_list);
+				while (count--)
+					iput(&pi->vfs_inode);
+			}
 		}
 	}
 
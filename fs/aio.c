@@ -456,6 +456,7 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
 	req->ki_eventfd = NULL;
+	req->ki_pages = NULL;
 
 	return req;
 }
@@ -25,6 +25,8 @@
 #include <linux/module.h>
 #include <linux/mempool.h>
 #include <linux/workqueue.h>
+#include <linux/cpu.h>
+#include <linux/sysctl.h>
 #include <scsi/sg.h>		/* for struct sg_iovec */
 
 #include <trace/events/block.h>
@@ -259,6 +261,35 @@ void bio_init(struct bio *bio)
 }
 EXPORT_SYMBOL(bio_init);
 
+/*
+ * Set up the bio_vec array of a freshly initialized bio
+ */
+static int bio_alloc_vecs(struct bio *bio, gfp_t gfp_mask, int nr_iovecs,
+			  struct bio_set *bs)
+{
+	unsigned long idx = BIO_POOL_NONE;
+	struct bio_vec *bvl = NULL;
+
+	if (unlikely(!nr_iovecs))
+		goto out_set;
+
+	if (nr_iovecs <= BIO_INLINE_VECS) {
+		bvl = bio->bi_inline_vecs;
+		nr_iovecs = BIO_INLINE_VECS;
+	} else {
+		bvl = bvec_alloc_bs(gfp_mask, nr_iovecs, &idx, bs);
+		if (unlikely(!bvl))
+			return -ENOMEM;
+
+		nr_iovecs = bvec_nr_vecs(idx);
+	}
+out_set:
+	bio->bi_flags |= idx << BIO_POOL_OFFSET;
+	bio->bi_max_vecs = nr_iovecs;
+	bio->bi_io_vec = bvl;
+	return 0;
+}
+
 /**
  * bio_alloc_bioset - allocate a bio for I/O
  * @gfp_mask:   the GFP_ mask given to the slab allocator
@@ -276,8 +307,6 @@ EXPORT_SYMBOL(bio_init);
  **/
 struct bio *bio_alloc_bioset(gfp_t gfp_mask, int nr_iovecs, struct bio_set *bs)
 {
-	unsigned long idx = BIO_POOL_NONE;
-	struct bio_vec *bvl = NULL;
 	struct bio *bio;
 	void *p;
 
@@ -288,28 +317,12 @@ struct bio *bio_alloc_bioset(gfp_t gfp_mask, int nr_iovecs, struct bio_set *bs)
 
 	bio_init(bio);
 
-	if (unlikely(!nr_iovecs))
-		goto out_set;
-
-	if (nr_iovecs <= BIO_INLINE_VECS) {
-		bvl = bio->bi_inline_vecs;
-		nr_iovecs = BIO_INLINE_VECS;
-	} else {
-		bvl = bvec_alloc_bs(gfp_mask, nr_iovecs, &idx, bs);
-		if (unlikely(!bvl))
-			goto err_free;
-
-		nr_iovecs = bvec_nr_vecs(idx);
+	if (unlikely(bio_alloc_vecs(bio, gfp_mask, nr_iovecs, bs))) {
+		mempool_free(p, bs->bio_pool);
+		return NULL;
 	}
-out_set:
-	bio->bi_flags |= idx << BIO_POOL_OFFSET;
-	bio->bi_max_vecs = nr_iovecs;
-	bio->bi_io_vec = bvl;
-	return bio;
 
-err_free:
-	mempool_free(p, bs->bio_pool);
-	return NULL;
+	return bio;
 }
 EXPORT_SYMBOL(bio_alloc_bioset);
 
@@ -348,6 +361,143 @@ struct bio *bio_alloc(gfp_t gfp_mask, unsigned int nr_iovecs)
 }
 EXPORT_SYMBOL(bio_alloc);
 
+/*
+ * Per-cpu cache of fs_bio_set bios, used by synchronous I/O paths that
+ * allocate and free bios at a high rate. Cached bios are allocated from
+ * the slab, never from the mempool, so that the mempool reserve is not
+ * held in the caches.
+ */
+#define BIO_CACHE_MAX		64
+
+struct bio_cache {
+	struct bio *free_list;
+	unsigned int nr;
+	unsigned long hits;
+	unsigned long misses;
+};
+static DEFINE_PER_CPU(struct bio_cache, bio_cache);
+
+static void bio_cache_destructor(struct bio *bio)
+{
+	struct bio_cache *cache;
+	unsigned long flags;
+
+	if (bio_has_allocated_vec(bio))
+		bvec_free_bs(fs_bio_set, bio->bi_io_vec, BIO_POOL_IDX(bio));
+
+	if (bio_integrity(bio))
+		bio_integrity_free(bio, fs_bio_set);
+
+	local_irq_save(flags);
+	cache = &__get_cpu_var(bio_cache);
+	if (cache->nr < BIO_CACHE_MAX) {
+		bio->bi_next = cache->free_list;
+		cache->free_list = bio;
+		cache->nr++;
+		bio = NULL;
+	}
+	local_irq_restore(flags);
+
+	if (bio)
+		kmem_cache_free(fs_bio_set->bio_slab, bio);
+}
+
+/**
+ *	bio_alloc_cached - allocate a new bio from the per-cpu bio cache
+ *	@gfp_mask: allocation mask to use
+ *	@nr_iovecs: number of iovecs
+ *
+ *	Like bio_alloc(), but the bio is taken from a per-cpu cache and given
+ *	back to it when freed, so that in steady state no slab or mempool
+ *	allocation is done for the bio itself, nor for its bio_vecs when
+ *	@nr_iovecs fits inline. Meant for synchronous I/O, which tends to be
+ *	completed on the cpu it was submitted from. Falls back to bio_alloc()
+ *	when the cache is empty and the slab is short of memory, so it has the
+ *	same guarantees.
+ */
+struct bio *bio_alloc_cached(gfp_t gfp_mask, unsigned int nr_iovecs)
+{
+	struct bio_cache *cache;
+	unsigned long flags;
+	struct bio *bio;
+
+	local_irq_save(flags);
+	cache = &__get_cpu_var(bio_cache);
+	bio = cache->free_list;
+	if (bio) {
+		cache->free_list = bio->bi_next;
+		cache->nr--;
+		cache->hits++;
+	} else
+		cache->misses++;
+	local_irq_restore(flags);
+
+	if (!bio) {
+		gfp_t __gfp_mask = gfp_mask & ~(__GFP_WAIT | __GFP_IO);
+
+		__gfp_mask |= __GFP_NOMEMALLOC | __GFP_NORETRY | __GFP_NOWARN;
+		bio = kmem_cache_alloc(fs_bio_set->bio_slab, __gfp_mask);
+		if (unlikely(!bio))
+			return bio_alloc(gfp_mask, nr_iovecs);
+	}
+
+	bio_init(bio);
+
+	if (unlikely(bio_alloc_vecs(bio, gfp_mask, nr_iovecs, fs_bio_set))) {
+		kmem_cache_free(fs_bio_set->bio_slab, bio);
+		return bio_alloc(gfp_mask, nr_iovecs);
+	}
+
+	bio->bi_destructor = bio_cache_destructor;
+	return bio;
+}
+EXPORT_SYMBOL(bio_alloc_cached);
+
+static void bio_cache_exit_cpu(int cpu)
+{
+	struct bio_cache *cache = &per_cpu(bio_cache, cpu);
+	struct bio *bio;
+
+	while ((bio = cache->free_list) != NULL) {
+		cache->free_list = bio->bi_next;
+		kmem_cache_free(fs_bio_set->bio_slab, bio);
+	}
+	cache->nr = 0;
+}
+
+static int bio_cpu_notify(struct notifier_block *self,
+			  unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		bio_cache_exit_cpu((unsigned long)hcpu);
+	return NOTIFY_OK;
+}
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+/*
+ * /proc/sys/fs/bio-cache-state: cached bios, cache hits, cache misses
+ */
+int proc_bio_cache_state(ctl_table *table, int write, void __user *buffer,
+			 size_t *lenp, loff_t *ppos)
+{
+	unsigned long state[3] = { 0, };
+	ctl_table t = *table;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct bio_cache *cache = &per_cpu(bio_cache, cpu);
+
+		state[0] += cache->nr;
+		state[1] += cache->hits;
+		state[2] += cache->misses;
+	}
+
+	t.data = state;
+	t.maxlen = sizeof(state);
+	return proc_doulongvec_minmax(&t, write, buffer, lenp, ppos);
+}
+#endif
+
 static void bio_kmalloc_destructor(struct bio *bio)
 {
 	if (bio_integrity(bio))
@@ -1687,6 +1837,8 @@ static int __init init_bio(void)
 	if (!bio_split_pool)
 		panic("bio: can't create split pool\n");
 
+	hotcpu_notifier(bio_cpu_notify, 0);
+
 	return 0;
 }
 subsys_initcall(init_bio);
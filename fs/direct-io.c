@@ -196,6 +196,30 @@ static inline unsigned dio_pages_present(struct dio_submit *sdio)
 	return sdio->tail - sdio->head;
 }
 
+/*
+ * Take the pages at @addr from those the submitter pinned already, see
+ * kiocb->ki_pages, rather than walk the page tables for them.
+ */
+static int dio_get_pinned_pages(struct kiocb *iocb, unsigned long addr,
+				int nr_pages, struct page **pages)
+{
+	unsigned long index;
+	int i;
+
+	if (addr < iocb->ki_pages_addr)
+		return -EFAULT;
+	index = (addr - iocb->ki_pages_addr) >> PAGE_SHIFT;
+	if (index >= iocb->ki_nr_pages)
+		return -EFAULT;
+
+	nr_pages = min_t(unsigned long, nr_pages, iocb->ki_nr_pages - index);
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = iocb->ki_pages[index + i];
+		page_cache_get(pages[i]);
+	}
+	return nr_pages;
+}
+
 /*
  * Go grab and pin some userspace pages.   Typically we'll get 64 at a time.
  */
@@ -205,11 +229,16 @@ static inline int dio_refill_pages(struct dio *dio, struct dio_submit *sdio)
 	int nr_pages;
 
 	nr_pages = min(sdio->total_pages - sdio->curr_page, DIO_PAGES);
-	ret = get_user_pages_fast(
-		sdio->curr_user_address,		/* Where from? */
-		nr_pages,			/* How many pages? */
-		dio->rw == READ,		/* Write to memory? */
-		&dio->pages[0]);		/* Put results here */
+	if (dio->iocb->ki_pages)
+		ret = dio_get_pinned_pages(dio->iocb,
+					   sdio->curr_user_address, nr_pages,
+					   &dio->pages[0]);
+	else
+		ret = get_user_pages_fast(
+			sdio->curr_user_address,	/* Where from? */
+			nr_pages,			/* How many pages? */
+			dio->rw == READ,		/* Write to memory? */
+			&dio->pages[0]);		/* Put results here */
 
 	if (ret < 0 && sdio->blocks_available && (dio->rw & WRITE)) {
 		struct page *page = ZERO_PAGE(0);
@@ -386,9 +415,13 @@ dio_bio_alloc(struct dio *dio, struct dio_submit *sdio,
 
 	/*
 	 * bio_alloc() is guaranteed to return a bio when called with
-	 * __GFP_WAIT and we request a valid number of vectors.
+	 * __GFP_WAIT and we request a valid number of vectors. Synchronous
+	 * dio completes where it was submitted, use the per-cpu bio cache.
 	 */
-	bio = bio_alloc(GFP_KERNEL, nr_vecs);
+	if (dio->is_async)
+		bio = bio_alloc(GFP_KERNEL, nr_vecs);
+	else
+		bio = bio_alloc_cached(GFP_KERNEL, nr_vecs);
 
 	bio->bi_bdev = bdev;
 	bio->bi_sector = first_sector;
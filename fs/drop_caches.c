@@ -16,24 +16,29 @@ int sysctl_drop_caches;
 static void drop_pagecache_sb(struct super_block *sb, void *unused)
 {
 	struct inode *inode, *toput_inode = NULL;
+	int cpu;
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
-		spin_lock(&inode->i_lock);
-		if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
-		    (inode->i_mapping->nrpages == 0)) {
+	for_each_possible_cpu(cpu) {
+		struct sb_inode_list *l = per_cpu_ptr(sb->s_inodes, cpu);
+
+		spin_lock(&l->lock);
+		list_for_each_entry(inode, &l->list, i_sb_list) {
+			spin_lock(&inode->i_lock);
+			if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
+			    (inode->i_mapping->nrpages == 0)) {
+				spin_unlock(&inode->i_lock);
+				continue;
+			}
+			__iget(inode);
 			spin_unlock(&inode->i_lock);
-			continue;
+			spin_unlock(&l->lock);
+			invalidate_mapping_pages(inode->i_mapping, 0, -1);
+			iput(toput_inode);
+			toput_inode = inode;
+			spin_lock(&l->lock);
 		}
-		__iget(inode);
-		spin_unlock(&inode->i_lock);
-		spin_unlock(&inode_sb_list_lock);
-		invalidate_mapping_pages(inode->i_mapping, 0, -1);
-		iput(toput_inode);
-		toput_inode = inode;
-		spin_lock(&inode_sb_list_lock);
+		spin_unlock(&l->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 	iput(toput_inode);
 }
 
@@ -77,6 +77,8 @@ typedef __u32 ext4_lblk_t;
 /* data type for block group number */
 typedef unsigned int ext4_group_t;
 
+#include "extent_status.h"
+
 /*
  * Flags used in mballoc's allocation_context flags field.
  *
@@ -767,17 +769,6 @@ do {									       \
 
 #endif /* defined(__KERNEL__) || defined(__linux__) */
 
-/*
- * storage for cached extent
- * If ec_len == 0, then the cache is invalid.
- * If ec_start == 0, then the cache represents a gap (null mapping)
- */
-struct ext4_ext_cache {
-	ext4_fsblk_t	ec_start;
-	ext4_lblk_t	ec_block;
-	__u32		ec_len; /* must be 32bit to return holes */
-};
-
 /*
  * fourth extended file system inode data in memory
  */
@@ -844,7 +835,6 @@ struct ext4_inode_info {
 	struct inode vfs_inode;
 	struct jbd2_inode *jinode;
 
-	struct ext4_ext_cache i_cached_extent;
 	/*
 	 * File creation time. Its function is same as that of
 	 * struct timespec i_{a,c,m}time in the generic inode.
@@ -858,6 +848,13 @@ struct ext4_inode_info {
 	/* ialloc */
 	ext4_group_t	i_last_alloc_group;
 
+	/* extents status tree */
+	struct ext4_es_tree i_es_tree;
+	rwlock_t i_es_lock;
+	struct list_head i_es_lru;	/* on the superblock's s_es_lru */
+	unsigned int i_es_lru_nr;	/* number of reclaimable extents */
+	int i_es_referenced;		/* looked up in since last shrink */
+
 	/* allocation reservation info for delalloc */
 	/* In case of bigalloc, these refer to clusters rather than blocks */
 	unsigned int i_reserved_data_blocks;
@@ -1127,6 +1124,7 @@ struct ext4_sb_info {
 	unsigned int s_cluster_bits;	/* log2 of s_cluster_ratio */
 	loff_t s_bitmap_maxbytes;	/* max bytes for bitmap files */
 	struct buffer_head * s_sbh;	/* Buffer containing the super block */
+	struct super_block *s_sb;	/* Back pointer to the VFS super block */
 	struct ext4_super_block *s_es;	/* Pointer to the super block in the buffer */
 	struct buffer_head **s_group_desc;
 	unsigned int s_mount_opt;
@@ -1187,12 +1185,25 @@ struct ext4_sb_info {
 	unsigned long extent_cache_hits;
 	unsigned long extent_cache_misses;
 
+	/* reclaim extents from extent status tree */
+	struct shrinker s_es_shrinker;
+	struct list_head s_es_lru;
+	spinlock_t s_es_lru_lock;
+	struct percpu_counter s_extent_cache_cnt;
+
 	/* for buddy allocator */
 	struct ext4_group_info ***s_group_info;
 	struct inode *s_buddy_cache;
 	spinlock_t s_md_lock;
 	unsigned short *s_mb_offsets;
 	unsigned int *s_mb_maxs;
+	/* groups by order of their largest free extent, and of their
+	 * average free extent size; see ext4_mb_find_group_by_order() */
+	struct list_head *s_mb_largest_free_orders;
+	spinlock_t *s_mb_largest_free_orders_locks;
+	struct list_head *s_mb_avg_fragment_size;
+	spinlock_t *s_mb_avg_fragment_size_locks;
+	atomic_t s_mb_uninit_groups;	/* groups not on the lists yet */
 
 	/* tunables */
 	unsigned long s_stripe;
@@ -1202,6 +1213,7 @@ struct ext4_sb_info {
 	unsigned int s_mb_stats;
 	unsigned int s_mb_order2_reqs;
 	unsigned int s_mb_group_prealloc;
+	unsigned int s_mb_optimize_scan;
 	unsigned int s_max_writeback_mb_bump;
 	/* where last allocation was done - for stream allocation */
 	unsigned long s_mb_last_group;
@@ -1870,6 +1882,8 @@ extern int  ext4_sync_inode(handle_t *, struct inode *);
 extern void ext4_dirty_inode(struct inode *, int);
 extern int ext4_change_inode_journal_flag(struct inode *, int);
 extern int ext4_get_inode_loc(struct inode *, struct ext4_iloc *);
+extern void ext4_prefetch_inodes(struct super_block *, const u64 *,
+				 unsigned int);
 extern int ext4_can_truncate(struct inode *inode);
 extern void ext4_truncate(struct inode *);
 extern int ext4_punch_hole(struct file *file, loff_t offset, loff_t length);
@@ -2131,7 +2145,11 @@ struct ext4_group_info {
 	ext4_grpblk_t	bb_free;	/* total free blocks */
 	ext4_grpblk_t	bb_fragments;	/* nr of freespace fragments */
 	ext4_grpblk_t	bb_largest_free_order;/* order of largest frag in BG */
+	ext4_grpblk_t	bb_avg_fragment_size_order; /* order of free / fragments */
+	ext4_group_t	bb_group;	/* group number of this BG */
 	struct          list_head bb_prealloc_list;
+	struct          list_head bb_largest_free_order_node;
+	struct          list_head bb_avg_fragment_size_node;
 #ifdef DOUBLE_CHECK
 	void            *bb_bitmap;
 #endif
@@ -2300,14 +2318,10 @@ enum ext4_state_bits {
 				 * never, ever appear in a buffer_head's state
 				 * flag. See EXT4_MAP_FROM_CLUSTER to see where
 				 * this is used. */
-	BH_Da_Mapped,	/* Delayed allocated block that now has a mapping. This
-			 * flag is set when ext4_map_blocks is called on a
-			 * delayed allocated block to get its real mapping. */
 };
 
 BUFFER_FNS(Uninit, uninit)
 TAS_BUFFER_FNS(Uninit, uninit)
-BUFFER_FNS(Da_Mapped, da_mapped)
 
 /*
  * Add new method to test wether block and inode bitmaps are properly
@@ -0,0 +1,586 @@
+/*
+ *  fs/ext4/extent_status.c
+ *
+ * Per-inode tree of extent status: it records which ranges of logical
+ * blocks are written, unwritten, delayed allocated or holes, so that
+ * block mapping can be answered without the on-disk extent tree, and so
+ * that delayed allocation does not have to look at buffer heads in the
+ * page cache to find out which blocks it has reserved.
+ *
+ * Extents in the tree never overlap.  Delayed extents exist nowhere
+ * else and are kept until the blocks are allocated or thrown away; all
+ * others are a cache of what is on disk, and are reclaimed by a shrinker
+ * under memory pressure.
+ */
+
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/backing-dev.h>
+#include "ext4.h"
+
+#include <trace/events/ext4.h>
+
+static struct kmem_cache *ext4_es_cachep;
+
+int __init ext4_init_es(void)
+{
+	ext4_es_cachep = KMEM_CACHE(extent_status, SLAB_RECLAIM_ACCOUNT);
+	if (ext4_es_cachep == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void ext4_exit_es(void)
+{
+	kmem_cache_destroy(ext4_es_cachep);
+}
+
+void ext4_es_init_tree(struct ext4_es_tree *tree)
+{
+	tree->root = RB_ROOT;
+	tree->cache_es = NULL;
+}
+
+static inline ext4_lblk_t ext4_es_end(struct extent_status *es)
+{
+	BUG_ON(es->es_lblk + es->es_len < es->es_lblk);
+	return es->es_lblk + es->es_len - 1;
+}
+
+/*
+ * Return the extent that contains lblk, or the first one after it if
+ * lblk falls in a range the tree knows nothing about.
+ */
+static struct extent_status *__es_tree_search(struct rb_root *root,
+					      ext4_lblk_t lblk)
+{
+	struct rb_node *node = root->rb_node;
+	struct extent_status *es = NULL;
+
+	while (node) {
+		es = rb_entry(node, struct extent_status, rb_node);
+		if (lblk < es->es_lblk)
+			node = node->rb_left;
+		else if (lblk > ext4_es_end(es))
+			node = node->rb_right;
+		else
+			return es;
+	}
+
+	if (es && lblk < es->es_lblk)
+		return es;
+
+	if (es && lblk > ext4_es_end(es)) {
+		node = rb_next(&es->rb_node);
+		return node ? rb_entry(node, struct extent_status, rb_node) :
+			      NULL;
+	}
+
+	return NULL;
+}
+
+static inline struct extent_status *ext4_es_next(struct extent_status *es)
+{
+	struct rb_node *node = rb_next(&es->rb_node);
+
+	return node ? rb_entry(node, struct extent_status, rb_node) : NULL;
+}
+
+/*
+ * Everything but delayed extents can be reclaimed; the inode counts
+ * them, and sits on the LRU list of the superblock while it has any.
+ * Called with i_es_lock held for writing.
+ */
+static struct extent_status *
+ext4_es_alloc_extent(struct inode *inode, ext4_lblk_t lblk, ext4_lblk_t len,
+		     ext4_fsblk_t pblk)
+{
+	struct extent_status *es;
+
+	es = kmem_cache_alloc(ext4_es_cachep, GFP_ATOMIC);
+	if (es == NULL)
+		return NULL;
+	es->es_lblk = lblk;
+	es->es_len = len;
+	es->es_pblk = pblk;
+
+	if (!ext4_es_is_delayed(es)) {
+		struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+		struct ext4_inode_info *ei = EXT4_I(inode);
+
+		ei->i_es_lru_nr++;
+		percpu_counter_inc(&sbi->s_extent_cache_cnt);
+		if (list_empty(&ei->i_es_lru)) {
+			spin_lock(&sbi->s_es_lru_lock);
+			if (list_empty(&ei->i_es_lru))
+				list_add_tail(&ei->i_es_lru, &sbi->s_es_lru);
+			spin_unlock(&sbi->s_es_lru_lock);
+		}
+	}
+	return es;
+}
+
+static void ext4_es_free_extent(struct inode *inode, struct extent_status *es)
+{
+	if (!ext4_es_is_delayed(es)) {
+		BUG_ON(EXT4_I(inode)->i_es_lru_nr == 0);
+		EXT4_I(inode)->i_es_lru_nr--;
+		percpu_counter_dec(&EXT4_SB(inode->i_sb)->s_extent_cache_cnt);
+	}
+	kmem_cache_free(ext4_es_cachep, es);
+}
+
+static void ext4_es_erase(struct inode *inode, struct extent_status *es)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+
+	rb_erase(&es->rb_node, &tree->root);
+	if (tree->cache_es == es)
+		tree->cache_es = NULL;
+	ext4_es_free_extent(inode, es);
+}
+
+/*
+ * Two extents can be merged if they have the same status, are adjacent,
+ * and for written and unwritten extents, are adjacent on disk too.
+ */
+static int ext4_es_can_merge(struct extent_status *es1,
+			     struct extent_status *es2)
+{
+	if (ext4_es_status(es1) != ext4_es_status(es2))
+		return 0;
+
+	if (((__u64) es1->es_len) + es2->es_len > EXT_MAX_BLOCKS)
+		return 0;
+
+	if (((__u64) es1->es_lblk) + es1->es_len != es2->es_lblk)
+		return 0;
+
+	if (ext4_es_is_mapped(es1) &&
+	    ext4_es_pblock(es1) + es1->es_len != ext4_es_pblock(es2))
+		return 0;
+
+	return 1;
+}
+
+static struct extent_status *
+ext4_es_try_to_merge_left(struct inode *inode, struct extent_status *es)
+{
+	struct extent_status *es1;
+	struct rb_node *node;
+
+	node = rb_prev(&es->rb_node);
+	if (!node)
+		return es;
+
+	es1 = rb_entry(node, struct extent_status, rb_node);
+	if (ext4_es_can_merge(es1, es)) {
+		es1->es_len += es->es_len;
+		ext4_es_erase(inode, es);
+		es = es1;
+	}
+
+	return es;
+}
+
+static struct extent_status *
+ext4_es_try_to_merge_right(struct inode *inode, struct extent_status *es)
+{
+	struct extent_status *es1;
+
+	es1 = ext4_es_next(es);
+	if (!es1)
+		return es;
+
+	if (ext4_es_can_merge(es, es1)) {
+		es->es_len += es1->es_len;
+		ext4_es_erase(inode, es1);
+	}
+
+	return es;
+}
+
+/*
+ * Add an extent that overlaps nothing in the tree, merging it with its
+ * neighbours where possible.  Only a delayed extent must make it into
+ * the tree; for the others, failing to allocate is not an error.
+ */
+static int __es_insert_extent(struct inode *inode, struct extent_status *newes)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct rb_node **p = &tree->root.rb_node;
+	struct rb_node *parent = NULL;
+	struct extent_status *es;
+
+	while (*p) {
+		parent = *p;
+		es = rb_entry(parent, struct extent_status, rb_node);
+
+		if (newes->es_lblk < es->es_lblk) {
+			if (ext4_es_can_merge(newes, es)) {
+				/*
+				 * Here we can modify es_lblk directly
+				 * because it isn't overlapped.
+				 */
+				es->es_lblk = newes->es_lblk;
+				es->es_len += newes->es_len;
+				es->es_pblk = newes->es_pblk;
+				es = ext4_es_try_to_merge_left(inode, es);
+				goto out;
+			}
+			p = &(*p)->rb_left;
+		} else if (newes->es_lblk > ext4_es_end(es)) {
+			if (ext4_es_can_merge(es, newes)) {
+				es->es_len += newes->es_len;
+				es = ext4_es_try_to_merge_right(inode, es);
+				goto out;
+			}
+			p = &(*p)->rb_right;
+		} else {
+			BUG_ON(1);
+			return -EINVAL;
+		}
+	}
+
+	es = ext4_es_alloc_extent(inode, newes->es_lblk, newes->es_len,
+				  newes->es_pblk);
+	if (!es)
+		return ext4_es_is_delayed(newes) ? -ENOMEM : 0;
+	rb_link_node(&es->rb_node, parent, p);
+	rb_insert_color(&es->rb_node, &tree->root);
+
+out:
+	tree->cache_es = es;
+	return 0;
+}
+
+/*
+ * Drop [lblk, end] from the tree.  Cutting the middle out of an extent
+ * takes a new one for its tail; when that cannot be allocated, the tail
+ * of an extent that only caches the disk is dropped as well, and only
+ * for a delayed extent is -ENOMEM returned, with the tree unchanged.
+ */
+static int __es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
+			      ext4_lblk_t end)
+{
+	struct ext4_es_tree *tree = &EXT4_I(inode)->i_es_tree;
+	struct extent_status *es, newes;
+	ext4_lblk_t len1, len2;
+	int err;
+
+	es = __es_tree_search(&tree->root, lblk);
+	if (!es || es->es_lblk > end)
+		return 0;
+
+	/* Simply invalidate cache_es. */
+	tree->cache_es = NULL;
+
+	len1 = lblk > es->es_lblk ? lblk - es->es_lblk : 0;
+	len2 = ext4_es_end(es) > end ? ext4_es_end(es) - end : 0;
+
+	if (len1 > 0 && len2 > 0) {
+		ext4_lblk_t orig_len = es->es_len;
+
+		newes.es_lblk = end + 1;
+		newes.es_len = len2;
+		newes.es_pblk = es->es_pblk;
+		if (ext4_es_is_mapped(es))
+			newes.es_pblk += end + 1 - es->es_lblk;
+		es->es_len = len1;
+		err = __es_insert_extent(inode, &newes);
+		if (err)
+			es->es_len = orig_len;
+		return err;
+	}
+
+	if (len1 > 0) {
+		es->es_len = len1;
+		es = ext4_es_next(es);
+	}
+
+	while (es && ext4_es_end(es) <= end) {
+		struct extent_status *next = ext4_es_next(es);
+
+		ext4_es_erase(inode, es);
+		es = next;
+	}
+
+	if (es && es->es_lblk <= end) {
+		ext4_lblk_t delta = end + 1 - es->es_lblk;
+
+		es->es_lblk = end + 1;
+		es->es_len -= delta;
+		if (ext4_es_is_mapped(es))
+			es->es_pblk += delta;
+	}
+
+	return 0;
+}
+
+static int __es_has_delayed(struct ext4_es_tree *tree, ext4_lblk_t lblk,
+			    ext4_lblk_t end)
+{
+	struct extent_status *es;
+
+	for (es = __es_tree_search(&tree->root, lblk);
+	     es && es->es_lblk <= end; es = ext4_es_next(es))
+		if (ext4_es_is_delayed(es))
+			return 1;
+	return 0;
+}
+
+/*
+ * ext4_es_insert_extent() records the status of [lblk, lblk + len),
+ * replacing whatever the tree knew about the range.  A hole is not
+ * recorded over delayed blocks: they are holes on disk, but have been
+ * reserved for.
+ */
+void ext4_es_insert_extent(struct inode *inode, ext4_lblk_t lblk,
+			   ext4_lblk_t len, ext4_fsblk_t pblk,
+			   unsigned long long status)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct extent_status newes;
+	ext4_lblk_t end = lblk + len - 1;
+	int err;
+
+	BUG_ON(end < lblk);
+	BUG_ON(pblk & EXTENT_STATUS_FLAGS);
+
+	newes.es_lblk = lblk;
+	newes.es_len = len;
+	newes.es_pblk = (status & (EXTENT_STATUS_WRITTEN |
+				   EXTENT_STATUS_UNWRITTEN)) ? pblk : 0;
+	newes.es_pblk |= status;
+	trace_ext4_es_insert_extent(inode, lblk, len, pblk, status);
+
+retry:
+	write_lock(&ei->i_es_lock);
+	if (ext4_es_is_hole(&newes) &&
+	    __es_has_delayed(&ei->i_es_tree, lblk, end)) {
+		write_unlock(&ei->i_es_lock);
+		return;
+	}
+	err = __es_remove_extent(inode, lblk, end);
+	if (!err)
+		err = __es_insert_extent(inode, &newes);
+	write_unlock(&ei->i_es_lock);
+
+	/*
+	 * Delayed extents must not be lost.  The allocations are GFP_ATOMIC
+	 * under i_es_lock, so retry them ourselves, as jbd2 does.
+	 */
+	if (err == -ENOMEM) {
+		congestion_wait(BLK_RW_ASYNC, HZ/50);
+		goto retry;
+	}
+}
+
+/*
+ * ext4_es_remove_extent() forgets [lblk, lblk + len), for instance
+ * because the blocks are being freed or their pages thrown away.
+ */
+void ext4_es_remove_extent(struct inode *inode, ext4_lblk_t lblk,
+			   ext4_lblk_t len)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	ext4_lblk_t end;
+	int err;
+
+	if (len == 0)
+		return;
+
+	end = lblk + len - 1;
+	if (end < lblk)
+		end = EXT_MAX_BLOCKS - 1;
+	trace_ext4_es_remove_extent(inode, lblk, len);
+
+retry:
+	write_lock(&ei->i_es_lock);
+	err = __es_remove_extent(inode, lblk, end);
+	write_unlock(&ei->i_es_lock);
+
+	if (err == -ENOMEM) {
+		congestion_wait(BLK_RW_ASYNC, HZ/50);
+		goto retry;
+	}
+}
+
+/*
+ * ext4_es_lookup_extent() copies the extent that contains lblk to *es
+ * and returns 1, or returns 0 if the tree does not know about lblk.
+ */
+int ext4_es_lookup_extent(struct inode *inode, ext4_lblk_t lblk,
+			  struct extent_status *es)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_es_tree *tree = &ei->i_es_tree;
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct extent_status *es1 = NULL;
+	struct rb_node *node;
+	int found = 0;
+
+	read_lock(&ei->i_es_lock);
+
+	/* find extent in cache firstly */
+	es1 = tree->cache_es;
+	if (es1 && lblk >= es1->es_lblk && lblk <= ext4_es_end(es1)) {
+		found = 1;
+		goto out;
+	}
+
+	node = tree->root.rb_node;
+	while (node) {
+		es1 = rb_entry(node, struct extent_status, rb_node);
+		if (lblk < es1->es_lblk)
+			node = node->rb_left;
+		else if (lblk > ext4_es_end(es1))
+			node = node->rb_right;
+		else {
+			found = 1;
+			break;
+		}
+	}
+
+out:
+	if (found) {
+		tree->cache_es = es1;
+		es->es_lblk = es1->es_lblk;
+		es->es_len = es1->es_len;
+		es->es_pblk = es1->es_pblk;
+		ei->i_es_referenced = 1;
+		sbi->extent_cache_hits++;
+	} else
+		sbi->extent_cache_misses++;
+
+	read_unlock(&ei->i_es_lock);
+
+	trace_ext4_es_lookup_extent(inode, lblk, found);
+	return found;
+}
+
+/*
+ * ext4_es_find_delayed_extent() copies to *es the first delayed extent
+ * that contains lblk or starts after it; es->es_len is 0 if there is
+ * none.
+ */
+void ext4_es_find_delayed_extent(struct inode *inode, ext4_lblk_t lblk,
+				 struct extent_status *es)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct extent_status *es1;
+
+	es->es_lblk = es->es_len = es->es_pblk = 0;
+
+	read_lock(&ei->i_es_lock);
+	for (es1 = __es_tree_search(&ei->i_es_tree.root, lblk); es1;
+	     es1 = ext4_es_next(es1)) {
+		if (ext4_es_is_delayed(es1)) {
+			es->es_lblk = es1->es_lblk;
+			es->es_len = es1->es_len;
+			es->es_pblk = es1->es_pblk;
+			break;
+		}
+	}
+	read_unlock(&ei->i_es_lock);
+}
+
+/*
+ * Free up to nr_to_scan of the extents of an inode that only cache the
+ * disk.  Called with i_es_lock held for writing.
+ */
+static int __es_try_to_reclaim_extents(struct ext4_inode_info *ei,
+				       int nr_to_scan)
+{
+	struct inode *inode = &ei->vfs_inode;
+	struct ext4_es_tree *tree = &ei->i_es_tree;
+	struct extent_status *es, *next;
+	struct rb_node *node;
+	int nr_shrunk = 0;
+
+	node = rb_first(&tree->root);
+	es = node ? rb_entry(node, struct extent_status, rb_node) : NULL;
+	while (es && ei->i_es_lru_nr && nr_to_scan > 0) {
+		next = ext4_es_next(es);
+		if (!ext4_es_is_delayed(es)) {
+			ext4_es_erase(inode, es);
+			nr_shrunk++;
+			nr_to_scan--;
+		}
+		es = next;
+	}
+	return nr_shrunk;
+}
+
+/*
+ * The inodes on the LRU list get a second chance: one that was looked
+ * up in since the last pass is only moved to the tail.
+ */
+static int ext4_es_shrink(struct shrinker *shrink, struct shrink_control *sc)
+{
+	struct ext4_sb_info *sbi = container_of(shrink,
+					struct ext4_sb_info, s_es_shrinker);
+	struct ext4_inode_info *ei;
+	LIST_HEAD(scanned);
+	int nr_to_scan = sc->nr_to_scan;
+	int nr_shrunk = 0;
+
+	if (!nr_to_scan)
+		return percpu_counter_read_positive(&sbi->s_extent_cache_cnt);
+
+	spin_lock(&sbi->s_es_lru_lock);
+	while (nr_to_scan > 0 && !list_empty(&sbi->s_es_lru)) {
+		int shrunk;
+
+		ei = list_first_entry(&sbi->s_es_lru, struct ext4_inode_info,
+				      i_es_lru);
+		list_move_tail(&ei->i_es_lru, &scanned);
+
+		if (ei->i_es_referenced) {
+			ei->i_es_referenced = 0;
+			continue;
+		}
+		if (!write_trylock(&ei->i_es_lock))
+			continue;
+
+		shrunk = __es_try_to_reclaim_extents(ei, nr_to_scan);
+		if (ei->i_es_lru_nr == 0)
+			list_del_init(&ei->i_es_lru);
+		write_unlock(&ei->i_es_lock);
+
+		nr_shrunk += shrunk;
+		nr_to_scan -= shrunk;
+	}
+	list_splice_tail(&scanned, &sbi->s_es_lru);
+	spin_unlock(&sbi->s_es_lru_lock);
+
+	trace_ext4_es_shrink(sbi->s_sb, sc->nr_to_scan, nr_shrunk);
+	return percpu_counter_read_positive(&sbi->s_extent_cache_cnt);
+}
+
+void ext4_es_register_shrinker(struct super_block *sb)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+
+	INIT_LIST_HEAD(&sbi->s_es_lru);
+	spin_lock_init(&sbi->s_es_lru_lock);
+	sbi->s_es_shrinker.shrink = ext4_es_shrink;
+	sbi->s_es_shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&sbi->s_es_shrinker);
+}
+
+void ext4_es_unregister_shrinker(struct super_block *sb)
+{
+	unregister_shrinker(&EXT4_SB(sb)->s_es_shrinker);
+}
+
+void ext4_es_lru_del(struct inode *inode)
+{
+	struct ext4_inode_info *ei = EXT4_I(inode);
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+
+	spin_lock(&sbi->s_es_lru_lock);
+	if (!list_empty(&ei->i_es_lru))
+		list_del_init(&ei->i_es_lru);
+	spin_unlock(&sbi->s_es_lru_lock);
+}
@@ -398,46 +398,44 @@ static pgoff_t ext4_num_dirty_pages(struct inode *inode, pgoff_t idx,
 }
 
 /*
- * Sets the BH_Da_Mapped bit on the buffer heads corresponding to the given map.
+ * Fills in map from the extent of the extent status tree that contains
+ * map->m_lblk, as a lookup of the extent tree or of the indirect blocks
+ * would, and returns the number of blocks mapped.  Delayed allocated
+ * blocks are holes on disk.
  */
-static void set_buffers_da_mapped(struct inode *inode,
-				   struct ext4_map_blocks *map)
+static int ext4_es_fill_map(struct ext4_map_blocks *map,
+			    struct extent_status *es)
 {
-	struct address_space *mapping = inode->i_mapping;
-	struct pagevec pvec;
-	int i, nr_pages;
-	pgoff_t index, end;
+	ext4_lblk_t len;
 
-	index = map->m_lblk >> (PAGE_CACHE_SHIFT - inode->i_blkbits);
-	end = (map->m_lblk + map->m_len - 1) >>
-		(PAGE_CACHE_SHIFT - inode->i_blkbits);
+	if (!ext4_es_is_mapped(es))
+		return 0;
 
-	pagevec_init(&pvec, 0);
-	while (index <= end) {
-		nr_pages = pagevec_lookup(&pvec, mapping, index,
-					  min(end - index + 1,
-					      (pgoff_t)PAGEVEC_SIZE));
-		if (nr_pages == 0)
-			break;
-		for (i = 0; i < nr_pages; i++) {
-			struct page *page = pvec.pages[i];
-			struct buffer_head *bh, *head;
+	len = es->es_lblk + es->es_len - map->m_lblk;
+	if (len < map->m_len)
+		map->m_len = len;
+	map->m_pblk = ext4_es_pblock(es) + map->m_lblk - es->es_lblk;
+	if (ext4_es_is_written(es))
+		map->m_flags |= EXT4_MAP_MAPPED;
+	else
+		map->m_flags |= EXT4_MAP_UNWRITTEN;
+	return map->m_len;
+}
 
-			if (unlikely(page->mapping != mapping) ||
-			    !PageDirty(page))
-				break;
+/*
+ * Records the blocks a lookup found in the extent status tree.  Holes are
+ * recorded by ext4_ext_map_blocks(), which knows where they end.  Called
+ * with i_data_sem held.
+ */
+static void ext4_es_cache_map(struct inode *inode,
+			      struct ext4_map_blocks *map, int retval)
+{
+	if (retval <= 0)
+		return;
 
-			if (page_has_buffers(page)) {
-				bh = head = page_buffers(page);
-				do {
-					set_buffer_da_mapped(bh);
-					bh = bh->b_this_page;
-				} while (bh != head);
-			}
-			index++;
-		}
-		pagevec_release(&pvec);
-	}
+	ext4_es_insert_extent(inode, map->m_lblk, retval, map->m_pblk,
+			      (map->m_flags & EXT4_MAP_UNWRITTEN) ?
+			      EXTENT_STATUS_UNWRITTEN : EXTENT_STATUS_WRITTEN);
 }
 
 /*
@@ -465,12 +463,23 @@ static void set_buffers_da_mapped(struct inode *inode,
 int ext4_map_blocks(handle_t *handle, struct inode *inode,
 		    struct ext4_map_blocks *map, int flags)
 {
+	struct extent_status es;
 	int retval;
 
 	map->m_flags = 0;
 	ext_debug("ext4_map_blocks(): inode %lu, flag %d, max_blocks %u,"
 		  "logical block %lu\n", inode->i_ino, flags, map->m_len,
 		  (unsigned long) map->m_lblk);
+
+	/*
+	 * The extent status tree answers for the ranges it knows about
+	 * without i_data_sem.
+	 */
+	if (ext4_es_lookup_extent(inode, map->m_lblk, &es)) {
+		retval = ext4_es_fill_map(map, &es);
+		goto found;
+	}
+
 	/*
 	 * Try to see if we can get the block without requesting a new
 	 * file system block.
@@ -483,8 +492,10 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 		retval = ext4_ind_map_blocks(handle, inode, map, flags &
 					     EXT4_GET_BLOCKS_KEEP_SIZE);
 	}
+	ext4_es_cache_map(inode, map, retval);
 	up_read((&EXT4_I(inode)->i_data_sem));
 
+found:
 	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
 		int ret = check_block_validity(inode, map);
 		if (ret != 0)
@@ -561,15 +572,23 @@ int ext4_map_blocks(handle_t *handle, struct inode *inode,
 			(flags & EXT4_GET_BLOCKS_DELALLOC_RESERVE))
 			ext4_da_update_reserve_space(inode, retval, 1);
 	}
-	if (flags & EXT4_GET_BLOCKS_DELALLOC_RESERVE) {
+	if (flags & EXT4_GET_BLOCKS_DELALLOC_RESERVE)
 		ext4_clear_inode_state(inode, EXT4_STATE_DELALLOC_RESERVED);
 
-		/* If we have successfully mapped the delayed allocated blocks,
-		 * set the BH_Da_Mapped bit on them. Its important to do this
-		 * under the protection of i_data_sem.
-		 */
-		if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED)
-			set_buffers_da_mapped(inode, map);
+	/*
+	 * Record the new mapping in the extent status tree; for delayed
+	 * allocated blocks this is what marks them as no longer delayed,
+	 * so it is done under the protection of i_data_sem.  Blocks asked
+	 * for as uninitialized may have been found written or left
+	 * unwritten, so they are only forgotten.
+	 */
+	if (retval > 0 && map->m_flags & EXT4_MAP_MAPPED) {
+		if (flags & EXT4_GET_BLOCKS_UNINIT_EXT)
+			ext4_es_remove_extent(inode, map->m_lblk, map->m_len);
+		else
+			ext4_es_insert_extent(inode, map->m_lblk, map->m_len,
+					      map->m_pblk,
+					      EXTENT_STATUS_WRITTEN);
 	}
 
 	up_write((&EXT4_I(inode)->i_data_sem));
@@ -1201,29 +1220,36 @@ static void ext4_da_page_release_reservation(struct page *page,
 	struct inode *inode = page->mapping->host;
 	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
 	int num_clusters;
+	ext4_lblk_t lblk, lblk_start = 0;
 
 	head = page_buffers(page);
 	bh = head;
+	lblk = page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits);
 	do {
 		unsigned int next_off = curr_off + bh->b_size;
 
 		if ((offset <= curr_off) && (buffer_delay(bh))) {
+			if (!to_release)
+				lblk_start = lblk;
 			to_release++;
 			clear_buffer_delay(bh);
-			clear_buffer_da_mapped(bh);
 		}
 		curr_off = next_off;
+		lblk++;
 	} while ((bh = bh->b_this_page) != head);
 
+	/* Invalidated blocks are no longer delayed allocated */
+	if (to_release)
+		ext4_es_remove_extent(inode, lblk_start, lblk - lblk_start);
+
 	/* If we have released all the blocks belonging to a cluster, then we
 	 * need to release the reserved space for that cluster. */
 	num_clusters = EXT4_NUM_B2C(sbi, to_release);
 	while (num_clusters > 0) {
-		ext4_fsblk_t lblk;
 		lblk = (page->index << (PAGE_CACHE_SHIFT - inode->i_blkbits)) +
 			((num_clusters - 1) << sbi->s_cluster_bits);
 		if (sbi->s_cluster_ratio == 1 ||
-		    !ext4_find_delalloc_cluster(inode, lblk, 1))
+		    !ext4_find_delalloc_cluster(inode, lblk))
 			ext4_da_release_space(inode, 1);
 
 		num_clusters--;
@@ -1329,8 +1355,6 @@ static int mpage_da_submit_io(struct mpage_da_data *mpd,
 						clear_buffer_delay(bh);
 						bh->b_blocknr = pblock;
 					}
-					if (buffer_da_mapped(bh))
-						clear_buffer_da_mapped(bh);
 					if (buffer_unwritten(bh) ||
 					    buffer_mapped(bh))
 						BUG_ON(bh->b_blocknr != pblock);
@@ -1400,6 +1424,11 @@ static void ext4_da_block_invalidatepages(struct mpage_da_data *mpd)
 
 	index = mpd->first_page;
 	end   = mpd->next_page - 1;
+
+	/* The delayed blocks of the pages are thrown away with them */
+	ext4_es_remove_extent(inode,
+			index << (PAGE_CACHE_SHIFT - inode->i_blkbits),
+			(end - index + 1) << (PAGE_CACHE_SHIFT - inode->i_blkbits));
 	while (index <= end) {
 		nr_pages = pagevec_lookup(&pvec, mapping, index, PAGEVEC_SIZE);
 		if (nr_pages == 0)
@@ -1675,16 +1704,39 @@ static int ext4_da_map_blocks(struct inode *inode, sector_t iblock,
 			      struct ext4_map_blocks *map,
 			      struct buffer_head *bh)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(inode->i_sb);
+	struct extent_status es;
 	int retval;
 	sector_t invalid_block = ~((sector_t) 0xffff);
 
-	if (invalid_block < ext4_blocks_count(EXT4_SB(inode->i_sb)->s_es))
+	if (invalid_block < ext4_blocks_count(sbi->s_es))
 		invalid_block = ~0;
 
 	map->m_flags = 0;
 	ext_debug("ext4_da_map_blocks(): inode %lu, max_blocks %u,"
 		  "logical block %lu\n", inode->i_ino, map->m_len,
 		  (unsigned long) map->m_lblk);
+
+	/* Lookup extent status tree firstly */
+	if (ext4_es_lookup_extent(inode, iblock, &es)) {
+		if (ext4_es_is_delayed(&es)) {
+			/* Already reserved for */
+			map_bh(bh, inode->i_sb, invalid_block);
+			set_buffer_new(bh);
+			set_buffer_delay(bh);
+			return 0;
+		}
+		if (ext4_es_is_hole(&es)) {
+			down_read((&EXT4_I(inode)->i_data_sem));
+			retval = 0;
+			if ((sbi->s_cluster_ratio > 1) &&
+			    ext4_find_delalloc_cluster(inode, map->m_lblk))
+				map->m_flags |= EXT4_MAP_FROM_CLUSTER;
+			goto add_delayed;
+		}
+		return ext4_es_fill_map(map, &es);
+	}
+
 	/*
 	 * Try to see if we can get the block without requesting a new
 	 * file system block.
@@ -1694,8 +1746,10 @@ static int ext4_da_map_blocks(struct inode *inode, sector_t iblock,
 		retval = ext4_ext_map_blocks(NULL, inode, map, 0);
 	else
 		retval = ext4_ind_map_blocks(NULL, inode, map, 0);
+	ext4_es_cache_map(inode, map, retval);
 
 	if (retval == 0) {
+add_delayed:
 		/*
 		 * XXX: __block_prepare_write() unmaps passed block,
 		 * is it OK?
@@ -1714,6 +1768,9 @@ static int ext4_da_map_blocks(struct inode *inode, sector_t iblock,
 		 */
 		map->m_flags &= ~EXT4_MAP_FROM_CLUSTER;
 
+		ext4_es_insert_extent(inode, map->m_lblk, 1, 0,
+				      EXTENT_STATUS_DELAYED);
+
 		map_bh(bh, inode->i_sb, invalid_block);
 		set_buffer_new(bh);
 		set_buffer_delay(bh);
@@ -3697,6 +3754,40 @@ int ext4_get_inode_loc(struct inode *inode, struct ext4_iloc *iloc)
 		!ext4_test_inode_state(inode, EXT4_STATE_XATTR));
 }
 
+/*
+ * Start reading the inode table blocks holding the given inodes, which
+ * getdents_plus() is about to look up.  The inode numbers come sorted,
+ * so inodes sharing a block are next to each other.
+ */
+void ext4_prefetch_inodes(struct super_block *sb, const u64 *inos,
+			  unsigned int nr)
+{
+	struct ext4_group_desc *gdp;
+	ext4_fsblk_t block, last = 0;
+	unsigned long ino, offset;
+	struct blk_plug plug;
+	unsigned int i;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++) {
+		ino = inos[i];
+		if (ino != inos[i] || !ext4_valid_inum(sb, ino))
+			continue;
+		gdp = ext4_get_group_desc(sb, (ino - 1) / EXT4_INODES_PER_GROUP(sb),
+					  NULL);
+		if (!gdp)
+			continue;
+		offset = (ino - 1) % EXT4_INODES_PER_GROUP(sb);
+		block = ext4_inode_table(sb, gdp) +
+			offset / EXT4_SB(sb)->s_inodes_per_block;
+		if (block == last)
+			continue;
+		sb_breadahead(sb, block);
+		last = block;
+	}
+	blk_finish_plug(&plug);
+}
+
 void ext4_set_inode_flags(struct inode *inode)
 {
 	unsigned int flags = EXT4_I(inode)->i_flags;
@@ -682,11 +682,13 @@ static void ext4_mb_mark_free_simple(struct super_block *sb,
 
 /*
  * Cache the order of the largest free extent we have available in this block
- * group.
+ * group, and keep the group on the list of its sbi for that order.
  */
 static void
 mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 {
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_largest_free_order;
 	int i;
 	int bits;
 
@@ -699,6 +701,54 @@ mb_set_largest_free_order(struct super_block *sb, struct ext4_group_info *grp)
 			break;
 		}
 	}
+
+	if (grp->bb_largest_free_order == old)
+		return;
+
+	if (old >= 0) {
+		spin_lock(&sbi->s_mb_largest_free_orders_locks[old]);
+		list_del_init(&grp->bb_largest_free_order_node);
+		spin_unlock(&sbi->s_mb_largest_free_orders_locks[old]);
+	}
+	i = grp->bb_largest_free_order;
+	if (i >= 0) {
+		spin_lock(&sbi->s_mb_largest_free_orders_locks[i]);
+		list_add_tail(&grp->bb_largest_free_order_node,
+			      &sbi->s_mb_largest_free_orders[i]);
+		spin_unlock(&sbi->s_mb_largest_free_orders_locks[i]);
+	}
+}
+
+/*
+ * Likewise for the order of the average size of the free extents of the
+ * group, which is what a search for a non power of 2 length goes by.
+ */
+static void
+mb_set_avg_fragment_size_order(struct super_block *sb,
+			       struct ext4_group_info *grp)
+{
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	int old = grp->bb_avg_fragment_size_order;
+	int new = -1;
+
+	if (grp->bb_free && grp->bb_fragments)
+		new = min_t(int, fls(grp->bb_free / grp->bb_fragments) - 1,
+			    MB_NUM_ORDERS(sb) - 1);
+	if (new == old)
+		return;
+
+	grp->bb_avg_fragment_size_order = new;
+	if (old >= 0) {
+		spin_lock(&sbi->s_mb_avg_fragment_size_locks[old]);
+		list_del_init(&grp->bb_avg_fragment_size_node);
+		spin_unlock(&sbi->s_mb_avg_fragment_size_locks[old]);
+	}
+	if (new >= 0) {
+		spin_lock(&sbi->s_mb_avg_fragment_size_locks[new]);
+		list_add_tail(&grp->bb_avg_fragment_size_node,
+			      &sbi->s_mb_avg_fragment_size[new]);
+		spin_unlock(&sbi->s_mb_avg_fragment_size_locks[new]);
+	}
 }
 
 static noinline_for_stack
@@ -744,8 +794,10 @@ void ext4_mb_generate_buddy(struct super_block *sb,
 		grp->bb_free = free;
 	}
 	mb_set_largest_free_order(sb, grp);
+	mb_set_avg_fragment_size_order(sb, grp);
 
-	clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state));
+	if (test_and_clear_bit(EXT4_GROUP_INFO_NEED_INIT_BIT, &(grp->bb_state)))
+		atomic_dec(&EXT4_SB(sb)->s_mb_uninit_groups);
 
 	period = get_cycles() - period;
 	spin_lock(&EXT4_SB(sb)->s_bal_lock);
@@ -1383,6 +1435,7 @@ static void mb_free_blocks(struct inode *inode, struct ext4_buddy *e4b,
 		} while (1);
 	}
 	mb_set_largest_free_order(sb, e4b->bd_info);
+	mb_set_avg_fragment_size_order(sb, e4b->bd_info);
 	mb_check_buddy(e4b);
 }
 
@@ -1510,6 +1563,7 @@ static int mb_mark_used(struct ext4_buddy *e4b, struct ext4_free_extent *ex)
 		e4b->bd_info->bb_counters[ord]++;
 	}
 	mb_set_largest_free_order(e4b->bd_sb, e4b->bd_info);
+	mb_set_avg_fragment_size_order(e4b->bd_sb, e4b->bd_info);
 
 	ext4_set_bits(EXT4_MB_BITMAP(e4b), ex->fe_start, len0);
 	mb_check_buddy(e4b);
@@ -1955,10 +2009,109 @@ static int ext4_mb_good_group(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * Look for blocks in one group, if it suits the criteria; the result is
+ * in ac->ac_status.
+ */
+static int ext4_mb_scan_group(struct ext4_allocation_context *ac,
+			      ext4_group_t group, int cr)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_buddy e4b;
+	int err;
+
+	/* This now checks without needing the buddy page */
+	if (!ext4_mb_good_group(ac, group, cr))
+		return 0;
+
+	err = ext4_mb_load_buddy(sb, group, &e4b);
+	if (err)
+		return err;
+
+	ext4_lock_group(sb, group);
+
+	/*
+	 * We need to check again after locking the
+	 * block group
+	 */
+	if (!ext4_mb_good_group(ac, group, cr)) {
+		ext4_unlock_group(sb, group);
+		ext4_mb_unload_buddy(&e4b);
+		return 0;
+	}
+
+	ac->ac_groups_scanned++;
+	if (cr == 0)
+		ext4_mb_simple_scan_group(ac, &e4b);
+	else if (cr == 1 && sbi->s_stripe &&
+			!(ac->ac_g_ex.fe_len % sbi->s_stripe))
+		ext4_mb_scan_aligned(ac, &e4b);
+	else
+		ext4_mb_complex_scan_group(ac, &e4b);
+
+	ext4_unlock_group(sb, group);
+	ext4_mb_unload_buddy(&e4b);
+	return 0;
+}
+
+/*
+ * Find an initialized group that suits criteria 0 or 1, from the lists
+ * of groups by order of their largest free extent, or of their average
+ * free extent size, starting with the smallest order in which every
+ * group has free extents that are large enough.  The group found goes to
+ * the tail of its list, so that the next search tries another one first.
+ */
+static int ext4_mb_find_group_by_order(struct ext4_allocation_context *ac,
+				       int cr, ext4_group_t ngroups,
+				       ext4_group_t *group)
+{
+	struct super_block *sb = ac->ac_sb;
+	struct ext4_sb_info *sbi = EXT4_SB(sb);
+	struct ext4_group_info *grp;
+	struct list_head *lists, *pos;
+	spinlock_t *locks;
+	int order;
+
+	if (cr == 0) {
+		lists = sbi->s_mb_largest_free_orders;
+		locks = sbi->s_mb_largest_free_orders_locks;
+		order = ac->ac_2order;
+	} else {
+		lists = sbi->s_mb_avg_fragment_size;
+		locks = sbi->s_mb_avg_fragment_size_locks;
+		order = fls(ac->ac_g_ex.fe_len - 1);
+	}
+
+	for (; order < MB_NUM_ORDERS(sb); order++) {
+		if (list_empty(&lists[order]))
+			continue;
+		spin_lock(&locks[order]);
+		list_for_each(pos, &lists[order]) {
+			if (cr == 0)
+				grp = list_entry(pos, struct ext4_group_info,
+						 bb_largest_free_order_node);
+			else
+				grp = list_entry(pos, struct ext4_group_info,
+						 bb_avg_fragment_size_node);
+			if (grp->bb_group >= ngroups ||
+			    EXT4_MB_GRP_NEED_INIT(grp) ||
+			    !ext4_mb_good_group(ac, grp->bb_group, cr))
+				continue;
+			list_move_tail(pos, &lists[order]);
+			spin_unlock(&locks[order]);
+			*group = grp->bb_group;
+			return 1;
+		}
+		spin_unlock(&locks[order]);
+	}
+	return 0;
+}
+
 static noinline_for_stack int
 ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 {
-	ext4_group_t ngroups, group, i;
+	ext4_group_t ngroups, group, first, i;
 	int cr;
 	int err = 0;
 	struct ext4_sb_info *sbi;
@@ -2026,42 +2179,44 @@ repeat:
 		 */
 		group = ac->ac_g_ex.fe_group;
 
+		/*
+		 * For the first two criteria, the groups that may suit are
+		 * on the per-order lists: past the goal group, take them
+		 * from there until one is tried again.  All groups have to
+		 * be scanned only while some of them were never loaded, as
+		 * those are not on the lists.
+		 */
+		if (cr < 2 && sbi->s_mb_optimize_scan) {
+			err = ext4_mb_scan_group(ac, group, cr);
+			if (err)
+				goto out;
+			first = ngroups;
+			for (i = 0; i < ngroups &&
+				    ac->ac_status == AC_STATUS_CONTINUE; i++) {
+				if (!ext4_mb_find_group_by_order(ac, cr, ngroups,
+								 &group) ||
+				    group == first)
+					break;
+				if (first == ngroups)
+					first = group;
+				err = ext4_mb_scan_group(ac, group, cr);
+				if (err)
+					goto out;
+			}
+			if (ac->ac_status != AC_STATUS_CONTINUE ||
+			    !atomic_read(&sbi->s_mb_uninit_groups))
+				continue;
+			group = ac->ac_g_ex.fe_group;
+		}
+
 		for (i = 0; i < ngroups; group++, i++) {
 			if (group == ngroups)
 				group = 0;
 
-			/* This now checks without needing the buddy page */
-			if (!ext4_mb_good_group(ac, group, cr))
-				continue;
-
-			err = ext4_mb_load_buddy(sb, group, &e4b);
+			err = ext4_mb_scan_group(ac, group, cr);
 			if (err)
 				goto out;
 
-			ext4_lock_group(sb, group);
-
-			/*
-			 * We need to check again after locking the
-			 * block group
-			 */
-			if (!ext4_mb_good_group(ac, group, cr)) {
-				ext4_unlock_group(sb, group);
-				ext4_mb_unload_buddy(&e4b);
-				continue;
-			}
-
-			ac->ac_groups_scanned++;
-			if (cr == 0)
-				ext4_mb_simple_scan_group(ac, &e4b);
-			else if (cr == 1 && sbi->s_stripe &&
-					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
-			else
-				ext4_mb_complex_scan_group(ac, &e4b);
-
-			ext4_unlock_group(sb, group);
-			ext4_mb_unload_buddy(&e4b);
-
 			if (ac->ac_status != AC_STATUS_CONTINUE)
 				break;
 		}
@@ -2261,6 +2416,11 @@ int ext4_mb_add_groupinfo(struct super_block *sb, ext4_group_t group,
 	init_rwsem(&meta_group_info[i]->alloc_sem);
 	meta_group_info[i]->bb_free_root = RB_ROOT;
 	meta_group_info[i]->bb_largest_free_order = -1;  /* uninit */
+	meta_group_info[i]->bb_avg_fragment_size_order = -1;  /* uninit */
+	meta_group_info[i]->bb_group = group;
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_largest_free_order_node);
+	INIT_LIST_HEAD(&meta_group_info[i]->bb_avg_fragment_size_node);
+	atomic_inc(&sbi->s_mb_uninit_groups);
 
 #ifdef DOUBLE_CHECK
 	{
@@ -2464,6 +2624,26 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 		i++;
 	} while (i <= sb->s_blocksize_bits + 1);
 
+	i = MB_NUM_ORDERS(sb) * sizeof(struct list_head);
+	sbi->s_mb_largest_free_orders = kmalloc(i, GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size = kmalloc(i, GFP_KERNEL);
+	i = MB_NUM_ORDERS(sb) * sizeof(spinlock_t);
+	sbi->s_mb_largest_free_orders_locks = kmalloc(i, GFP_KERNEL);
+	sbi->s_mb_avg_fragment_size_locks = kmalloc(i, GFP_KERNEL);
+	if (!sbi->s_mb_largest_free_orders || !sbi->s_mb_avg_fragment_size ||
+	    !sbi->s_mb_largest_free_orders_locks ||
+	    !sbi->s_mb_avg_fragment_size_locks) {
+		ret = -ENOMEM;
+		goto out_free_groupinfo_slab;
+	}
+	for (i = 0; i < MB_NUM_ORDERS(sb); i++) {
+		INIT_LIST_HEAD(&sbi->s_mb_largest_free_orders[i]);
+		spin_lock_init(&sbi->s_mb_largest_free_orders_locks[i]);
+		INIT_LIST_HEAD(&sbi->s_mb_avg_fragment_size[i]);
+		spin_lock_init(&sbi->s_mb_avg_fragment_size_locks[i]);
+	}
+	atomic_set(&sbi->s_mb_uninit_groups, 0);
+
 	spin_lock_init(&sbi->s_md_lock);
 	spin_lock_init(&sbi->s_bal_lock);
 
@@ -2472,6 +2652,7 @@ int ext4_mb_init(struct super_block *sb, int needs_recovery)
 	sbi->s_mb_stats = MB_DEFAULT_STATS;
 	sbi->s_mb_stream_request = MB_DEFAULT_STREAM_THRESHOLD;
 	sbi->s_mb_order2_reqs = MB_DEFAULT_ORDER2_REQS;
+	sbi->s_mb_optimize_scan = MB_DEFAULT_OPTIMIZE_SCAN;
 	/*
 	 * The default group preallocation is 512, which for 4k block
 	 * sizes translates to 2 megabytes.  However for bigalloc file
@@ -2533,6 +2714,14 @@ out_free_locality_groups:
 out_free_groupinfo_slab:
 	ext4_groupinfo_destroy_slabs();
 out:
+	kfree(sbi->s_mb_largest_free_orders);
+	sbi->s_mb_largest_free_orders = NULL;
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	sbi->s_mb_largest_free_orders_locks = NULL;
+	kfree(sbi->s_mb_avg_fragment_size);
+	sbi->s_mb_avg_fragment_size = NULL;
+	kfree(sbi->s_mb_avg_fragment_size_locks);
+	sbi->s_mb_avg_fragment_size_locks = NULL;
 	kfree(sbi->s_mb_offsets);
 	sbi->s_mb_offsets = NULL;
 	kfree(sbi->s_mb_maxs);
@@ -2585,6 +2774,10 @@ int ext4_mb_release(struct super_block *sb)
 			kfree(sbi->s_group_info[i]);
 		ext4_kvfree(sbi->s_group_info);
 	}
+	kfree(sbi->s_mb_largest_free_orders);
+	kfree(sbi->s_mb_largest_free_orders_locks);
+	kfree(sbi->s_mb_avg_fragment_size);
+	kfree(sbi->s_mb_avg_fragment_size_locks);
 	kfree(sbi->s_mb_offsets);
 	kfree(sbi->s_mb_maxs);
 	if (sbi->s_buddy_cache)
@@ -94,6 +94,17 @@ extern u8 mb_enable_debug;
  */
 #define MB_DEFAULT_GROUP_PREALLOC	512
 
+/*
+ * pick groups for 2^N and average fragment size searches from the
+ * per-order lists rather than by scanning all of them
+ */
+#define MB_DEFAULT_OPTIMIZE_SCAN	1
+
+/*
+ * number of orders a buddy has: 0 (the bitmap) to s_blocksize_bits + 1
+ */
+#define MB_NUM_ORDERS(sb)		((sb)->s_blocksize_bits + 2)
+
 
 struct ext4_free_data {
 	/* this links the free block information from group_info */
@@ -761,8 +761,8 @@ out:
 		kfree(donor_path);
 	}
 
-	ext4_ext_invalidate_cache(orig_inode);
-	ext4_ext_invalidate_cache(donor_inode);
+	ext4_es_remove_extent(orig_inode, from, count);
+	ext4_es_remove_extent(donor_inode, from, count);
 
 	double_up_write_data_sem(orig_inode, donor_inode);
 
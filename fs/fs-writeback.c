@@ -27,6 +27,7 @@
 #include <linux/backing-dev.h>
 #include <linux/buffer_head.h>
 #include <linux/tracepoint.h>
+#include <linux/hash.h>
 #include "internal.h"
 
 /*
@@ -525,6 +526,154 @@ static long writeback_chunk_size(struct backing_dev_info *bdi,
 	return pages;
 }
 
+/*
+ * Write back the inodes the flusher handed to a worker.  Each inode is
+ * written just like writeback_sb_inodes() does, and leaves the worker's
+ * list the same way it would have left b_io.
+ */
+void bdi_writeback_worker_fn(struct work_struct *w)
+{
+	struct bdi_writeback_worker *worker =
+		container_of(w, struct bdi_writeback_worker, work);
+	struct bdi_writeback *wb = worker->wb;
+	struct wb_writeback_work *work = wb->worker_work;
+	struct writeback_control wbc = {
+		.sync_mode		= work->sync_mode,
+		.tagged_writepages	= work->tagged_writepages,
+		.for_kupdate		= work->for_kupdate,
+		.for_background		= work->for_background,
+		.range_cyclic		= work->range_cyclic,
+		.range_start		= 0,
+		.range_end		= LLONG_MAX,
+	};
+	unsigned long start_time = jiffies;
+	int swapwrite = current->flags & PF_SWAPWRITE;
+	long write_chunk;
+
+	/* like the flusher thread */
+	current->flags |= PF_SWAPWRITE;
+
+	spin_lock(&wb->list_lock);
+	while (!list_empty(&worker->b_io)) {
+		struct inode *inode = wb_inode(worker->b_io.prev);
+
+		spin_lock(&inode->i_lock);
+		write_chunk = writeback_chunk_size(wb->bdi, work);
+		wbc.nr_to_write = write_chunk;
+		wbc.pages_skipped = 0;
+
+		writeback_single_inode(inode, wb, &wbc);
+
+		work->nr_pages -= write_chunk - wbc.nr_to_write;
+		worker->wrote += write_chunk - wbc.nr_to_write;
+		worker->nr_pages += write_chunk - wbc.nr_to_write;
+		worker->nr_inodes++;
+		if (!(inode->i_state & I_DIRTY))
+			worker->wrote++;
+		if (wbc.pages_skipped)
+			redirty_tail(inode, wb);
+		spin_unlock(&inode->i_lock);
+		spin_unlock(&wb->list_lock);
+		iput(inode);
+		cond_resched();
+		spin_lock(&wb->list_lock);
+	}
+	spin_unlock(&wb->list_lock);
+
+	worker->nr_batches++;
+	worker->busy_time += jiffies - start_time;
+	if (!swapwrite)
+		current->flags &= ~PF_SWAPWRITE;
+}
+
+/*
+ * Inodes are partitioned among the workers by runs of inode numbers, so
+ * that inodes allocated together, which most filesystems number close to
+ * each other in the same allocation group, are written by the same worker.
+ */
+#define WB_WORKER_INO_SHIFT	10
+
+static struct bdi_writeback_worker *inode_to_worker(struct bdi_writeback *wb,
+						    struct inode *inode)
+{
+	return &wb->workers[hash_long(inode->i_ino >> WB_WORKER_INO_SHIFT,
+				      BITS_PER_LONG) % wb->nr_workers];
+}
+
+/*
+ * writeback_sb_inodes() for a bdi with a pool of writeback workers.
+ *
+ * Takes up to BDI_WORKER_BATCH inodes per worker off b_io, moves them to
+ * the lists of the workers they fall to, and waits for the workers to
+ * write them all before going on with the next batch.  So when this
+ * returns, every inode it took has been written, as data integrity
+ * writeback needs.  Called with wb->list_lock and wb->workers_mutex held.
+ */
+static long writeback_sb_inodes_parallel(struct super_block *sb,
+					 struct bdi_writeback *wb,
+					 struct wb_writeback_work *work)
+{
+	unsigned int max_batch = wb->nr_workers * BDI_WORKER_BATCH;
+	unsigned long start_time = jiffies;
+	long wrote = 0;
+	unsigned int i, batch;
+	bool other_sb = false;
+
+	wb->worker_work = work;
+	while (!list_empty(&wb->b_io) && !other_sb) {
+		for (batch = 0; batch < max_batch && !list_empty(&wb->b_io); ) {
+			struct inode *inode = wb_inode(wb->b_io.prev);
+
+			if (inode->i_sb != sb) {
+				if (work->sb) {
+					redirty_tail(inode, wb);
+					continue;
+				}
+				other_sb = true;
+				break;
+			}
+
+			spin_lock(&inode->i_lock);
+			if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
+				spin_unlock(&inode->i_lock);
+				redirty_tail(inode, wb);
+				continue;
+			}
+			__iget(inode);
+			spin_unlock(&inode->i_lock);
+			list_move(&inode->i_wb_list,
+				  &inode_to_worker(wb, inode)->b_io);
+			batch++;
+		}
+		if (!batch)
+			break;
+
+		spin_unlock(&wb->list_lock);
+		for (i = 0; i < wb->nr_workers; i++)
+			if (!list_empty(&wb->workers[i].b_io))
+				queue_work(bdi_writeback_wq,
+					   &wb->workers[i].work);
+		for (i = 0; i < wb->nr_workers; i++)
+			flush_work(&wb->workers[i].work);
+		spin_lock(&wb->list_lock);
+
+		for (i = 0; i < wb->nr_workers; i++) {
+			wrote += wb->workers[i].wrote;
+			wb->workers[i].wrote = 0;
+		}
+
+		/* the same tests as at the end of writeback_sb_inodes */
+		if (wrote) {
+			if (time_is_before_jiffies(start_time + HZ / 10UL))
+				break;
+			if (work->nr_pages <= 0)
+				break;
+		}
+	}
+	wb->worker_work = NULL;
+	return wrote;
+}
+
 /*
  * Write a portion of b_io inodes which belong to @sb.
  *
@@ -551,6 +700,19 @@ static long writeback_sb_inodes(struct super_block *sb,
 	long write_chunk;
 	long wrote = 0;  /* count both pages and inodes */
 
+	/*
+	 * Hand the inodes to the bdi's writeback workers if it has some,
+	 * and nobody else is using them right now.
+	 */
+	if (wb->nr_workers > 1 && mutex_trylock(&wb->workers_mutex)) {
+		if (wb->workers) {
+			wrote = writeback_sb_inodes_parallel(sb, wb, work);
+			mutex_unlock(&wb->workers_mutex);
+			return wrote;
+		}
+		mutex_unlock(&wb->workers_mutex);
+	}
+
 	while (!list_empty(&wb->b_io)) {
 		struct inode *inode = wb_inode(wb->b_io.prev);
 
@@ -1169,6 +1331,7 @@ EXPORT_SYMBOL(__mark_inode_dirty);
 static void wait_sb_inodes(struct super_block *sb)
 {
 	struct inode *inode, *old_inode = NULL;
+	int cpu;
 
 	/*
 	 * We need to be protected against the filesystem going from
@@ -1176,8 +1339,6 @@ static void wait_sb_inodes(struct super_block *sb)
 	 */
 	WARN_ON(!rwsem_is_locked(&sb->s_umount));
 
-	spin_lock(&inode_sb_list_lock);
-
 	/*
 	 * Data integrity sync. Must wait for all pages under writeback,
 	 * because there may have been pages dirtied before our sync
@@ -1185,37 +1346,42 @@ static void wait_sb_inodes(struct super_block *sb)
 	 * In which case, the inode may not be on the dirty list, but
 	 * we still have to wait for that writeout.
 	 */
-	list_for_each_entry(inode, &sb->s_inodes, i_sb_list) {
-		struct address_space *mapping = inode->i_mapping;
+	for_each_possible_cpu(cpu) {
+		struct sb_inode_list *l = per_cpu_ptr(sb->s_inodes, cpu);
 
-		spin_lock(&inode->i_lock);
-		if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
-		    (mapping->nrpages == 0)) {
+		spin_lock(&l->lock);
+		list_for_each_entry(inode, &l->list, i_sb_list) {
+			struct address_space *mapping = inode->i_mapping;
+
+			spin_lock(&inode->i_lock);
+			if ((inode->i_state & (I_FREEING|I_WILL_FREE|I_NEW)) ||
+			    (mapping->nrpages == 0)) {
+				spin_unlock(&inode->i_lock);
+				continue;
+			}
+			__iget(inode);
 			spin_unlock(&inode->i_lock);
-			continue;
-		}
-		__iget(inode);
-		spin_unlock(&inode->i_lock);
-		spin_unlock(&inode_sb_list_lock);
+			spin_unlock(&l->lock);
 
-		/*
-		 * We hold a reference to 'inode' so it couldn't have been
-		 * removed from s_inodes list while we dropped the
-		 * inode_sb_list_lock.  We cannot iput the inode now as we can
-		 * be holding the last reference and we cannot iput it under
-		 * inode_sb_list_lock. So we keep the reference and iput it
-		 * later.
-		 */
-		iput(old_inode);
-		old_inode = inode;
+			/*
+			 * We hold a reference to 'inode' so it couldn't have
+			 * been removed from its s_inodes shard while we
+			 * dropped the shard lock.  We cannot iput the inode
+			 * now as we can be holding the last reference and we
+			 * cannot iput it under the shard lock. So we keep the
+			 * reference and iput it later.
+			 */
+			iput(old_inode);
+			old_inode = inode;
 
-		filemap_fdatawait(mapping);
+			filemap_fdatawait(mapping);
 
-		cond_resched();
+			cond_resched();
 
-		spin_lock(&inode_sb_list_lock);
+			spin_lock(&l->lock);
+		}
+		spin_unlock(&l->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 	iput(old_inode);
 }
 
@@ -536,6 +536,7 @@ struct fuse_copy_state {
 	struct pipe_buffer *currbuf;
 	struct pipe_inode_info *pipe;
 	unsigned long nr_segs;
+	unsigned long max_segs;	/* size of pipebufs, pipe->buffers may grow */
 	unsigned long seglen;
 	unsigned long addr;
 	struct page *pg;
@@ -610,7 +611,7 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 		} else {
 			struct page *page;
 
-			if (cs->nr_segs == cs->pipe->buffers)
+			if (cs->nr_segs == cs->max_segs)
 				return -EIO;
 
 			page = alloc_page(GFP_HIGHUSER);
@@ -790,7 +791,7 @@ static int fuse_ref_page(struct fuse_copy_state *cs, struct page *page,
 {
 	struct pipe_buffer *buf;
 
-	if (cs->nr_segs == cs->pipe->buffers)
+	if (cs->nr_segs == cs->max_segs)
 		return -EIO;
 
 	unlock_request(cs->fc, cs->req);
@@ -1222,19 +1223,22 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	int ret;
 	int page_nr = 0;
 	int do_wakeup = 0;
+	unsigned long max_segs;
 	struct pipe_buffer *bufs;
 	struct fuse_copy_state cs;
 	struct fuse_conn *fc = fuse_get_conn(in);
 	if (!fc)
 		return -EPERM;
 
-	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
+	max_segs = ACCESS_ONCE(pipe->buffers);
+	bufs = kmalloc(max_segs * sizeof(struct pipe_buffer), GFP_KERNEL);
 	if (!bufs)
 		return -ENOMEM;
 
 	fuse_copy_init(&cs, fc, 1, NULL, 0);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
+	cs.max_segs = max_segs;
 	ret = fuse_dev_do_read(fc, in, &cs, len);
 	if (ret < 0)
 		goto out;
@@ -1768,11 +1772,14 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	if (!fc)
 		return -EPERM;
 
+	/* sized under the lock, as the pipe may grow until it is taken */
+	pipe_lock(pipe);
 	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
-	if (!bufs)
+	if (!bufs) {
+		pipe_unlock(pipe);
 		return -ENOMEM;
+	}
 
-	pipe_lock(pipe);
 	nbuf = 0;
 	rem = 0;
 	for (idx = 0; idx < pipe->nrbufs && rem < len; idx++)
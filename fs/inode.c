@@ -26,6 +26,7 @@
 #include <linux/ima.h>
 #include <linux/cred.h>
 #include <linux/buffer_head.h> /* for inode_has_buffers */
+#include <linux/rculist_bl.h>
 #include "internal.h"
 
 /*
@@ -35,36 +36,34 @@
  *   inode->i_state, inode->i_hash, __iget()
  * inode->i_sb->s_inode_lru_lock protects:
  *   inode->i_sb->s_inode_lru, inode->i_lru
- * inode_sb_list_lock protects:
- *   sb->s_inodes, inode->i_sb_list
+ * the lock of each sb->s_inodes shard protects:
+ *   that shard's list, inode->i_sb_list
  * bdi->wb.list_lock protects:
  *   bdi->wb.b_{dirty,io,more_io}, inode->i_wb_list
- * inode_hash_lock protects:
- *   inode_hashtable, inode->i_hash
+ * the bit lock of each inode_hashtable bucket protects:
+ *   changes to that bucket's chain, inode->i_hash
+ *
+ * Hash lookups walk a bucket under rcu_read_lock() alone, and take
+ * inode->i_lock to check an inode they find; inodes are freed by RCU, and
+ * one that is taken off the hash is seen as unhashed under its i_lock.
  *
  * Lock ordering:
  *
- * inode_sb_list_lock
+ * sb->s_inodes shard lock
  *   inode->i_lock
  *     inode->i_sb->s_inode_lru_lock
  *
  * bdi->wb.list_lock
  *   inode->i_lock
  *
- * inode_hash_lock
- *   inode_sb_list_lock
+ * inode_hashtable bucket lock
+ *   sb->s_inodes shard lock
  *   inode->i_lock
- *
- * iunique_lock
- *   inode_hash_lock
  */
 
 static unsigned int i_hash_mask __read_mostly;
 static unsigned int i_hash_shift __read_mostly;
-static struct hlist_head *inode_hashtable __read_mostly;
-static __cacheline_aligned_in_smp DEFINE_SPINLOCK(inode_hash_lock);
-
-__cacheline_aligned_in_smp DEFINE_SPINLOCK(inode_sb_list_lock);
+static struct hlist_bl_head *inode_hashtable __read_mostly;
 
 /*
  * Empty aops. Can be used for the cases where the user does not
@@ -289,7 +288,7 @@ EXPORT_SYMBOL(address_space_init_once);
 void inode_init_once(struct inode *inode)
 {
 	memset(inode, 0, sizeof(*inode));
-	INIT_HLIST_NODE(&inode->i_hash);
+	INIT_HLIST_BL_NODE(&inode->i_hash);
 	INIT_LIST_HEAD(&inode->i_dentry);
 	INIT_LIST_HEAD(&inode->i_devices);
 	INIT_LIST_HEAD(&inode->i_wb_list);
@@ -354,21 +353,41 @@ static void inode_lru_list_del(struct inode *inode)
  */
 void inode_sb_list_add(struct inode *inode)
 {
-	spin_lock(&inode_sb_list_lock);
-	list_add(&inode->i_sb_list, &inode->i_sb->s_inodes);
-	spin_unlock(&inode_sb_list_lock);
+	struct sb_inode_list *l = get_cpu_ptr(inode->i_sb->s_inodes);
+
+	spin_lock(&l->lock);
+	inode->i_sb_list_shard = l;
+	list_add(&inode->i_sb_list, &l->list);
+	spin_unlock(&l->lock);
+	put_cpu_ptr(inode->i_sb->s_inodes);
 }
 EXPORT_SYMBOL_GPL(inode_sb_list_add);
 
 static inline void inode_sb_list_del(struct inode *inode)
 {
+	struct sb_inode_list *l = inode->i_sb_list_shard;
+
 	if (!list_empty(&inode->i_sb_list)) {
-		spin_lock(&inode_sb_list_lock);
+		spin_lock(&l->lock);
 		list_del_init(&inode->i_sb_list);
-		spin_unlock(&inode_sb_list_lock);
+		spin_unlock(&l->lock);
 	}
 }
 
+/**
+ * sb_has_inodes - check whether a superblock has any inodes left
+ * @sb:		superblock to check
+ */
+bool sb_has_inodes(struct super_block *sb)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (!list_empty(&per_cpu_ptr(sb->s_inodes, cpu)->list))
+			return true;
+	return false;
+}
+
 static unsigned long hash(struct super_block *sb, unsigned long hashval)
 {
 	unsigned long tmp;
@@ -389,13 +408,14 @@ static unsigned long hash(struct super_block *sb, unsigned long hashval)
  */
 void __insert_inode_hash(struct inode *inode, unsigned long hashval)
 {
-	struct hlist_head *b = inode_hashtable + hash(inode->i_sb, hashval);
+	struct hlist_bl_head *b = inode_hashtable + hash(inode->i_sb, hashval);
 
-	spin_lock(&inode_hash_lock);
+	hlist_bl_lock(b);
 	spin_lock(&inode->i_lock);
-	hlist_add_head(&inode->i_hash, b);
+	inode->i_hash_head = b;
+	hlist_bl_add_head_rcu(&inode->i_hash, b);
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(b);
 }
 EXPORT_SYMBOL(__insert_inode_hash);
 
@@ -407,11 +427,17 @@ EXPORT_SYMBOL(__insert_inode_hash);
  */
 void __remove_inode_hash(struct inode *inode)
 {
-	spin_lock(&inode_hash_lock);
+	struct hlist_bl_head *b = inode->i_hash_head;
+
+	/* an inode hashed with hlist_bl_add_fake() is on no bucket */
+	if (b)
+		hlist_bl_lock(b);
 	spin_lock(&inode->i_lock);
-	hlist_del_init(&inode->i_hash);
+	hlist_bl_del_init_rcu(&inode->i_hash);
+	inode->i_hash_head = NULL;
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	if (b)
+		hlist_bl_unlock(b);
 }
 EXPORT_SYMBOL(__remove_inode_hash);
 
@@ -514,24 +540,29 @@ void evict_inodes(struct super_block *sb)
 {
 	struct inode *inode, *next;
 	LIST_HEAD(dispose);
+	int cpu;
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry_safe(inode, next, &sb->s_inodes, i_sb_list) {
-		if (atomic_read(&inode->i_count))
-			continue;
+	for_each_possible_cpu(cpu) {
+		struct sb_inode_list *l = per_cpu_ptr(sb->s_inodes, cpu);
 
-		spin_lock(&inode->i_lock);
-		if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
+		spin_lock(&l->lock);
+		list_for_each_entry_safe(inode, next, &l->list, i_sb_list) {
+			if (atomic_read(&inode->i_count))
+				continue;
+
+			spin_lock(&inode->i_lock);
+			if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
+				spin_unlock(&inode->i_lock);
+				continue;
+			}
+
+			inode->i_state |= I_FREEING;
+			inode_lru_list_del(inode);
 			spin_unlock(&inode->i_lock);
-			continue;
+			list_add(&inode->i_lru, &dispose);
 		}
-
-		inode->i_state |= I_FREEING;
-		inode_lru_list_del(inode);
-		spin_unlock(&inode->i_lock);
-		list_add(&inode->i_lru, &dispose);
+		spin_unlock(&l->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 
 	dispose_list(&dispose);
 }
@@ -551,31 +582,36 @@ int invalidate_inodes(struct super_block *sb, bool kill_dirty)
 	int busy = 0;
 	struct inode *inode, *next;
 	LIST_HEAD(dispose);
+	int cpu;
 
-	spin_lock(&inode_sb_list_lock);
-	list_for_each_entry_safe(inode, next, &sb->s_inodes, i_sb_list) {
-		spin_lock(&inode->i_lock);
-		if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
-			spin_unlock(&inode->i_lock);
-			continue;
-		}
-		if (inode->i_state & I_DIRTY && !kill_dirty) {
-			spin_unlock(&inode->i_lock);
-			busy = 1;
-			continue;
-		}
-		if (atomic_read(&inode->i_count)) {
+	for_each_possible_cpu(cpu) {
+		struct sb_inode_list *l = per_cpu_ptr(sb->s_inodes, cpu);
+
+		spin_lock(&l->lock);
+		list_for_each_entry_safe(inode, next, &l->list, i_sb_list) {
+			spin_lock(&inode->i_lock);
+			if (inode->i_state & (I_NEW | I_FREEING | I_WILL_FREE)) {
+				spin_unlock(&inode->i_lock);
+				continue;
+			}
+			if (inode->i_state & I_DIRTY && !kill_dirty) {
+				spin_unlock(&inode->i_lock);
+				busy = 1;
+				continue;
+			}
+			if (atomic_read(&inode->i_count)) {
+				spin_unlock(&inode->i_lock);
+				busy = 1;
+				continue;
+			}
+
+			inode->i_state |= I_FREEING;
+			inode_lru_list_del(inode);
 			spin_unlock(&inode->i_lock);
-			busy = 1;
-			continue;
+			list_add(&inode->i_lru, &dispose);
 		}
-
-		inode->i_state |= I_FREEING;
-		inode_lru_list_del(inode);
-		spin_unlock(&inode->i_lock);
-		list_add(&inode->i_lru, &dispose);
+		spin_unlock(&l->lock);
 	}
-	spin_unlock(&inode_sb_list_lock);
 
 	dispose_list(&dispose);
 
@@ -696,22 +732,28 @@ void prune_icache_sb(struct super_block *sb, int nr_to_scan)
 	dispose_list(&freeable);
 }
 
-static void __wait_on_freeing_inode(struct inode *inode);
+static void __wait_on_freeing_inode(struct inode *inode,
+				   struct hlist_bl_head *locked);
 /*
- * Called with the inode lock held.
+ * Called either under rcu_read_lock(), with @locked NULL, or with the bit
+ * lock of @head held and @locked pointing to it. An RCU walk may see an
+ * inode that is being taken off the hash, so that is checked for under its
+ * i_lock.
  */
 static struct inode *find_inode(struct super_block *sb,
-				struct hlist_head *head,
+				struct hlist_bl_head *head,
 				int (*test)(struct inode *, void *),
-				void *data)
+				void *data, struct hlist_bl_head *locked)
 {
-	struct hlist_node *node;
+	struct hlist_bl_node *node;
 	struct inode *inode = NULL;
 
 repeat:
-	hlist_for_each_entry(inode, node, head, i_hash) {
+	hlist_bl_for_each_entry_rcu(inode, node, head, i_hash) {
+		if (inode->i_sb != sb)
+			continue;
 		spin_lock(&inode->i_lock);
-		if (inode->i_sb != sb) {
+		if (inode_unhashed(inode) || inode->i_sb != sb) {
 			spin_unlock(&inode->i_lock);
 			continue;
 		}
@@ -720,7 +762,7 @@ repeat:
 			continue;
 		}
 		if (inode->i_state & (I_FREEING|I_WILL_FREE)) {
-			__wait_on_freeing_inode(inode);
+			__wait_on_freeing_inode(inode, locked);
 			goto repeat;
 		}
 		__iget(inode);
@@ -735,24 +777,24 @@ repeat:
  * iget_locked for details.
  */
 static struct inode *find_inode_fast(struct super_block *sb,
-				struct hlist_head *head, unsigned long ino)
+				struct hlist_bl_head *head, unsigned long ino,
+				struct hlist_bl_head *locked)
 {
-	struct hlist_node *node;
+	struct hlist_bl_node *node;
 	struct inode *inode = NULL;
 
 repeat:
-	hlist_for_each_entry(inode, node, head, i_hash) {
-		spin_lock(&inode->i_lock);
-		if (inode->i_ino != ino) {
-			spin_unlock(&inode->i_lock);
+	hlist_bl_for_each_entry_rcu(inode, node, head, i_hash) {
+		if (inode->i_ino != ino || inode->i_sb != sb)
 			continue;
-		}
-		if (inode->i_sb != sb) {
+		spin_lock(&inode->i_lock);
+		if (inode_unhashed(inode) || inode->i_ino != ino ||
+		    inode->i_sb != sb) {
 			spin_unlock(&inode->i_lock);
 			continue;
 		}
 		if (inode->i_state & (I_FREEING|I_WILL_FREE)) {
-			__wait_on_freeing_inode(inode);
+			__wait_on_freeing_inode(inode, locked);
 			goto repeat;
 		}
 		__iget(inode);
@@ -839,8 +881,6 @@ struct inode *new_inode(struct super_block *sb)
 {
 	struct inode *inode;
 
-	spin_lock_prefetch(&inode_sb_list_lock);
-
 	inode = new_inode_pseudo(sb);
 	if (inode)
 		inode_sb_list_add(inode);
@@ -905,19 +945,18 @@ EXPORT_SYMBOL(unlock_new_inode);
  * hashed, and with the I_NEW flag set. The file system gets to fill it in
  * before unlocking it via unlock_new_inode().
  *
- * Note both @test and @set are called with the inode_hash_lock held, so can't
- * sleep.
+ * Note both @test and @set are called with a spinlock held, so can't sleep.
  */
 struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *),
 		int (*set)(struct inode *, void *), void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, hashval);
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	inode = find_inode(sb, head, test, data);
-	spin_unlock(&inode_hash_lock);
+	rcu_read_lock();
+	inode = find_inode(sb, head, test, data, NULL);
+	rcu_read_unlock();
 
 	if (inode) {
 		wait_on_inode(inode);
@@ -928,19 +967,20 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 	if (inode) {
 		struct inode *old;
 
-		spin_lock(&inode_hash_lock);
+		hlist_bl_lock(head);
 		/* We released the lock, so.. */
-		old = find_inode(sb, head, test, data);
+		old = find_inode(sb, head, test, data, head);
 		if (!old) {
 			if (set(inode, data))
 				goto set_failed;
 
 			spin_lock(&inode->i_lock);
 			inode->i_state = I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			inode->i_hash_head = head;
+			hlist_bl_add_head_rcu(&inode->i_hash, head);
 			spin_unlock(&inode->i_lock);
 			inode_sb_list_add(inode);
-			spin_unlock(&inode_hash_lock);
+			hlist_bl_unlock(head);
 
 			/* Return the locked inode with I_NEW set, the
 			 * caller is responsible for filling in the contents
@@ -953,7 +993,7 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 		 * us. Use the old inode instead of the one we just
 		 * allocated.
 		 */
-		spin_unlock(&inode_hash_lock);
+		hlist_bl_unlock(head);
 		destroy_inode(inode);
 		inode = old;
 		wait_on_inode(inode);
@@ -961,7 +1001,7 @@ struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 	return inode;
 
 set_failed:
-	spin_unlock(&inode_hash_lock);
+	hlist_bl_unlock(head);
 	destroy_inode(inode);
 	return NULL;
 }
@@ -982,12 +1022,12 @@ EXPORT_SYMBOL(iget5_locked);
  */
 struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, ino);
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	inode = find_inode_fast(sb, head, ino);
-	spin_unlock(&inode_hash_lock);
+	rcu_read_lock();
+	inode = find_inode_fast(sb, head, ino, NULL);
+	rcu_read_unlock();
 	if (inode) {
 		wait_on_inode(inode);
 		return inode;
@@ -997,17 +1037,18 @@ struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 	if (inode) {
 		struct inode *old;
 
-		spin_lock(&inode_hash_lock);
+		hlist_bl_lock(head);
 		/* We released the lock, so.. */
-		old = find_inode_fast(sb, head, ino);
+		old = find_inode_fast(sb, head, ino, head);
 		if (!old) {
 			inode->i_ino = ino;
 			spin_lock(&inode->i_lock);
 			inode->i_state = I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			inode->i_hash_head = head;
+			hlist_bl_add_head_rcu(&inode->i_hash, head);
 			spin_unlock(&inode->i_lock);
 			inode_sb_list_add(inode);
-			spin_unlock(&inode_hash_lock);
+			hlist_bl_unlock(head);
 
 			/* Return the locked inode with I_NEW set, the
 			 * caller is responsible for filling in the contents
@@ -1020,7 +1061,7 @@ struct inode *iget_locked(struct super_block *sb, unsigned long ino)
 		 * us. Use the old inode instead of the one we just
 		 * allocated.
 		 */
-		spin_unlock(&inode_hash_lock);
+		hlist_bl_unlock(head);
 		destroy_inode(inode);
 		inode = old;
 		wait_on_inode(inode);
@@ -1038,18 +1079,18 @@ EXPORT_SYMBOL(iget_locked);
  */
 static int test_inode_iunique(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *b = inode_hashtable + hash(sb, ino);
-	struct hlist_node *node;
+	struct hlist_bl_head *b = inode_hashtable + hash(sb, ino);
+	struct hlist_bl_node *node;
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	hlist_for_each_entry(inode, node, b, i_hash) {
+	rcu_read_lock();
+	hlist_bl_for_each_entry_rcu(inode, node, b, i_hash) {
 		if (inode->i_ino == ino && inode->i_sb == sb) {
-			spin_unlock(&inode_hash_lock);
+			rcu_read_unlock();
 			return 0;
 		}
 	}
-	spin_unlock(&inode_hash_lock);
+	rcu_read_unlock();
 
 	return 1;
 }
@@ -1124,17 +1165,17 @@ EXPORT_SYMBOL(igrab);
  * Note: I_NEW is not waited upon so you have to be very careful what you do
  * with the returned inode.  You probably should be using ilookup5() instead.
  *
- * Note2: @test is called with the inode_hash_lock held, so can't sleep.
+ * Note2: @test is called with a spinlock held, so can't sleep.
  */
 struct inode *ilookup5_nowait(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, hashval);
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	inode = find_inode(sb, head, test, data);
-	spin_unlock(&inode_hash_lock);
+	rcu_read_lock();
+	inode = find_inode(sb, head, test, data, NULL);
+	rcu_read_unlock();
 
 	return inode;
 }
@@ -1155,7 +1196,7 @@ EXPORT_SYMBOL(ilookup5_nowait);
  * This is a generalized version of ilookup() for file systems where the
  * inode number is not sufficient for unique identification of an inode.
  *
- * Note: @test is called with the inode_hash_lock held, so can't sleep.
+ * Note: @test is called with a spinlock held, so can't sleep.
  */
 struct inode *ilookup5(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
@@ -1178,12 +1219,12 @@ EXPORT_SYMBOL(ilookup5);
  */
 struct inode *ilookup(struct super_block *sb, unsigned long ino)
 {
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, ino);
 	struct inode *inode;
 
-	spin_lock(&inode_hash_lock);
-	inode = find_inode_fast(sb, head, ino);
-	spin_unlock(&inode_hash_lock);
+	rcu_read_lock();
+	inode = find_inode_fast(sb, head, ino, NULL);
+	rcu_read_unlock();
 
 	if (inode)
 		wait_on_inode(inode);
@@ -1195,13 +1236,13 @@ int insert_inode_locked(struct inode *inode)
 {
 	struct super_block *sb = inode->i_sb;
 	ino_t ino = inode->i_ino;
-	struct hlist_head *head = inode_hashtable + hash(sb, ino);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, ino);
 
 	while (1) {
-		struct hlist_node *node;
+		struct hlist_bl_node *node;
 		struct inode *old = NULL;
-		spin_lock(&inode_hash_lock);
-		hlist_for_each_entry(old, node, head, i_hash) {
+		hlist_bl_lock(head);
+		hlist_bl_for_each_entry(old, node, head, i_hash) {
 			if (old->i_ino != ino)
 				continue;
 			if (old->i_sb != sb)
@@ -1216,14 +1257,15 @@ int insert_inode_locked(struct inode *inode)
 		if (likely(!node)) {
 			spin_lock(&inode->i_lock);
 			inode->i_state |= I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			inode->i_hash_head = head;
+			hlist_bl_add_head_rcu(&inode->i_hash, head);
 			spin_unlock(&inode->i_lock);
-			spin_unlock(&inode_hash_lock);
+			hlist_bl_unlock(head);
 			return 0;
 		}
 		__iget(old);
 		spin_unlock(&old->i_lock);
-		spin_unlock(&inode_hash_lock);
+		hlist_bl_unlock(head);
 		wait_on_inode(old);
 		if (unlikely(!inode_unhashed(old))) {
 			iput(old);
@@ -1238,14 +1280,14 @@ int insert_inode_locked4(struct inode *inode, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
 {
 	struct super_block *sb = inode->i_sb;
-	struct hlist_head *head = inode_hashtable + hash(sb, hashval);
+	struct hlist_bl_head *head = inode_hashtable + hash(sb, hashval);
 
 	while (1) {
-		struct hlist_node *node;
+		struct hlist_bl_node *node;
 		struct inode *old = NULL;
 
-		spin_lock(&inode_hash_lock);
-		hlist_for_each_entry(old, node, head, i_hash) {
+		hlist_bl_lock(head);
+		hlist_bl_for_each_entry(old, node, head, i_hash) {
 			if (old->i_sb != sb)
 				continue;
 			if (!test(old, data))
@@ -1260,14 +1302,15 @@ int insert_inode_locked4(struct inode *inode, unsigned long hashval,
 		if (likely(!node)) {
 			spin_lock(&inode->i_lock);
 			inode->i_state |= I_NEW;
-			hlist_add_head(&inode->i_hash, head);
+			inode->i_hash_head = head;
+			hlist_bl_add_head_rcu(&inode->i_hash, head);
 			spin_unlock(&inode->i_lock);
-			spin_unlock(&inode_hash_lock);
+			hlist_bl_unlock(head);
 			return 0;
 		}
 		__iget(old);
 		spin_unlock(&old->i_lock);
-		spin_unlock(&inode_hash_lock);
+		hlist_bl_unlock(head);
 		wait_on_inode(old);
 		if (unlikely(!inode_unhashed(old))) {
 			iput(old);
@@ -1540,17 +1583,24 @@ EXPORT_SYMBOL(inode_wait);
  * wake_up_bit(&inode->i_state, __I_NEW) after removing from the hash list
  * will DTRT.
  */
-static void __wait_on_freeing_inode(struct inode *inode)
+static void __wait_on_freeing_inode(struct inode *inode,
+				   struct hlist_bl_head *locked)
 {
 	wait_queue_head_t *wq;
 	DEFINE_WAIT_BIT(wait, &inode->i_state, __I_NEW);
 	wq = bit_waitqueue(&inode->i_state, __I_NEW);
 	prepare_to_wait(wq, &wait.wait, TASK_UNINTERRUPTIBLE);
 	spin_unlock(&inode->i_lock);
-	spin_unlock(&inode_hash_lock);
+	if (locked)
+		hlist_bl_unlock(locked);
+	else
+		rcu_read_unlock();
 	schedule();
 	finish_wait(wq, &wait.wait);
-	spin_lock(&inode_hash_lock);
+	if (locked)
+		hlist_bl_lock(locked);
+	else
+		rcu_read_lock();
 }
 
 static __initdata unsigned long ihash_entries;
@@ -1578,7 +1628,7 @@ void __init inode_init_early(void)
 
 	inode_hashtable =
 		alloc_large_system_hash("Inode-cache",
-					sizeof(struct hlist_head),
+					sizeof(struct hlist_bl_head),
 					ihash_entries,
 					14,
 					HASH_EARLY,
@@ -1587,7 +1637,7 @@ void __init inode_init_early(void)
 					0);
 
 	for (loop = 0; loop < (1 << i_hash_shift); loop++)
-		INIT_HLIST_HEAD(&inode_hashtable[loop]);
+		INIT_HLIST_BL_HEAD(&inode_hashtable[loop]);
 }
 
 void __init inode_init(void)
@@ -1608,7 +1658,7 @@ void __init inode_init(void)
 
 	inode_hashtable =
 		alloc_large_system_hash("Inode-cache",
-					sizeof(struct hlist_head),
+					sizeof(struct hlist_bl_head),
 					ihash_entries,
 					14,
 					0,
@@ -1617,7 +1667,7 @@ void __init inode_init(void)
 					0);
 
 	for (loop = 0; loop < (1 << i_hash_shift); loop++)
-		INIT_HLIST_HEAD(&inode_hashtable[loop]);
+		INIT_HLIST_BL_HEAD(&inode_hashtable[loop]);
 }
 
 void init_special_inode(struct inode *inode, umode_t mode, dev_t rdev)
@@ -126,7 +126,7 @@ extern long do_handle_open(int mountdirfd,
 /*
  * inode.c
  */
-extern spinlock_t inode_sb_list_lock;
+extern bool sb_has_inodes(struct super_block *sb);
 
 /*
  * fs-writeback.c
@@ -0,0 +1,1752 @@
+/*
+ * Shared application/kernel submission and completion ring pairs, for
+ * supporting fast/efficient IO.
+ *
+ * An io_uring instance is a file. Mapping it gives the application two
+ * rings shared with the kernel: the submission queue (SQ), to which it
+ * adds requests by filling a struct io_uring_sqe and publishing its index
+ * in the SQ ring, and the completion queue (CQ), from which it reaps a
+ * struct io_uring_cqe for each of them. io_uring_enter() submits all the
+ * pending requests at once and optionally waits for completions; with
+ * IORING_SETUP_SQPOLL a kernel thread polls the SQ ring instead, so that
+ * an application that keeps it busy never enters the kernel at all.
+ *
+ * Requests are first attempted from the submitting context when they
+ * cannot block: reads of data that is in the page cache, and socket I/O,
+ * which is done with MSG_DONTWAIT and waits for the socket to become ready
+ * on its wait queue rather than in a thread. Everything else is handed to
+ * a per-instance pool of kernel workers, running with the mm and the
+ * credentials of the task that created the instance.
+ *
+ * A note on the read/write ordering memory barriers that are matched
+ * between the application and kernel side. When the application reads
+ * the CQ ring tail, it must use an appropriate smp_rmb() to order with the
+ * smp_wmb() the kernel uses before writing the tail. It also needs a
+ * smp_mb() before updating CQ head (ordering the entry load(s) with the
+ * head store), pairing with the smp_mb() the kernel issues after reading
+ * the head. Likewise, the application must use an appropriate smp_wmb()
+ * both before writing the SQ tail (ordering the SQ entry stores with the
+ * tail store) and, with SQPOLL, before checking IORING_SQ_NEED_WAKEUP.
+ *
+ * Also see the examples in Documentation/filesystems/io_uring.txt.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/compat.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/fsnotify.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/mmu_context.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/net.h>
+#include <linux/socket.h>
+#include <linux/uio.h>
+#include <linux/log2.h>
+#include <linux/io_uring.h>
+
+#include <asm/uaccess.h>
+
+#include "read_write.h"
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+
+/* largest buffer that can be registered, and pages looked up inline */
+#define IORING_MAX_BUF_SIZE	(1UL << 30)
+#define IORING_MAX_CACHED_PAGES	64
+
+/* rounds of a socket that polls ready but still would block */
+#define IORING_MAX_POLL_RETRIES	3
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+/*
+ * The layout of the rings, as mapped by the application, which finds its
+ * way around them with the offsets io_uring_setup() returns.
+ */
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[];
+};
+
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_uring_cqe	cqes[] ____cacheline_aligned_in_smp;
+};
+
+struct io_mapped_ubuf {
+	u64		ubuf;
+	size_t		len;
+	struct page	**pages;
+	unsigned int	nr_pages;
+};
+
+struct io_ring_ctx {
+	struct {
+		struct io_sq_ring	*sq_ring;
+		unsigned		cached_sq_head;
+		unsigned		sq_entries;
+		unsigned		sq_mask;
+		unsigned long		sq_thread_idle;
+		struct io_uring_sqe	*sq_sqes;
+		bool			compat;
+	} ____cacheline_aligned_in_smp;
+
+	/* IO offload */
+	struct workqueue_struct	*sqo_wq;
+	struct task_struct	*sqo_thread;	/* if using sq thread polling */
+	struct mm_struct	*sqo_mm;
+	const struct cred	*creds;
+	wait_queue_head_t	sqo_wait;
+
+	struct {
+		struct io_cq_ring	*cq_ring;
+		unsigned		cached_cq_tail;
+		unsigned		cq_entries;
+		unsigned		cq_mask;
+		wait_queue_head_t	cq_wait;	/* poll() of the ring */
+	} ____cacheline_aligned_in_smp;
+
+	/*
+	 * If used, fixed file set. Writers must ensure that nothing is in
+	 * flight, see io_uring_register().
+	 */
+	struct file		**user_files;
+	unsigned		nr_user_files;
+
+	/* if used, fixed mapped user buffers */
+	unsigned		nr_user_bufs;
+	struct io_mapped_ubuf	*user_bufs;
+
+	struct {
+		struct mutex		uring_lock;
+		wait_queue_head_t	wait;	/* io_uring_enter() */
+	} ____cacheline_aligned_in_smp;
+
+	struct {
+		spinlock_t		completion_lock;
+		/* requests waiting for their socket to become ready */
+		struct list_head	poll_list;
+		/* workers running a request, interrupted at teardown */
+		struct list_head	worker_list;
+		bool			dying;
+	} ____cacheline_aligned_in_smp;
+
+	atomic_t		inflight;
+	wait_queue_head_t	inflight_wait;
+};
+
+struct io_kiocb {
+	struct io_ring_ctx	*ctx;
+	struct file		*file;
+	/* one for the owner, one while io_poll_arm() works on it */
+	atomic_t		refs;
+	struct io_uring_sqe	sqe;
+	u64			user_data;
+	unsigned int		flags;
+#define REQ_F_FIXED_FILE	1	/* ctx owns file */
+#define REQ_F_FAIL_LINK		2	/* cancel the requests linked to it */
+#define REQ_F_PREP_FAILED	4	/* completes with ->result */
+	int			result;
+
+	/* on ->ctx->poll_list, or on the link_list of the request before */
+	struct list_head	list;
+	/* requests that only start once this one completed */
+	struct list_head	link_list;
+
+	struct work_struct	work;
+
+	/* armed on the wait queue of a socket */
+	wait_queue_t		wait;
+	wait_queue_head_t	*poll_head;
+	unsigned int		poll_events;
+};
+
+struct io_poll_table {
+	poll_table		pt;
+	struct io_kiocb		*req;
+};
+
+struct io_worker {
+	struct list_head	list;
+	struct task_struct	*task;
+};
+
+static struct kmem_cache *req_cachep;
+
+static const struct file_operations io_uring_fops;
+
+static void io_sq_wq_submit_work(struct work_struct *work);
+
+static unsigned io_sqring_entries(struct io_ring_ctx *ctx)
+{
+	return ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head;
+}
+
+static unsigned io_cqring_events(struct io_cq_ring *ring)
+{
+	/* See comment at the top of this file */
+	smp_rmb();
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+/*
+ * Fetch the next valid entry off the SQ ring and copy it, so that the
+ * application may reuse the slot as soon as the head moved past it.
+ * Entries with an invalid index are dropped and counted.
+ */
+static bool io_get_sqring(struct io_ring_ctx *ctx, struct io_uring_sqe *sqe)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned index;
+
+	while (ctx->cached_sq_head != ACCESS_ONCE(ring->r.tail)) {
+		/* See comment at the top of this file */
+		smp_rmb();
+		index = ACCESS_ONCE(ring->array[ctx->cached_sq_head &
+						ctx->sq_mask]);
+		ctx->cached_sq_head++;
+		if (likely(index < ctx->sq_entries)) {
+			memcpy(sqe, &ctx->sq_sqes[index], sizeof(*sqe));
+			return true;
+		}
+		ring->dropped++;
+	}
+	return false;
+}
+
+static void io_commit_sqring(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+
+	if (ring->r.head != ctx->cached_sq_head) {
+		/* the entries must be read before the slots are handed back */
+		smp_mb();
+		ACCESS_ONCE(ring->r.head) = ctx->cached_sq_head;
+	}
+}
+
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 ki_user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_uring_cqe *cqe;
+	unsigned tail = ctx->cached_cq_tail;
+
+	/*
+	 * If the CQ ring is full, we have no choice but to drop the event
+	 * and account it: the application reaps too slowly.
+	 */
+	if (tail - ACCESS_ONCE(ring->r.head) == ring->ring_entries) {
+		ring->overflow++;
+		return;
+	}
+	/* See comment at the top of this file */
+	smp_mb();
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	cqe->user_data = ki_user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+
+	ctx->cached_cq_tail++;
+	/* order the entry with the tail that publishes it */
+	smp_wmb();
+	ACCESS_ONCE(ring->r.tail) = ctx->cached_cq_tail;
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	smp_mb();
+	if (waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+	if (waitqueue_active(&ctx->cq_wait))
+		wake_up_interruptible(&ctx->cq_wait);
+}
+
+static struct io_kiocb *io_get_req(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+	if (!req)
+		return NULL;
+
+	atomic_inc(&ctx->inflight);
+	atomic_set(&req->refs, 1);
+	req->ctx = ctx;
+	req->file = NULL;
+	req->flags = 0;
+	req->poll_head = NULL;
+	INIT_LIST_HEAD(&req->list);
+	INIT_LIST_HEAD(&req->link_list);
+	INIT_WORK(&req->work, io_sq_wq_submit_work);
+	return req;
+}
+
+static void io_free_req(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (req->file && !(req->flags & REQ_F_FIXED_FILE))
+		fput(req->file);
+	kmem_cache_free(req_cachep, req);
+
+	if (atomic_dec_and_test(&ctx->inflight))
+		wake_up(&ctx->inflight_wait);
+}
+
+static void io_put_req(struct io_kiocb *req)
+{
+	if (atomic_dec_and_test(&req->refs))
+		io_free_req(req);
+}
+
+/*
+ * The head of a chain completed: start the next request, which takes over
+ * the rest of the chain. The workers issue it, so that long chains do not
+ * nest in the completion path.
+ */
+static void io_req_link_next(struct io_kiocb *req)
+{
+	struct io_kiocb *nxt;
+
+	nxt = list_first_entry(&req->link_list, struct io_kiocb, list);
+	list_del_init(&nxt->list);
+	list_splice_init(&req->link_list, &nxt->link_list);
+
+	queue_work(req->ctx->sqo_wq, &nxt->work);
+}
+
+/* The head of a chain failed: none of the requests after it start */
+static void io_fail_links(struct io_kiocb *req)
+{
+	struct io_kiocb *link;
+
+	while (!list_empty(&req->link_list)) {
+		link = list_first_entry(&req->link_list, struct io_kiocb, list);
+		list_del_init(&link->list);
+
+		io_cqring_add_event(req->ctx, link->user_data, -ECANCELED);
+		io_put_req(link);
+	}
+}
+
+static void io_complete(struct io_kiocb *req, long res)
+{
+	io_cqring_add_event(req->ctx, req->user_data, res);
+
+	if (!list_empty(&req->link_list)) {
+		if (res < 0 || (req->flags & REQ_F_FAIL_LINK))
+			io_fail_links(req);
+		else
+			io_req_link_next(req);
+	}
+	io_put_req(req);
+}
+
+static void io_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+			       poll_table *p)
+{
+	struct io_poll_table *pt = container_of(p, struct io_poll_table, pt);
+	struct io_kiocb *req = pt->req;
+
+	/* a request waits on a single queue */
+	if (req->poll_head)
+		return;
+
+	req->poll_head = head;
+	add_wait_queue(head, &req->wait);
+}
+
+/*
+ * Called with the lock of the wait queue held, possibly from interrupt
+ * context: leave the queue and have a worker retry the request.
+ */
+static int io_poll_wake(wait_queue_t *wait, unsigned mode, int sync,
+			void *key)
+{
+	struct io_kiocb *req = container_of(wait, struct io_kiocb, wait);
+	unsigned long mask = (unsigned long)key;
+
+	if (mask && !(mask & req->poll_events))
+		return 0;
+
+	list_del_init(&wait->task_list);
+	queue_work(req->ctx->sqo_wq, &req->work);
+	return 1;
+}
+
+/*
+ * Takes @req off the wait queue it is armed on. Returns false if a wakeup
+ * got there first, and queued the request to the workers.
+ */
+static bool io_poll_disarm(struct io_kiocb *req)
+{
+	wait_queue_head_t *head = req->poll_head;
+	unsigned long flags;
+	bool armed;
+
+	spin_lock_irqsave(&head->lock, flags);
+	armed = !list_empty(&req->wait.task_list);
+	if (armed)
+		list_del_init(&req->wait.task_list);
+	spin_unlock_irqrestore(&head->lock, flags);
+
+	return armed;
+}
+
+/*
+ * A socket operation of @req would block: wait for the socket to report
+ * @events, and retry then. Returns -EIOCBQUEUED once the request belongs
+ * to the wait queue or to the workers, -EAGAIN if the socket is ready
+ * already, and -ECANCELED if the ring is being torn down.
+ *
+ * Once on the wait queue, the request may be woken, retried and freed by
+ * a worker at any time: a reference keeps it around until arming is done.
+ */
+static int io_poll_arm(struct io_kiocb *req, unsigned int events)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_poll_table ipt;
+	unsigned int mask;
+	bool armed;
+	int ret;
+
+	atomic_inc(&req->refs);
+	req->poll_head = NULL;
+	req->poll_events = events | POLLERR | POLLHUP;
+	init_waitqueue_func_entry(&req->wait, io_poll_wake);
+	INIT_LIST_HEAD(&req->wait.task_list);
+
+	init_poll_funcptr(&ipt.pt, io_poll_queue_proc);
+	ipt.pt.key = req->poll_events;
+	ipt.req = req;
+
+	mask = req->file->f_op->poll(req->file, &ipt.pt);
+	if (!req->poll_head) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (mask & req->poll_events) {
+		ret = io_poll_disarm(req) ? -EAGAIN : -EIOCBQUEUED;
+		goto out;
+	}
+
+	/*
+	 * Lock order is completion_lock, then the lock of the wait queue:
+	 * io_poll_wake() takes neither, and the queue cannot fire twice.
+	 */
+	spin_lock_irq(&ctx->completion_lock);
+	spin_lock(&req->poll_head->lock);
+	armed = !list_empty(&req->wait.task_list);
+	if (armed && ctx->dying) {
+		list_del_init(&req->wait.task_list);
+		ret = -ECANCELED;
+	} else {
+		if (armed)
+			list_add_tail(&req->list, &ctx->poll_list);
+		ret = -EIOCBQUEUED;
+	}
+	spin_unlock(&req->poll_head->lock);
+	spin_unlock_irq(&ctx->completion_lock);
+out:
+	io_put_req(req);
+	return ret;
+}
+
+/* Completes the requests still waiting on a socket, as the ring goes away */
+static void io_poll_cancel_all(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req, *tmp;
+	LIST_HEAD(list);
+
+	spin_lock_irq(&ctx->completion_lock);
+	ctx->dying = true;
+	list_for_each_entry_safe(req, tmp, &ctx->poll_list, list) {
+		list_del_init(&req->list);
+		if (io_poll_disarm(req))
+			list_add_tail(&req->list, &list);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	while (!list_empty(&list)) {
+		req = list_first_entry(&list, struct io_kiocb, list);
+		list_del_init(&req->list);
+		io_complete(req, -ECANCELED);
+	}
+}
+
+/*
+ * A socket that keeps polling ready while the operation still would
+ * block is not polled for ever: after a few rounds the request goes to
+ * the workers, which then wait in the operation itself.
+ */
+static int io_sock_rw(struct io_kiocb *req, struct socket *sock, int rw,
+		      struct iovec *iov, unsigned long nr_segs, size_t len,
+		      bool force_nonblock)
+{
+	struct msghdr msg;
+	unsigned int flags;
+	int ret, tries;
+
+	for (tries = 0; ; tries++) {
+		flags = 0;
+		if (force_nonblock || tries < IORING_MAX_POLL_RETRIES)
+			flags = MSG_DONTWAIT;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = nr_segs;
+
+		if (rw == READ) {
+			ret = sock_recvmsg(sock, &msg, len, flags);
+		} else {
+			msg.msg_flags = flags;
+			ret = sock_sendmsg(sock, &msg, len);
+		}
+
+		if (ret != -EAGAIN || !flags ||
+		    (req->file->f_flags & O_NONBLOCK))
+			return ret;
+		if (tries >= IORING_MAX_POLL_RETRIES)
+			return -EAGAIN;
+
+		ret = io_poll_arm(req, rw == READ ? POLLIN : POLLOUT);
+		if (ret != -EAGAIN)
+			return ret;
+	}
+}
+
+/*
+ * True if a buffered read of @len bytes at @pos finds all its pages in the
+ * page cache and up to date, and so can be done without blocking.
+ */
+static bool io_range_cached(struct address_space *mapping, loff_t pos,
+			    size_t len)
+{
+	loff_t isize = i_size_read(mapping->host);
+	pgoff_t index, last;
+	struct page *page;
+	bool uptodate;
+
+	if (!len || pos >= isize)
+		return true;
+
+	index = pos >> PAGE_CACHE_SHIFT;
+	last = (min_t(loff_t, pos + len, isize) - 1) >> PAGE_CACHE_SHIFT;
+	if (last - index >= IORING_MAX_CACHED_PAGES)
+		return false;
+
+	for (; index <= last; index++) {
+		page = find_get_page(mapping, index);
+		if (!page)
+			return false;
+		uptodate = PageUptodate(page);
+		page_cache_release(page);
+		if (!uptodate)
+			return false;
+	}
+	return true;
+}
+
+static bool io_rw_nonblock(struct file *file, int rw, loff_t pos, size_t len)
+{
+	umode_t mode = file->f_mapping->host->i_mode;
+
+	if (!S_ISREG(mode) && !S_ISBLK(mode))
+		return file->f_flags & O_NONBLOCK;
+	if (rw == WRITE || (file->f_flags & O_DIRECT))
+		return false;
+	return io_range_cached(file->f_mapping, pos, len);
+}
+
+static ssize_t io_import_iovec(struct io_kiocb *req, int rw,
+			       struct iovec *fast_iov, struct iovec **iov,
+			       unsigned long *nr_segs,
+			       struct io_mapped_ubuf **imup)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct io_mapped_ubuf *imu;
+	u64 addr = sqe->addr;
+	size_t len = sqe->len;
+
+	*iov = fast_iov;
+	*imup = NULL;
+	if (sqe->opcode == IORING_OP_READ_FIXED ||
+	    sqe->opcode == IORING_OP_WRITE_FIXED) {
+		if (unlikely(sqe->buf_index >= ctx->nr_user_bufs))
+			return -EFAULT;
+
+		/* the range must lie within the registered buffer */
+		imu = &ctx->user_bufs[sqe->buf_index];
+		if (addr < imu->ubuf || addr + len < addr ||
+		    addr + len > imu->ubuf + imu->len)
+			return -EFAULT;
+
+		fast_iov->iov_base = (void __user *)(unsigned long)addr;
+		fast_iov->iov_len = len;
+		*nr_segs = 1;
+		*imup = imu;
+		return len;
+	}
+
+	*nr_segs = len;
+#ifdef CONFIG_COMPAT
+	if (ctx->compat)
+		return compat_rw_copy_check_uvector(rw,
+				(struct compat_iovec __user *)(unsigned long)addr,
+				len, UIO_FASTIOV, fast_iov, iov, 1);
+#endif
+	return rw_copy_check_uvector(rw,
+			(struct iovec __user *)(unsigned long)addr, len,
+			UIO_FASTIOV, fast_iov, iov, 1);
+}
+
+static int io_rw(struct io_kiocb *req, int rw, bool force_nonblock)
+{
+	struct iovec iovstack[UIO_FASTIOV], *iov = iovstack;
+	struct io_mapped_ubuf *imu;
+	struct file *file = req->file;
+	loff_t pos = req->sqe.off;
+	unsigned long nr_segs;
+	struct socket *sock;
+	io_fn_t fn;
+	iov_fn_t fnv;
+	ssize_t ret;
+	size_t len;
+	int err;
+
+	if (req->sqe.ioprio || req->sqe.rw_flags)
+		return -EINVAL;
+	if (!(file->f_mode & (rw == READ ? FMODE_READ : FMODE_WRITE)))
+		return -EBADF;
+	if (!file->f_op)
+		return -EINVAL;
+
+	ret = io_import_iovec(req, rw, iovstack, &iov, &nr_segs, &imu);
+	if (ret < 0)
+		goto out;
+	len = ret;
+
+	sock = sock_from_file(file, &err);
+	if (sock) {
+		ret = io_sock_rw(req, sock, rw, iov, nr_segs, len,
+				 force_nonblock);
+		goto out;
+	}
+
+	if (force_nonblock && !io_rw_nonblock(file, rw, pos, len)) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	ret = rw_verify_area(rw, file, &pos, len);
+	if (ret < 0)
+		goto out;
+
+	if (rw == READ) {
+		fn = file->f_op->read;
+		fnv = file->f_op->aio_read;
+	} else {
+		fn = (io_fn_t)file->f_op->write;
+		fnv = file->f_op->aio_write;
+	}
+
+	if (fnv && imu)
+		ret = do_sync_readv_writev_pinned(file, iov, nr_segs, len,
+				&pos, fnv, imu->pages, imu->ubuf & PAGE_MASK,
+				imu->nr_pages);
+	else if (fnv)
+		ret = do_sync_readv_writev(file, iov, nr_segs, len, &pos, fnv);
+	else if (fn)
+		ret = do_loop_readv_writev(file, iov, nr_segs, &pos, fn);
+	else
+		ret = -EINVAL;
+
+	if (ret > 0) {
+		if (rw == READ)
+			fsnotify_access(file);
+		else
+			fsnotify_modify(file);
+	}
+out:
+	/* a short transfer breaks a chain, like an error does */
+	if (ret >= 0 && ret != len)
+		req->flags |= REQ_F_FAIL_LINK;
+	if (iov != iovstack)
+		kfree(iov);
+	return ret;
+}
+
+static int io_fsync(struct io_kiocb *req, bool force_nonblock)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	loff_t end = sqe->off + sqe->len;
+
+	if (unlikely(sqe->addr || sqe->ioprio || sqe->buf_index))
+		return -EINVAL;
+	if (unlikely(sqe->fsync_flags & ~IORING_FSYNC_DATASYNC))
+		return -EINVAL;
+
+	/* fsync always requires a blocking context */
+	if (force_nonblock)
+		return -EAGAIN;
+
+	return vfs_fsync_range(req->file, sqe->off, end > 0 ? end : LLONG_MAX,
+			       sqe->fsync_flags & IORING_FSYNC_DATASYNC);
+}
+
+/*
+ * Issues @req and completes it, unless it is left waiting on a socket.
+ * With @force_nonblock, a request that would block goes to the workers.
+ */
+static void io_issue_req(struct io_kiocb *req, bool force_nonblock)
+{
+	int ret;
+
+	if (unlikely(req->flags & REQ_F_PREP_FAILED)) {
+		io_complete(req, req->result);
+		return;
+	}
+
+	switch (req->sqe.opcode) {
+	case IORING_OP_NOP:
+		ret = 0;
+		break;
+	case IORING_OP_READV:
+	case IORING_OP_READ_FIXED:
+		ret = io_rw(req, READ, force_nonblock);
+		break;
+	case IORING_OP_WRITEV:
+	case IORING_OP_WRITE_FIXED:
+		ret = io_rw(req, WRITE, force_nonblock);
+		break;
+	case IORING_OP_FSYNC:
+		ret = io_fsync(req, force_nonblock);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	if (ret == -EIOCBQUEUED)
+		return;
+	if (ret == -EAGAIN && force_nonblock) {
+		queue_work(req->ctx->sqo_wq, &req->work);
+		return;
+	}
+	io_complete(req, ret);
+}
+
+/*
+ * Requests in the workers may block for as long as a pipe, a tty or a
+ * socket has nothing for them. So that the ring can still go away, the
+ * worker takes SIGKILL while it runs one, which io_kill_workers() sends,
+ * and requests that only start once teardown has begun are cancelled.
+ */
+static void io_sq_wq_submit_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_ring_ctx *ctx = req->ctx;
+	struct mm_struct *mm = ctx->sqo_mm;
+	struct io_worker worker;
+	const struct cred *old_cred;
+	mm_segment_t old_fs;
+	bool dying;
+
+	worker.task = current;
+	allow_signal(SIGKILL);
+
+	/* back from a wait on a socket */
+	spin_lock_irq(&ctx->completion_lock);
+	list_del_init(&req->list);
+	dying = ctx->dying;
+	if (!dying)
+		list_add(&worker.list, &ctx->worker_list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	if (dying) {
+		io_complete(req, -ECANCELED);
+		goto out;
+	}
+
+	/* the buffers of the request are in the address space of the ring */
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		io_complete(req, -EFAULT);
+		goto out_del;
+	}
+
+	old_cred = override_creds(ctx->creds);
+	use_mm(mm);
+	old_fs = get_fs();
+	set_fs(USER_DS);
+
+	io_issue_req(req, false);
+
+	set_fs(old_fs);
+	unuse_mm(mm);
+	mmput(mm);
+	revert_creds(old_cred);
+out_del:
+	spin_lock_irq(&ctx->completion_lock);
+	list_del(&worker.list);
+	spin_unlock_irq(&ctx->completion_lock);
+out:
+	/* the worker goes back to the pool as it came */
+	flush_signals(current);
+	disallow_signal(SIGKILL);
+}
+
+/* Interrupts what the workers are blocked in, once ctx->dying is set */
+static void io_kill_workers(struct io_ring_ctx *ctx)
+{
+	struct io_worker *worker;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry(worker, &ctx->worker_list, list)
+		send_sig(SIGKILL, worker->task, 1);
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+static int io_req_prep(struct io_kiocb *req, bool from_sq_thread)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct io_uring_sqe *sqe = &req->sqe;
+	unsigned fd = sqe->fd;
+
+	if (unlikely(sqe->flags & ~(IOSQE_FIXED_FILE | IOSQE_IO_LINK)))
+		return -EINVAL;
+
+	switch (sqe->opcode) {
+	case IORING_OP_NOP:
+		return 0;
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+	case IORING_OP_FSYNC:
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sqe->flags & IOSQE_FIXED_FILE) {
+		if (unlikely(!ctx->user_files || fd >= ctx->nr_user_files))
+			return -EBADF;
+		req->file = ctx->user_files[fd];
+		req->flags |= REQ_F_FIXED_FILE;
+		return 0;
+	}
+
+	/* the sq thread has no file table to look the descriptor up in */
+	if (from_sq_thread)
+		return -EBADF;
+
+	req->file = fget(fd);
+	if (unlikely(!req->file))
+		return -EBADF;
+	return 0;
+}
+
+/*
+ * Submits up to @to_submit entries of the SQ ring, called with uring_lock
+ * held. A request with IOSQE_IO_LINK set holds back the one after it
+ * until it completes; the chain is issued once its last request is in.
+ */
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned to_submit,
+			  bool from_sq_thread)
+{
+	struct io_kiocb *req, *link = NULL;
+	int submitted = 0;
+	u8 sqe_flags;
+	int ret;
+
+	while (submitted < to_submit) {
+		req = io_get_req(ctx);
+		if (unlikely(!req))
+			break;
+		if (!io_get_sqring(ctx, &req->sqe)) {
+			io_free_req(req);
+			break;
+		}
+		submitted++;
+
+		req->user_data = req->sqe.user_data;
+		sqe_flags = req->sqe.flags;
+
+		ret = io_req_prep(req, from_sq_thread);
+		if (unlikely(ret)) {
+			/* fails when its turn comes, and breaks the chain */
+			req->flags |= REQ_F_PREP_FAILED;
+			req->result = ret;
+		}
+
+		if (link) {
+			list_add_tail(&req->list, &link->link_list);
+		} else if (sqe_flags & IOSQE_IO_LINK) {
+			link = req;
+			continue;
+		} else {
+			io_issue_req(req, true);
+		}
+
+		if (link && !(sqe_flags & IOSQE_IO_LINK)) {
+			io_issue_req(link, true);
+			link = NULL;
+		}
+	}
+
+	/* a chain ends with the batch it was submitted in */
+	if (link)
+		io_issue_req(link, true);
+
+	io_commit_sqring(ctx);
+
+	return submitted ? submitted : -EAGAIN;
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	struct mm_struct *cur_mm = NULL;
+	const struct cred *old_cred;
+	mm_segment_t old_fs;
+	unsigned long timeout;
+	unsigned to_submit;
+	DEFINE_WAIT(wait);
+
+	old_fs = get_fs();
+	set_fs(USER_DS);
+	old_cred = override_creds(ctx->creds);
+
+	timeout = jiffies + ctx->sq_thread_idle;
+	while (!kthread_should_stop()) {
+		to_submit = io_sqring_entries(ctx);
+		if (!to_submit) {
+			/* keep polling for a while before going to sleep */
+			if (time_before(jiffies, timeout)) {
+				cond_resched();
+				continue;
+			}
+
+			/* the mm may go away while we sleep */
+			if (cur_mm) {
+				unuse_mm(cur_mm);
+				mmput(cur_mm);
+				cur_mm = NULL;
+			}
+
+			prepare_to_wait(&ctx->sqo_wait, &wait,
+					TASK_INTERRUPTIBLE);
+
+			/* Tell userspace we may need a wakeup call */
+			ctx->sq_ring->flags |= IORING_SQ_NEED_WAKEUP;
+			smp_mb();
+
+			if (!io_sqring_entries(ctx) && !kthread_should_stop())
+				schedule();
+			finish_wait(&ctx->sqo_wait, &wait);
+
+			ctx->sq_ring->flags &= ~IORING_SQ_NEED_WAKEUP;
+			timeout = jiffies + ctx->sq_thread_idle;
+			continue;
+		}
+
+		/* without it, copies to and from the buffers fault */
+		if (!cur_mm && atomic_inc_not_zero(&ctx->sqo_mm->mm_users)) {
+			use_mm(ctx->sqo_mm);
+			cur_mm = ctx->sqo_mm;
+		}
+
+		mutex_lock(&ctx->uring_lock);
+		io_submit_sqes(ctx, min(to_submit, ctx->sq_entries), true);
+		mutex_unlock(&ctx->uring_lock);
+
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+
+	if (cur_mm) {
+		unuse_mm(cur_mm);
+		mmput(cur_mm);
+	}
+	revert_creds(old_cred);
+	set_fs(old_fs);
+
+	return 0;
+}
+
+/*
+ * Wait until events become available, if we don't already have some. The
+ * application must reap them itself, they become visible to it
+ * automatically.
+ */
+static int io_cqring_wait(struct io_ring_ctx *ctx, unsigned min_events,
+			  const sigset_t __user *sig, size_t sigsz)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	sigset_t ksigmask, sigsaved;
+	int ret;
+
+	if (io_cqring_events(ring) >= min_events)
+		return 0;
+
+	if (sig) {
+#ifdef CONFIG_COMPAT
+		if (is_compat_task()) {
+			compat_sigset_t csigmask;
+
+			if (sigsz != sizeof(compat_sigset_t))
+				return -EINVAL;
+			if (copy_from_user(&csigmask, sig, sizeof(csigmask)))
+				return -EFAULT;
+			sigset_from_compat(&ksigmask, &csigmask);
+		} else
+#endif
+		{
+			if (sigsz != sizeof(sigset_t))
+				return -EINVAL;
+			if (copy_from_user(&ksigmask, sig, sizeof(ksigmask)))
+				return -EFAULT;
+		}
+		sigdelsetmask(&ksigmask, sigmask(SIGKILL) | sigmask(SIGSTOP));
+		sigprocmask(SIG_SETMASK, &ksigmask, &sigsaved);
+	}
+
+	ret = wait_event_interruptible(ctx->wait,
+				       io_cqring_events(ring) >= min_events);
+	if (ret)
+		ret = -EINTR;
+
+	/* as in epoll_pwait(), a signal is delivered under the new mask */
+	if (sig) {
+#ifdef HAVE_SET_RESTORE_SIGMASK
+		if (ret == -EINTR) {
+			memcpy(&current->saved_sigmask, &sigsaved,
+			       sizeof(sigsaved));
+			set_restore_sigmask();
+		} else
+#endif
+			sigprocmask(SIG_SETMASK, &sigsaved, NULL);
+	}
+
+	return ret;
+}
+
+static void io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		fput(ctx->user_files[i]);
+
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned nr_args)
+{
+	__s32 __user *fds = (__s32 __user *)arg;
+	struct file *file;
+	unsigned i;
+	int ret = 0;
+	s32 fd;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		ret = -EFAULT;
+		if (copy_from_user(&fd, &fds[i], sizeof(fd)))
+			break;
+
+		ret = -EBADF;
+		file = fget(fd);
+		if (!file)
+			break;
+
+		/*
+		 * Don't allow io_uring instances to be registered: a ring
+		 * that holds itself would never be released.
+		 */
+		if (file->f_op == &io_uring_fops) {
+			fput(file);
+			break;
+		}
+
+		ctx->user_files[i] = file;
+		ctx->nr_user_files++;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_files_unregister(ctx);
+
+	return ret;
+}
+
+static void *io_pages_alloc(unsigned nr_pages)
+{
+	size_t size = nr_pages * sizeof(struct page *);
+
+	if (size <= PAGE_SIZE)
+		return kmalloc(size, GFP_KERNEL);
+	return vmalloc(size);
+}
+
+static void io_pages_free(struct page **pages)
+{
+	if (is_vmalloc_addr(pages))
+		vfree(pages);
+	else
+		kfree(pages);
+}
+
+static void io_unaccount_mem(struct mm_struct *mm, unsigned long nr_pages)
+{
+	down_write(&mm->mmap_sem);
+	mm->pinned_vm -= nr_pages;
+	up_write(&mm->mmap_sem);
+}
+
+static int io_account_mem(struct mm_struct *mm, unsigned long nr_pages)
+{
+	unsigned long lock_limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	int ret = 0;
+
+	down_write(&mm->mmap_sem);
+	if (mm->pinned_vm + nr_pages > lock_limit && !capable(CAP_IPC_LOCK))
+		ret = -ENOMEM;
+	else
+		mm->pinned_vm += nr_pages;
+	up_write(&mm->mmap_sem);
+
+	return ret;
+}
+
+static void io_sqe_buffer_unregister(struct io_ring_ctx *ctx)
+{
+	struct io_mapped_ubuf *imu;
+	unsigned i, j;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++) {
+		imu = &ctx->user_bufs[i];
+
+		for (j = 0; j < imu->nr_pages; j++)
+			put_page(imu->pages[j]);
+		io_unaccount_mem(ctx->sqo_mm, imu->nr_pages);
+		io_pages_free(imu->pages);
+	}
+
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+}
+
+static int io_copy_iov(struct io_ring_ctx *ctx, struct iovec *dst,
+		       void __user *arg, unsigned index)
+{
+	struct iovec __user *src;
+
+#ifdef CONFIG_COMPAT
+	if (ctx->compat) {
+		struct compat_iovec __user *ciovs;
+		struct compat_iovec ciov;
+
+		ciovs = (struct compat_iovec __user *)arg;
+		if (copy_from_user(&ciov, &ciovs[index], sizeof(ciov)))
+			return -EFAULT;
+
+		dst->iov_base = compat_ptr(ciov.iov_base);
+		dst->iov_len = ciov.iov_len;
+		return 0;
+	}
+#endif
+	src = (struct iovec __user *)arg;
+	if (copy_from_user(dst, &src[index], sizeof(*dst)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Pins the pages of the buffers, so that I/O to them needs no page
+ * lookups and no faults. They are charged to RLIMIT_MEMLOCK.
+ */
+static int io_sqe_buffer_register(struct io_ring_ctx *ctx, void __user *arg,
+				  unsigned nr_args)
+{
+	struct mm_struct *mm = ctx->sqo_mm;
+	struct io_mapped_ubuf *imu;
+	struct page **pages;
+	unsigned long ubuf, start, end;
+	unsigned i, nr_pages;
+	struct iovec iov;
+	int ret, pret;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > UIO_MAXIOV)
+		return -EINVAL;
+	if (current->mm != mm)
+		return -EINVAL;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+				 GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		ret = io_copy_iov(ctx, &iov, arg, i);
+		if (ret)
+			goto err;
+
+		ret = -EFAULT;
+		if (!iov.iov_base || !iov.iov_len ||
+		    iov.iov_len > IORING_MAX_BUF_SIZE)
+			goto err;
+		if (!access_ok(VERIFY_WRITE, iov.iov_base, iov.iov_len))
+			goto err;
+
+		ubuf = (unsigned long)iov.iov_base;
+		end = (ubuf + iov.iov_len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		start = ubuf >> PAGE_SHIFT;
+		nr_pages = end - start;
+
+		ret = io_account_mem(mm, nr_pages);
+		if (ret)
+			goto err;
+
+		ret = -ENOMEM;
+		pages = io_pages_alloc(nr_pages);
+		if (!pages) {
+			io_unaccount_mem(mm, nr_pages);
+			goto err;
+		}
+
+		down_read(&mm->mmap_sem);
+		pret = get_user_pages(current, mm, ubuf & PAGE_MASK, nr_pages,
+				      1, 0, pages, NULL);
+		up_read(&mm->mmap_sem);
+
+		if (pret != nr_pages) {
+			while (pret > 0)
+				put_page(pages[--pret]);
+			io_pages_free(pages);
+			io_unaccount_mem(mm, nr_pages);
+			ret = pret < 0 ? pret : -EFAULT;
+			goto err;
+		}
+
+		imu = &ctx->user_bufs[i];
+		imu->ubuf = ubuf;
+		imu->len = iov.iov_len;
+		imu->pages = pages;
+		imu->nr_pages = nr_pages;
+		ctx->nr_user_bufs++;
+	}
+	return 0;
+err:
+	io_sqe_buffer_unregister(ctx);
+	return ret;
+}
+
+static void *io_mem_alloc(size_t size)
+{
+	gfp_t gfp_flags = GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN |
+			  __GFP_NORETRY;
+
+	return (void *)__get_free_pages(gfp_flags, get_order(size));
+}
+
+static void io_mem_free(void *ptr, size_t size)
+{
+	if (ptr)
+		free_pages((unsigned long)ptr, get_order(size));
+}
+
+static size_t io_sq_ring_size(unsigned entries)
+{
+	return sizeof(struct io_sq_ring) + entries * sizeof(u32);
+}
+
+static size_t io_sqes_size(unsigned entries)
+{
+	return entries * sizeof(struct io_uring_sqe);
+}
+
+static size_t io_cq_ring_size(unsigned entries)
+{
+	return sizeof(struct io_cq_ring) + entries * sizeof(struct io_uring_cqe);
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	if (ctx->sqo_thread)
+		kthread_stop(ctx->sqo_thread);
+
+	/*
+	 * Nothing is submitted from here on; what is left waits on sockets
+	 * or runs in the workers, and chains may queue more work until the
+	 * workqueue is drained. Work that starts from now on is cancelled,
+	 * and work that is blocked is interrupted.
+	 */
+	io_poll_cancel_all(ctx);
+	io_kill_workers(ctx);
+	if (ctx->sqo_wq)
+		destroy_workqueue(ctx->sqo_wq);
+
+	io_sqe_buffer_unregister(ctx);
+	io_sqe_files_unregister(ctx);
+
+	if (ctx->sqo_mm)
+		mmdrop(ctx->sqo_mm);
+	if (ctx->creds)
+		put_cred(ctx->creds);
+
+	io_mem_free(ctx->sq_ring, io_sq_ring_size(ctx->sq_entries));
+	io_mem_free(ctx->sq_sqes, io_sqes_size(ctx->sq_entries));
+	io_mem_free(ctx->cq_ring, io_cq_ring_size(ctx->cq_entries));
+
+	kfree(ctx);
+}
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	struct io_sq_ring *sq_ring = ctx->sq_ring;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	/* See comment at the top of this file */
+	smp_rmb();
+	if (ACCESS_ONCE(sq_ring->r.tail) - ACCESS_ONCE(sq_ring->r.head) !=
+	    ctx->sq_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (io_cqring_events(ctx->cq_ring))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	file->private_data = NULL;
+	io_ring_ctx_free(ctx);
+	return 0;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long sz = vma->vm_end - vma->vm_start;
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned long pfn;
+	size_t size;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		size = io_sq_ring_size(ctx->sq_entries);
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		size = io_sqes_size(ctx->sq_entries);
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		size = io_cq_ring_size(ctx->cq_entries);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sz > PAGE_SIZE << get_order(size))
+		return -EINVAL;
+
+	pfn = virt_to_phys(ptr) >> PAGE_SHIFT;
+	return remap_pfn_range(vma, vma->vm_start, pfn, sz, vma->vm_page_prot);
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+	.llseek		= noop_llseek,
+};
+
+SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags, const sigset_t __user *, sig,
+		size_t, sigsz)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	int submitted = 0;
+	struct file *file;
+	int fput_needed;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	file = fget_light(fd, &fput_needed);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = file->private_data;
+
+	/*
+	 * For SQ polling, the thread will do all submissions and
+	 * completions. Just return the requested submit count, and wake
+	 * the thread if we were asked to.
+	 */
+	ret = 0;
+	if (ctx->sqo_thread) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		submitted = to_submit;
+	} else if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_submit_sqes(ctx, to_submit, false);
+		mutex_unlock(&ctx->uring_lock);
+
+		if (submitted < 0) {
+			ret = submitted;
+			goto out_fput;
+		}
+	}
+
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->cq_entries);
+		ret = io_cqring_wait(ctx, min_complete, sig, sigsz);
+	}
+
+out_fput:
+	fput_light(file, fput_needed);
+	return submitted ? submitted : ret;
+}
+
+static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
+				  struct io_uring_params *p)
+{
+	struct io_sq_ring *sq_ring;
+	struct io_cq_ring *cq_ring;
+
+	sq_ring = io_mem_alloc(io_sq_ring_size(p->sq_entries));
+	if (!sq_ring)
+		return -ENOMEM;
+
+	ctx->sq_ring = sq_ring;
+	sq_ring->ring_mask = p->sq_entries - 1;
+	sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_mask = sq_ring->ring_mask;
+	ctx->sq_entries = sq_ring->ring_entries;
+
+	ctx->sq_sqes = io_mem_alloc(io_sqes_size(p->sq_entries));
+	if (!ctx->sq_sqes)
+		return -ENOMEM;
+
+	cq_ring = io_mem_alloc(io_cq_ring_size(p->cq_entries));
+	if (!cq_ring)
+		return -ENOMEM;
+
+	ctx->cq_ring = cq_ring;
+	cq_ring->ring_mask = p->cq_entries - 1;
+	cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_mask = cq_ring->ring_mask;
+	ctx->cq_entries = cq_ring->ring_entries;
+	return 0;
+}
+
+static int io_sq_offload_start(struct io_ring_ctx *ctx,
+			       struct io_uring_params *p)
+{
+	int cpu;
+
+	if (p->flags & IORING_SETUP_SQPOLL) {
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+
+		ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
+		if (!ctx->sq_thread_idle)
+			ctx->sq_thread_idle = HZ;
+
+		if (p->flags & IORING_SETUP_SQ_AFF) {
+			cpu = p->sq_thread_cpu;
+			if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+				return -EINVAL;
+
+			ctx->sqo_thread = kthread_create_on_node(io_sq_thread,
+					ctx, cpu_to_node(cpu), "io_uring-sq/%d",
+					cpu);
+			if (!IS_ERR(ctx->sqo_thread))
+				kthread_bind(ctx->sqo_thread, cpu);
+		} else {
+			ctx->sqo_thread = kthread_create(io_sq_thread, ctx,
+							 "io_uring-sq");
+		}
+		if (IS_ERR(ctx->sqo_thread)) {
+			int ret = PTR_ERR(ctx->sqo_thread);
+
+			ctx->sqo_thread = NULL;
+			return ret;
+		}
+	} else if (p->flags & IORING_SETUP_SQ_AFF) {
+		/* Can't have SQ_AFF without SQPOLL */
+		return -EINVAL;
+	}
+
+	/* Do QD, or 2 * CPUS, whatever is smallest */
+	ctx->sqo_wq = alloc_workqueue("io_ring-wq", WQ_UNBOUND | WQ_FREEZABLE,
+			min(ctx->sq_entries - 1, 2 * num_online_cpus()));
+	if (!ctx->sqo_wq)
+		return -ENOMEM;
+
+	if (ctx->sqo_thread)
+		wake_up_process(ctx->sqo_thread);
+	return 0;
+}
+
+static struct io_ring_ctx *io_ring_ctx_alloc(void)
+{
+	struct io_ring_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	init_waitqueue_head(&ctx->sqo_wait);
+	init_waitqueue_head(&ctx->cq_wait);
+	mutex_init(&ctx->uring_lock);
+	init_waitqueue_head(&ctx->wait);
+	spin_lock_init(&ctx->completion_lock);
+	INIT_LIST_HEAD(&ctx->poll_list);
+	INIT_LIST_HEAD(&ctx->worker_list);
+	atomic_set(&ctx->inflight, 0);
+	init_waitqueue_head(&ctx->inflight_wait);
+	return ctx;
+}
+
+static int io_uring_create(unsigned entries, struct io_uring_params *p,
+			   struct io_uring_params __user *params)
+{
+	struct io_ring_ctx *ctx;
+	int ret;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	/*
+	 * Use twice as many entries for the CQ ring. It's possible for the
+	 * application to drive a higher depth than the size of the SQ ring,
+	 * since the sqes are only used at submission time.
+	 */
+	p->sq_entries = roundup_pow_of_two(entries);
+	p->cq_entries = 2 * p->sq_entries;
+
+	ctx = io_ring_ctx_alloc();
+	if (!ctx)
+		return -ENOMEM;
+
+#ifdef CONFIG_COMPAT
+	ctx->compat = is_compat_task();
+#endif
+	ctx->creds = get_current_cred();
+	atomic_inc(&current->mm->mm_count);
+	ctx->sqo_mm = current->mm;
+
+	ret = io_allocate_scq_urings(ctx, p);
+	if (ret)
+		goto err;
+
+	ret = io_sq_offload_start(ctx, p);
+	if (ret)
+		goto err;
+
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+
+	ret = -EFAULT;
+	if (copy_to_user(params, p, sizeof(*p)))
+		goto err;
+
+	ret = anon_inode_getfd("[io_uring]", &io_uring_fops, ctx,
+			       O_RDWR | O_CLOEXEC);
+	if (ret < 0)
+		goto err;
+	return ret;
+err:
+	io_ring_ctx_free(ctx);
+	return ret;
+}
+
+/*
+ * Sets up an aio uring context, and returns the fd. Applications asks for a
+ * ring size, we return the actual sq/cq ring sizes (among other things) in
+ * the params structure passed in.
+ */
+SYSCALL_DEFINE2(io_uring_setup, u32, entries,
+		struct io_uring_params __user *, params)
+{
+	struct io_uring_params p;
+	int i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+
+	/* IORING_SETUP_IOPOLL is not supported */
+	if (p.flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF))
+		return -EINVAL;
+
+	return io_uring_create(entries, &p, params);
+}
+
+/*
+ * Requests in flight may still use the registered files and buffers: wait
+ * for them to go before taking them away. New ones are kept out by
+ * uring_lock.
+ */
+static int io_wait_idle(struct io_ring_ctx *ctx)
+{
+	if (wait_event_interruptible(ctx->inflight_wait,
+				     !atomic_read(&ctx->inflight)))
+		return -EINTR;
+	return 0;
+}
+
+static int __io_uring_register(struct io_ring_ctx *ctx, unsigned opcode,
+			       void __user *arg, unsigned nr_args)
+{
+	int ret;
+
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = io_sqe_buffer_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_BUFFERS:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_bufs)
+			break;
+		ret = io_wait_idle(ctx);
+		if (!ret)
+			io_sqe_buffer_unregister(ctx);
+		break;
+	case IORING_REGISTER_FILES:
+		ret = io_sqe_files_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_FILES:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_files)
+			break;
+		ret = io_wait_idle(ctx);
+		if (!ret)
+			io_sqe_files_unregister(ctx);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	return ret;
+}
+
+SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	struct file *file;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = file->private_data;
+
+	mutex_lock(&ctx->uring_lock);
+	ret = __io_uring_register(ctx, opcode, arg, nr_args);
+	mutex_unlock(&ctx->uring_lock);
+out_fput:
+	fput(file);
+	return ret;
+}
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	return 0;
+}
+__initcall(io_uring_init);
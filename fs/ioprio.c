@@ -66,7 +66,8 @@ int set_task_ioprio(struct task_struct *task, int ioprio)
 
 	if (!err) {
 		ioc->ioprio = ioprio;
-		ioc->ioprio_changed = 1;
+		set_bit(IOC_CFQ_IOPRIO_CHANGED, &ioc->ioprio_changed);
+		set_bit(IOC_BFQ_IOPRIO_CHANGED, &ioc->ioprio_changed);
 	}
 
 	task_unlock(task);
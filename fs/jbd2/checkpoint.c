@@ -554,6 +554,58 @@ int jbd2_cleanup_journal_tail(journal_t *journal)
 	return 0;
 }
 
+/*
+ * jbd2_checkpoint_work: background checkpointing, queued by the commit
+ * code once it is done with a transaction.
+ *
+ * Reaps the checkpoint buffers that writeback has already cleaned, and if
+ * free log space has dropped below JBD2_CHECKPOINT_START transactions'
+ * worth, checkpoints until there is JBD2_CHECKPOINT_STOP transactions'
+ * worth again, so that handles rarely have to wait in
+ * __jbd2_log_wait_for_space() for a checkpoint to be done.
+ */
+void jbd2_checkpoint_work(struct work_struct *work)
+{
+	journal_t *journal = container_of(work, journal_t, j_checkpoint_work);
+	int nblocks = journal->j_max_transaction_buffers;
+	int space_left, did = 0;
+	ktime_t start;
+
+	spin_lock(&journal->j_list_lock);
+	__jbd2_journal_clean_checkpoint_list(journal);
+	spin_unlock(&journal->j_list_lock);
+
+	read_lock(&journal->j_state_lock);
+	space_left = __jbd2_log_space_left(journal);
+	read_unlock(&journal->j_state_lock);
+	if (space_left >= JBD2_CHECKPOINT_START * nblocks)
+		return;
+
+	start = ktime_get();
+	mutex_lock(&journal->j_checkpoint_mutex);
+	while (!is_journal_aborted(journal)) {
+		read_lock(&journal->j_state_lock);
+		space_left = __jbd2_log_space_left(journal);
+		read_unlock(&journal->j_state_lock);
+		if (space_left >= JBD2_CHECKPOINT_STOP * nblocks ||
+		    !journal->j_checkpoint_transactions)
+			break;
+		if (jbd2_log_do_checkpoint(journal) < 0)
+			break;
+		did = 1;
+	}
+	if (did)
+		jbd2_cleanup_journal_tail(journal);
+	mutex_unlock(&journal->j_checkpoint_mutex);
+
+	if (did) {
+		spin_lock(&journal->j_history_lock);
+		__jbd2_phase_hist_add(journal, JBD2_PHASE_CHECKPOINT, start,
+				      ktime_get());
+		spin_unlock(&journal->j_history_lock);
+	}
+}
+
 
 /* Checkpoint list management */
 
@@ -318,7 +318,8 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	int flags;
 	int err;
 	unsigned long long blocknr;
-	ktime_t start_time;
+	ktime_t start_time, lock_time, logging_time, commit_rec_time;
+	ktime_t durable_time;
 	u64 commit_time;
 	char *tagp = NULL;
 	journal_header_t *header;
@@ -355,6 +356,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	jbd_debug(1, "JBD2: starting commit of transaction %d\n",
 			commit_transaction->t_tid);
 
+	lock_time = ktime_get();
 	write_lock(&journal->j_state_lock);
 	commit_transaction->t_state = T_LOCKED;
 
@@ -364,22 +366,18 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	stats.run.rs_running = jbd2_time_diff(commit_transaction->t_start,
 					      stats.run.rs_locked);
 
-	spin_lock(&commit_transaction->t_handle_lock);
 	while (atomic_read(&commit_transaction->t_updates)) {
 		DEFINE_WAIT(wait);
 
 		prepare_to_wait(&journal->j_wait_updates, &wait,
 					TASK_UNINTERRUPTIBLE);
 		if (atomic_read(&commit_transaction->t_updates)) {
-			spin_unlock(&commit_transaction->t_handle_lock);
 			write_unlock(&journal->j_state_lock);
 			schedule();
 			write_lock(&journal->j_state_lock);
-			spin_lock(&commit_transaction->t_handle_lock);
 		}
 		finish_wait(&journal->j_wait_updates, &wait);
 	}
-	spin_unlock(&commit_transaction->t_handle_lock);
 
 	J_ASSERT (atomic_read(&commit_transaction->t_outstanding_credits) <=
 			journal->j_max_transaction_buffers);
@@ -418,15 +416,6 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 		jbd2_journal_refile_buffer(journal, jh);
 	}
 
-	/*
-	 * Now try to drop any written-back buffers from the journal's
-	 * checkpoint lists.  We do this *before* commit because it potentially
-	 * frees some memory
-	 */
-	spin_lock(&journal->j_list_lock);
-	__jbd2_journal_clean_checkpoint_list(journal);
-	spin_unlock(&journal->j_list_lock);
-
 	jbd_debug(3, "JBD2: commit phase 1\n");
 
 	/*
@@ -474,6 +463,7 @@ void jbd2_journal_commit_transaction(journal_t *journal)
 	write_unlock(&journal->j_state_lock);
 
 	trace_jbd2_commit_logging(journal, commit_transaction);
+	logging_time = ktime_get();
 	stats.run.rs_logging = jiffies;
 	stats.run.rs_flushing = jbd2_time_diff(stats.run.rs_flushing,
 					       stats.run.rs_logging);
@@ -807,6 +797,7 @@ wait_for_iobuf:
 	commit_transaction->t_state = T_COMMIT_JFLUSH;
 	write_unlock(&journal->j_state_lock);
 
+	commit_rec_time = ktime_get();
 	if (!JBD2_HAS_INCOMPAT_FEATURE(journal,
 				       JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
 		err = journal_submit_commit_record(journal, commit_transaction,
@@ -825,6 +816,19 @@ wait_for_iobuf:
 	if (err)
 		jbd2_journal_abort(journal, err);
 
+	/*
+	 * The transaction is on stable storage now: let anybody who only
+	 * waits for it to be durable, such as fsync(), go while we file
+	 * its buffers for checkpoint.
+	 */
+	durable_time = ktime_get();
+	if (!is_journal_aborted(journal)) {
+		write_lock(&journal->j_state_lock);
+		journal->j_commit_durable = commit_transaction->t_tid;
+		write_unlock(&journal->j_state_lock);
+		wake_up(&journal->j_wait_done_commit);
+	}
+
 	/* End of a transaction!  Finally, we can do checkpoint
            processing: any buffers committed as a result of this
            transaction can be removed from any checkpoint list it was on
@@ -851,14 +855,23 @@ restart_loop:
 		int try_to_free = 0;
 
 		jh = commit_transaction->t_forget;
-		spin_unlock(&journal->j_list_lock);
 		bh = jh2bh(jh);
 		/*
 		 * Get a reference so that bh cannot be freed before we are
 		 * done with it.
 		 */
 		get_bh(bh);
-		jbd_lock_bh_state(bh);
+		/*
+		 * The buffer state lock ranks above j_list_lock.  Most of the
+		 * time nobody else holds it, so try for it first: that keeps
+		 * j_list_lock held across the whole batch of buffers moved to
+		 * the checkpoint list, rather than taking it twice for each.
+		 */
+		if (!jbd_trylock_bh_state(bh)) {
+			spin_unlock(&journal->j_list_lock);
+			jbd_lock_bh_state(bh);
+			spin_lock(&journal->j_list_lock);
+		}
 		J_ASSERT_JH(jh,	jh->b_transaction == commit_transaction);
 
 		/*
@@ -888,7 +901,6 @@ restart_loop:
 			jh->b_frozen_triggers = NULL;
 		}
 
-		spin_lock(&journal->j_list_lock);
 		cp_transaction = jh->b_cp_transaction;
 		if (cp_transaction) {
 			JBUFFER_TRACE(jh, "remove from old cp transaction");
@@ -994,11 +1006,22 @@ restart_loop:
 	journal->j_stats.run.rs_handle_count += stats.run.rs_handle_count;
 	journal->j_stats.run.rs_blocks += stats.run.rs_blocks;
 	journal->j_stats.run.rs_blocks_logged += stats.run.rs_blocks_logged;
+	__jbd2_phase_hist_add(journal, JBD2_PHASE_LOCKED, lock_time, start_time);
+	__jbd2_phase_hist_add(journal, JBD2_PHASE_FLUSHING, start_time,
+			      logging_time);
+	__jbd2_phase_hist_add(journal, JBD2_PHASE_LOGGING, logging_time,
+			      commit_rec_time);
+	__jbd2_phase_hist_add(journal, JBD2_PHASE_COMMIT, commit_rec_time,
+			      durable_time);
+	__jbd2_phase_hist_add(journal, JBD2_PHASE_FILING, durable_time,
+			      ktime_get());
+	__jbd2_phase_hist_add(journal, JBD2_PHASE_TOTAL, lock_time, ktime_get());
 	spin_unlock(&journal->j_history_lock);
 
 	commit_transaction->t_state = T_FINISHED;
 	J_ASSERT(commit_transaction == journal->j_committing_transaction);
 	journal->j_commit_sequence = commit_transaction->t_tid;
+	journal->j_commit_durable = commit_transaction->t_tid;
 	journal->j_committing_transaction = NULL;
 	commit_time = ktime_to_ns(ktime_sub(ktime_get(), start_time));
 
@@ -1045,4 +1068,5 @@ restart_loop:
 		kfree(commit_transaction);
 
 	wake_up(&journal->j_wait_done_commit);
+	jbd2_queue_checkpoint(journal);
 }
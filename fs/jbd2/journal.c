@@ -82,6 +82,7 @@ EXPORT_SYMBOL(jbd2_journal_errno);
 EXPORT_SYMBOL(jbd2_journal_ack_err);
 EXPORT_SYMBOL(jbd2_journal_clear_err);
 EXPORT_SYMBOL(jbd2_log_wait_commit);
+EXPORT_SYMBOL(jbd2_log_wait_durable);
 EXPORT_SYMBOL(jbd2_log_start_commit);
 EXPORT_SYMBOL(jbd2_journal_start_commit);
 EXPORT_SYMBOL(jbd2_journal_force_commit_nested);
@@ -512,6 +513,17 @@ int jbd2_log_start_commit(journal_t *journal, tid_t tid)
 {
 	int ret;
 
+	/*
+	 * Once a transaction grows too old or too big, every handle that
+	 * stops on it asks for its commit.  Only the first needs to take
+	 * j_state_lock for writing.
+	 */
+	read_lock(&journal->j_state_lock);
+	ret = tid_geq(journal->j_commit_request, tid);
+	read_unlock(&journal->j_state_lock);
+	if (ret)
+		return 0;
+
 	write_lock(&journal->j_state_lock);
 	ret = __jbd2_log_start_commit(journal, tid);
 	write_unlock(&journal->j_state_lock);
@@ -662,6 +674,37 @@ int jbd2_log_wait_commit(journal_t *journal, tid_t tid)
 	return err;
 }
 
+/*
+ * Wait for the commit block of a specified transaction to be on stable
+ * storage.  Unlike jbd2_log_wait_commit(), this does not wait for the
+ * commit to file the transaction's buffers for checkpoint, so callers
+ * that only need the transaction to be durable, such as fsync(), can go
+ * on while that is done.
+ * The caller may not hold the journal lock.
+ */
+int jbd2_log_wait_durable(journal_t *journal, tid_t tid)
+{
+	int err = 0;
+
+	read_lock(&journal->j_state_lock);
+	while (tid_gt(tid, journal->j_commit_durable)) {
+		jbd_debug(1, "JBD2: want %d, j_commit_durable=%d\n",
+				  tid, journal->j_commit_durable);
+		wake_up(&journal->j_wait_commit);
+		read_unlock(&journal->j_state_lock);
+		wait_event(journal->j_wait_done_commit,
+				!tid_gt(tid, journal->j_commit_durable));
+		read_lock(&journal->j_state_lock);
+	}
+	read_unlock(&journal->j_state_lock);
+
+	if (unlikely(is_journal_aborted(journal))) {
+		printk(KERN_EMERG "journal commit I/O error\n");
+		err = -EIO;
+	}
+	return err;
+}
+
 /*
  * Log buffer allocation routines:
  */
@@ -853,6 +896,75 @@ static const struct file_operations jbd2_seq_info_fops = {
 	.release        = jbd2_seq_info_release,
 };
 
+/*
+ * Add the time from start to end to the histogram of a phase.
+ * Called with j_history_lock held.
+ */
+void __jbd2_phase_hist_add(journal_t *journal, int phase,
+			   ktime_t start, ktime_t end)
+{
+	s64 us = ktime_to_us(ktime_sub(end, start));
+	int bucket = 0;
+
+	if (us > 1)
+		bucket = min_t(int, ilog2(us), JBD2_HIST_BUCKETS - 1);
+	journal->j_phase_hist[phase][bucket]++;
+}
+
+static const char *jbd2_phase_names[JBD2_NR_PHASES] = {
+	[JBD2_PHASE_LOCKED]	= "locked",
+	[JBD2_PHASE_FLUSHING]	= "flushing",
+	[JBD2_PHASE_LOGGING]	= "logging",
+	[JBD2_PHASE_COMMIT]	= "commit",
+	[JBD2_PHASE_FILING]	= "filing",
+	[JBD2_PHASE_TOTAL]	= "total",
+	[JBD2_PHASE_CHECKPOINT]	= "checkpoint",
+};
+
+static int jbd2_seq_hist_show(struct seq_file *seq, void *v)
+{
+	journal_t *journal = seq->private;
+	unsigned long (*hist)[JBD2_HIST_BUCKETS];
+	int phase, i;
+
+	hist = kmalloc(sizeof(journal->j_phase_hist), GFP_KERNEL);
+	if (!hist)
+		return -ENOMEM;
+	spin_lock(&journal->j_history_lock);
+	memcpy(hist, journal->j_phase_hist, sizeof(journal->j_phase_hist));
+	spin_unlock(&journal->j_history_lock);
+
+	seq_printf(seq, "%-10s", "usecs");
+	for (phase = 0; phase < JBD2_NR_PHASES; phase++)
+		seq_printf(seq, " %10s", jbd2_phase_names[phase]);
+	seq_putc(seq, '\n');
+	for (i = 0; i < JBD2_HIST_BUCKETS; i++) {
+		if (i == JBD2_HIST_BUCKETS - 1)
+			seq_printf(seq, ">=%-8lu", 1UL << i);
+		else
+			seq_printf(seq, "<%-9lu", 2UL << i);
+		for (phase = 0; phase < JBD2_NR_PHASES; phase++)
+			seq_printf(seq, " %10lu", hist[phase][i]);
+		seq_putc(seq, '\n');
+	}
+
+	kfree(hist);
+	return 0;
+}
+
+static int jbd2_seq_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, jbd2_seq_hist_show, PDE(inode)->data);
+}
+
+static const struct file_operations jbd2_seq_hist_fops = {
+	.owner		= THIS_MODULE,
+	.open           = jbd2_seq_hist_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
+
 static struct proc_dir_entry *proc_jbd2_stats;
 
 static void jbd2_stats_proc_init(journal_t *journal)
@@ -861,11 +973,14 @@ static void jbd2_stats_proc_init(journal_t *journal)
 	if (journal->j_proc_entry) {
 		proc_create_data("info", S_IRUGO, journal->j_proc_entry,
 				 &jbd2_seq_info_fops, journal);
+		proc_create_data("commit_hist", S_IRUGO, journal->j_proc_entry,
+				 &jbd2_seq_hist_fops, journal);
 	}
 }
 
 static void jbd2_stats_proc_exit(journal_t *journal)
 {
+	remove_proc_entry("commit_hist", journal->j_proc_entry);
 	remove_proc_entry("info", journal->j_proc_entry);
 	remove_proc_entry(journal->j_devname, proc_jbd2_stats);
 }
@@ -899,6 +1014,7 @@ static journal_t * journal_init_common (void)
 	spin_lock_init(&journal->j_revoke_lock);
 	spin_lock_init(&journal->j_list_lock);
 	rwlock_init(&journal->j_state_lock);
+	INIT_WORK(&journal->j_checkpoint_work, jbd2_checkpoint_work);
 
 	journal->j_commit_interval = (HZ * JBD2_DEFAULT_MAX_COMMIT_AGE);
 	journal->j_min_batch_time = 0;
@@ -1109,6 +1225,7 @@ static int journal_reset(journal_t *journal)
 	journal->j_tail_sequence = journal->j_transaction_sequence;
 	journal->j_commit_sequence = journal->j_transaction_sequence - 1;
 	journal->j_commit_request = journal->j_commit_sequence;
+	journal->j_commit_durable = journal->j_commit_sequence;
 
 	journal->j_max_transaction_buffers = journal->j_maxlen / 4;
 
@@ -1377,6 +1494,9 @@ int jbd2_journal_destroy(journal_t *journal)
 	if (journal->j_running_transaction)
 		jbd2_journal_commit_transaction(journal);
 
+	/* Nothing queues background checkpointing any more */
+	cancel_work_sync(&journal->j_checkpoint_work);
+
 	/* Force any old transactions to disk */
 
 	/* Totally anal locking here... */
@@ -2346,6 +2466,16 @@ static void jbd2_journal_destroy_handle_cache(void)
 
 }
 
+/*
+ * Background checkpointing, queued at the end of each commit
+ */
+static struct workqueue_struct *jbd2_checkpoint_wq;
+
+void jbd2_queue_checkpoint(journal_t *journal)
+{
+	queue_work(jbd2_checkpoint_wq, &journal->j_checkpoint_work);
+}
+
 /*
  * Module startup and shutdown
  */
@@ -2377,6 +2507,12 @@ static int __init journal_init(void)
 	BUILD_BUG_ON(sizeof(struct journal_superblock_s) != 1024);
 
 	ret = journal_init_caches();
+	if (ret == 0) {
+		jbd2_checkpoint_wq = alloc_workqueue("jbd2-checkpoint",
+					WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+		if (!jbd2_checkpoint_wq)
+			ret = -ENOMEM;
+	}
 	if (ret == 0) {
 		jbd2_create_debugfs_entry();
 		jbd2_create_jbd_stats_proc_entry();
@@ -2395,6 +2531,7 @@ static void __exit journal_exit(void)
 #endif
 	jbd2_remove_debugfs_entry();
 	jbd2_remove_jbd_stats_proc_entry();
+	destroy_workqueue(jbd2_checkpoint_wq);
 	jbd2_journal_destroy_caches();
 }
 
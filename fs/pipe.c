@@ -195,18 +195,62 @@ static void iov_fault_in_pages_read(struct iovec *iov, unsigned long len)
 	}
 }
 
+/*
+ * Pages the pipe is done with are kept on tmp_pages for writers to reuse,
+ * so that a busy pipe doesn't go back to the page allocator for every
+ * page of data.  No more than PIPE_MAX_TMP_PAGES are kept, and the pages
+ * kept and the pages in use together never take more than a full pipe
+ * would, so an idle pipe holds on to little.
+ */
+#define PIPE_MAX_TMP_PAGES	8
+
+static struct page *pipe_get_page(struct pipe_inode_info *pipe)
+{
+	struct page *page;
+
+	if (!pipe->nr_tmp_pages)
+		return alloc_page(GFP_HIGHUSER);
+
+	page = list_first_entry(&pipe->tmp_pages, struct page, lru);
+	list_del(&page->lru);
+	pipe->nr_tmp_pages--;
+	return page;
+}
+
+static void pipe_put_page(struct pipe_inode_info *pipe, struct page *page)
+{
+	if (pipe->nr_tmp_pages < PIPE_MAX_TMP_PAGES &&
+	    pipe->nr_tmp_pages + pipe->nrbufs < pipe->buffers) {
+		list_add(&page->lru, &pipe->tmp_pages);
+		pipe->nr_tmp_pages++;
+	} else
+		__free_page(page);
+}
+
+static void pipe_free_tmp_pages(struct pipe_inode_info *pipe,
+				unsigned int keep)
+{
+	struct page *page;
+
+	while (pipe->nr_tmp_pages > keep) {
+		page = list_first_entry(&pipe->tmp_pages, struct page, lru);
+		list_del(&page->lru);
+		pipe->nr_tmp_pages--;
+		__free_page(page);
+	}
+}
+
 static void anon_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
 	struct page *page = buf->page;
 
 	/*
-	 * If nobody else uses this page, and we don't already have a
-	 * temporary page, let's keep track of it as a one-deep
-	 * allocation cache. (Otherwise just release our reference to it)
+	 * If nobody else uses this page, keep it for the next write.
+	 * (Otherwise just release our reference to it)
 	 */
-	if (page_count(page) == 1 && !pipe->tmp_page)
-		pipe->tmp_page = page;
+	if (page_count(page) == 1)
+		pipe_put_page(pipe, page);
 	else
 		page_cache_release(page);
 }
@@ -412,6 +456,9 @@ redo:
 				curbuf = (curbuf + 1) & (pipe->buffers - 1);
 				pipe->curbuf = curbuf;
 				pipe->nrbufs = --bufs;
+				pipe->read_since_full = 1;
+				if (!bufs)
+					pipe_shrink_idle(pipe);
 				do_wakeup = 1;
 			}
 			total_len -= chars;
@@ -540,17 +587,14 @@ redo1:
 		if (bufs < pipe->buffers) {
 			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
-			struct page *page = pipe->tmp_page;
+			struct page *page;
 			char *src;
 			int error, atomic = 1;
 
-			if (!page) {
-				page = alloc_page(GFP_HIGHUSER);
-				if (unlikely(!page)) {
-					ret = ret ? : -ENOMEM;
-					break;
-				}
-				pipe->tmp_page = page;
+			page = pipe_get_page(pipe);
+			if (unlikely(!page)) {
+				ret = ret ? : -ENOMEM;
+				break;
 			}
 			/* Always wake up, even if the copy fails. Otherwise
 			 * we lock up (O_NONBLOCK-)readers that sleep due to
@@ -581,6 +625,7 @@ redo2:
 					atomic = 0;
 					goto redo2;
 				}
+				pipe_put_page(pipe, page);
 				if (!ret)
 					ret = error;
 				break;
@@ -590,10 +635,10 @@ redo2:
 			/* Insert it into the buffer array */
 			buf->page = page;
 			buf->ops = &anon_pipe_buf_ops;
+			buf->flags = 0;
 			buf->offset = 0;
 			buf->len = chars;
 			pipe->nrbufs = ++bufs;
-			pipe->tmp_page = NULL;
 
 			total_len -= chars;
 			if (!total_len)
@@ -606,6 +651,8 @@ redo2:
 				ret = -EAGAIN;
 			break;
 		}
+		if (pipe_grow(pipe))
+			continue;
 		if (signal_pending(current)) {
 			if (!ret)
 				ret = -ERESTARTSYS;
@@ -899,6 +946,7 @@ struct pipe_inode_info * alloc_pipe_info(struct inode *inode)
 		pipe->bufs = kzalloc(sizeof(struct pipe_buffer) * PIPE_DEF_BUFFERS, GFP_KERNEL);
 		if (pipe->bufs) {
 			init_waitqueue_head(&pipe->wait);
+			INIT_LIST_HEAD(&pipe->tmp_pages);
 			pipe->r_counter = pipe->w_counter = 1;
 			pipe->inode = inode;
 			pipe->buffers = PIPE_DEF_BUFFERS;
@@ -919,8 +967,7 @@ void __free_pipe_info(struct pipe_inode_info *pipe)
 		if (buf->ops)
 			buf->ops->release(pipe, buf);
 	}
-	if (pipe->tmp_page)
-		__free_page(pipe->tmp_page);
+	pipe_free_tmp_pages(pipe, 0);
 	kfree(pipe->bufs);
 	kfree(pipe);
 }
@@ -1166,9 +1213,59 @@ static long pipe_set_size(struct pipe_inode_info *pipe, unsigned long nr_pages)
 	kfree(pipe->bufs);
 	pipe->bufs = bufs;
 	pipe->buffers = nr_pages;
+	pipe->full_count = 0;
+	if (pipe->nr_tmp_pages + pipe->nrbufs > nr_pages)
+		pipe_free_tmp_pages(pipe, nr_pages - pipe->nrbufs);
 	return nr_pages * PAGE_SIZE;
 }
 
+/*
+ * Called with the pipe locked by a writer that is about to wait for room.
+ * When the readers keep emptying the pipe and the writers keep filling
+ * it, the pipe is too small for the rate at which data goes through it:
+ * double it, up to pipe_max_size, so that readers and writers move more
+ * per wakeup.  A writer that waits again before any reader has taken
+ * from the pipe only sees a stalled reader, and that doesn't count.
+ * Returns 1 if the pipe grew.
+ */
+int pipe_grow(struct pipe_inode_info *pipe)
+{
+	unsigned int nr_pages = pipe->buffers * 2;
+
+	/* Not the internal splice pipes, nor one the user sized */
+	if (!pipe->inode || pipe->user_size)
+		return 0;
+	if (nr_pages > pipe_max_size >> PAGE_SHIFT)
+		return 0;
+	if (!pipe->read_since_full)
+		return 0;
+
+	pipe->read_since_full = 0;
+	if (time_after(jiffies, pipe->full_time + PIPE_GROW_DECAY))
+		pipe->full_count = 0;
+	pipe->full_time = jiffies;
+	if (++pipe->full_count < PIPE_GROW_FULL)
+		return 0;
+
+	return pipe_set_size(pipe, nr_pages) > 0;
+}
+
+/*
+ * Called with the pipe locked by a reader that emptied it.  A pipe that
+ * grew but has not been full for PIPE_GROW_DECAY goes back to its default
+ * size.
+ */
+void pipe_shrink_idle(struct pipe_inode_info *pipe)
+{
+	if (pipe->buffers <= PIPE_DEF_BUFFERS || pipe->user_size ||
+	    !pipe->inode || pipe->waiting_writers)
+		return;
+	if (time_before_eq(jiffies, pipe->full_time + PIPE_GROW_DECAY))
+		return;
+
+	pipe_set_size(pipe, PIPE_DEF_BUFFERS);
+}
+
 /*
  * Currently we rely on the pipe array holding a power-of-2 number
  * of pages.
@@ -1237,6 +1334,8 @@ long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
 			goto out;
 		}
 		ret = pipe_set_size(pipe, nr_pages);
+		if (ret > 0)
+			pipe->user_size = 1;
 		break;
 		}
 	case F_GETPIPE_SZ:
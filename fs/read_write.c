@@ -573,6 +573,20 @@ EXPORT_SYMBOL(iov_shorten);
 
 ssize_t do_sync_readv_writev(struct file *filp, const struct iovec *iov,
 		unsigned long nr_segs, size_t len, loff_t *ppos, iov_fn_t fn)
+{
+	return do_sync_readv_writev_pinned(filp, iov, nr_segs, len, ppos, fn,
+					   NULL, 0, 0);
+}
+
+/*
+ * do_sync_readv_writev() of a buffer whose nr_pages pages, from the user
+ * address pages_addr on, the caller has pinned: direct I/O uses them
+ * instead of looking them up.
+ */
+ssize_t do_sync_readv_writev_pinned(struct file *filp,
+		const struct iovec *iov, unsigned long nr_segs, size_t len,
+		loff_t *ppos, iov_fn_t fn, struct page **pages,
+		unsigned long pages_addr, unsigned long nr_pages)
 {
 	struct kiocb kiocb;
 	ssize_t ret;
@@ -581,6 +595,9 @@ ssize_t do_sync_readv_writev(struct file *filp, const struct iovec *iov,
 	kiocb.ki_pos = *ppos;
 	kiocb.ki_left = len;
 	kiocb.ki_nbytes = len;
+	kiocb.ki_pages = pages;
+	kiocb.ki_pages_addr = pages_addr;
+	kiocb.ki_nr_pages = nr_pages;
 
 	for (;;) {
 		ret = fn(&kiocb, iov, nr_segs, kiocb.ki_pos);
@@ -10,5 +10,9 @@ typedef ssize_t (*iov_fn_t)(struct kiocb *, const struct iovec *,
 
 ssize_t do_sync_readv_writev(struct file *filp, const struct iovec *iov,
 		unsigned long nr_segs, size_t len, loff_t *ppos, iov_fn_t fn);
+ssize_t do_sync_readv_writev_pinned(struct file *filp,
+		const struct iovec *iov, unsigned long nr_segs, size_t len,
+		loff_t *ppos, iov_fn_t fn, struct page **pages,
+		unsigned long pages_addr, unsigned long nr_pages);
 ssize_t do_loop_readv_writev(struct file *filp, struct iovec *iov,
 		unsigned long nr_segs, loff_t *ppos, io_fn_t fn);
@@ -14,7 +14,11 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/dirent.h>
+#include <linux/dirent_plus.h>
+#include <linux/namei.h>
 #include <linux/security.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/syscalls.h>
 #include <linux/unistd.h>
 
@@ -309,3 +313,227 @@ SYSCALL_DEFINE3(getdents64, unsigned int, fd,
 out:
 	return error;
 }
+
+/*
+ * getdents_plus() is getdents64() that also gives the attributes of the
+ * inodes the entries name, to save directory scanners an lstat() per
+ * entry.  The entries are gathered into a kernel buffer first: the
+ * lookups they need cannot be done from the filldir callback, which the
+ * filesystem may call with its own locks held.
+ */
+#define DIRENT_PLUS_BUF_MAX	(64 * 1024)
+
+struct getdents_plus_callback {
+	struct linux_dirent_plus * current_dir;
+	struct linux_dirent_plus * previous;
+	int count;
+	int error;
+	unsigned int nr;
+};
+
+static int filldir_plus(void * __buf, const char * name, int namlen,
+			loff_t offset, u64 ino, unsigned int d_type)
+{
+	struct linux_dirent_plus *dirent;
+	struct getdents_plus_callback * buf = __buf;
+	int reclen = ALIGN(offsetof(struct linux_dirent_plus, d_name) +
+			   namlen + 1, sizeof(u64));
+
+	buf->error = -EINVAL;	/* only used if we fail.. */
+	if (reclen > buf->count)
+		return -EINVAL;
+	if (buf->previous)
+		buf->previous->d_off = offset;
+	dirent = buf->current_dir;
+	memset(dirent, 0, offsetof(struct linux_dirent_plus, d_name));
+	dirent->d_ino = ino;
+	dirent->d_reclen = reclen;
+	dirent->d_type = d_type;
+	memcpy(dirent->d_name, name, namlen);
+	/* the terminating NUL and the padding up to reclen */
+	memset(dirent->d_name + namlen, 0,
+	       reclen - offsetof(struct linux_dirent_plus, d_name) - namlen);
+	buf->previous = dirent;
+	buf->current_dir = (void *)dirent + reclen;
+	buf->count -= reclen;
+	buf->nr++;
+	return 0;
+}
+
+/*
+ * The dentry of an entry if the dcache has it and can be trusted without
+ * asking the filesystem, NULL if it has to be looked up.  ".." is never
+ * filled in, it may well be on another filesystem.
+ */
+static struct dentry *dirent_plus_cached(struct dentry *parent,
+					 struct linux_dirent_plus *de)
+{
+	struct qstr name;
+	struct dentry *dentry;
+
+	name.name = (const unsigned char *)de->d_name;
+	name.len = strlen(de->d_name);
+	if (name.name[0] == '.') {
+		if (name.len == 1)
+			return dget(parent);
+		if (name.len == 2 && name.name[1] == '.')
+			return ERR_PTR(-ENOENT);
+	}
+
+	dentry = d_hash_and_lookup(parent, &name);
+	if (dentry && ((dentry->d_flags & DCACHE_OP_REVALIDATE) ||
+		       d_need_lookup(dentry))) {
+		dput(dentry);
+		dentry = NULL;
+	}
+	return dentry;
+}
+
+static int cmp_ino(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void dirent_plus_fill(struct linux_dirent_plus *de, struct kstat *stat)
+{
+	struct dirent_plus_attr *attr = &de->d_attr;
+
+	attr->mode = stat->mode;
+	attr->nlink = stat->nlink;
+	attr->uid = stat->uid;
+	attr->gid = stat->gid;
+	attr->rdev = new_encode_dev(stat->rdev);
+	attr->blksize = stat->blksize;
+	attr->size = stat->size;
+	attr->blocks = stat->blocks;
+	attr->atime = stat->atime.tv_sec;
+	attr->mtime = stat->mtime.tv_sec;
+	attr->ctime = stat->ctime.tv_sec;
+	attr->atime_nsec = stat->atime.tv_nsec;
+	attr->mtime_nsec = stat->mtime.tv_nsec;
+	attr->ctime_nsec = stat->ctime.tv_nsec;
+	de->d_valid |= DIRENT_PLUS_ATTR;
+}
+
+/*
+ * Fill in the attributes of the nr entries at de.  Those the dcache has
+ * are taken from there; for the rest the filesystem is asked to start
+ * reading the inodes all at once, before they are looked up one by one.
+ * Entries that are gone or have been replaced since readdir saw them are
+ * left without attributes, as are all of them if the directory may not
+ * be searched.  So are mountpoints: their dentries have the attributes of
+ * the directory that is covered, not of the root lstat() would reach.
+ */
+static void getdents_plus_attrs(struct file *file,
+				struct linux_dirent_plus *de, unsigned int nr,
+				unsigned int flags)
+{
+	struct dentry *parent = file->f_path.dentry;
+	struct inode *dir = parent->d_inode;
+	struct super_block *sb = dir->i_sb;
+	struct linux_dirent_plus *d;
+	unsigned int i, nr_missed = 0;
+	struct dentry **dentries;
+	struct kstat stat;
+	u64 *inos;
+
+	if (inode_permission(dir, MAY_EXEC))
+		return;
+
+	inos = kmalloc(nr * (sizeof(*inos) + sizeof(*dentries)), GFP_KERNEL);
+	if (!inos)
+		return;
+	dentries = (struct dentry **)(inos + nr);
+
+	for (i = 0, d = de; i < nr; i++, d = (void *)d + d->d_reclen) {
+		dentries[i] = dirent_plus_cached(parent, d);
+		if (!dentries[i])
+			inos[nr_missed++] = d->d_ino;
+	}
+
+	if (nr_missed && !(flags & DIRENT_PLUS_CACHED)) {
+		if (sb->s_op->prefetch_inodes) {
+			sort(inos, nr_missed, sizeof(*inos), cmp_ino, NULL);
+			sb->s_op->prefetch_inodes(sb, inos, nr_missed);
+		}
+
+		for (i = 0, d = de; i < nr; i++, d = (void *)d + d->d_reclen) {
+			if (dentries[i])
+				continue;
+			mutex_lock(&dir->i_mutex);
+			dentries[i] = lookup_one_len(d->d_name, parent,
+						     strlen(d->d_name));
+			mutex_unlock(&dir->i_mutex);
+		}
+	}
+
+	for (i = 0, d = de; i < nr; i++, d = (void *)d + d->d_reclen) {
+		if (IS_ERR_OR_NULL(dentries[i]))
+			continue;
+		if (dentries[i]->d_inode && !d_mountpoint(dentries[i]) &&
+		    !vfs_getattr(file->f_path.mnt, dentries[i], &stat) &&
+		    stat.ino == d->d_ino)
+			dirent_plus_fill(d, &stat);
+		dput(dentries[i]);
+	}
+
+	kfree(inos);
+}
+
+SYSCALL_DEFINE4(getdents_plus, unsigned int, fd,
+		struct linux_dirent_plus __user *, dirent, unsigned int, count,
+		unsigned int, flags)
+{
+	struct file * file;
+	struct linux_dirent_plus * kbuf;
+	struct getdents_plus_callback buf;
+	unsigned int size;
+	int error;
+
+	error = -EINVAL;
+	if (flags & ~DIRENT_PLUS_CACHED)
+		goto out;
+
+	error = -EFAULT;
+	if (!access_ok(VERIFY_WRITE, dirent, count))
+		goto out;
+
+	error = -EBADF;
+	file = fget(fd);
+	if (!file)
+		goto out;
+
+	error = -ENOMEM;
+	size = min_t(unsigned int, count, DIRENT_PLUS_BUF_MAX);
+	kbuf = kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (!kbuf && size > PAGE_SIZE) {
+		size = PAGE_SIZE;
+		kbuf = kmalloc(size, GFP_KERNEL);
+	}
+	if (!kbuf)
+		goto out_fput;
+
+	buf.current_dir = kbuf;
+	buf.previous = NULL;
+	buf.count = size;
+	buf.error = 0;
+	buf.nr = 0;
+
+	error = vfs_readdir(file, filldir_plus, &buf);
+	if (error >= 0)
+		error = buf.error;
+	if (buf.previous) {
+		buf.previous->d_off = file->f_pos;
+		getdents_plus_attrs(file, kbuf, buf.nr, flags);
+		error = size - buf.count;
+		if (copy_to_user(dirent, kbuf, error))
+			error = -EFAULT;
+	}
+	kfree(kbuf);
+out_fput:
+	fput(file);
+out:
+	return error;
+}
@@ -124,6 +124,14 @@ struct kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/*
+	 * Pages the submitter pinned for the user buffer at ki_pages_addr,
+	 * which direct I/O takes instead of looking them up, or NULL.
+	 */
+	struct page		**ki_pages;
+	unsigned long		ki_pages_addr;	/* page aligned */
+	unsigned long		ki_nr_pages;
 };
 
 #define is_sync_kiocb(iocb)	((iocb)->ki_key == KIOCB_SYNC_KEY)
@@ -140,6 +148,7 @@ struct kiocb {
 		(x)->ki_dtor = NULL;			\
 		(x)->ki_obj.tsk = tsk;			\
 		(x)->ki_user_data = 0;                  \
+		(x)->ki_pages = NULL;			\
 	} while (0)
 
 #define AIO_RING_MAGIC			0xa10a10a1
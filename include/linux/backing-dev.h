@@ -15,12 +15,15 @@
 #include <linux/fs.h>
 #include <linux/sched.h>
 #include <linux/timer.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include <linux/writeback.h>
 #include <linux/atomic.h>
 
 struct page;
 struct device;
 struct dentry;
+struct wb_writeback_work;
 
 /*
  * Bits in backing_dev_info.state
@@ -47,6 +50,30 @@ enum bdi_stat_item {
 
 #define BDI_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 
+/*
+ * Most writeback workers a bdi can have, and how many inodes each is
+ * handed at a time
+ */
+#define BDI_MAX_WORKERS		64
+#define BDI_WORKER_BATCH	16
+
+/*
+ * A writeback worker writes the inodes the flusher thread partitioned to
+ * it, in parallel with the other workers of its bdi.
+ */
+struct bdi_writeback_worker {
+	struct work_struct work;
+	struct bdi_writeback *wb;
+	struct list_head b_io;		/* inodes handed to this worker */
+	long wrote;			/* pages and inodes in this batch */
+
+	/* statistics */
+	unsigned long nr_batches;	/* batches of inodes written */
+	unsigned long nr_inodes;	/* inodes written */
+	unsigned long nr_pages;		/* pages written */
+	unsigned long busy_time;	/* jiffies spent writing */
+};
+
 struct bdi_writeback {
 	struct backing_dev_info *bdi;	/* our parent bdi */
 	unsigned int nr;
@@ -60,6 +87,11 @@ struct bdi_writeback {
 	struct list_head b_io;		/* parked for writeback */
 	struct list_head b_more_io;	/* parked for more writeback */
 	spinlock_t list_lock;		/* protects the b_* lists */
+
+	struct mutex workers_mutex;	/* held while the workers are used */
+	struct bdi_writeback_worker *workers;
+	unsigned int nr_workers;	/* 1: the flusher writes by itself */
+	struct wb_writeback_work *worker_work; /* work the workers are on */
 };
 
 struct backing_dev_info {
@@ -107,6 +139,7 @@ struct backing_dev_info {
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debug_dir;
 	struct dentry *debug_stats;
+	struct dentry *debug_workers;
 #endif
 };
 
@@ -122,12 +155,15 @@ void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages,
 			enum wb_reason reason);
 void bdi_start_background_writeback(struct backing_dev_info *bdi);
 int bdi_writeback_thread(void *data);
+void bdi_writeback_worker_fn(struct work_struct *work);
+int bdi_set_writeback_workers(struct backing_dev_info *bdi, unsigned int nr);
 int bdi_has_dirty_io(struct backing_dev_info *bdi);
 void bdi_arm_supers_timer(void);
 void bdi_wakeup_thread_delayed(struct backing_dev_info *bdi);
 void bdi_lock_two(struct bdi_writeback *wb1, struct bdi_writeback *wb2);
 
 extern spinlock_t bdi_lock;
+extern struct workqueue_struct *bdi_writeback_wq;
 extern struct list_head bdi_list;
 extern struct list_head bdi_pending_list;
 
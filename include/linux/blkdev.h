@@ -48,6 +48,17 @@ struct request_list {
 	int elvpriv;
 	mempool_t *rq_pool;
 	wait_queue_head_t wait[2];
+
+	/*
+	 * requests preallocated at queue init, indexed by their bit in
+	 * rq_map. Requests are taken from here first and from rq_pool
+	 * only when all of them are in use.
+	 */
+	struct request *rqs;
+	unsigned long *rq_map;
+	unsigned int rq_depth;
+	unsigned long rq_hits;
+	unsigned long rq_misses;
 };
 
 /*
@@ -125,10 +136,10 @@ struct request {
 	struct gendisk *rq_disk;
 	struct hd_struct *part;
 	unsigned long start_time;
-#ifdef CONFIG_BLK_CGROUP
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
-#endif
+	unsigned int stat_bytes;	/* size when dispatched, for latency stats */
+	bool stat_flush;		/* waits for a cache flush */
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
 	 */
@@ -377,6 +388,12 @@ struct request_queue {
 
 	struct mutex		sysfs_lock;
 
+	/* on-stack plugging statistics, see blk_flush_plug_list() */
+	struct blk_plug_stats __percpu *plug_stats;
+
+	/* completion latency histograms, see blk-stat.c */
+	struct blk_lat_stats __percpu *lat_stats;
+
 #if defined(CONFIG_BLK_DEV_BSG)
 	bsg_job_fn		*bsg_job_fn;
 	int			bsg_job_size;
@@ -387,6 +404,10 @@ struct request_queue {
 	/* Throttle data */
 	struct throtl_data *td;
 #endif
+#ifdef CONFIG_BLK_WBT
+	/* Writeback throttling */
+	struct rq_wb		*rq_wb;
+#endif
 };
 
 #define QUEUE_FLAG_QUEUED	1	/* uses generic tag queueing */
@@ -864,6 +885,32 @@ struct request_queue *blk_alloc_queue(gfp_t);
 struct request_queue *blk_alloc_queue_node(gfp_t, int);
 extern void blk_put_queue(struct request_queue *);
 
+/*
+ * Request latency histograms, kept per cpu.  Bucket i counts the requests
+ * that took less than 2^i usecs (and at least 2^(i-1)); the last bucket
+ * also holds everything slower.
+ */
+#define BLK_LAT_NR_BUCKETS	24
+
+enum {
+	BLK_LAT_READ,
+	BLK_LAT_WRITE,
+	BLK_LAT_DISCARD,
+	BLK_LAT_FLUSH,
+	BLK_LAT_NR_OPS,
+};
+
+/* reads and writes of up to 4k, 16k, 64k, 256k, and larger */
+#define BLK_LAT_NR_SIZES	5
+
+struct blk_lat_stats {
+	unsigned long op[BLK_LAT_NR_OPS][BLK_LAT_NR_BUCKETS];
+	unsigned long size[BLK_LAT_NR_SIZES][BLK_LAT_NR_BUCKETS];
+};
+
+#define BLK_PLUG_HASH_BITS	3
+#define BLK_PLUG_HASH_SIZE	(1 << BLK_PLUG_HASH_BITS)
+
 /*
  * blk_plug permits building a queue of related requests by holding the I/O
  * fragments for a short period. This allows merging of sequential requests
@@ -881,9 +928,18 @@ struct blk_plug {
 	struct list_head list; /* requests */
 	struct list_head cb_list; /* md requires an unplug callback */
 	unsigned int should_sort; /* list to be sorted before flushing? */
+	unsigned int count; /* number of requests on list */
+	struct hlist_head hash[BLK_PLUG_HASH_SIZE]; /* requests by end sector */
 };
 #define BLK_MAX_REQUEST_COUNT 16
 
+struct blk_plug_stats {
+	unsigned long merges; /* bios merged into a plugged request */
+	unsigned long flushes; /* batches handed to the queue */
+	unsigned long requests; /* requests in those batches */
+	unsigned long direct; /* ... spliced straight to the dispatch list */
+};
+
 struct blk_plug_cb {
 	struct list_head list;
 	void (*callback)(struct blk_plug_cb *);
@@ -1155,7 +1211,6 @@ static inline void put_dev_sector(Sector p)
 struct work_struct;
 int kblockd_schedule_work(struct request_queue *q, struct work_struct *work);
 
-#ifdef CONFIG_BLK_CGROUP
 /*
  * This should not be using sched_clock(). A real patch is in progress
  * to fix this up, until that is in place we need to disable preemption
@@ -1168,6 +1223,11 @@ static inline void set_start_time_ns(struct request *req)
 	preempt_enable();
 }
 
+static inline uint64_t rq_start_time_ns(struct request *req)
+{
+	return req->start_time_ns;
+}
+
 static inline void set_io_start_time_ns(struct request *req)
 {
 	preempt_disable();
@@ -1175,27 +1235,10 @@ static inline void set_io_start_time_ns(struct request *req)
 	preempt_enable();
 }
 
-static inline uint64_t rq_start_time_ns(struct request *req)
-{
-        return req->start_time_ns;
-}
-
 static inline uint64_t rq_io_start_time_ns(struct request *req)
 {
         return req->io_start_time_ns;
 }
-#else
-static inline void set_start_time_ns(struct request *req) {}
-static inline void set_io_start_time_ns(struct request *req) {}
-static inline uint64_t rq_start_time_ns(struct request *req)
-{
-	return 0;
-}
-static inline uint64_t rq_io_start_time_ns(struct request *req)
-{
-	return 0;
-}
-#endif
 
 #define MODULE_ALIAS_BLOCKDEV(major,minor) \
 	MODULE_ALIAS("block-major-" __stringify(major) "-" __stringify(minor))
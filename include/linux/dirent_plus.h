@@ -0,0 +1,60 @@
+/*
+ * include/linux/dirent_plus.h
+ *
+ * Header file for getdents_plus(): directory entries returned together
+ * with the attributes of the inodes they name, as lstat() would give them.
+ * Entries that are mountpoints come without attributes.
+ */
+#ifndef _LINUX_DIRENT_PLUS_H
+#define _LINUX_DIRENT_PLUS_H
+
+#include <linux/types.h>
+
+/*
+ * Attributes of the inode an entry names, valid if d_valid has
+ * DIRENT_PLUS_ATTR set
+ */
+struct dirent_plus_attr {
+	__u32	mode;
+	__u32	nlink;
+	__u32	uid;
+	__u32	gid;
+	__u32	rdev;		/* new_encode_dev() encoded */
+	__u32	blksize;
+	__u64	size;
+	__u64	blocks;		/* in 512 byte units */
+	__s64	atime;
+	__s64	mtime;
+	__s64	ctime;
+	__u32	atime_nsec;
+	__u32	mtime_nsec;
+	__u32	ctime_nsec;
+	__u32	__pad;
+};
+
+/*
+ * Laid out the same for 32 and 64 bit userspace, d_reclen is a multiple
+ * of 8 bytes.
+ */
+struct linux_dirent_plus {
+	__u64	d_ino;
+	__s64	d_off;		/* offset of the next entry */
+	__u16	d_reclen;
+	__u8	d_type;
+	__u8	__pad;
+	__u32	d_valid;	/* DIRENT_PLUS_ flags */
+	struct dirent_plus_attr d_attr;
+	char	d_name[0];
+};
+
+/*
+ * d_valid
+ */
+#define DIRENT_PLUS_ATTR	(1U << 0)	/* d_attr is filled in */
+
+/*
+ * getdents_plus() flags
+ */
+#define DIRENT_PLUS_CACHED	(1U << 0)	/* only from the dcache */
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Dynamic queue limits (dql) - Definitions
+ *
+ * dql is used along with a producer/consumer queue, typically the transmit
+ * ring of a device, which has these properties:
+ *
+ *   1) Objects are queued up to some limit specified as a number of objects
+ *      (bytes, for network devices).
+ *   2) Periodically a completion process runs and retires the objects the
+ *      consumer is done with.
+ *   3) Starvation happens when the limit has been reached, everything queued
+ *      has in fact been consumed, but completion processing has not run yet,
+ *      so nothing new can be queued.
+ *   4) The less is queued, the better (shorter latency for what is queued
+ *      behind).
+ *
+ * dql computes the limit as the smallest number of objects that avoids
+ * starvation: the limit grows when the queue ran empty while over the
+ * limit, and it shrinks by the smallest slack (objects queued beyond what
+ * was needed to stay busy) seen over a hold time.
+ *
+ * The producer calls dql_queued() with each batch of objects it queues and
+ * dql_avail() to know whether it may queue more; the consumer calls
+ * dql_completed() with the number of objects retired.  Both sides must be
+ * serialized on their own, but not against each other: the few fields the
+ * producer reads are only written by dql_completed(), and go in their own
+ * cacheline.
+ */
+
+#ifndef _LINUX_DQL_H
+#define _LINUX_DQL_H
+
+#ifdef __KERNEL__
+
+#include <linux/bug.h>
+#include <linux/cache.h>
+#include <linux/kernel.h>
+
+struct dql {
+	/* Fields accessed in enqueue path (dql_queued) */
+	unsigned int	num_queued;		/* Total ever queued */
+	unsigned int	adj_limit;		/* limit + num_completed */
+	unsigned int	last_obj_cnt;		/* Count at last queuing */
+
+	/* Fields accessed only by completion path (dql_completed) */
+
+	unsigned int	limit ____cacheline_aligned_in_smp; /* Current limit */
+	unsigned int	num_completed;		/* Total ever completed */
+
+	unsigned int	prev_ovlimit;		/* Previous over limit */
+	unsigned int	prev_num_queued;	/* Previous queue total */
+	unsigned int	prev_last_obj_cnt;	/* Previous queuing cnt */
+
+	unsigned int	lowest_slack;		/* Lowest slack found */
+	unsigned long	slack_start_time;	/* Time slacks seen */
+
+	/* Configuration */
+	unsigned int	max_limit;		/* Max limit */
+	unsigned int	min_limit;		/* Minimum limit */
+	unsigned int	slack_hold_time;	/* Time to measure slack */
+};
+
+/* Set some static maximums */
+#define DQL_MAX_OBJECT (UINT_MAX / 16)
+#define DQL_MAX_LIMIT ((UINT_MAX / 2) - DQL_MAX_OBJECT)
+
+/*
+ * Record number of objects queued. Assumes that caller has already checked
+ * availability in the queue with dql_avail.
+ */
+static inline void dql_queued(struct dql *dql, unsigned int count)
+{
+	BUG_ON(count > DQL_MAX_OBJECT);
+
+	dql->num_queued += count;
+	dql->last_obj_cnt = count;
+}
+
+/* Returns how many objects can be queued, < 0 indicates over limit. */
+static inline int dql_avail(const struct dql *dql)
+{
+	return dql->adj_limit - dql->num_queued;
+}
+
+/* Record number of completed objects and recalculate the limit. */
+extern void dql_completed(struct dql *dql, unsigned int count);
+
+/* Reset dql state */
+extern void dql_reset(struct dql *dql);
+
+/* Initialize dql state */
+extern int dql_init(struct dql *dql, unsigned hold_time);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_DQL_H */
@@ -18,6 +18,10 @@ struct sock_extended_err {
 #define SO_EE_ORIGIN_ICMP	2
 #define SO_EE_ORIGIN_ICMP6	3
 #define SO_EE_ORIGIN_TIMESTAMPING 4
+#define SO_EE_ORIGIN_ZEROCOPY	5
+
+/* for SO_EE_ORIGIN_ZEROCOPY: the data of the sends was copied after all */
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
 
 #define SO_EE_OFFENDER(ee)	((struct sockaddr*)((ee)+1))
 
@@ -26,6 +26,13 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Request an exclusive wakeup from the target file descriptor: of the
+ * epoll sets that wait on it with this flag, an event wakes up only one
+ * that has a waiter, instead of all of them
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
@@ -31,6 +31,34 @@ struct cfq_io_context {
 	struct rcu_head rcu_head;
 };
 
+struct bfq_queue;
+struct bfq_io_context {
+	void *key;
+
+	struct bfq_queue *bfqq[2];
+
+	struct io_context *ioc;
+
+	struct cfq_ttime ttime;
+
+	struct list_head queue_list;
+	struct hlist_node cic_list;
+
+	void (*dtor)(struct io_context *); /* destructor */
+	void (*exit)(struct io_context *); /* called on task exit */
+
+	struct rcu_head rcu_head;
+};
+
+/*
+ * Bits in io_context->ioprio_changed, one per io scheduler that keeps
+ * per-process state in the io_context.
+ */
+enum {
+	IOC_CFQ_IOPRIO_CHANGED,
+	IOC_BFQ_IOPRIO_CHANGED,
+};
+
 /*
  * I/O subsystem state of the associated processes.  It is refcounted
  * and kmalloc'ed. These could be shared between processes.
@@ -43,7 +71,7 @@ struct io_context {
 	spinlock_t lock;
 
 	unsigned short ioprio;
-	unsigned short ioprio_changed;
+	unsigned long ioprio_changed;
 
 #if defined(CONFIG_BLK_CGROUP) || defined(CONFIG_BLK_CGROUP_MODULE)
 	unsigned short cgroup_changed;
@@ -58,6 +86,10 @@ struct io_context {
 	struct radix_tree_root radix_root;
 	struct hlist_head cic_list;
 	void __rcu *ioc_data;
+
+	struct radix_tree_root bfq_radix_root;
+	struct hlist_head bfq_cic_list;
+	void __rcu *bfq_ioc_data;
 };
 
 static inline struct io_context *ioc_task_link(struct io_context *ioc)
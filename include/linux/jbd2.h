@@ -31,6 +31,7 @@
 #include <linux/mutex.h>
 #include <linux/timer.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 #endif
 
 #define journal_oom_retry 1
@@ -440,9 +441,6 @@ struct transaction_chp_stats_s {
  *    ->j_list_lock
  *
  *    j_state_lock
- *    ->t_handle_lock
- *
- *    j_state_lock
  *    ->j_list_lock			(journal_unmap_buffer)
  *
  */
@@ -537,13 +535,9 @@ struct transaction_s
 	 */
 	struct list_head	t_inode_list;
 
-	/*
-	 * Protects info related to handles
-	 */
-	spinlock_t		t_handle_lock;
-
 	/*
 	 * Longest time some handle had to wait for running transaction
+	 * [cmpxchg, only kept with jbd2_journal_enable_debug]
 	 */
 	unsigned long		t_max_wait;
 
@@ -559,13 +553,13 @@ struct transaction_s
 
 	/*
 	 * Number of outstanding updates running on this transaction
-	 * [t_handle_lock]
+	 * [atomic, raised under j_state_lock held for reading]
 	 */
 	atomic_t		t_updates;
 
 	/*
 	 * Number of buffers reserved for use by all handles in this transaction
-	 * handle but not yet modified. [t_handle_lock]
+	 * handle but not yet modified. [atomic]
 	 */
 	atomic_t		t_outstanding_credits;
 
@@ -587,7 +581,7 @@ struct transaction_s
 	ktime_t			t_start_time;
 
 	/*
-	 * How many handles used this transaction? [t_handle_lock]
+	 * How many handles used this transaction? [atomic]
 	 */
 	atomic_t		t_handle_count;
 
@@ -635,6 +629,34 @@ jbd2_time_diff(unsigned long start, unsigned long end)
 
 #define JBD2_NR_BATCH	64
 
+/*
+ * Checkpointing in the background starts once less than
+ * JBD2_CHECKPOINT_START times j_max_transaction_buffers of the log is
+ * free, and goes on until JBD2_CHECKPOINT_STOP times that is.  Handles
+ * only wait for a checkpoint when less than once that is free.
+ */
+#define JBD2_CHECKPOINT_START	2
+#define JBD2_CHECKPOINT_STOP	3
+
+/*
+ * Latency histograms of the phases of a commit, and of background
+ * checkpointing.  Bucket n counts the times that took 2^n to 2^(n+1)
+ * microseconds; the first also counts those under a microsecond and
+ * the last all those longer.
+ */
+enum {
+	JBD2_PHASE_LOCKED,	/* waiting for handles to stop */
+	JBD2_PHASE_FLUSHING,	/* submitting ordered data and revokes */
+	JBD2_PHASE_LOGGING,	/* writing and waiting for log blocks */
+	JBD2_PHASE_COMMIT,	/* writing the commit block until durable */
+	JBD2_PHASE_FILING,	/* filing buffers for checkpoint */
+	JBD2_PHASE_TOTAL,	/* the whole commit */
+	JBD2_PHASE_CHECKPOINT,	/* one run of background checkpointing */
+	JBD2_NR_PHASES
+};
+
+#define JBD2_HIST_BUCKETS	24
+
 /**
  * struct journal_s - The journal_s type is the concrete type associated with
  *     journal_t.
@@ -861,6 +883,13 @@ struct journal_s
 	 */
 	tid_t			j_commit_request;
 
+	/*
+	 * Sequence number of the most recent transaction whose commit
+	 * block is on stable storage; it may still be filing its buffers
+	 * for checkpoint.  Never behind j_commit_sequence. [j_state_lock]
+	 */
+	tid_t			j_commit_durable;
+
 	/*
 	 * Journal uuid: identifies the object (filesystem, LVM volume etc)
 	 * backed by this journal.  This will eventually be replaced by an array
@@ -924,12 +953,19 @@ struct journal_s
 	void			(*j_commit_callback)(journal_t *,
 						     transaction_t *);
 
+	/*
+	 * Writes back checkpoint transactions in the background, queued
+	 * after each commit
+	 */
+	struct work_struct	j_checkpoint_work;
+
 	/*
 	 * Journal statistics
 	 */
 	spinlock_t		j_history_lock;
 	struct proc_dir_entry	*j_proc_entry;
 	struct transaction_stats_s j_stats;
+	unsigned long		j_phase_hist[JBD2_NR_PHASES][JBD2_HIST_BUCKETS];
 
 	/* Failed journal commit ID */
 	unsigned int		j_failed_commit;
@@ -979,6 +1015,12 @@ extern void jbd2_journal_commit_transaction(journal_t *);
 int __jbd2_journal_clean_checkpoint_list(journal_t *journal);
 int __jbd2_journal_remove_checkpoint(struct journal_head *);
 void __jbd2_journal_insert_checkpoint(struct journal_head *, transaction_t *);
+void jbd2_checkpoint_work(struct work_struct *work);
+void jbd2_queue_checkpoint(journal_t *journal);
+
+/* Statistics */
+void __jbd2_phase_hist_add(journal_t *journal, int phase,
+			   ktime_t start, ktime_t end);
 
 
 /*
@@ -1165,6 +1207,7 @@ int __jbd2_log_start_commit(journal_t *journal, tid_t tid);
 int jbd2_journal_start_commit(journal_t *journal, tid_t *tid);
 int jbd2_journal_force_commit_nested(journal_t *journal);
 int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
+int jbd2_log_wait_durable(journal_t *journal, tid_t tid);
 int jbd2_log_do_checkpoint(journal_t *journal);
 int jbd2_trans_will_send_data_barrier(journal_t *journal, tid_t tid);
 
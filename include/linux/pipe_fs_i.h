@@ -5,6 +5,17 @@
 
 #define PIPE_DEF_BUFFERS	16
 
+/*
+ * A pipe whose blocking writers found it full this many times, each time
+ * after its readers had made room, is doubled in size, up to
+ * pipe_max_size, unless its size was set with F_SETPIPE_SZ. The count
+ * starts over when the pipe was last found full PIPE_GROW_DECAY ago, and
+ * a grown pipe that has not been full for that long goes back to
+ * PIPE_DEF_BUFFERS once it is empty.
+ */
+#define PIPE_GROW_FULL		8
+#define PIPE_GROW_DECAY		(HZ)
+
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
 #define PIPE_BUF_FLAG_GIFT	0x04	/* page is a gift */
@@ -32,7 +43,12 @@ struct pipe_buffer {
  *	@nrbufs: the number of non-empty pipe buffers in this pipe
  *	@buffers: total number of buffers (should be a power of 2)
  *	@curbuf: the current pipe buffer entry
- *	@tmp_page: cached released page
+ *	@tmp_pages: released pages kept for reuse by writers
+ *	@nr_tmp_pages: number of pages on @tmp_pages
+ *	@full_count: times a writer found the pipe full since it last grew
+ *	@full_time: jiffies when a writer last found the pipe full
+ *	@read_since_full: readers took buffers since the pipe was last full
+ *	@user_size: the size was set with F_SETPIPE_SZ, don't grow the pipe
  *	@readers: number of current readers of this pipe
  *	@writers: number of current writers of this pipe
  *	@waiting_writers: number of writers blocked waiting for room
@@ -51,7 +67,12 @@ struct pipe_inode_info {
 	unsigned int waiting_writers;
 	unsigned int r_counter;
 	unsigned int w_counter;
-	struct page *tmp_page;
+	struct list_head tmp_pages;
+	unsigned int nr_tmp_pages;
+	unsigned int full_count;
+	unsigned long full_time;
+	unsigned int read_since_full;
+	unsigned int user_size;
 	struct fasync_struct *fasync_readers;
 	struct fasync_struct *fasync_writers;
 	struct inode *inode;
@@ -150,6 +171,8 @@ void pipe_wait(struct pipe_inode_info *pipe);
 struct pipe_inode_info * alloc_pipe_info(struct inode * inode);
 void free_pipe_info(struct inode * inode);
 void __free_pipe_info(struct pipe_inode_info *);
+int pipe_grow(struct pipe_inode_info *);
+void pipe_shrink_idle(struct pipe_inode_info *);
 
 /* Generic pipe buffer ops functions */
 void *generic_pipe_buf_map(struct pipe_inode_info *, struct pipe_buffer *, int);
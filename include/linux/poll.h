@@ -25,6 +25,12 @@ extern struct ctl_table epoll_table[]; /* for sysctl */
 
 #define DEFAULT_POLLMASK (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM)
 
+/*
+ * Kernel internal: in the key, asks a socket to busy poll its device
+ * queue; in the returned mask, tells select/poll the socket can do so.
+ */
+#define POLL_BUSY_LOOP	0x8000
+
 struct poll_table_struct;
 
 /* 
@@ -39,7 +45,7 @@ typedef struct poll_table_struct {
 
 static inline void poll_wait(struct file * filp, wait_queue_head_t * wait_address, poll_table *p)
 {
-	if (p && wait_address)
+	if (p && p->qproc && wait_address)
 		p->qproc(filp, wait_address, p);
 }
 
@@ -224,11 +224,22 @@ enum {
  * The callback notifies userspace to release buffers when skb DMA is done in
  * lower device, the skb last reference should be 0 when calling this.
  * The desc is used to track userspace buffer index.
+ *
+ * The buffers of MSG_ZEROCOPY sends (callback sock_zerocopy_callback) are
+ * shared instead of copied by clones and by the segments split off an skb:
+ * each skb holds a reference in refcnt, and the last one reports sends id
+ * to id + len - 1 complete on the socket error queue. zerocopy is cleared
+ * if the data had to be copied on the way.
  */
 struct ubuf_info {
 	void (*callback)(void *);
 	void *arg;
 	unsigned long desc;
+	atomic_t refcnt;
+	u32 id;
+	u16 len;
+	u8 zerocopy;
+	u32 bytelen;
 };
 
 /* This data is invariant across clones and lives at
@@ -292,6 +303,9 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* This indicates the skb is a train of UDP datagrams of gso_size. */
+	SKB_GSO_UDP_L4 = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -354,6 +368,7 @@ typedef unsigned char *sk_buff_data_t;
  *		ports.
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
+ *	@napi_id: id of the NAPI struct this skb came from
  *	@secmark: security marking
  *	@mark: Generic packet mark
  *	@dropcount: total number of sk_receive_queue overflows
@@ -449,8 +464,11 @@ struct sk_buff {
 
 	/* 0/13 bit hole */
 
-#ifdef CONFIG_NET_DMA
-	dma_cookie_t		dma_cookie;
+#if defined CONFIG_NET_DMA || defined CONFIG_NET_RX_BUSY_POLL
+	union {
+		unsigned int	napi_id;
+		dma_cookie_t	dma_cookie;
+	};
 #endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
@@ -629,6 +647,34 @@ static inline unsigned char *skb_end_pointer(const struct sk_buff *skb)
 /* Internal */
 #define skb_shinfo(SKB)	((struct skb_shared_info *)(skb_end_pointer(SKB)))
 
+extern struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size);
+extern void sock_zerocopy_callback(void *arg);
+extern void sock_zerocopy_put(struct ubuf_info *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info *uarg);
+extern int skb_zerocopy_from_user(struct sk_buff *skb,
+				  const void __user *from, int len);
+
+/* The user buffer the frags of @skb point to, if any */
+static inline struct ubuf_info *skb_zcopy(struct sk_buff *skb)
+{
+	if (skb && (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY))
+		return skb_shinfo(skb)->destructor_arg;
+	return NULL;
+}
+
+static inline void sock_zerocopy_get(struct ubuf_info *uarg)
+{
+	atomic_inc(&uarg->refcnt);
+}
+
+/* Makes @skb hold a reference on the MSG_ZEROCOPY buffer @uarg */
+static inline void skb_zcopy_set(struct sk_buff *skb, struct ubuf_info *uarg)
+{
+	sock_zerocopy_get(uarg);
+	skb_shinfo(skb)->destructor_arg = uarg;
+	skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
+}
+
 static inline struct skb_shared_hwtstamps *skb_hwtstamps(struct sk_buff *skb)
 {
 	return &skb_shinfo(skb)->hwtstamps;
@@ -2492,6 +2538,30 @@ static inline void skb_checksum_none_assert(const struct sk_buff *skb)
 
 bool skb_partial_csum_set(struct sk_buff *skb, u16 start, u16 off);
 
+/*
+ * Copies user frags into kernel pages before @skb is duplicated, except
+ * MSG_ZEROCOPY frags, which the duplicate can share.
+ */
+static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	struct ubuf_info *uarg = skb_zcopy(skb);
+
+	if (likely(!uarg) || uarg->callback == sock_zerocopy_callback)
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
+/*
+ * Copies all user frags into kernel pages before @skb is queued to a
+ * socket, where it may stay for an unbounded time.
+ */
+static inline int skb_orphan_frags_rx(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!skb_zcopy(skb)))
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
 static inline bool skb_is_recycleable(const struct sk_buff *skb, int skb_size)
 {
 	if (irqs_disabled())
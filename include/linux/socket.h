@@ -265,6 +265,7 @@ struct ucred {
 #define MSG_NOSIGNAL	0x4000	/* Do not generate SIGPIPE */
 #define MSG_MORE	0x8000	/* Sender will send more */
 #define MSG_WAITFORONE	0x10000	/* recvmmsg(): block until 1+ packets avail */
+#define MSG_ZEROCOPY	0x4000000	/* Use user data in kernel path */
 
 #define MSG_EOF         MSG_FIN
 
@@ -22,6 +22,7 @@ struct itimerval;
 struct kexec_segment;
 struct linux_dirent;
 struct linux_dirent64;
+struct linux_dirent_plus;
 struct list_head;
 struct mmap_arg_struct;
 struct msgbuf;
@@ -63,6 +64,7 @@ struct getcpu_cache;
 struct old_linux_dirent;
 struct perf_event_attr;
 struct file_handle;
+struct io_uring_params;
 
 #include <linux/types.h>
 #include <linux/aio_abi.h>
@@ -857,4 +859,15 @@ asmlinkage long sys_process_vm_writev(pid_t pid,
 				      unsigned long riovcnt,
 				      unsigned long flags);
 
+asmlinkage long sys_io_uring_setup(u32 entries,
+				   struct io_uring_params __user *p);
+asmlinkage long sys_io_uring_enter(unsigned int fd, u32 to_submit,
+				   u32 min_complete, u32 flags,
+				   const sigset_t __user *sig, size_t sigsz);
+asmlinkage long sys_io_uring_register(unsigned int fd, unsigned int op,
+				      void __user *arg, unsigned int nr_args);
+asmlinkage long sys_getdents_plus(unsigned int fd,
+				  struct linux_dirent_plus __user *dirent,
+				  unsigned int count, unsigned int flags);
+
 #endif
@@ -167,6 +167,8 @@ struct tcp_info {
 	__u32	tcpi_rcv_space;
 
 	__u32	tcpi_total_retrans;
+
+	__u64	tcpi_pacing_rate;	/* bytes per second, ~0 if unset */
 };
 
 /* for TCP_MD5SIG socket option */
@@ -318,6 +320,9 @@ struct tcp_sock {
 	u32	rcv_tstamp;	/* timestamp of last received ACK (for keepalives) */
 	u32	lsndtime;	/* timestamp of last sent data packet (for restart window) */
 
+	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
+	unsigned long	tsq_flags;
+
 	/* Data for direct copy to user */
 	struct {
 		struct sk_buff_head	prequeue;
@@ -468,6 +473,12 @@ struct tcp_sock {
 	struct tcp_cookie_values  *cookie_values;
 };
 
+enum tsq_flags {
+	TSQ_THROTTLED,		/* tcp_write_xmit() stopped on the TSQ limit */
+	TSQ_QUEUED,		/* socket is on this cpu's tsq_tasklet list */
+	TCP_TSQ_DEFERRED,	/* tcp_tasklet_func() found socket was owned */
+};
+
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
 {
 	return (struct tcp_sock *)sk;
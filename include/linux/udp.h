@@ -29,6 +29,8 @@ struct udphdr {
 /* UDP socket options */
 #define UDP_CORK	1	/* Never send partially complete segments */
 #define UDP_ENCAP	100	/* Set the socket to accept encapsulated packets */
+#define UDP_SEGMENT	103	/* Set GSO segmentation size */
+#define UDP_GRO		104	/* This socket can receive UDP GRO packets */
 
 /* UDP encapsulation types */
 #define UDP_ENCAP_ESPINUDP_NON_IKE	1 /* draft-ietf-ipsec-nat-t-ike-00/01 */
@@ -76,11 +78,21 @@ struct udp_sock {
 #define UDPLITE_SEND_CC  0x2  		/* set via udplite setsockopt         */
 #define UDPLITE_RECV_CC  0x4		/* set via udplite setsocktopt        */
 	__u8		 pcflag;        /* marks socket as UDP-Lite if > 0    */
-	__u8		 unused[3];
+	__u8		 gro_enabled;	/* takes GRO packets (UDP_GRO)        */
+	__u16		 gso_size;	/* segment size of sends (UDP_SEGMENT) */
 	/*
 	 * For encapsulation sockets.
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
+	/*
+	 * GRO of the packets an encapsulation socket carries: gro_receive
+	 * is called with the encapsulation header at the GRO offset, and
+	 * gro_complete with the offset of what follows it.
+	 */
+	struct sk_buff **(*gro_receive)(struct sock *sk,
+					struct sk_buff **head,
+					struct sk_buff *skb);
+	int (*gro_complete)(struct sock *sk, struct sk_buff *skb, int nhoff);
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
@@ -0,0 +1,157 @@
+/*
+ * include/net/busy_poll.h	Busy polling of the NAPI context that last
+ *				delivered to a socket, for low latency
+ *				receive.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _LINUX_NET_BUSY_POLL_H
+#define _LINUX_NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+/*
+ * A blocking reader normally sleeps until the device interrupt has run
+ * NAPI in softirq context and the protocol has woken it up.  With busy
+ * polling, each packet records the id of the NAPI context it came from
+ * (skb->napi_id), the protocol copies it into the socket it delivers to
+ * (sk->sk_napi_id), and a reader finding its receive queue empty calls
+ * that NAPI poll routine itself, from syscall context, for up to
+ * sk->sk_ll_usec microseconds (SO_BUSY_POLL, net.core.busy_read) before
+ * going to sleep.  poll() and select() do the same for all the sockets
+ * they wait on, for up to net.core.busy_poll microseconds.
+ *
+ * Only packets received through napi_gro_receive() or napi_gro_frags()
+ * are marked; loopback and other netif_rx() devices are not, since they
+ * have no NAPI context of their own to poll.
+ */
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+extern unsigned int sysctl_net_busy_read __read_mostly;
+extern unsigned int sysctl_net_busy_poll __read_mostly;
+
+/* packets handed to napi->poll() per busy polling round */
+#define BUSY_POLL_BUDGET 8
+
+static inline bool net_busy_loop_on(void)
+{
+	return sysctl_net_busy_poll;
+}
+
+static inline bool sk_can_busy_loop(const struct sock *sk)
+{
+	return sk->sk_ll_usec && sk->sk_napi_id && !signal_pending(current);
+}
+
+/* a cheap clock in (roughly) microseconds */
+static inline unsigned long busy_loop_current_time(void)
+{
+	return (unsigned long)(local_clock() >> 10);
+}
+
+/* in poll/select we use the global sysctl_net_busy_poll value */
+static inline bool busy_loop_timeout(unsigned long start_time)
+{
+	unsigned long bp_usec = ACCESS_ONCE(sysctl_net_busy_poll);
+
+	if (bp_usec) {
+		unsigned long end_time = start_time + bp_usec;
+		unsigned long now = busy_loop_current_time();
+
+		return time_after(now, end_time);
+	}
+	return true;
+}
+
+static inline bool sk_busy_loop_timeout(struct sock *sk,
+					unsigned long start_time)
+{
+	unsigned long bp_usec = ACCESS_ONCE(sk->sk_ll_usec);
+
+	if (bp_usec) {
+		unsigned long end_time = start_time + bp_usec;
+		unsigned long now = busy_loop_current_time();
+
+		return time_after(now, end_time);
+	}
+	return true;
+}
+
+extern void napi_busy_loop(unsigned int napi_id,
+			   bool (*loop_end)(void *, unsigned long),
+			   void *loop_end_arg);
+extern bool sk_busy_loop_end(void *p, unsigned long start_time);
+
+/*
+ * Polls the NAPI context of @sk until data shows up on its receive queue
+ * or sk->sk_ll_usec has passed, or only once if @nonblock.  Returns true
+ * if there is data to read.
+ */
+static inline bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	unsigned int napi_id = ACCESS_ONCE(sk->sk_napi_id);
+
+	if (napi_id)
+		napi_busy_loop(napi_id, nonblock ? NULL : sk_busy_loop_end, sk);
+
+	return !skb_queue_empty(&sk->sk_receive_queue);
+}
+
+/* used in the NIC receive handler to mark the skb */
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+	skb->napi_id = napi->napi_id;
+}
+
+/* used in the protocol handler to propagate the napi_id to the socket */
+static inline void sk_mark_napi_id(struct sock *sk, const struct sk_buff *skb)
+{
+	sk->sk_napi_id = skb->napi_id;
+}
+
+#else /* CONFIG_NET_RX_BUSY_POLL */
+
+static inline bool net_busy_loop_on(void)
+{
+	return false;
+}
+
+static inline bool sk_can_busy_loop(const struct sock *sk)
+{
+	return false;
+}
+
+static inline unsigned long busy_loop_current_time(void)
+{
+	return 0;
+}
+
+static inline bool busy_loop_timeout(unsigned long start_time)
+{
+	return true;
+}
+
+static inline bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return false;
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, const struct sk_buff *skb)
+{
+}
+
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+#endif /* _LINUX_NET_BUSY_POLL_H */
@@ -10,6 +10,9 @@
 struct gre_protocol {
 	int  (*handler)(struct sk_buff *skb);
 	void (*err_handler)(struct sk_buff *skb, u32 info);
+	struct sk_buff **(*gro_receive)(struct sk_buff **head,
+					struct sk_buff *skb);
+	int  (*gro_complete)(struct sk_buff *skb, int nhoff);
 };
 
 int gre_add_protocol(const struct gre_protocol *proto, u8 version);
@@ -103,6 +103,9 @@ static inline struct udp_hslot *udp_hashslot2(struct udp_table *table,
 /* Default, as per the RFC, is to always do csums. */
 #define UDP_CSUM_DEFAULT	0
 
+/* Most datagrams one UDP_SEGMENT send may be cut into */
+#define UDP_MAX_SEGMENTS	64
+
 extern struct proto udp_prot;
 
 extern atomic_long_t udp_memory_allocated;
@@ -259,4 +262,7 @@ extern void udp_init(void);
 
 extern int udp4_ufo_send_check(struct sk_buff *skb);
 extern struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, u32 features);
+extern struct sk_buff **udp4_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb);
+extern int udp4_gro_complete(struct sk_buff *skb, int thoff);
 #endif	/* _UDP_H */
@@ -1746,18 +1746,19 @@ TRACE_EVENT(ext4_get_implied_cluster_alloc_exit,
 		  __entry->len, __entry->flags, __entry->ret)
 );
 
-TRACE_EVENT(ext4_ext_put_in_cache,
-	TP_PROTO(struct inode *inode, ext4_lblk_t lblk, unsigned int len,
-		 ext4_fsblk_t start),
+TRACE_EVENT(ext4_es_insert_extent,
+	TP_PROTO(struct inode *inode, ext4_lblk_t lblk, ext4_lblk_t len,
+		 ext4_fsblk_t pblk, unsigned long long status),
 
-	TP_ARGS(inode, lblk, len, start),
+	TP_ARGS(inode, lblk, len, pblk, status),
 
 	TP_STRUCT__entry(
 		__field(	ino_t,		ino	)
 		__field(	dev_t,		dev	)
 		__field(	ext4_lblk_t,	lblk	)
-		__field(	unsigned int,	len	)
-		__field(	ext4_fsblk_t,	start	)
+		__field(	ext4_lblk_t,	len	)
+		__field(	ext4_fsblk_t,	pblk	)
+		__field(	unsigned int,	status	)
 	),
 
 	TP_fast_assign(
@@ -1765,56 +1766,101 @@ TRACE_EVENT(ext4_ext_put_in_cache,
 		__entry->dev	= inode->i_sb->s_dev;
 		__entry->lblk	= lblk;
 		__entry->len	= len;
-		__entry->start	= start;
+		__entry->pblk	= pblk;
+		__entry->status	= status >> 60;
 	),
 
-	TP_printk("dev %d,%d ino %lu lblk %u len %u start %llu",
+	TP_printk("dev %d,%d ino %lu es [%u/%u) pblk %llu status %x",
 		  MAJOR(__entry->dev), MINOR(__entry->dev),
 		  (unsigned long) __entry->ino,
-		  (unsigned) __entry->lblk,
-		  __entry->len,
-		  (unsigned long long) __entry->start)
+		  (unsigned) __entry->lblk, (unsigned) __entry->len,
+		  (unsigned long long) __entry->pblk, __entry->status)
 );
 
-TRACE_EVENT(ext4_ext_in_cache,
-	TP_PROTO(struct inode *inode, ext4_lblk_t lblk, int ret),
+TRACE_EVENT(ext4_es_remove_extent,
+	TP_PROTO(struct inode *inode, ext4_lblk_t lblk, ext4_lblk_t len),
 
-	TP_ARGS(inode, lblk, ret),
+	TP_ARGS(inode, lblk, len),
 
 	TP_STRUCT__entry(
 		__field(	ino_t,		ino	)
 		__field(	dev_t,		dev	)
 		__field(	ext4_lblk_t,	lblk	)
-		__field(	int,		ret	)
+		__field(	ext4_lblk_t,	len	)
 	),
 
 	TP_fast_assign(
 		__entry->ino	= inode->i_ino;
 		__entry->dev	= inode->i_sb->s_dev;
 		__entry->lblk	= lblk;
-		__entry->ret	= ret;
+		__entry->len	= len;
+	),
+
+	TP_printk("dev %d,%d ino %lu es [%u/%u)",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long) __entry->ino,
+		  (unsigned) __entry->lblk, (unsigned) __entry->len)
+);
+
+TRACE_EVENT(ext4_es_lookup_extent,
+	TP_PROTO(struct inode *inode, ext4_lblk_t lblk, int found),
+
+	TP_ARGS(inode, lblk, found),
+
+	TP_STRUCT__entry(
+		__field(	ino_t,		ino	)
+		__field(	dev_t,		dev	)
+		__field(	ext4_lblk_t,	lblk	)
+		__field(	int,		found	)
+	),
+
+	TP_fast_assign(
+		__entry->ino	= inode->i_ino;
+		__entry->dev	= inode->i_sb->s_dev;
+		__entry->lblk	= lblk;
+		__entry->found	= found;
 	),
 
-	TP_printk("dev %d,%d ino %lu lblk %u ret %d",
+	TP_printk("dev %d,%d ino %lu lblk %u found %d",
 		  MAJOR(__entry->dev), MINOR(__entry->dev),
 		  (unsigned long) __entry->ino,
 		  (unsigned) __entry->lblk,
-		  __entry->ret)
+		  __entry->found)
+);
+
+TRACE_EVENT(ext4_es_shrink,
+	TP_PROTO(struct super_block *sb, int nr_to_scan, int nr_shrunk),
 
+	TP_ARGS(sb, nr_to_scan, nr_shrunk),
+
+	TP_STRUCT__entry(
+		__field(	dev_t,	dev		)
+		__field(	int,	nr_to_scan	)
+		__field(	int,	nr_shrunk	)
+	),
+
+	TP_fast_assign(
+		__entry->dev		= sb->s_dev;
+		__entry->nr_to_scan	= nr_to_scan;
+		__entry->nr_shrunk	= nr_shrunk;
+	),
+
+	TP_printk("dev %d,%d nr_to_scan %d nr_shrunk %d",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->nr_to_scan, __entry->nr_shrunk)
 );
 
 TRACE_EVENT(ext4_find_delalloc_range,
 	TP_PROTO(struct inode *inode, ext4_lblk_t from, ext4_lblk_t to,
-		int reverse, int found, ext4_lblk_t found_blk),
+		int found, ext4_lblk_t found_blk),
 
-	TP_ARGS(inode, from, to, reverse, found, found_blk),
+	TP_ARGS(inode, from, to, found, found_blk),
 
 	TP_STRUCT__entry(
 		__field(	ino_t,		ino		)
 		__field(	dev_t,		dev		)
 		__field(	ext4_lblk_t,	from		)
 		__field(	ext4_lblk_t,	to		)
-		__field(	int,		reverse		)
 		__field(	int,		found		)
 		__field(	ext4_lblk_t,	found_blk	)
 	),
@@ -1824,17 +1870,16 @@ TRACE_EVENT(ext4_find_delalloc_range,
 		__entry->dev		= inode->i_sb->s_dev;
 		__entry->from		= from;
 		__entry->to		= to;
-		__entry->reverse	= reverse;
 		__entry->found		= found;
 		__entry->found_blk	= found_blk;
 	),
 
-	TP_printk("dev %d,%d ino %lu from %u to %u reverse %d found %d "
+	TP_printk("dev %d,%d ino %lu from %u to %u found %d "
 		  "(blk = %u)",
 		  MAJOR(__entry->dev), MINOR(__entry->dev),
 		  (unsigned long) __entry->ino,
 		  (unsigned) __entry->from, (unsigned) __entry->to,
-		  __entry->reverse, __entry->found,
+		  __entry->found,
 		  (unsigned) __entry->found_blk)
 );
 
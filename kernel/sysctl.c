@@ -1417,6 +1417,13 @@ static struct ctl_table fs_table[] = {
 		.mode		= 0444,
 		.proc_handler	= proc_nr_dentry,
 	},
+#ifdef CONFIG_BLOCK
+	{
+		.procname	= "bio-cache-state",
+		.mode		= 0444,
+		.proc_handler	= proc_bio_cache_state,
+	},
+#endif
 	{
 		.procname	= "overflowuid",
 		.data		= &fs_overflowuid,
@@ -8,6 +8,7 @@
 #include <linux/mm.h>
 #include <linux/sched.h>
 #include <linux/module.h>
+#include <linux/slab.h>
 #include <linux/writeback.h>
 #include <linux/device.h>
 #include <trace/events/writeback.h>
@@ -39,6 +40,9 @@ DEFINE_SPINLOCK(bdi_lock);
 LIST_HEAD(bdi_list);
 LIST_HEAD(bdi_pending_list);
 
+/* runs the parallel writeback workers of all bdis */
+struct workqueue_struct *bdi_writeback_wq;
+
 static struct task_struct *sync_supers_tsk;
 static struct timer_list sync_supers_timer;
 
@@ -134,15 +138,54 @@ static const struct file_operations bdi_debug_stats_fops = {
 	.release	= single_release,
 };
 
+static int bdi_debug_workers_show(struct seq_file *m, void *v)
+{
+	struct backing_dev_info *bdi = m->private;
+	struct bdi_writeback *wb = &bdi->wb;
+	struct bdi_writeback_worker *worker;
+	unsigned int i;
+
+	/* keep the workers from being freed under us */
+	mutex_lock(&wb->workers_mutex);
+	seq_printf(m, "%-6s %10s %10s %12s %10s\n",
+		   "worker", "batches", "inodes", "written_kB", "busy_ms");
+	for (i = 0; wb->workers && i < wb->nr_workers; i++) {
+		worker = &wb->workers[i];
+		seq_printf(m, "%-6u %10lu %10lu %12lu %10u\n", i,
+			   worker->nr_batches, worker->nr_inodes,
+			   worker->nr_pages << (PAGE_SHIFT - 10),
+			   jiffies_to_msecs(worker->busy_time));
+	}
+	mutex_unlock(&wb->workers_mutex);
+
+	return 0;
+}
+
+static int bdi_debug_workers_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bdi_debug_workers_show, inode->i_private);
+}
+
+static const struct file_operations bdi_debug_workers_fops = {
+	.open		= bdi_debug_workers_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static void bdi_debug_register(struct backing_dev_info *bdi, const char *name)
 {
 	bdi->debug_dir = debugfs_create_dir(name, bdi_debug_root);
 	bdi->debug_stats = debugfs_create_file("stats", 0444, bdi->debug_dir,
 					       bdi, &bdi_debug_stats_fops);
+	bdi->debug_workers = debugfs_create_file("workers", 0444,
+						 bdi->debug_dir, bdi,
+						 &bdi_debug_workers_fops);
 }
 
 static void bdi_debug_unregister(struct backing_dev_info *bdi)
 {
+	debugfs_remove(bdi->debug_workers);
 	debugfs_remove(bdi->debug_stats);
 	debugfs_remove(bdi->debug_dir);
 }
@@ -225,12 +268,31 @@ static ssize_t max_ratio_store(struct device *dev,
 }
 BDI_SHOW(max_ratio, bdi->max_ratio)
 
+static ssize_t writeback_workers_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct backing_dev_info *bdi = dev_get_drvdata(dev);
+	char *end;
+	unsigned int nr;
+	ssize_t ret = -EINVAL;
+
+	nr = simple_strtoul(buf, &end, 10);
+	if (*buf && (end[0] == '\0' || (end[0] == '\n' && end[1] == '\0'))) {
+		ret = bdi_set_writeback_workers(bdi, nr);
+		if (!ret)
+			ret = count;
+	}
+	return ret;
+}
+BDI_SHOW(writeback_workers, bdi->wb.nr_workers)
+
 #define __ATTR_RW(attr) __ATTR(attr, 0644, attr##_show, attr##_store)
 
 static struct device_attribute bdi_dev_attrs[] = {
 	__ATTR_RW(read_ahead_kb),
 	__ATTR_RW(min_ratio),
 	__ATTR_RW(max_ratio),
+	__ATTR_RW(writeback_workers),
 	__ATTR_NULL,
 };
 
@@ -253,6 +315,10 @@ static int __init default_bdi_init(void)
 	sync_supers_tsk = kthread_run(bdi_sync_supers, NULL, "sync_supers");
 	BUG_ON(IS_ERR(sync_supers_tsk));
 
+	bdi_writeback_wq = alloc_workqueue("writeback",
+					   WQ_MEM_RECLAIM | WQ_UNBOUND, 0);
+	BUG_ON(!bdi_writeback_wq);
+
 	setup_timer(&sync_supers_timer, sync_supers_timer_fn, 0);
 	bdi_arm_supers_timer();
 
@@ -653,6 +719,43 @@ static void bdi_wb_init(struct bdi_writeback *wb, struct backing_dev_info *bdi)
 	INIT_LIST_HEAD(&wb->b_more_io);
 	spin_lock_init(&wb->list_lock);
 	setup_timer(&wb->wakeup_timer, wakeup_timer_fn, (unsigned long)bdi);
+	mutex_init(&wb->workers_mutex);
+	wb->nr_workers = 1;
+}
+
+/*
+ * Set the number of workers that write back the inodes of @bdi in
+ * parallel.  With one, the flusher thread writes them by itself.
+ */
+int bdi_set_writeback_workers(struct backing_dev_info *bdi, unsigned int nr)
+{
+	struct bdi_writeback *wb = &bdi->wb;
+	struct bdi_writeback_worker *workers = NULL, *old;
+	unsigned int i;
+
+	if (nr < 1 || nr > BDI_MAX_WORKERS)
+		return -EINVAL;
+
+	if (nr > 1) {
+		workers = kcalloc(nr, sizeof(*workers), GFP_KERNEL);
+		if (!workers)
+			return -ENOMEM;
+		for (i = 0; i < nr; i++) {
+			INIT_WORK(&workers[i].work, bdi_writeback_worker_fn);
+			INIT_LIST_HEAD(&workers[i].b_io);
+			workers[i].wb = wb;
+		}
+	}
+
+	/* no batch of inodes is being written while we hold the mutex */
+	mutex_lock(&wb->workers_mutex);
+	old = wb->workers;
+	wb->workers = workers;
+	wb->nr_workers = nr;
+	mutex_unlock(&wb->workers_mutex);
+
+	kfree(old);
+	return 0;
 }
 
 /*
@@ -732,6 +835,9 @@ void bdi_destroy(struct backing_dev_info *bdi)
 	 */
 	del_timer_sync(&bdi->wb.wakeup_timer);
 
+	kfree(bdi->wb.workers);
+	bdi->wb.workers = NULL;
+
 	for (i = 0; i < NR_BDI_STAT_ITEMS; i++)
 		percpu_counter_destroy(&bdi->bdi_stat[i]);
 
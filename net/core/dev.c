@@ -137,6 +137,7 @@
 #include <linux/if_pppox.h>
 #include <linux/ppp_defs.h>
 #include <linux/net_tstamp.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -181,6 +182,15 @@ static DEFINE_SPINLOCK(ptype_lock);
 static struct list_head ptype_base[PTYPE_HASH_SIZE] __read_mostly;
 static struct list_head ptype_all __read_mostly;	/* Taps */
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* NAPI contexts by napi_id, for busy polling sockets to find them. */
+#define NAPI_HASH_SIZE	(256)
+
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+static struct hlist_head napi_hash[NAPI_HASH_SIZE];
+#endif
+
 /*
  * The @dev_base_head list is protected by @dev_base_lock and the rtnl
  * semaphore.
@@ -1570,12 +1580,10 @@ static inline bool is_skb_forwardable(struct net_device *dev,
  */
 int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
 {
-	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-		if (skb_copy_ubufs(skb, GFP_ATOMIC)) {
-			atomic_long_inc(&dev->rx_dropped);
-			kfree_skb(skb);
-			return NET_RX_DROP;
-		}
+	if (skb_orphan_frags_rx(skb, GFP_ATOMIC)) {
+		atomic_long_inc(&dev->rx_dropped);
+		kfree_skb(skb);
+		return NET_RX_DROP;
 	}
 
 	skb_orphan(skb);
@@ -1598,6 +1606,9 @@ static inline int deliver_skb(struct sk_buff *skb,
 			      struct packet_type *pt_prev,
 			      struct net_device *orig_dev)
 {
+	/* receivers may hold on to the skb: do not let them pin user pages */
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
+		return -ENOMEM;
 	atomic_inc(&skb->users);
 	return pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 }
@@ -1654,8 +1665,12 @@ static void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 			pt_prev = ptype;
 		}
 	}
-	if (pt_prev)
-		pt_prev->func(skb2, skb->dev, pt_prev, skb->dev);
+	if (pt_prev) {
+		if (!skb_orphan_frags_rx(skb2, GFP_ATOMIC))
+			pt_prev->func(skb2, skb->dev, pt_prev, skb->dev);
+		else
+			kfree_skb(skb2);
+	}
 	rcu_read_unlock();
 }
 
@@ -2084,25 +2099,6 @@ static int dev_gso_segment(struct sk_buff *skb, int features)
 	return 0;
 }
 
-/*
- * Try to orphan skb early, right before transmission by the device.
- * We cannot orphan skb if tx timestamp is requested or the sk-reference
- * is needed on driver level for other reasons, e.g. see net/can/raw.c
- */
-static inline void skb_orphan_try(struct sk_buff *skb)
-{
-	struct sock *sk = skb->sk;
-
-	if (sk && !skb_shinfo(skb)->tx_flags) {
-		/* skb_tx_hash() wont be able to get sk.
-		 * We copy sk_hash into skb->rxhash
-		 */
-		if (!skb->rxhash)
-			skb->rxhash = sk->sk_hash;
-		skb_orphan(skb);
-	}
-}
-
 static bool can_checksum_protocol(unsigned long features, __be16 protocol)
 {
 	return ((features & NETIF_F_GEN_CSUM) ||
@@ -2187,8 +2183,6 @@ int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
 		if (!list_empty(&ptype_all))
 			dev_queue_xmit_nit(skb, dev);
 
-		skb_orphan_try(skb);
-
 		features = netif_skb_features(skb);
 
 		if (vlan_tx_tag_present(skb) &&
@@ -2256,7 +2250,7 @@ gso:
 			return rc;
 		}
 		txq_trans_update(txq);
-		if (unlikely(netif_tx_queue_stopped(txq) && skb->next))
+		if (unlikely(netif_xmit_stopped(txq) && skb->next))
 			return NETDEV_TX_BUSY;
 	} while (skb->next);
 
@@ -2530,7 +2524,7 @@ int dev_queue_xmit(struct sk_buff *skb)
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				__this_cpu_inc(xmit_recursion);
 				rc = dev_hard_start_xmit(skb, dev, txq);
 				__this_cpu_dec(xmit_recursion);
@@ -3330,8 +3324,11 @@ ncls:
 	}
 
 	if (pt_prev) {
+		if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
+			goto drop;
 		ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 	} else {
+drop:
 		atomic_long_inc(&skb->dev->rx_dropped);
 		kfree_skb(skb);
 		/* Jamal, now you will not able to escape explaining
@@ -3421,6 +3418,38 @@ static void flush_backlog(void *arg)
 	}
 }
 
+/*
+ * Look up the GRO handlers of a protocol, for encapsulations that hand the
+ * inner packet on.  Must be called under rcu_read_lock().
+ */
+struct packet_type *gro_find_receive_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_receive_by_type);
+
+struct packet_type *gro_find_complete_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_complete_by_type);
+
 static int napi_gro_complete(struct sk_buff *skb)
 {
 	struct packet_type *ptype;
@@ -3438,7 +3467,7 @@ static int napi_gro_complete(struct sk_buff *skb)
 		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
 			continue;
 
-		err = ptype->gro_complete(skb);
+		err = ptype->gro_complete(skb, 0);
 		break;
 	}
 	rcu_read_unlock();
@@ -3468,6 +3497,28 @@ inline void napi_gro_flush(struct napi_struct *napi)
 }
 EXPORT_SYMBOL(napi_gro_flush);
 
+/* Moves the first @grow bytes of frag0 to the linear part of @skb */
+static void gro_pull_from_frag0(struct sk_buff *skb, int grow)
+{
+	struct skb_shared_info *pinfo = skb_shinfo(skb);
+
+	BUG_ON(skb->end - skb->tail < grow);
+
+	memcpy(skb_tail_pointer(skb), NAPI_GRO_CB(skb)->frag0, grow);
+
+	skb->tail += grow;
+	skb->data_len -= grow;
+
+	pinfo->frags[0].page_offset += grow;
+	skb_frag_size_sub(&pinfo->frags[0], grow);
+
+	if (unlikely(!skb_frag_size(&pinfo->frags[0]))) {
+		skb_frag_unref(skb, 0);
+		memmove(pinfo->frags, pinfo->frags + 1,
+			--pinfo->nr_frags * sizeof(skb_frag_t));
+	}
+}
+
 enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
 	struct sk_buff **pp = NULL;
@@ -3530,26 +3581,8 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 	ret = GRO_HELD;
 
 pull:
-	if (skb_headlen(skb) < skb_gro_offset(skb)) {
-		int grow = skb_gro_offset(skb) - skb_headlen(skb);
-
-		BUG_ON(skb->end - skb->tail < grow);
-
-		memcpy(skb_tail_pointer(skb), NAPI_GRO_CB(skb)->frag0, grow);
-
-		skb->tail += grow;
-		skb->data_len -= grow;
-
-		skb_shinfo(skb)->frags[0].page_offset += grow;
-		skb_frag_size_sub(&skb_shinfo(skb)->frags[0], grow);
-
-		if (unlikely(!skb_frag_size(&skb_shinfo(skb)->frags[0]))) {
-			skb_frag_unref(skb, 0);
-			memmove(skb_shinfo(skb)->frags,
-				skb_shinfo(skb)->frags + 1,
-				--skb_shinfo(skb)->nr_frags * sizeof(skb_frag_t));
-		}
-	}
+	if (skb_headlen(skb) < skb_gro_offset(skb))
+		gro_pull_from_frag0(skb, skb_gro_offset(skb) - skb_headlen(skb));
 
 ok:
 	return ret;
@@ -3571,7 +3604,7 @@ __napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		diffs = (unsigned long)p->dev ^ (unsigned long)skb->dev;
 		diffs |= p->vlan_tci ^ skb->vlan_tci;
 		diffs |= compare_ether_header(skb_mac_header(p),
-					      skb_gro_mac_header(skb));
+					      skb_mac_header(skb));
 		NAPI_GRO_CB(p)->same_flow = !diffs;
 		NAPI_GRO_CB(p)->flush = 0;
 	}
@@ -3618,6 +3651,7 @@ EXPORT_SYMBOL(skb_gro_reset_offset);
 
 gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
+	skb_mark_napi_id(skb, napi);
 	skb_gro_reset_offset(skb);
 
 	return napi_skb_finish(__napi_gro_receive(napi, skb), skb);
@@ -3654,11 +3688,10 @@ gro_result_t napi_frags_finish(struct napi_struct *napi, struct sk_buff *skb,
 	switch (ret) {
 	case GRO_NORMAL:
 	case GRO_HELD:
+		__skb_push(skb, ETH_HLEN);
 		skb->protocol = eth_type_trans(skb, skb->dev);
 
-		if (ret == GRO_HELD)
-			skb_gro_pull(skb, -ETH_HLEN);
-		else if (netif_receive_skb(skb))
+		if (ret == GRO_NORMAL && netif_receive_skb(skb))
 			ret = GRO_DROP;
 		break;
 
@@ -3680,26 +3713,32 @@ struct sk_buff *napi_frags_skb(struct napi_struct *napi)
 	struct sk_buff *skb = napi->skb;
 	struct ethhdr *eth;
 	unsigned int hlen;
-	unsigned int off;
 
 	napi->skb = NULL;
 
 	skb_reset_mac_header(skb);
 	skb_gro_reset_offset(skb);
 
-	off = skb_gro_offset(skb);
-	hlen = off + sizeof(*eth);
-	eth = skb_gro_header_fast(skb, off);
+	/*
+	 * Pull the Ethernet header out of the way, so that GRO offsets
+	 * count from the network header as they do for napi_gro_receive():
+	 * the gro_receive handlers find the headers of held packets at
+	 * the same offsets as those of @skb.
+	 */
+	hlen = sizeof(*eth);
 	if (skb_gro_header_hard(skb, hlen)) {
-		eth = skb_gro_header_slow(skb, hlen, off);
-		if (unlikely(!eth)) {
+		if (unlikely(!skb_gro_header_slow(skb, hlen, 0))) {
 			napi_reuse_skb(napi, skb);
 			skb = NULL;
 			goto out;
 		}
+	} else {
+		gro_pull_from_frag0(skb, hlen);
+		NAPI_GRO_CB(skb)->frag0 += hlen;
+		NAPI_GRO_CB(skb)->frag0_len -= hlen;
 	}
-
-	skb_gro_pull(skb, sizeof(*eth));
+	eth = (struct ethhdr *)skb->data;
+	__skb_pull(skb, hlen);
 
 	/*
 	 * This works because the only protocols we care about don't require
@@ -3719,6 +3758,8 @@ gro_result_t napi_gro_frags(struct napi_struct *napi)
 	if (!skb)
 		return GRO_DROP;
 
+	skb_mark_napi_id(skb, napi);
+
 	return napi_frags_finish(napi, skb, __napi_gro_receive(napi, skb));
 }
 EXPORT_SYMBOL(napi_gro_frags);
@@ -3829,6 +3870,10 @@ void __napi_complete(struct napi_struct *n)
 	BUG_ON(!test_bit(NAPI_STATE_SCHED, &n->state));
 	BUG_ON(n->gro_list);
 
+	/* napi_busy_loop() keeps NAPI_STATE_SCHED until it is done */
+	if (unlikely(test_bit(NAPI_STATE_IN_BUSY_POLL, &n->state)))
+		return;
+
 	list_del(&n->poll_list);
 	smp_mb__before_clear_bit();
 	clear_bit(NAPI_STATE_SCHED, &n->state);
@@ -3847,12 +3892,186 @@ void napi_complete(struct napi_struct *n)
 		return;
 
 	napi_gro_flush(n);
+	if (unlikely(test_bit(NAPI_STATE_IN_BUSY_POLL, &n->state)))
+		return;
+
 	local_irq_save(flags);
 	__napi_complete(n);
 	local_irq_restore(flags);
 }
 EXPORT_SYMBOL(napi_complete);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* must be called under rcu_read_lock(), as we dont take a reference */
+static struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	unsigned int hash = napi_id % NAPI_HASH_SIZE;
+	struct napi_struct *napi;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu(napi, pos, &napi_hash[hash], napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+
+static void napi_hash_add(struct napi_struct *napi)
+{
+	if (test_and_set_bit(NAPI_STATE_HASHED, &napi->state))
+		return;
+
+	spin_lock(&napi_hash_lock);
+
+	/* 0 is not a valid id */
+	do {
+		if (unlikely(++napi_gen_id == 0))
+			napi_gen_id = 1;
+	} while (napi_by_id(napi_gen_id));
+	napi->napi_id = napi_gen_id;
+
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   &napi_hash[napi->napi_id % NAPI_HASH_SIZE]);
+
+	spin_unlock(&napi_hash_lock);
+}
+
+/* Returns true if the caller has to wait for a RCU grace period before
+ * freeing the NAPI context.
+ */
+static bool napi_hash_del(struct napi_struct *napi)
+{
+	bool rcu_sync_needed = false;
+
+	spin_lock(&napi_hash_lock);
+	if (test_and_clear_bit(NAPI_STATE_HASHED, &napi->state)) {
+		rcu_sync_needed = true;
+		hlist_del_rcu(&napi->napi_hash_node);
+	}
+	spin_unlock(&napi_hash_lock);
+	return rcu_sync_needed;
+}
+
+static void busy_poll_stop(struct napi_struct *napi, void *have_poll_lock)
+{
+	int rc;
+
+	clear_bit(NAPI_STATE_IN_BUSY_POLL, &napi->state);
+
+	local_bh_disable();
+
+	/* Interrupts the driver turned back on while we were polling may
+	 * have been missed, since the NAPI was not ours to schedule.  One
+	 * more poll lets the driver complete the NAPI for real and rearm
+	 * its interrupts, or hands what is left to the softirq.
+	 */
+	rc = napi->poll(napi, BUSY_POLL_BUDGET);
+	trace_napi_poll(napi);
+	netpoll_poll_unlock(have_poll_lock);
+	if (rc == BUSY_POLL_BUDGET)
+		__napi_schedule(napi);
+	local_bh_enable();
+}
+
+/**
+ *	napi_busy_loop - poll a NAPI context from process context
+ *	@napi_id: id of the NAPI context
+ *	@loop_end: returns true when polling should stop, or %NULL to poll
+ *		   only once
+ *	@loop_end_arg: argument of @loop_end
+ *
+ *	Takes NAPI_STATE_SCHED of the NAPI context if neither its softirq
+ *	nor another busy poller runs it, and calls its poll routine until
+ *	@loop_end says so, giving the cpu up when someone else needs it.
+ */
+void napi_busy_loop(unsigned int napi_id,
+		    bool (*loop_end)(void *, unsigned long),
+		    void *loop_end_arg)
+{
+	unsigned long start_time = loop_end ? busy_loop_current_time() : 0;
+	int (*napi_poll)(struct napi_struct *napi, int budget);
+	void *have_poll_lock = NULL;
+	struct napi_struct *napi;
+
+restart:
+	napi_poll = NULL;
+
+	rcu_read_lock();
+
+	napi = napi_by_id(napi_id);
+	if (!napi)
+		goto out;
+
+	preempt_disable();
+	for (;;) {
+		int work = 0;
+
+		local_bh_disable();
+		if (!napi_poll) {
+			unsigned long val = ACCESS_ONCE(napi->state);
+
+			/* If multiple threads are competing for this napi,
+			 * we avoid dirtying napi->state as much as we can.
+			 */
+			if (val & ((1UL << NAPI_STATE_DISABLE) |
+				   (1UL << NAPI_STATE_SCHED) |
+				   (1UL << NAPI_STATE_IN_BUSY_POLL)))
+				goto count;
+			if (cmpxchg(&napi->state, val,
+				    val | (1UL << NAPI_STATE_IN_BUSY_POLL) |
+					  (1UL << NAPI_STATE_SCHED)) != val)
+				goto count;
+
+			/* we own the poll_list linkage now, see
+			 * struct napi_struct
+			 */
+			INIT_LIST_HEAD(&napi->poll_list);
+			have_poll_lock = netpoll_poll_lock(napi);
+			napi_poll = napi->poll;
+		}
+		work = napi_poll(napi, BUSY_POLL_BUDGET);
+		trace_napi_poll(napi);
+		/* deliver what GRO held back, we are not waiting for more */
+		napi_gro_flush(napi);
+count:
+		if (work > 0)
+			NET_ADD_STATS_BH(dev_net(napi->dev),
+					 LINUX_MIB_BUSYPOLLRXPACKETS, work);
+		local_bh_enable();
+
+		if (!loop_end || loop_end(loop_end_arg, start_time))
+			break;
+
+		if (unlikely(need_resched())) {
+			if (napi_poll)
+				busy_poll_stop(napi, have_poll_lock);
+			preempt_enable();
+			rcu_read_unlock();
+			cond_resched();
+			if (loop_end(loop_end_arg, start_time))
+				return;
+			goto restart;
+		}
+		cpu_relax();
+	}
+	if (napi_poll)
+		busy_poll_stop(napi, have_poll_lock);
+	preempt_enable();
+out:
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(napi_busy_loop);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline bool napi_hash_del(struct napi_struct *napi)
+{
+	return false;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -3869,6 +4088,7 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	napi->poll_owner = -1;
 #endif
 	set_bit(NAPI_STATE_SCHED, &napi->state);
+	napi_hash_add(napi);
 }
 EXPORT_SYMBOL(netif_napi_add);
 
@@ -3876,6 +4096,10 @@ void netif_napi_del(struct napi_struct *napi)
 {
 	struct sk_buff *skb, *next;
 
+	/* wait for busy pollers that may still see it in the hash */
+	if (napi_hash_del(napi))
+		synchronize_net();
+
 	list_del_init(&napi->dev_list);
 	napi_free_frags(napi);
 
@@ -5548,6 +5772,9 @@ static void netdev_init_one_queue(struct net_device *dev,
 	queue->xmit_lock_owner = -1;
 	netdev_queue_numa_node_write(queue, NUMA_NO_NODE);
 	queue->dev = dev;
+#ifdef CONFIG_BQL
+	dql_init(&queue->dql, HZ);
+#endif
 }
 
 static int netif_alloc_netdev_queues(struct net_device *dev)
@@ -587,17 +587,8 @@ void sk_filter_release_rcu(struct rcu_head *rcu)
 }
 EXPORT_SYMBOL(sk_filter_release_rcu);
 
-/**
- *	sk_attach_filter - attach a socket filter
- *	@fprog: the filter program
- *	@sk: the socket to use
- *
- * Attach the user's filter code. We first run some sanity checks on
- * it to make sure it does not explode on us later. If an error
- * occurs or there is insufficient memory for the filter a negative
- * errno code is returned. On success the return is zero.
- */
-int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
+static int __sk_attach_filter(struct sock_fprog *fprog, struct sock *sk,
+			      bool kernel)
 {
 	struct sk_filter *fp, *old_fp;
 	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
@@ -610,7 +601,9 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 	fp = sock_kmalloc(sk, fsize+sizeof(*fp), GFP_KERNEL);
 	if (!fp)
 		return -ENOMEM;
-	if (copy_from_user(fp->insns, fprog->filter, fsize)) {
+	if (kernel)
+		memcpy(fp->insns, (__force void *)fprog->filter, fsize);
+	else if (copy_from_user(fp->insns, fprog->filter, fsize)) {
 		sock_kfree_s(sk, fp, fsize+sizeof(*fp));
 		return -EFAULT;
 	}
@@ -635,8 +628,37 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		sk_filter_uncharge(sk, old_fp);
 	return 0;
 }
+
+/**
+ *	sk_attach_filter - attach a socket filter
+ *	@fprog: the filter program
+ *	@sk: the socket to use
+ *
+ * Attach the user's filter code. We first run some sanity checks on
+ * it to make sure it does not explode on us later. If an error
+ * occurs or there is insufficient memory for the filter a negative
+ * errno code is returned. On success the return is zero.
+ */
+int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
+{
+	return __sk_attach_filter(fprog, sk, false);
+}
 EXPORT_SYMBOL_GPL(sk_attach_filter);
 
+/**
+ *	sk_attach_filter_kernel - attach a socket filter held by the kernel
+ *	@fprog: the filter program, whose code is in kernel memory
+ *	@sk: the socket to use
+ *
+ * Like sk_attach_filter(), for a filter that a driver copied in earlier
+ * and attaches to more sockets as they come.
+ */
+int sk_attach_filter_kernel(struct sock_fprog *fprog, struct sock *sk)
+{
+	return __sk_attach_filter(fprog, sk, true);
+}
+EXPORT_SYMBOL_GPL(sk_attach_filter_kernel);
+
 int sk_detach_filter(struct sock *sk)
 {
 	int ret = -ENOENT;
@@ -329,6 +329,34 @@ static void skb_clone_fraglist(struct sk_buff *skb)
 		skb_get(list);
 }
 
+/*
+ * Drops the reference of @skb on its user buffer; @zerocopy tells whether
+ * the user pages were used in place up to here.
+ */
+static void skb_zcopy_clear(struct sk_buff *skb, bool zerocopy)
+{
+	struct ubuf_info *uarg = skb_zcopy(skb);
+
+	if (uarg) {
+		if (uarg->callback == sock_zerocopy_callback) {
+			uarg->zerocopy = uarg->zerocopy && zerocopy;
+			sock_zerocopy_put(uarg);
+		} else if (uarg->callback) {
+			uarg->callback(uarg);
+		}
+		skb_shinfo(skb)->tx_flags &= ~SKBTX_DEV_ZEROCOPY;
+	}
+}
+
+/* Lets @nskb, which took over frags of @orig, share its MSG_ZEROCOPY buffer */
+static void skb_zerocopy_clone(struct sk_buff *nskb, struct sk_buff *orig)
+{
+	struct ubuf_info *uarg = skb_zcopy(orig);
+
+	if (uarg && !skb_zcopy(nskb))
+		skb_zcopy_set(nskb, uarg);
+}
+
 static void skb_release_data(struct sk_buff *skb)
 {
 	if (!skb->cloned ||
@@ -344,13 +372,7 @@ static void skb_release_data(struct sk_buff *skb)
 		 * If skb buf is from userspace, we need to notify the caller
 		 * the lower device DMA has done;
 		 */
-		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-			struct ubuf_info *uarg;
-
-			uarg = skb_shinfo(skb)->destructor_arg;
-			if (uarg->callback)
-				uarg->callback(uarg);
-		}
+		skb_zcopy_clear(skb, true);
 
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
@@ -558,6 +580,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 #endif
 	new->protocol		= old->protocol;
 	new->mark		= old->mark;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 	new->skb_iif		= old->skb_iif;
 	__nf_copy(new, old);
 #if defined(CONFIG_NETFILTER_XT_TARGET_TRACE) || \
@@ -642,10 +667,18 @@ EXPORT_SYMBOL_GPL(skb_morph);
 int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	int i;
-	int num_frags = skb_shinfo(skb)->nr_frags;
+	int num_frags;
 	struct page *page, *head = NULL;
-	struct ubuf_info *uarg = skb_shinfo(skb)->destructor_arg;
 
+	/* MSG_ZEROCOPY frags may be shared with clones still in flight,
+	 * which keep using the user pages: copy into a private shinfo.
+	 */
+	if (skb_cloned(skb) &&
+	    skb_zcopy(skb)->callback == sock_zerocopy_callback &&
+	    pskb_expand_head(skb, 0, 0, gfp_mask))
+		return -ENOMEM;
+
+	num_frags = skb_shinfo(skb)->nr_frags;
 	for (i = 0; i < num_frags; i++) {
 		u8 *vaddr;
 		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
@@ -671,8 +704,6 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 		skb_frag_unref(skb, i);
 
-	uarg->callback(uarg);
-
 	/* skb frags point to kernel buffers */
 	for (i = skb_shinfo(skb)->nr_frags; i > 0; i--) {
 		__skb_fill_page_desc(skb, i-1, head, 0,
@@ -680,7 +711,7 @@ int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
 		head = (struct page *)head->private;
 	}
 
-	skb_shinfo(skb)->tx_flags &= ~SKBTX_DEV_ZEROCOPY;
+	skb_zcopy_clear(skb, false);
 	return 0;
 }
 
@@ -703,10 +734,8 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 {
 	struct sk_buff *n;
 
-	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-		if (skb_copy_ubufs(skb, gfp_mask))
-			return NULL;
-	}
+	if (skb_orphan_frags(skb, gfp_mask))
+		return NULL;
 
 	n = skb + 1;
 	if (skb->fclone == SKB_FCLONE_ORIG &&
@@ -825,18 +854,17 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 	if (skb_shinfo(skb)->nr_frags) {
 		int i;
 
-		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-			if (skb_copy_ubufs(skb, gfp_mask)) {
-				kfree_skb(n);
-				n = NULL;
-				goto out;
-			}
+		if (skb_orphan_frags(skb, gfp_mask)) {
+			kfree_skb(n);
+			n = NULL;
+			goto out;
 		}
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
 			skb_shinfo(n)->frags[i] = skb_shinfo(skb)->frags[i];
 			skb_frag_ref(skb, i);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		skb_zerocopy_clone(n, skb);
 	}
 
 	if (skb_has_frag_list(skb)) {
@@ -903,6 +931,10 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		goto adjust_others;
 	}
 
+	/* copy this zero copy skb frags, before the shinfo is */
+	if (!fastpath && skb_orphan_frags(skb, gfp_mask))
+		goto nodata;
+
 	data = kmalloc(size + sizeof(struct skb_shared_info), gfp_mask);
 	if (!data)
 		goto nodata;
@@ -919,11 +951,9 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	if (fastpath) {
 		kfree(skb->head);
 	} else {
-		/* copy this zero copy skb frags */
-		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
-			if (skb_copy_ubufs(skb, gfp_mask))
-				goto nofrags;
-		}
+		/* the new shinfo holds its own MSG_ZEROCOPY reference */
+		if (skb_zcopy(skb))
+			sock_zerocopy_get(skb_zcopy(skb));
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			skb_frag_ref(skb, i);
 
@@ -958,8 +988,6 @@ adjust_others:
 	atomic_set(&skb_shinfo(skb)->dataref, 1);
 	return 0;
 
-nofrags:
-	kfree(data);
 nodata:
 	return -ENOMEM;
 }
@@ -1541,7 +1569,7 @@ static inline int spd_fill_page(struct splice_pipe_desc *spd,
 				struct sk_buff *skb, int linear,
 				struct sock *sk)
 {
-	if (unlikely(spd->nr_pages == pipe->buffers))
+	if (unlikely(spd->nr_pages == spd->nr_pages_max))
 		return 1;
 
 	if (linear) {
@@ -2207,6 +2235,7 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 {
 	int pos = skb_headlen(skb);
 
+	skb_zerocopy_clone(skb1, skb);
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2249,6 +2278,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* frags of different user buffers cannot be mixed */
+	if (skb_zcopy(tgt) || skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2719,6 +2752,7 @@ struct sk_buff *skb_segment(struct sk_buff *skb, u32 features)
 		}
 
 		frag = skb_shinfo(nskb)->frags;
+		skb_zerocopy_clone(nskb, skb);
 
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
@@ -3169,6 +3203,195 @@ void skb_tstamp_tx(struct sk_buff *orig_skb,
 }
 EXPORT_SYMBOL_GPL(skb_tstamp_tx);
 
+/*
+ * MSG_ZEROCOPY completions.  The ubuf_info of a send lives in the cb of
+ * the skb that later carries its completion to the socket error queue.
+ * That skb is charged to the option memory of the socket, which bounds
+ * the number of sends in flight: when it runs out, sendmsg() fails with
+ * ENOBUFS until the application has read some completions.
+ */
+static struct sk_buff *skb_from_uarg(struct ubuf_info *uarg)
+{
+	return container_of((void *)uarg, struct sk_buff, cb);
+}
+
+struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+
+	skb = sock_omalloc(sk, 0, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	uarg = (void *)skb->cb;
+	uarg->callback = sock_zerocopy_callback;
+	uarg->arg = NULL;
+	uarg->desc = 0;
+	atomic_set(&uarg->refcnt, 1);
+	uarg->id = ((u32)atomic_inc_return(&sk->sk_zckey)) - 1;
+	uarg->len = 1;
+	uarg->zerocopy = 1;
+	uarg->bytelen = size;
+	sock_hold(sk);
+
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+/* Merges the range of a completion into the one queued before it */
+static bool skb_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo, old_hi;
+	u64 sum_len;
+
+	old_lo = serr->ee.ee_info;
+	old_hi = serr->ee.ee_data;
+	sum_len = old_hi - old_lo + 1ULL + len;
+
+	if (sum_len >= (1ULL << 32))
+		return false;
+
+	if (lo != old_hi + 1)
+		return false;
+
+	serr->ee.ee_data += len;
+	return true;
+}
+
+/*
+ * Called through skb_zcopy_clear() when the last skb is done with the
+ * user pages of the sends in @arg.  Queues their completion, a range
+ * of send ids in ee_info (first) and ee_data (last), or extends the
+ * completion still at the tail of the error queue.
+ */
+void sock_zerocopy_callback(void *arg)
+{
+	struct ubuf_info *uarg = arg;
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock_exterr_skb *serr;
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+
+	/* if !len, there was only 1 call, and it was aborted
+	 * so do not queue a completion notification
+	 */
+	if (!uarg->len || sock_flag(sk, SOCK_DEAD))
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_data = hi;
+	serr->ee.ee_info = lo;
+	if (!uarg->zerocopy)
+		serr->ee.ee_code |= SO_EE_CODE_ZEROCOPY_COPIED;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || SKB_EXT_ERR(tail)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    SKB_EXT_ERR(tail)->ee.ee_code != serr->ee.ee_code ||
+	    !skb_zerocopy_notify_extend(tail, lo, len)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	sk->sk_error_report(sk);
+
+release:
+	consume_skb(skb);
+	sock_put(sk);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_callback);
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		sock_zerocopy_callback(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* Gives back the send id of a sendmsg() that failed before queueing data */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	if (uarg) {
+		struct sock *sk = skb_from_uarg(uarg)->sk;
+
+		atomic_dec(&sk->sk_zckey);
+		uarg->len--;
+
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+/**
+ * skb_zerocopy_from_user - attach user pages to an skb as frags
+ * @skb: buffer to append to, whose ubuf_info is set by the caller
+ * @from: user address of the data
+ * @len: number of bytes
+ *
+ * Pins the pages under @from and appends them to the frags of @skb; the
+ * caller charges them to its socket. Returns the number of bytes
+ * appended, which is less than @len when the frags ran out, or a
+ * negative error if none could be.
+ */
+int skb_zerocopy_from_user(struct sk_buff *skb, const void __user *from,
+			   int len)
+{
+	unsigned long base = (unsigned long)from;
+	struct page *pages[MAX_SKB_FRAGS];
+	int i, n, done = 0;
+	int nr_pages;
+
+	n = MAX_SKB_FRAGS - skb_shinfo(skb)->nr_frags;
+	nr_pages = ((base & ~PAGE_MASK) + len + ~PAGE_MASK) >> PAGE_SHIFT;
+	if (nr_pages > n)
+		nr_pages = n;
+	if (!nr_pages)
+		return -EMSGSIZE;
+
+	n = get_user_pages_fast(base, nr_pages, 0, pages);
+	if (n <= 0)
+		return n ? n : -EFAULT;
+
+	for (i = 0; i < n && done < len; i++) {
+		int off = (base + done) & ~PAGE_MASK;
+		int size = min_t(int, len - done, PAGE_SIZE - off);
+		int last = skb_shinfo(skb)->nr_frags;
+
+		if (skb_can_coalesce(skb, last, pages[i], off)) {
+			skb_frag_size_add(&skb_shinfo(skb)->frags[last - 1],
+					  size);
+			put_page(pages[i]);
+		} else {
+			skb_fill_page_desc(skb, last, pages[i], off, size);
+		}
+		done += size;
+	}
+	for (; i < n; i++)
+		put_page(pages[i]);
+
+	skb->len += done;
+	skb->data_len += done;
+	skb->truesize += done;
+	return done;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_from_user);
+
 
 /**
  * skb_partial_csum_set - set up and verify partial csum values for packet
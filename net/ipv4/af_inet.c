@@ -1259,6 +1259,7 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, u32 features)
 	int ihl;
 	int id;
 	unsigned int offset = 0;
+	bool udpfrag;
 
 	if (!(features & NETIF_F_V4_CSUM))
 		features &= ~NETIF_F_SG;
@@ -1268,6 +1269,7 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, u32 features)
 		       SKB_GSO_UDP |
 		       SKB_GSO_DODGY |
 		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_UDP_L4 |
 		       0)))
 		goto out;
 
@@ -1289,6 +1291,10 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, u32 features)
 	proto = iph->protocol & (MAX_INET_PROTOS - 1);
 	segs = ERR_PTR(-EPROTONOSUPPORT);
 
+	/* UFO makes IP fragments, UDP GSO whole datagrams */
+	udpfrag = proto == IPPROTO_UDP &&
+		  !(skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4);
+
 	rcu_read_lock();
 	ops = rcu_dereference(inet_protos[proto]);
 	if (likely(ops && ops->gso_segment))
@@ -1301,7 +1307,7 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, u32 features)
 	skb = segs;
 	do {
 		iph = ip_hdr(skb);
-		if (proto == IPPROTO_UDP) {
+		if (udpfrag) {
 			iph->id = htons(id);
 			iph->frag_off = htons(offset >> 3);
 			if (skb->next != NULL)
@@ -1340,6 +1346,9 @@ static struct sk_buff **inet_gro_receive(struct sk_buff **head,
 			goto out;
 	}
 
+	/* this may be the inner header of a tunnel */
+	skb_set_network_header(skb, off);
+
 	proto = iph->protocol & (MAX_INET_PROTOS - 1);
 
 	rcu_read_lock();
@@ -1363,7 +1372,11 @@ static struct sk_buff **inet_gro_receive(struct sk_buff **head,
 		if (!NAPI_GRO_CB(p)->same_flow)
 			continue;
 
-		iph2 = ip_hdr(p);
+		/*
+		 * The network header of a held packet is its innermost one,
+		 * compare the header at the same offset as ours.
+		 */
+		iph2 = (struct iphdr *)(p->data + off);
 
 		if ((iph->protocol ^ iph2->protocol) |
 		    (iph->tos ^ iph2->tos) |
@@ -1396,13 +1409,13 @@ out:
 	return pp;
 }
 
-static int inet_gro_complete(struct sk_buff *skb)
+static int inet_gro_complete(struct sk_buff *skb, int nhoff)
 {
 	const struct net_protocol *ops;
-	struct iphdr *iph = ip_hdr(skb);
+	struct iphdr *iph = (struct iphdr *)(skb->data + nhoff);
 	int proto = iph->protocol & (MAX_INET_PROTOS - 1);
 	int err = -ENOSYS;
-	__be16 newlen = htons(skb->len - skb_network_offset(skb));
+	__be16 newlen = htons(skb->len - nhoff);
 
 	csum_replace2(&iph->check, iph->tot_len, newlen);
 	iph->tot_len = newlen;
@@ -1412,7 +1425,8 @@ static int inet_gro_complete(struct sk_buff *skb)
 	if (WARN_ON(!ops || !ops->gro_complete))
 		goto out_unlock;
 
-	err = ops->gro_complete(skb);
+	/* inet_gro_receive() only merges packets without IP options */
+	err = ops->gro_complete(skb, nhoff + sizeof(*iph));
 
 out_unlock:
 	rcu_read_unlock();
@@ -1535,6 +1549,8 @@ static const struct net_protocol udp_protocol = {
 	.err_handler =	udp_err,
 	.gso_send_check = udp4_ufo_send_check,
 	.gso_segment = udp4_ufo_fragment,
+	.gro_receive = udp4_gro_receive,
+	.gro_complete = udp4_gro_complete,
 	.no_policy =	1,
 	.netns_ok =	1,
 };
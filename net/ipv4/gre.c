@@ -110,10 +110,66 @@ static void gre_err(struct sk_buff *skb, u32 info)
 	rcu_read_unlock();
 }
 
+static struct sk_buff **gre_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb)
+{
+	const struct gre_protocol *proto;
+	struct sk_buff **pp = NULL;
+	unsigned int hlen, off;
+	u8 *h;
+	u8 ver;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	h = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		h = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!h))
+			goto flush;
+	}
+
+	ver = h[1]&0x7f;
+	if (ver >= GREPROTO_MAX)
+		goto flush;
+
+	rcu_read_lock();
+	proto = rcu_dereference(gre_proto[ver]);
+	if (!proto || !proto->gro_receive) {
+		rcu_read_unlock();
+		goto flush;
+	}
+	pp = proto->gro_receive(head, skb);
+	rcu_read_unlock();
+	return pp;
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+static int gre_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	const struct gre_protocol *proto;
+	u8 ver = skb->data[nhoff + 1]&0x7f;
+	int err = -ENOENT;
+
+	if (ver >= GREPROTO_MAX)
+		return err;
+
+	rcu_read_lock();
+	proto = rcu_dereference(gre_proto[ver]);
+	if (proto && proto->gro_complete)
+		err = proto->gro_complete(skb, nhoff);
+	rcu_read_unlock();
+	return err;
+}
+
 static const struct net_protocol net_gre_protocol = {
-	.handler     = gre_rcv,
-	.err_handler = gre_err,
-	.netns_ok    = 1,
+	.handler      = gre_rcv,
+	.err_handler  = gre_err,
+	.gro_receive  = gre_gro_receive,
+	.gro_complete = gre_gro_complete,
+	.netns_ok     = 1,
 };
 
 static int __init gre_init(void)
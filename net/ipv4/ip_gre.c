@@ -688,6 +688,109 @@ drop_nolock:
 	return 0;
 }
 
+/*
+ * GRO of IPv4 and IPv6 carried to a local ipgre device. A checksum or
+ * sequence number would differ from one packet to the next, so only
+ * packets with a key or none at all are merged, by handing them on to
+ * GRO of the inner protocol with skb->csum covering the inner packet.
+ */
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct packet_type *ptype;
+	struct sk_buff **pp = NULL;
+	const struct iphdr *iph;
+	struct ip_tunnel *tunnel;
+	unsigned int hlen, off;
+	unsigned int grehlen = 4;
+	struct sk_buff *p;
+	__be16 flags, gre_proto;
+	__be32 key = 0;
+	__wsum csum;
+	int flush = 1;
+	u8 *h;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 8;
+	h = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		h = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!h))
+			goto out;
+	}
+
+	flags = *(__be16 *)h;
+	if (flags & ~GRE_KEY)
+		goto out;
+	if (flags & GRE_KEY) {
+		key = *(__be32 *)(h + 4);
+		grehlen += 4;
+	}
+
+	gre_proto = *(__be16 *)(h + 2);
+	if (gre_proto != htons(ETH_P_IP) && gre_proto != htons(ETH_P_IPV6))
+		goto out;
+
+	/* the inner protocol verifies its checksum with skb->csum */
+	if (skb->ip_summed != CHECKSUM_COMPLETE)
+		goto out;
+
+	iph = skb_gro_network_header(skb);
+	if (ipv4_is_multicast(iph->daddr))
+		goto out;
+
+	tunnel = ipgre_tunnel_lookup(skb->dev, iph->saddr, iph->daddr, key,
+				     gre_proto);
+	if (!tunnel || tunnel->dev->type != ARPHRD_IPGRE ||
+	    tunnel->parms.i_flags & (GRE_CSUM | GRE_SEQ))
+		goto out;
+
+	ptype = gro_find_receive_by_type(gre_proto);
+	if (!ptype)
+		goto out;
+
+	for (p = *head; p; p = p->next) {
+		const u8 *h2;
+
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		h2 = p->data + off;
+		if (*(__be32 *)h2 != *(__be32 *)h ||
+		    ((flags & GRE_KEY) && *(__be32 *)(h2 + 4) != key))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, grehlen);
+	csum = csum_partial(h, grehlen, 0);
+	skb->csum = csum_sub(skb->csum, csum);
+	flush = 0;
+
+	pp = ptype->gro_receive(head, skb);
+
+	/* not verified by the inner protocol: ipgre_rcv() expects it whole */
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->csum = csum_add(skb->csum, csum);
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+	return pp;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb, int nhoff)
+{
+	struct packet_type *ptype;
+	__be16 flags = *(__be16 *)(skb->data + nhoff);
+	__be16 gre_proto = *(__be16 *)(skb->data + nhoff + 2);
+	int grehlen = (flags & GRE_KEY) ? 8 : 4;
+
+	ptype = gro_find_complete_by_type(gre_proto);
+	if (!ptype)
+		return -ENOENT;
+
+	return ptype->gro_complete(skb, nhoff + grehlen);
+}
+
 static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct ip_tunnel *tunnel = netdev_priv(dev);
@@ -1313,8 +1416,10 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 
 
 static const struct gre_protocol ipgre_protocol = {
-	.handler     = ipgre_rcv,
-	.err_handler = ipgre_err,
+	.handler      = ipgre_rcv,
+	.err_handler  = ipgre_err,
+	.gro_receive  = ipgre_gro_receive,
+	.gro_complete = ipgre_gro_complete,
 };
 
 static void ipgre_destroy_tunnels(struct ipgre_net *ign, struct list_head *head)
@@ -783,6 +783,52 @@ static inline int ip_ufo_append_data(struct sock *sk,
 				       (length - transhdrlen));
 }
 
+/* Upper bound of the frags needed to map @len bytes of @iov */
+static int ip_zerocopy_nr_frags(const struct iovec *iov, int len)
+{
+	int nr = 0;
+
+	while (len > 0) {
+		unsigned long base = (unsigned long)iov->iov_base;
+		int copy = min_t(int, len, iov->iov_len);
+
+		nr += ((base & ~PAGE_MASK) + copy + ~PAGE_MASK) >> PAGE_SHIFT;
+		len -= copy;
+		iov++;
+	}
+	return nr;
+}
+
+/* Attaches @len bytes of @iov, starting at @offset, to @skb as frags */
+static int ip_zerocopy_append(struct sk_buff *skb, const struct iovec *iov,
+			      int offset, int len)
+{
+	int done = 0;
+
+	while (offset >= iov->iov_len) {
+		offset -= iov->iov_len;
+		iov++;
+	}
+
+	while (done < len) {
+		int copy = min_t(int, len - done, iov->iov_len - offset);
+		int n;
+
+		if (copy) {
+			n = skb_zerocopy_from_user(skb, iov->iov_base + offset,
+						   copy);
+			if (n < 0)
+				return n;
+			if (n < copy)
+				return -EMSGSIZE;
+			done += n;
+		}
+		offset = 0;
+		iov++;
+	}
+	return done;
+}
+
 static int __ip_append_data(struct sock *sk,
 			    struct flowi4 *fl4,
 			    struct sk_buff_head *queue,
@@ -793,6 +839,7 @@ static int __ip_append_data(struct sock *sk,
 			    unsigned int flags)
 {
 	struct inet_sock *inet = inet_sk(sk);
+	struct ubuf_info *uarg = NULL;
 	struct sk_buff *skb;
 
 	struct ip_options *opt = cork->opt;
@@ -802,6 +849,8 @@ static int __ip_append_data(struct sock *sk,
 	int copy;
 	int err;
 	int offset = 0;
+	int zc = 0;
+	bool paged;
 	unsigned int maxfraglen, fragheaderlen;
 	int csummode = CHECKSUM_NONE;
 	struct rtable *rt = (struct rtable *)cork->dst;
@@ -809,7 +858,13 @@ static int __ip_append_data(struct sock *sk,
 	skb = skb_peek_tail(queue);
 
 	exthdrlen = !skb ? rt->dst.header_len : 0;
-	mtu = cork->fragsize;
+	/*
+	 * A UDP GSO datagram is cut into gso_size segments on the way out,
+	 * it only has to fit in an IP packet for now.  Keep its data in
+	 * pages rather than in one large linear buffer.
+	 */
+	mtu = cork->gso_size ? 0xFFFF : cork->fragsize;
+	paged = cork->gso_size && (rt->dst.dev->features & NETIF_F_SG);
 
 	hh_len = LL_RESERVED_SPACE(rt->dst.dev);
 
@@ -832,6 +887,30 @@ static int __ip_append_data(struct sock *sk,
 	    !exthdrlen)
 		csummode = CHECKSUM_PARTIAL;
 
+	/* GSO computes the checksums of the segments, in software if need be */
+	if (transhdrlen && cork->gso_size)
+		csummode = CHECKSUM_PARTIAL;
+
+	/*
+	 * MSG_ZEROCOPY maps the user data of a datagram that fits in a
+	 * single packet, and has its checksum computed by the device.
+	 * Anything else is copied as usual, and reported so.
+	 */
+	if ((flags & MSG_ZEROCOPY) && length && sock_flag(sk, SOCK_ZEROCOPY)) {
+		uarg = sock_zerocopy_alloc(sk, length);
+		if (!uarg)
+			return -ENOBUFS;
+
+		zc = !skb && csummode == CHECKSUM_PARTIAL &&
+		     getfrag == ip_generic_getfrag &&
+		     (rt->dst.dev->features & NETIF_F_SG) &&
+		     sk_zerocopy_worthwhile(rt->dst.dev, length) &&
+		     ip_zerocopy_nr_frags(from, length - transhdrlen) <=
+		     MAX_SKB_FRAGS;
+		if (!zc)
+			uarg->zerocopy = 0;
+	}
+
 	cork->length += length;
 	if (((length > mtu) || (skb && skb_is_gso(skb))) &&
 	    (sk->sk_protocol == IPPROTO_UDP) &&
@@ -841,6 +920,7 @@ static int __ip_append_data(struct sock *sk,
 					 maxfraglen, flags);
 		if (err)
 			goto error;
+		sock_zerocopy_put(uarg);
 		return 0;
 	}
 
@@ -865,6 +945,7 @@ static int __ip_append_data(struct sock *sk,
 			unsigned int fraglen;
 			unsigned int fraggap;
 			unsigned int alloclen;
+			unsigned int pagedlen = 0;
 			struct sk_buff *skb_prev;
 alloc_new_skb:
 			skb_prev = skb;
@@ -885,7 +966,14 @@ alloc_new_skb:
 			if ((flags & MSG_MORE) &&
 			    !(rt->dst.dev->features&NETIF_F_SG))
 				alloclen = mtu;
-			else
+			else if (zc) {
+				/* only the headers, the data goes in frags */
+				pagedlen = datalen - transhdrlen;
+				alloclen = fraglen - pagedlen;
+			} else if (paged) {
+				alloclen = min_t(int, fraglen, MAX_HEADER);
+				pagedlen = fraglen - alloclen;
+			} else
 				alloclen = fraglen;
 
 			alloclen += exthdrlen;
@@ -926,11 +1014,13 @@ alloc_new_skb:
 			skb->csum = 0;
 			skb_reserve(skb, hh_len);
 			skb_shinfo(skb)->tx_flags = cork->tx_flags;
+			if (zc)
+				skb_zcopy_set(skb, uarg);
 
 			/*
 			 *	Find where to start putting bytes.
 			 */
-			data = skb_put(skb, fraglen + exthdrlen);
+			data = skb_put(skb, fraglen + exthdrlen - pagedlen);
 			skb_set_network_header(skb, exthdrlen);
 			skb->transport_header = (skb->network_header +
 						 fragheaderlen);
@@ -946,7 +1036,7 @@ alloc_new_skb:
 				pskb_trim_unique(skb_prev, maxfraglen);
 			}
 
-			copy = datalen - transhdrlen - fraggap;
+			copy = datalen - transhdrlen - fraggap - pagedlen;
 			if (copy > 0 && getfrag(from, data + transhdrlen, offset, copy, fraggap, skb) < 0) {
 				err = -EFAULT;
 				kfree_skb(skb);
@@ -954,7 +1044,7 @@ alloc_new_skb:
 			}
 
 			offset += copy;
-			length -= datalen - fraggap;
+			length -= datalen - fraggap - pagedlen;
 			transhdrlen = 0;
 			exthdrlen = 0;
 			csummode = CHECKSUM_NONE;
@@ -969,7 +1059,12 @@ alloc_new_skb:
 		if (copy > length)
 			copy = length;
 
-		if (!(rt->dst.dev->features&NETIF_F_SG)) {
+		if (zc) {
+			err = ip_zerocopy_append(skb, from, offset, copy);
+			if (err < 0)
+				goto error;
+			atomic_add(copy, &sk->sk_wmem_alloc);
+		} else if (!(rt->dst.dev->features&NETIF_F_SG)) {
 			unsigned int off;
 
 			off = skb->len;
@@ -1031,10 +1126,12 @@ alloc_new_skb:
 		length -= copy;
 	}
 
+	sock_zerocopy_put(uarg);
 	return 0;
 
 error:
 	cork->length -= length;
+	sock_zerocopy_put_abort(uarg);
 	IP_INC_STATS(sock_net(sk), IPSTATS_MIB_OUTDISCARDS);
 	return err;
 }
@@ -1073,6 +1170,7 @@ static int ip_setup_cork(struct sock *sk, struct inet_cork *cork,
 	cork->dst = &rt->dst;
 	cork->length = 0;
 	cork->tx_flags = ipc->tx_flags;
+	cork->gso_size = ipc->gso_size;
 	cork->page = NULL;
 	cork->off = 0;
 
@@ -1417,9 +1515,8 @@ struct sk_buff *ip_make_skb(struct sock *sk,
 					int len, int odd, struct sk_buff *skb),
 			    void *from, int length, int transhdrlen,
 			    struct ipcm_cookie *ipc, struct rtable **rtp,
-			    unsigned int flags)
+			    struct inet_cork *cork, unsigned int flags)
 {
-	struct inet_cork cork;
 	struct sk_buff_head queue;
 	int err;
 
@@ -1428,21 +1525,21 @@ struct sk_buff *ip_make_skb(struct sock *sk,
 
 	__skb_queue_head_init(&queue);
 
-	cork.flags = 0;
-	cork.addr = 0;
-	cork.opt = NULL;
-	err = ip_setup_cork(sk, &cork, ipc, rtp);
+	cork->flags = 0;
+	cork->addr = 0;
+	cork->opt = NULL;
+	err = ip_setup_cork(sk, cork, ipc, rtp);
 	if (err)
 		return ERR_PTR(err);
 
-	err = __ip_append_data(sk, fl4, &queue, &cork, getfrag,
+	err = __ip_append_data(sk, fl4, &queue, cork, getfrag,
 			       from, length, transhdrlen, flags);
 	if (err) {
-		__ip_flush_pending_frames(sk, &queue, &cork);
+		__ip_flush_pending_frames(sk, &queue, cork);
 		return ERR_PTR(err);
 	}
 
-	return __ip_make_skb(sk, fl4, &queue, &cork);
+	return __ip_make_skb(sk, fl4, &queue, cork);
 }
 
 /*
@@ -1480,6 +1577,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, __be32 daddr,
 	ipc.addr = daddr;
 	ipc.opt = NULL;
 	ipc.tx_flags = 0;
+	ipc.gso_size = 0;
 
 	if (replyopts.opt.opt.optlen) {
 		ipc.opt = &replyopts.opt;
@@ -383,6 +383,7 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 		struct sock_extended_err ee;
 		struct sockaddr_in	 offender;
 	} errhdr;
+	unsigned long flags;
 	int err;
 	int copied;
 
@@ -405,7 +406,8 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	serr = SKB_EXT_ERR(skb);
 
 	sin = (struct sockaddr_in *)msg->msg_name;
-	if (sin) {
+	/* a MSG_ZEROCOPY completion carries no packet to take it from */
+	if (sin && serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
 		sin->sin_family = AF_INET;
 		sin->sin_addr.s_addr = *(__be32 *)(skb_network_header(skb) +
 						   serr->addr_offset);
@@ -434,16 +436,21 @@ int ip_recv_error(struct sock *sk, struct msghdr *msg, int len)
 	msg->msg_flags |= MSG_ERRQUEUE;
 	err = copied;
 
-	/* Reset and regenerate socket error */
-	spin_lock_bh(&sk->sk_error_queue.lock);
-	sk->sk_err = 0;
+	/*
+	 * Reset and regenerate socket error. MSG_ZEROCOPY completions are
+	 * no errors, and may be queued from hard irq context.
+	 */
+	spin_lock_irqsave(&sk->sk_error_queue.lock, flags);
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		sk->sk_err = 0;
 	skb2 = skb_peek(&sk->sk_error_queue);
-	if (skb2 != NULL) {
+	if (skb2 != NULL &&
+	    SKB_EXT_ERR(skb2)->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
 		sk->sk_err = SKB_EXT_ERR(skb2)->ee.ee_errno;
-		spin_unlock_bh(&sk->sk_error_queue.lock);
+		spin_unlock_irqrestore(&sk->sk_error_queue.lock, flags);
 		sk->sk_error_report(sk);
 	} else
-		spin_unlock_bh(&sk->sk_error_queue.lock);
+		spin_unlock_irqrestore(&sk->sk_error_queue.lock, flags);
 
 out_free_skb:
 	kfree_skb(skb);
@@ -273,6 +273,7 @@
 #include <net/ip.h>
 #include <net/netdma.h>
 #include <net/sock.h>
+#include <net/busy_poll.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -457,7 +458,7 @@ unsigned int tcp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	}
 	/* This barrier is coupled with smp_wmb() in tcp_reset() */
 	smp_rmb();
-	if (sk->sk_err)
+	if (sk->sk_err || !skb_queue_empty(&sk->sk_error_queue))
 		mask |= POLLERR;
 
 	return mask;
@@ -725,10 +726,22 @@ static unsigned int tcp_xmit_size_goal(struct sock *sk, u32 mss_now,
 	xmit_size_goal = mss_now;
 
 	if (large_allowed && sk_can_gso(sk)) {
-		xmit_size_goal = ((sk->sk_gso_max_size - 1) -
-				  inet_csk(sk)->icsk_af_ops->net_header_len -
-				  inet_csk(sk)->icsk_ext_hdr_len -
-				  tp->tcp_header_len);
+		u32 gso_size, hlen;
+
+		hlen = inet_csk(sk)->icsk_af_ops->net_header_len +
+		       inet_csk(sk)->icsk_ext_hdr_len +
+		       tp->tcp_header_len;
+
+		/* Goal is to send at least one packet per ms,
+		 * not one big TSO packet every 100 ms.
+		 * This preserves ACK clocking and is consistent
+		 * with tcp_tso_should_defer() heuristic.
+		 */
+		gso_size = sk->sk_pacing_rate / (2 * MSEC_PER_SEC);
+		gso_size = max_t(u32, gso_size, 2 * mss_now);
+
+		xmit_size_goal = min_t(u32, gso_size,
+				       sk->sk_gso_max_size - 1 - hlen);
 
 		xmit_size_goal = tcp_bound_to_half_wnd(tp, xmit_size_goal);
 
@@ -916,15 +929,33 @@ int tcp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 {
 	struct iovec *iov;
 	struct tcp_sock *tp = tcp_sk(sk);
+	struct ubuf_info *uarg = NULL;
 	struct sk_buff *skb;
 	int iovlen, flags;
 	int mss_now, size_goal;
-	int sg, err, copied;
+	int sg, zc = 0, err, copied;
 	long timeo;
 
 	lock_sock(sk);
 
 	flags = msg->msg_flags;
+	if ((flags & MSG_ZEROCOPY) && size && sock_flag(sk, SOCK_ZEROCOPY)) {
+		struct dst_entry *dst = __sk_dst_get(sk);
+
+		uarg = sock_zerocopy_alloc(sk, size);
+		if (!uarg) {
+			err = -ENOBUFS;
+			goto out_err;
+		}
+
+		/* the frags must not need a copy to be checksummed */
+		zc = (sk->sk_route_caps & NETIF_F_SG) &&
+		     (sk->sk_route_caps & NETIF_F_ALL_CSUM) &&
+		     sk_zerocopy_worthwhile(dst ? dst->dev : NULL, size);
+		if (!zc)
+			uarg->zerocopy = 0;
+	}
+
 	timeo = sock_sndtimeo(sk, flags & MSG_DONTWAIT);
 
 	/* Wait for a connection to finish. */
@@ -974,7 +1005,7 @@ new_segment:
 					goto wait_for_sndbuf;
 
 				skb = sk_stream_alloc_skb(sk,
-							  select_size(sk, sg),
+							  zc ? 0 : select_size(sk, sg),
 							  sk->sk_allocation);
 				if (!skb)
 					goto wait_for_memory;
@@ -995,7 +1026,32 @@ new_segment:
 				copy = seglen;
 
 			/* Where to copy to? */
-			if (skb_tailroom(skb) > 0) {
+			if (zc) {
+				struct ubuf_info *orig = skb_zcopy(skb);
+
+				/* an skb reports to a single sendmsg() */
+				if (orig && orig != uarg) {
+					tcp_mark_push(tp, skb);
+					goto new_segment;
+				}
+
+				if (!sk_wmem_schedule(sk, copy))
+					goto wait_for_memory;
+
+				err = skb_zerocopy_from_user(skb, from, copy);
+				if (err == -EMSGSIZE) {
+					tcp_mark_push(tp, skb);
+					goto new_segment;
+				}
+				if (err < 0)
+					goto do_fault;
+				copy = err;
+
+				if (!orig)
+					skb_zcopy_set(skb, uarg);
+				sk->sk_wmem_queued += copy;
+				sk_mem_charge(sk, copy);
+			} else if (skb_tailroom(skb) > 0) {
 				/* We have some space in skb head. Superb! */
 				if (copy > skb_tailroom(skb))
 					copy = skb_tailroom(skb);
@@ -1110,6 +1166,7 @@ wait_for_memory:
 out:
 	if (copied)
 		tcp_push(sk, flags, mss_now, tp->nonagle);
+	sock_zerocopy_put(uarg);
 	release_sock(sk);
 	return copied;
 
@@ -1127,6 +1184,7 @@ do_error:
 	if (copied)
 		goto out;
 out_err:
+	sock_zerocopy_put_abort(uarg);
 	err = sk_stream_error(sk, flags, err);
 	release_sock(sk);
 	return err;
@@ -1415,6 +1473,14 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	struct sk_buff *skb;
 	u32 urg_hole = 0;
 
+	/* MSG_ZEROCOPY completions */
+	if (unlikely(flags & MSG_ERRQUEUE) && sk->sk_family == AF_INET)
+		return ip_recv_error(sk, msg, len);
+
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue) &&
+	    (sk->sk_state == TCP_ESTABLISHED))
+		sk_busy_loop(sk, nonblock);
+
 	lock_sock(sk);
 
 	err = -ENOTCONN;
@@ -2490,6 +2556,9 @@ void tcp_get_info(const struct sock *sk, struct tcp_info *info)
 	info->tcpi_rcv_space = tp->rcvq_space.space;
 
 	info->tcpi_total_retrans = tp->total_retrans;
+
+	info->tcpi_pacing_rate = sk->sk_pacing_rate != ~0U ?
+					sk->sk_pacing_rate : ~0ULL;
 }
 EXPORT_SYMBOL_GPL(tcp_get_info);
 
@@ -3304,4 +3373,5 @@ void __init tcp_init(void)
 	tcp_secret_primary = &tcp_secret_one;
 	tcp_secret_retiring = &tcp_secret_two;
 	tcp_secret_secondary = &tcp_secret_two;
+	tcp_tasklet_init();
 }
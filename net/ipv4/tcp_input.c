@@ -3673,6 +3673,31 @@ static int tcp_process_frto(struct sock *sk, int flag)
 	return 0;
 }
 
+/* Set sk_pacing_rate to twice the current delivery rate, mss * cwnd / srtt,
+ * so that a packet scheduler such as fq can spread out the segments of a
+ * TSO burst and tcp_xmit_size_goal() can size TSO packets for ~1 ms of
+ * data, while still leaving room for cwnd to grow.
+ */
+static void tcp_update_pacing_rate(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	u64 rate;
+
+	rate = (u64)tp->mss_cache * 2 * (HZ << 3);
+
+	rate *= max(tp->snd_cwnd, tp->packets_out);
+
+	/* Correction for small srtt : minimum srtt being 8 (1 jiffy << 3),
+	 * be conservative and assume srtt = 1 (125 us instead of 1.25 ms).
+	 * This also takes care of srtt = 0, before tcp_rtt_estimator()
+	 * was ever called.
+	 */
+	if (tp->srtt > 8 + 2)
+		do_div(rate, tp->srtt);
+
+	sk->sk_pacing_rate = min_t(u64, rate, ~0U);
+}
+
 /* This routine deals with incoming acks, but not outgoing ones. */
 static int tcp_ack(struct sock *sk, const struct sk_buff *skb, int flag)
 {
@@ -3778,6 +3803,8 @@ static int tcp_ack(struct sock *sk, const struct sk_buff *skb, int flag)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
 	}
 
+	tcp_update_pacing_rate(sk);
+
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
 		dst_confirm(__sk_dst_get(sk));
 
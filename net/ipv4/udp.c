@@ -96,6 +96,7 @@
 #include <linux/inet.h>
 #include <linux/netdevice.h>
 #include <linux/slab.h>
+#include <linux/random.h>
 #include <net/tcp_states.h>
 #include <linux/skbuff.h>
 #include <linux/proc_fs.h>
@@ -105,6 +106,7 @@
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include <trace/events/udp.h>
 #include "udp_impl.h"
 
@@ -136,6 +138,7 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	uid_t uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net) &&
@@ -144,6 +147,8 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (*saddr_comp)(sk, sk2)) {
 			if (bitmap)
 				__set_bit(udp_sk(sk2)->udp_port_hash >> log,
@@ -166,6 +171,7 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	uid_t uid = sock_i_uid(sk);
 	int res = 0;
 
 	spin_lock(&hslot2->lock);
@@ -176,6 +182,8 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (*saddr_comp)(sk, sk2)) {
 			res = 1;
 			break;
@@ -406,19 +414,31 @@ static struct sock *udp4_lib_lookup2(struct net *net,
 {
 	struct sock *sk, *result;
 	struct hlist_nulls_node *node;
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 begin:
 	result = NULL;
 	badness = -1;
+	reuseport = 0;
 	udp_portaddr_for_each_entry_rcu(sk, node, &hslot2->head) {
 		score = compute_score2(sk, net, saddr, sport,
 				      daddr, hnum, dif);
 		if (score > badness) {
 			result = sk;
 			badness = score;
-			if (score == SCORE2_MAX)
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			} else if (score == SCORE2_MAX)
 				goto exact_match;
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -454,7 +474,8 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash2, slot2, slot = udp_hashfn(net, hnum, udptable->mask);
 	struct udp_hslot *hslot2, *hslot = &udptable->hash[slot];
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 	rcu_read_lock();
 	if (hslot->count > 10) {
@@ -484,12 +505,24 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 begin:
 	result = NULL;
 	badness = -1;
+	reuseport = 0;
 	sk_nulls_for_each_rcu(sk, node, &hslot->head) {
 		score = compute_score(sk, net, saddr, hnum, sport,
 				      daddr, dport, dif);
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -707,7 +740,8 @@ static void udp4_hwcsum(struct sk_buff *skb, __be32 src, __be32 dst)
 	}
 }
 
-static int udp_send_skb(struct sk_buff *skb, struct flowi4 *fl4)
+static int udp_send_skb(struct sk_buff *skb, struct flowi4 *fl4,
+			struct inet_cork *cork)
 {
 	struct sock *sk = skb->sk;
 	struct inet_sock *inet = inet_sk(sk);
@@ -716,6 +750,7 @@ static int udp_send_skb(struct sk_buff *skb, struct flowi4 *fl4)
 	int is_udplite = IS_UDPLITE(sk);
 	int offset = skb_transport_offset(skb);
 	int len = skb->len - offset;
+	int datalen = len - sizeof(*uh);
 	__wsum csum = 0;
 
 	/*
@@ -727,6 +762,33 @@ static int udp_send_skb(struct sk_buff *skb, struct flowi4 *fl4)
 	uh->len = htons(len);
 	uh->check = 0;
 
+	/*
+	 * UDP_SEGMENT: the datagram goes down the stack in one piece and is
+	 * cut into gso_size datagrams by the device or by GSO, which fill
+	 * in their checksums.
+	 */
+	if (cork->gso_size) {
+		const int hlen = skb_network_header_len(skb) + sizeof(*uh);
+
+		if (hlen + cork->gso_size > cork->fragsize ||
+		    datalen > cork->gso_size * UDP_MAX_SEGMENTS) {
+			kfree_skb(skb);
+			return -EINVAL;
+		}
+		if (is_udplite || sk->sk_no_check == UDP_CSUM_NOXMIT ||
+		    skb->ip_summed != CHECKSUM_PARTIAL ||
+		    skb_has_frag_list(skb)) {
+			kfree_skb(skb);
+			return -EIO;
+		}
+		if (datalen > cork->gso_size) {
+			skb_shinfo(skb)->gso_size = cork->gso_size;
+			skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+			skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(datalen,
+							cork->gso_size);
+		}
+	}
+
 	if (is_udplite)  				 /*     UDP-Lite      */
 		csum = udplite_csum(skb);
 
@@ -778,7 +840,7 @@ static int udp_push_pending_frames(struct sock *sk)
 	if (!skb)
 		goto out;
 
-	err = udp_send_skb(skb, fl4);
+	err = udp_send_skb(skb, fl4, &inet->cork.base);
 
 out:
 	up->len = 0;
@@ -786,6 +848,29 @@ out:
 	return err;
 }
 
+static int udp_cmsg_send(struct msghdr *msg, u16 *gso_size)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (!CMSG_OK(msg, cmsg))
+			return -EINVAL;
+		if (cmsg->cmsg_level != SOL_UDP)
+			continue;
+
+		switch (cmsg->cmsg_type) {
+		case UDP_SEGMENT:
+			if (cmsg->cmsg_len != CMSG_LEN(sizeof(__u16)))
+				return -EINVAL;
+			*gso_size = *(__u16 *)CMSG_DATA(cmsg);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
 int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		size_t len)
 {
@@ -819,6 +904,7 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	ipc.opt = NULL;
 	ipc.tx_flags = 0;
+	ipc.gso_size = up->gso_size;
 
 	getfrag = is_udplite ? udplite_getfrag : ip_generic_getfrag;
 
@@ -873,6 +959,9 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (err)
 		return err;
 	if (msg->msg_controllen) {
+		err = udp_cmsg_send(msg, &ipc.gso_size);
+		if (err)
+			return err;
 		err = ip_cmsg_send(sock_net(sk), msg, &ipc);
 		if (err)
 			return err;
@@ -958,12 +1047,14 @@ back_from_confirm:
 
 	/* Lockless fast path for the non-corking case. */
 	if (!corkreq) {
+		struct inet_cork cork;
+
 		skb = ip_make_skb(sk, fl4, getfrag, msg->msg_iov, ulen,
 				  sizeof(struct udphdr), &ipc, &rt,
-				  msg->msg_flags);
+				  &cork, msg->msg_flags);
 		err = PTR_ERR(skb);
 		if (skb && !IS_ERR(skb))
-			err = udp_send_skb(skb, fl4);
+			err = udp_send_skb(skb, fl4, &cork);
 		goto out;
 	}
 
@@ -1153,6 +1244,20 @@ int udp_ioctl(struct sock *sk, int cmd, unsigned long arg)
 }
 EXPORT_SYMBOL(udp_ioctl);
 
+/*
+ * Tells a UDP_GRO reader the size of the datagrams a coalesced one was
+ * made of; all but the last of them are that long.
+ */
+static void udp_cmsg_recv(struct msghdr *msg, struct sk_buff *skb)
+{
+	int gso_size;
+
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) {
+		gso_size = skb_shinfo(skb)->gso_size;
+		put_cmsg(msg, SOL_UDP, UDP_GRO, sizeof(gso_size), &gso_size);
+	}
+}
+
 /*
  * 	This should be easy, if there is something there we
  * 	return it, otherwise we block.
@@ -1232,6 +1337,8 @@ try_again:
 	}
 	if (inet->cmsg_flags)
 		ip_cmsg_recv(msg, skb);
+	if (udp_sk(sk)->gro_enabled)
+		udp_cmsg_recv(msg, skb);
 
 	err = len;
 	if (flags & MSG_TRUNC)
@@ -1354,8 +1461,10 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
 	int rc;
 
-	if (inet_sk(sk)->inet_daddr)
+	if (inet_sk(sk)->inet_daddr) {
 		sock_rps_save_rxhash(sk, skb);
+		sk_mark_napi_id(sk, skb);
+	}
 
 	rc = ip_queue_rcv_skb(sk, skb);
 	if (rc < 0) {
@@ -1383,7 +1492,7 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
  * Note that in the success and error cases, the skb is assumed to
  * have either been requeued or freed.
  */
-int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+static int udp_queue_rcv_one_skb(struct sock *sk, struct sk_buff *skb)
 {
 	struct udp_sock *up = udp_sk(sk);
 	int rc;
@@ -1491,6 +1600,54 @@ drop:
 	return -1;
 }
 
+/*
+ * A datagram coalesced by GRO, or sent with UDP_SEGMENT over loopback,
+ * is only queued as it is to a socket that asked for it with UDP_GRO.
+ */
+static bool udp_unexpected_gso(struct sock *sk, struct sk_buff *skb)
+{
+	struct udp_sock *up = udp_sk(sk);
+
+	return skb_is_gso(skb) &&
+	       (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) &&
+	       (!up->gro_enabled || up->encap_type);
+}
+
+int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *next, *segs;
+	int ret;
+
+	if (likely(!udp_unexpected_gso(sk, skb)))
+		return udp_queue_rcv_one_skb(sk, skb);
+
+	/* segment from the MAC header, as the transmit path would */
+	__skb_push(skb, skb->data - skb_mac_header(skb));
+	segs = skb_gso_segment(skb, NETIF_F_SG | NETIF_F_HW_CSUM);
+	if (IS_ERR_OR_NULL(segs)) {
+		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
+				 IS_UDPLITE(sk));
+		atomic_inc(&sk->sk_drops);
+		kfree_skb(skb);
+		return -1;
+	}
+	consume_skb(skb);
+
+	for (skb = segs; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		__skb_pull(skb, skb_transport_offset(skb));
+
+		/* the headers of a segment cannot be resubmitted */
+		ret = udp_queue_rcv_one_skb(sk, skb);
+		if (ret > 0) {
+			UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
+					 IS_UDPLITE(sk));
+			kfree_skb(skb);
+		}
+	}
+	return 0;
+}
 
 static void flush_stack(struct sock **stack, unsigned int count,
 			struct sk_buff *skb, unsigned int final)
@@ -1770,6 +1927,21 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		}
 		break;
 
+	/* Segmentation and receive offload are only done over IPv4 so far */
+	case UDP_SEGMENT:
+		if (is_udplite || sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		if (val < 0 || val > USHRT_MAX)
+			return -EINVAL;
+		up->gso_size = val;
+		break;
+
+	case UDP_GRO:
+		if (is_udplite || sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		up->gro_enabled = !!val;
+		break;
+
 	/*
 	 * 	UDP-Lite's partial checksum coverage (RFC 3828).
 	 */
@@ -1852,6 +2024,14 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->encap_type;
 		break;
 
+	case UDP_SEGMENT:
+		val = up->gso_size;
+		break;
+
+	case UDP_GRO:
+		val = up->gro_enabled;
+		break;
+
 	/* The following two cannot be changed on UDP sockets, the return is
 	 * always 0 (which corresponds to the full checksum coverage of UDP). */
 	case UDPLITE_SEND_CSCOV:
@@ -2246,6 +2426,65 @@ int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ * Cuts a UDP_SEGMENT datagram, or one coalesced by GRO, back into
+ * datagrams of gso_size, each with its own header and checksum.
+ */
+static struct sk_buff *__udp_gso_segment(struct sk_buff *skb, u32 features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct udphdr *uh;
+	unsigned int mss;
+	unsigned int oldlen;
+	__be32 delta;
+	int len;
+
+	if (!pskb_may_pull(skb, sizeof(*uh)))
+		goto out;
+
+	mss = skb_shinfo(skb)->gso_size;
+	if (unlikely(skb->len <= sizeof(*uh) + mss))
+		goto out;
+
+	oldlen = (u16)~skb->len;
+	__skb_pull(skb, sizeof(*uh));
+
+	if (skb_gso_ok(skb, features | NETIF_F_GSO_ROBUST)) {
+		/* Packet is from an untrusted source, reset gso_segs. */
+		skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(skb->len, mss);
+
+		segs = NULL;
+		goto out;
+	}
+
+	segs = skb_segment(skb, features);
+	if (IS_ERR(segs))
+		goto out;
+
+	/*
+	 * The check of the original holds the pseudo header sum of its
+	 * length: replace that by the length of each segment, as
+	 * tcp_tso_segment() does.
+	 */
+	for (skb = segs; skb; skb = skb->next) {
+		uh = udp_hdr(skb);
+		len = skb->len - skb_transport_offset(skb);
+		uh->len = htons(len);
+
+		delta = htonl(oldlen + len);
+		uh->check = ~csum_fold((__force __wsum)((__force u32)uh->check +
+							(__force u32)delta));
+		if (skb->ip_summed != CHECKSUM_PARTIAL) {
+			uh->check = csum_fold(csum_partial(uh, sizeof(*uh),
+							   skb->csum));
+			if (uh->check == 0)
+				uh->check = CSUM_MANGLED_0;
+		}
+	}
+out:
+	return segs;
+}
+
 struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, u32 features)
 {
 	struct sk_buff *segs = ERR_PTR(-EINVAL);
@@ -2253,6 +2492,9 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, u32 features)
 	int offset;
 	__wsum csum;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return __udp_gso_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -2288,3 +2530,200 @@ out:
 	return segs;
 }
 
+
+/* Datagrams GRO coalesces at most into one */
+#define UDP_GRO_CNT_MAX 64
+
+static struct sk_buff **udp_gro_receive_segment(struct sk_buff **head,
+						struct sk_buff *skb,
+						struct udphdr *uh)
+{
+	struct sk_buff *p;
+	struct udphdr *uh2;
+	unsigned int ulen = ntohs(uh->len);
+
+	/* requires a checksum, for symmetry with GSO, and no padding */
+	if (!uh->check || ulen <= sizeof(*uh) || ulen != skb_gro_len(skb)) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+
+	skb_gro_pull(skb, sizeof(*uh));
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = udp_hdr(p);
+
+		/* match ports only, the checksum of both is non zero */
+		if (*(u32 *)&uh->source ^ *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		/*
+		 * A datagram longer than the first one of the flow starts a
+		 * new one; a shorter one is the last that can be added.
+		 */
+		if (ulen > ntohs(uh2->len) || NAPI_GRO_CB(p)->flush ||
+		    skb_gro_receive(head, skb))
+			return head;
+
+		if (ulen < ntohs(uh2->len) ||
+		    NAPI_GRO_CB(*head)->count >= UDP_GRO_CNT_MAX)
+			return head;
+
+		return NULL;
+	}
+
+	return NULL;
+}
+
+/*
+ * Hands a datagram to the gro_receive() hook of the tunnel socket it is
+ * addressed to, with skb->csum left covering the inner packet only.
+ */
+static struct sk_buff **udp_gro_receive_encap(struct sock *sk,
+					      struct sk_buff **head,
+					      struct sk_buff *skb,
+					      struct udphdr *uh)
+{
+	const struct iphdr *iph = skb_gro_network_header(skb);
+	unsigned int off = skb_gro_offset(skb);
+	struct sk_buff **pp;
+	struct udphdr *uh2;
+	struct sk_buff *p;
+	__wsum csum;
+
+	if (skb->ip_summed != CHECKSUM_COMPLETE ||
+	    (uh->check && csum_tcpudp_magic(iph->saddr, iph->daddr,
+					    skb_gro_len(skb), IPPROTO_UDP,
+					    skb->csum)))
+		goto flush;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		/* udp_hdr(p) is the header of the inner packet by now */
+		uh2 = (struct udphdr *)(p->data + off);
+		if ((*(u32 *)&uh->source ^ *(u32 *)&uh2->source) ||
+		    !uh->check != !uh2->check)
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, sizeof(*uh));
+	csum = csum_partial(uh, sizeof(*uh), 0);
+	skb->csum = csum_sub(skb->csum, csum);
+
+	pp = udp_sk(sk)->gro_receive(sk, head, skb);
+
+	/* not verified by the inner protocol: udp_rcv() will do it */
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->csum = csum_add(skb->csum, csum);
+
+	return pp;
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	const struct iphdr *iph;
+	struct udp_sock *up;
+	struct udphdr *uh;
+	unsigned int hlen;
+	unsigned int off;
+	struct sock *sk;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto flush;
+	}
+
+	iph = skb_gro_network_header(skb);
+	if (ipv4_is_multicast(iph->daddr) || ipv4_is_lbcast(iph->daddr))
+		goto flush;
+
+	/* only datagrams to sockets that asked for it are coalesced */
+	sk = __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			       iph->daddr, uh->dest, skb->dev->ifindex,
+			       &udp_table);
+	if (!sk)
+		goto flush;
+	up = udp_sk(sk);
+
+	if (ACCESS_ONCE(up->gro_receive)) {
+		pp = udp_gro_receive_encap(sk, head, skb, uh);
+	} else if (up->gro_enabled && !up->encap_type) {
+		switch (skb->ip_summed) {
+		case CHECKSUM_COMPLETE:
+			if (uh->check &&
+			    !csum_tcpudp_magic(iph->saddr, iph->daddr,
+					       skb_gro_len(skb), IPPROTO_UDP,
+					       skb->csum)) {
+				skb->ip_summed = CHECKSUM_UNNECESSARY;
+				break;
+			}
+
+			/* fall through */
+		case CHECKSUM_NONE:
+			NAPI_GRO_CB(skb)->flush = 1;
+			sock_put(sk);
+			return NULL;
+		}
+
+		pp = udp_gro_receive_segment(head, skb, uh);
+	} else {
+		NAPI_GRO_CB(skb)->flush = 1;
+	}
+
+	sock_put(sk);
+	return pp;
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+int udp4_gro_complete(struct sk_buff *skb, int thoff)
+{
+	const struct iphdr *iph;
+	struct udphdr *uh;
+	struct sock *sk;
+	int err = 0;
+
+	/* inet_gro_receive() only merges headers without options */
+	iph = (struct iphdr *)(skb->data + thoff - sizeof(*iph));
+	uh = (struct udphdr *)(skb->data + thoff);
+	uh->len = htons(skb->len - thoff);
+
+	sk = __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			       iph->daddr, uh->dest, skb->dev->ifindex,
+			       &udp_table);
+	if (sk && ACCESS_ONCE(udp_sk(sk)->gro_complete)) {
+		err = udp_sk(sk)->gro_complete(sk, skb, thoff + sizeof(*uh));
+	} else {
+		uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr,
+					       skb->len - thoff,
+					       IPPROTO_UDP, 0);
+		skb->csum_start = (unsigned char *)uh - skb->head;
+		skb->csum_offset = offsetof(struct udphdr, check);
+		skb->ip_summed = CHECKSUM_PARTIAL;
+
+		skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+		skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+	}
+
+	if (sk)
+		sock_put(sk);
+	return err;
+}
@@ -1426,7 +1426,7 @@ static int process_rcf(struct sk_buff *skb, struct nf_conn *ct,
 		nf_ct_refresh(ct, skb, info->timeout * HZ);
 
 		/* Set expect timeout */
-		spin_lock_bh(&nf_conntrack_lock);
+		spin_lock_bh(&nf_conntrack_expect_lock);
 		exp = find_expect(ct, &ct->tuplehash[dir].tuple.dst.u3,
 				  info->sig_port[!dir]);
 		if (exp) {
@@ -1436,7 +1436,7 @@ static int process_rcf(struct sk_buff *skb, struct nf_conn *ct,
 			nf_ct_dump_tuple(&exp->tuple);
 			set_expect_timeout(exp, info->timeout);
 		}
-		spin_unlock_bh(&nf_conntrack_lock);
+		spin_unlock_bh(&nf_conntrack_expect_lock);
 	}
 
 	return 0;
@@ -1464,7 +1464,9 @@ static int process_urq(struct sk_buff *skb, struct nf_conn *ct,
 	}
 
 	/* Clear old expect */
+	spin_lock_bh(&nf_conntrack_expect_lock);
 	nf_ct_remove_expectations(ct);
+	spin_unlock_bh(&nf_conntrack_expect_lock);
 	info->sig_port[dir] = 0;
 	info->sig_port[!dir] = 0;
 
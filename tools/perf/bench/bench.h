@@ -4,6 +4,21 @@
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_block_replay(int argc, const char **argv, const char *prefix __used);
+extern int bench_block_wbt(int argc, const char **argv, const char *prefix __used);
+extern int bench_block_uring(int argc, const char **argv, const char *prefix __used);
+extern int bench_net_reuseport(int argc, const char **argv, const char *prefix __used);
+extern int bench_net_tun(int argc, const char **argv, const char *prefix __used);
+extern int bench_net_busy_poll(int argc, const char **argv, const char *prefix __used);
+extern int bench_net_conntrack(int argc, const char **argv, const char *prefix __used);
+extern int bench_net_zerocopy(int argc, const char **argv, const char *prefix __used);
+extern int bench_net_udp_gso(int argc, const char **argv, const char *prefix __used);
+extern int bench_fs_mballoc(int argc, const char **argv, const char *prefix __used);
+extern int bench_fs_epoll_wait(int argc, const char **argv, const char *prefix __used);
+extern int bench_fs_create(int argc, const char **argv, const char *prefix __used);
+extern int bench_fs_fsmark(int argc, const char **argv, const char *prefix __used);
+extern int bench_fs_pipe(int argc, const char **argv, const char *prefix __used);
+extern int bench_fs_readdir(int argc, const char **argv, const char *prefix __used);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -0,0 +1,448 @@
+/*
+ * block-replay.c
+ *
+ * replay: Replay a block trace once per I/O scheduler
+ *
+ * The trace is the binary output of "blkparse -d", i.e. a stream of
+ * struct blk_io_trace records. Queue events are replayed against a block
+ * device with O_DIRECT, one thread per process found in the trace, each
+ * thread issuing its I/O synchronously and at the original pace. This
+ * keeps the dependencies between the requests of a process, which is
+ * what the I/O schedulers react to. The device is typically a null_blk
+ * device, optionally with completion latency, so that the results only
+ * depend on the scheduler.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/fs.h>
+
+#define REPLAY_ALIGN		4096
+#define REPLAY_HIST_BUCKETS	32
+
+static const char	*trace_file;
+static const char	*device		= "/dev/nullb0";
+static const char	*schedulers	= "noop,deadline,cfq,bfq";
+static bool		do_write;
+static bool		no_delay;
+static int		max_events;
+
+static const struct option options[] = {
+	OPT_STRING('i', "input", &trace_file, "file",
+		    "Trace to replay (output of blkparse -d)"),
+	OPT_STRING('d', "device", &device, "/dev/nullb0",
+		    "Block device to replay the trace on"),
+	OPT_STRING('s', "schedulers", &schedulers, "noop,deadline,cfq,bfq",
+		    "Comma separated list of I/O schedulers to compare"),
+	OPT_BOOLEAN('w', "write", &do_write,
+		    "Replay writes too (destroys the device contents)"),
+	OPT_BOOLEAN('n', "no-delay", &no_delay,
+		    "Issue I/O as fast as possible, ignoring trace timing"),
+	OPT_INTEGER('l', "limit", &max_events,
+		    "Replay at most this many events (0: all)"),
+	OPT_END()
+};
+
+static const char * const bench_block_replay_usage[] = {
+	"perf bench block replay -i <trace> <options>",
+	NULL
+};
+
+/*
+ * On-disk trace format, as in include/linux/blktrace_api.h
+ */
+#define BLK_IO_TRACE_MAGIC	0x65617400
+#define BLK_TA_QUEUE_ACT	1
+#define BLK_TC_WRITE		(1 << 1)
+#define BLK_TC_PC		(1 << 9)
+#define BLK_TC_NOTIFY		(1 << 10)
+#define BLK_TC_SHIFT		16
+
+struct blk_io_trace {
+	u32 magic;
+	u32 sequence;
+	u64 time;
+	u64 sector;
+	u32 bytes;
+	u32 action;
+	u32 pid;
+	u32 device;
+	u32 cpu;
+	u16 error;
+	u16 pdu_len;
+};
+
+struct replay_event {
+	u64 time;		/* nsecs since the first event */
+	u64 sector;
+	u32 bytes;
+	bool write;
+};
+
+struct replay_task {
+	pid_t pid;
+	struct replay_event *events;
+	int nr_events, alloc_events;
+
+	/* results of the current run */
+	u64 *lat;		/* usecs, one per replayed event */
+	int nr_lat;
+	u64 bytes;
+	pthread_t thread;
+};
+
+static struct replay_task *tasks;
+static int nr_tasks;
+static u64 max_bytes;
+
+static int replay_fd;
+static u64 device_sectors;
+static struct timeval run_start;
+
+static struct replay_task *task_find(pid_t pid)
+{
+	int i;
+
+	for (i = 0; i < nr_tasks; i++)
+		if (tasks[i].pid == pid)
+			return &tasks[i];
+
+	tasks = realloc(tasks, (nr_tasks + 1) * sizeof(*tasks));
+	if (!tasks)
+		die("out of memory\n");
+	memset(&tasks[nr_tasks], 0, sizeof(*tasks));
+	tasks[nr_tasks].pid = pid;
+
+	return &tasks[nr_tasks++];
+}
+
+static void task_add_event(struct replay_task *task, struct replay_event *ev)
+{
+	if (task->nr_events == task->alloc_events) {
+		task->alloc_events = task->alloc_events ?
+			task->alloc_events * 2 : 64;
+		task->events = realloc(task->events, task->alloc_events *
+				       sizeof(*task->events));
+		if (!task->events)
+			die("out of memory\n");
+	}
+	task->events[task->nr_events++] = *ev;
+}
+
+/*
+ * Keep the queue events (one per bio submitted by a process), skipping
+ * the ones without data, like flushes.
+ */
+static int read_trace(const char *path)
+{
+	struct blk_io_trace t;
+	struct replay_event ev;
+	u64 first_time = 0;
+	int nr = 0, fd;
+	u32 act;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	while (read(fd, &t, sizeof(t)) == sizeof(t)) {
+		if ((t.magic & 0xffffff00) != BLK_IO_TRACE_MAGIC) {
+			fprintf(stderr, "%s: bad trace magic\n", path);
+			close(fd);
+			return -1;
+		}
+
+		if (t.pdu_len && lseek(fd, t.pdu_len, SEEK_CUR) < 0)
+			break;
+
+		act = t.action & 0xffff;
+		if (act != BLK_TA_QUEUE_ACT || !t.bytes)
+			continue;
+		if ((t.action >> BLK_TC_SHIFT) & (BLK_TC_NOTIFY | BLK_TC_PC))
+			continue;
+
+		if (!nr)
+			first_time = t.time;
+
+		ev.time = t.time - first_time;
+		ev.sector = t.sector;
+		ev.bytes = t.bytes;
+		ev.write = !!((t.action >> BLK_TC_SHIFT) & BLK_TC_WRITE);
+		if (ev.write && !do_write)
+			continue;
+
+		task_add_event(task_find(t.pid), &ev);
+		if (ev.bytes > max_bytes)
+			max_bytes = ev.bytes;
+
+		if (++nr == max_events)
+			break;
+	}
+
+	close(fd);
+	return nr;
+}
+
+static u64 elapsed_nsecs(void)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, &run_start, &diff);
+	return (u64)diff.tv_sec * 1000000000ULL + diff.tv_usec * 1000ULL;
+}
+
+static void *replay_thread(void *arg)
+{
+	struct replay_task *task = arg;
+	struct replay_event *ev;
+	struct timeval start, stop, diff;
+	void *buf;
+	off_t off;
+	ssize_t ret;
+	size_t len;
+	u64 now;
+	int i;
+
+	if (posix_memalign(&buf, REPLAY_ALIGN, max_bytes))
+		die("out of memory\n");
+	memset(buf, 0, max_bytes);
+
+	for (i = 0; i < task->nr_events; i++) {
+		ev = &task->events[i];
+
+		if (!no_delay) {
+			now = elapsed_nsecs();
+			if (ev->time > now)
+				usleep((ev->time - now) / 1000);
+		}
+
+		/* O_DIRECT wants aligned offsets and sizes */
+		len = (ev->bytes + 511) & ~511UL;
+		off = (ev->sector % (device_sectors - len / 512)) * 512;
+
+		gettimeofday(&start, NULL);
+		if (ev->write)
+			ret = pwrite(replay_fd, buf, len, off);
+		else
+			ret = pread(replay_fd, buf, len, off);
+		gettimeofday(&stop, NULL);
+
+		if (ret < 0) {
+			fprintf(stderr, "I/O error at %llu: %s\n",
+				(unsigned long long)off, strerror(errno));
+			continue;
+		}
+
+		timersub(&stop, &start, &diff);
+		task->lat[task->nr_lat++] = diff.tv_sec * 1000000ULL +
+			diff.tv_usec;
+		task->bytes += ret;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int switch_scheduler(const char *name)
+{
+	char path[PATH_MAX];
+	const char *disk;
+	int fd, ret;
+
+	disk = strrchr(device, '/');
+	disk = disk ? disk + 1 : device;
+	snprintf(path, sizeof(path), "/sys/block/%s/queue/scheduler", disk);
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	ret = write(fd, name, strlen(name));
+	close(fd);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to select %s: %s\n", name,
+			strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_results(const char *sched, u64 *lat, int nr, u64 bytes,
+			  struct timeval *diff)
+{
+	unsigned long hist[REPLAY_HIST_BUCKETS];
+	double secs;
+	int i, b;
+
+	secs = diff->tv_sec + diff->tv_usec / 1000000.0;
+	qsort(lat, nr, sizeof(*lat), cmp_u64);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s: %d I/Os in %lu.%03lu sec\n\n", sched, nr,
+		       diff->tv_sec, (unsigned long)(diff->tv_usec / 1000));
+		printf(" %14lf MB/sec\n", bytes / secs / (1024 * 1024));
+		printf(" %14lf IOPS\n", nr / secs);
+		if (!nr)
+			break;
+		printf(" %14llu usecs p50 latency\n",
+		       (unsigned long long)lat[nr / 2]);
+		printf(" %14llu usecs p90 latency\n",
+		       (unsigned long long)lat[nr * 90 / 100]);
+		printf(" %14llu usecs p99 latency\n",
+		       (unsigned long long)lat[nr * 99 / 100]);
+		printf(" %14llu usecs max latency\n\n",
+		       (unsigned long long)lat[nr - 1]);
+
+		memset(hist, 0, sizeof(hist));
+		for (i = 0; i < nr; i++) {
+			for (b = 0; b < REPLAY_HIST_BUCKETS - 1 &&
+				    lat[i] >= (1ULL << b); b++)
+				;
+			hist[b]++;
+		}
+		for (b = 0; b < REPLAY_HIST_BUCKETS; b++) {
+			if (!hist[b])
+				continue;
+			printf(" %10llu usecs: %lu\n",
+			       b ? (unsigned long long)1 << (b - 1) : 0ULL,
+			       hist[b]);
+		}
+		printf("\n");
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%s %lf %lf %llu\n", sched,
+		       bytes / secs / (1024 * 1024), nr / secs,
+		       nr ? (unsigned long long)lat[nr * 99 / 100] : 0ULL);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int replay_once(const char *sched, int nr_events)
+{
+	struct timeval stop, diff;
+	u64 *lat, bytes = 0;
+	int i, nr = 0;
+
+	if (switch_scheduler(sched))
+		return -1;
+
+	for (i = 0; i < nr_tasks; i++) {
+		tasks[i].lat = calloc(tasks[i].nr_events, sizeof(u64));
+		if (!tasks[i].lat)
+			die("out of memory\n");
+		tasks[i].nr_lat = 0;
+		tasks[i].bytes = 0;
+	}
+
+	gettimeofday(&run_start, NULL);
+	for (i = 0; i < nr_tasks; i++)
+		if (pthread_create(&tasks[i].thread, NULL, replay_thread,
+				   &tasks[i]))
+			die("pthread_create failed\n");
+	for (i = 0; i < nr_tasks; i++)
+		pthread_join(tasks[i].thread, NULL);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &run_start, &diff);
+
+	lat = malloc(nr_events * sizeof(u64));
+	if (!lat)
+		die("out of memory\n");
+	for (i = 0; i < nr_tasks; i++) {
+		memcpy(lat + nr, tasks[i].lat, tasks[i].nr_lat * sizeof(u64));
+		nr += tasks[i].nr_lat;
+		bytes += tasks[i].bytes;
+		free(tasks[i].lat);
+	}
+
+	print_results(sched, lat, nr, bytes, &diff);
+	free(lat);
+	return 0;
+}
+
+int bench_block_replay(int argc, const char **argv,
+		       const char *prefix __used)
+{
+	char *list, *sched, *saveptr = NULL;
+	u64 size;
+	int nr_events, ret = 0;
+
+	argc = parse_options(argc, argv, options,
+			     bench_block_replay_usage, 0);
+	if (!trace_file) {
+		/* nothing to replay, e.g. when run by "perf bench all" */
+		fprintf(stderr, "No trace specified, use -i <trace>\n");
+		return 1;
+	}
+
+	nr_events = read_trace(trace_file);
+	if (nr_events <= 0) {
+		fprintf(stderr, "No I/O to replay in %s\n", trace_file);
+		return 1;
+	}
+
+	replay_fd = open(device, (do_write ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (replay_fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", device,
+			strerror(errno));
+		return 1;
+	}
+
+	if (ioctl(replay_fd, BLKGETSIZE64, &size) < 0 ||
+	    size / 512 <= max_bytes / 512 + 1) {
+		fprintf(stderr, "%s is too small\n", device);
+		close(replay_fd);
+		return 1;
+	}
+	device_sectors = size / 512;
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# Replaying %d I/Os from %d tasks on %s\n\n",
+		       nr_events, nr_tasks, device);
+
+	list = strdup(schedulers);
+	for (sched = strtok_r(list, ",", &saveptr); sched;
+	     sched = strtok_r(NULL, ",", &saveptr)) {
+		ret = replay_once(sched, nr_events);
+		if (ret)
+			break;
+	}
+
+	free(list);
+	close(replay_fd);
+	return ret ? 1 : 0;
+}
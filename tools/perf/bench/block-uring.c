@@ -0,0 +1,530 @@
+/*
+ * block-uring.c
+ *
+ * uring: random read IOPS per core of io_uring against AIO
+ *
+ * Reads blocks at random offsets of a device or file, keeping a fixed
+ * number of them in flight: first through io_submit() and io_getevents(),
+ * what libaio does, then through io_uring, with the file and buffers
+ * registered, and last with a kernel thread polling the submission ring
+ * when run as root. For each run this reports the IOPS, how many cpus
+ * were busy meanwhile and the IOPS per busy cpu. Busy time is taken from
+ * /proc/stat for the whole system, so that the time of kernel threads
+ * counts too: run it on an otherwise idle machine. Nothing is written;
+ * use a RAM backed device (brd, "modprobe brd") to leave the cost of the
+ * interface alone.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+#include "../../../include/linux/io_uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <linux/fs.h>
+#include <linux/aio_abi.h>
+
+#define wmb()		__sync_synchronize()
+#define mb()		__sync_synchronize()
+
+static const char	*device		= "/dev/ram0";
+static int		depth		= 32;
+static int		block_size	= 4096;
+static int		runtime		= 5;
+static bool		buffered;
+
+static const struct option options[] = {
+	OPT_STRING('d', "device", &device, "/dev/ram0",
+		    "Device or file to read from (default: /dev/ram0)"),
+	OPT_INTEGER('q', "depth", &depth,
+		    "Reads kept in flight (default: 32)"),
+	OPT_INTEGER('b', "block", &block_size,
+		    "Bytes per read (default: 4096)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run each interface (default: 5)"),
+	OPT_BOOLEAN('B', "buffered", &buffered,
+		    "Read through the page cache instead of O_DIRECT"),
+	OPT_END()
+};
+
+static const char * const bench_block_uring_usage[] = {
+	"perf bench block uring <options>",
+	NULL
+};
+
+struct uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	char *sq_ptr, *cq_ptr;
+	size_t sq_len, sqes_len, cq_len;
+};
+
+struct uring_result {
+	unsigned long ios;
+	double secs;
+	double busy_secs;	/* of all cpus */
+};
+
+static int fd;
+static char *bufs;
+static u64 nr_blocks;
+static u64 rand_state = 0x2545f4914f6cdd1dULL;
+
+static u64 random_offset(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return (rand_state % nr_blocks) * block_size;
+}
+
+/* Sums up the time all cpus spent busy so far, in seconds */
+static double cpu_busy_secs(void)
+{
+	unsigned long long val, total = 0, idle = 0;
+	char line[256], *p, *end;
+	FILE *f;
+	int i;
+
+	f = fopen("/proc/stat", "r");
+	if (!f || !fgets(line, sizeof(line), f))
+		die("cannot read /proc/stat\n");
+	fclose(f);
+
+	/* cpu user nice system idle iowait irq softirq steal ... */
+	p = line + 3;
+	for (i = 0; ; i++) {
+		val = strtoull(p, &end, 10);
+		if (end == p)
+			break;
+		p = end;
+		total += val;
+		if (i == 3 || i == 4)
+			idle += val;
+	}
+
+	return (double)(total - idle) / sysconf(_SC_CLK_TCK);
+}
+
+static double tv_secs(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static bool time_is_up(struct timeval *start)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &diff);
+	return diff.tv_sec >= runtime;
+}
+
+static void check_read(long res)
+{
+	if (res != block_size)
+		die("read failed: %s\n",
+		    res < 0 ? strerror(-res) : "short read");
+}
+
+static int run_aio(struct uring_result *r, struct timeval *start)
+{
+	struct iocb *iocbs, **ptrs;
+	struct io_event *events;
+	aio_context_t ctx = 0;
+	int i, n;
+
+	iocbs = calloc(depth, sizeof(*iocbs));
+	ptrs = calloc(depth, sizeof(*ptrs));
+	events = calloc(depth, sizeof(*events));
+	if (!iocbs || !ptrs || !events)
+		die("out of memory\n");
+
+	if (syscall(__NR_io_setup, depth, &ctx))
+		die("io_setup failed: %s\n", strerror(errno));
+
+	for (i = 0; i < depth; i++) {
+		iocbs[i].aio_lio_opcode = IOCB_CMD_PREAD;
+		iocbs[i].aio_fildes = fd;
+		iocbs[i].aio_buf = (unsigned long)(bufs + i * block_size);
+		iocbs[i].aio_nbytes = block_size;
+		iocbs[i].aio_offset = random_offset();
+		iocbs[i].aio_data = i;
+		ptrs[i] = &iocbs[i];
+	}
+	n = depth;
+
+	do {
+		if (syscall(__NR_io_submit, ctx, n, ptrs) != n)
+			die("io_submit failed: %s\n", strerror(errno));
+
+		n = syscall(__NR_io_getevents, ctx, 1, depth, events, NULL);
+		if (n < 0)
+			die("io_getevents failed: %s\n", strerror(errno));
+
+		for (i = 0; i < n; i++) {
+			struct iocb *iocb = &iocbs[events[i].data];
+
+			check_read(events[i].res);
+			iocb->aio_offset = random_offset();
+			ptrs[i] = iocb;
+		}
+		r->ios += n;
+	} while (!time_is_up(start));
+
+	/* waits for the reads in flight */
+	syscall(__NR_io_destroy, ctx);
+
+	free(events);
+	free(ptrs);
+	free(iocbs);
+	return 0;
+}
+
+static char *uring_map(int ring_fd, size_t len, off_t offset)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+	if (ptr == MAP_FAILED)
+		die("cannot map the rings: %s\n", strerror(errno));
+	return ptr;
+}
+
+static int uring_setup(struct uring *ring, bool sqpoll)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	if (sqpoll)
+		p.flags = IORING_SETUP_SQPOLL;
+
+	ring->fd = syscall(__NR_io_uring_setup, depth, &p);
+	if (ring->fd < 0) {
+		fprintf(stderr, "cannot set up io_uring%s: %s\n",
+			sqpoll ? " with SQPOLL" : "", strerror(errno));
+		return -1;
+	}
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->sq_ptr = uring_map(ring->fd, ring->sq_len, IORING_OFF_SQ_RING);
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *)uring_map(ring->fd, ring->sqes_len,
+						      IORING_OFF_SQES);
+	ring->cq_len = p.cq_off.cqes +
+		       p.cq_entries * sizeof(struct io_uring_cqe);
+	ring->cq_ptr = uring_map(ring->fd, ring->cq_len, IORING_OFF_CQ_RING);
+
+	ring->sq_head = (unsigned *)(ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)(ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_flags = (unsigned *)(ring->sq_ptr + p.sq_off.flags);
+	ring->sq_array = (unsigned *)(ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned *)(ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)(ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(ring->cq_ptr + p.cq_off.cqes);
+
+	return 0;
+}
+
+static void uring_exit(struct uring *ring)
+{
+	munmap(ring->sq_ptr, ring->sq_len);
+	munmap(ring->sqes, ring->sqes_len);
+	munmap(ring->cq_ptr, ring->cq_len);
+	/* waits for the reads in flight */
+	close(ring->fd);
+}
+
+/*
+ * Queues a read into buffer @slot, which uses the sqe of the same index:
+ * no more than depth reads are ever in flight.
+ */
+static void uring_queue(struct uring *ring, unsigned slot, bool fixed)
+{
+	struct io_uring_sqe *sqe = &ring->sqes[slot];
+	unsigned tail = *ring->sq_tail;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->off = random_offset();
+	sqe->user_data = slot;
+	if (fixed) {
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->fd = 0;
+		sqe->addr = (unsigned long)(bufs + slot * block_size);
+		sqe->len = block_size;
+		sqe->buf_index = slot;
+	} else {
+		static struct iovec *iovs;
+
+		if (!iovs) {
+			iovs = calloc(depth, sizeof(*iovs));
+			if (!iovs)
+				die("out of memory\n");
+		}
+		iovs[slot].iov_base = bufs + slot * block_size;
+		iovs[slot].iov_len = block_size;
+
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = fd;
+		sqe->addr = (unsigned long)&iovs[slot];
+		sqe->len = 1;
+	}
+
+	ring->sq_array[tail & *ring->sq_mask] = slot;
+	/* the entry must be visible before the tail */
+	wmb();
+	*ring->sq_tail = tail + 1;
+}
+
+static int uring_register(struct uring *ring)
+{
+	struct iovec *iovs;
+	int i, ret;
+
+	iovs = calloc(depth, sizeof(*iovs));
+	if (!iovs)
+		die("out of memory\n");
+	for (i = 0; i < depth; i++) {
+		iovs[i].iov_base = bufs + i * block_size;
+		iovs[i].iov_len = block_size;
+	}
+
+	ret = syscall(__NR_io_uring_register, ring->fd,
+		      IORING_REGISTER_BUFFERS, iovs, depth);
+	free(iovs);
+	if (ret) {
+		fprintf(stderr, "cannot register buffers: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	ret = syscall(__NR_io_uring_register, ring->fd,
+		      IORING_REGISTER_FILES, &fd, 1);
+	if (ret) {
+		fprintf(stderr, "cannot register the file: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Reaps the completions there are, and queues a new read for each */
+static unsigned uring_reap(struct uring *ring, bool fixed)
+{
+	unsigned head = *ring->cq_head, tail, n = 0;
+	struct io_uring_cqe *cqe;
+
+	tail = *ring->cq_tail;
+	rmb();
+	for (; head != tail; head++, n++) {
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		check_read(cqe->res);
+		uring_queue(ring, cqe->user_data, fixed);
+	}
+
+	/* the entries must be read before the kernel may overwrite them */
+	mb();
+	*ring->cq_head = head;
+	return n;
+}
+
+static int run_uring(struct uring_result *r, struct timeval *start,
+		     bool fixed, bool sqpoll)
+{
+	struct uring ring;
+	unsigned to_submit, flags;
+	int i, ret;
+
+	if (uring_setup(&ring, sqpoll))
+		return -1;
+	if (fixed && uring_register(&ring)) {
+		uring_exit(&ring);
+		return -1;
+	}
+
+	for (i = 0; i < depth; i++)
+		uring_queue(&ring, i, fixed);
+	to_submit = depth;
+
+	do {
+		if (sqpoll) {
+			/*
+			 * The thread submits on its own: enter the kernel
+			 * only to wake it up, or to wait when no read has
+			 * completed yet.
+			 */
+			to_submit = uring_reap(&ring, fixed);
+			r->ios += to_submit;
+
+			flags = 0;
+			mb();
+			if (*ring.sq_flags & IORING_SQ_NEED_WAKEUP)
+				flags |= IORING_ENTER_SQ_WAKEUP;
+			if (!to_submit)
+				flags |= IORING_ENTER_GETEVENTS;
+			if (!flags)
+				continue;
+			to_submit = 0;
+		} else {
+			flags = IORING_ENTER_GETEVENTS;
+		}
+
+		ret = syscall(__NR_io_uring_enter, ring.fd, to_submit, 1,
+			      flags, NULL, 0);
+		if (ret < 0)
+			die("io_uring_enter failed: %s\n", strerror(errno));
+
+		if (!sqpoll) {
+			to_submit = uring_reap(&ring, fixed);
+			r->ios += to_submit;
+		}
+	} while (!time_is_up(start));
+
+	uring_exit(&ring);
+	return 0;
+}
+
+static void print_results(const char *name, struct uring_result *r)
+{
+	double iops = r->ios / r->secs;
+	double cpus = r->busy_secs / r->secs;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %-16s %10.0lf IOPS %6.2lf cpus busy %10.0lf IOPS/cpu\n",
+		       name, iops, cpus, cpus ? iops / cpus : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%s %.0lf %.2lf %.0lf\n", name, iops, cpus,
+		       cpus ? iops / cpus : 0);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+enum {
+	RUN_AIO,
+	RUN_URING,
+	RUN_URING_FIXED,
+	RUN_URING_SQPOLL,
+};
+
+static const char * const run_names[] = {
+	[RUN_AIO]		= "aio",
+	[RUN_URING]		= "io_uring",
+	[RUN_URING_FIXED]	= "+fixed",
+	[RUN_URING_SQPOLL]	= "+sqpoll",
+};
+
+static int run_once(int type)
+{
+	struct timeval start, stop, diff;
+	struct uring_result r;
+	double busy;
+	int ret;
+
+	memset(&r, 0, sizeof(r));
+	busy = cpu_busy_secs();
+	gettimeofday(&start, NULL);
+
+	switch (type) {
+	case RUN_AIO:
+		ret = run_aio(&r, &start);
+		break;
+	case RUN_URING:
+		ret = run_uring(&r, &start, false, false);
+		break;
+	case RUN_URING_FIXED:
+		ret = run_uring(&r, &start, true, false);
+		break;
+	default:
+		ret = run_uring(&r, &start, true, true);
+		break;
+	}
+	if (ret)
+		return ret;
+
+	gettimeofday(&stop, NULL);
+	r.busy_secs = cpu_busy_secs() - busy;
+	timersub(&stop, &start, &diff);
+	r.secs = tv_secs(&diff);
+
+	print_results(run_names[type], &r);
+	return 0;
+}
+
+int bench_block_uring(int argc, const char **argv, const char *prefix __used)
+{
+	struct stat st;
+	u64 size;
+	int ret;
+
+	argc = parse_options(argc, argv, options, bench_block_uring_usage, 0);
+
+	if (depth < 1 || depth > 4096 || block_size < 512 ||
+	    block_size % 512 || runtime < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	fd = open(device, O_RDONLY | (buffered ? 0 : O_DIRECT));
+	if (fd < 0)
+		die("cannot open %s: %s\n", device, strerror(errno));
+	if (fstat(fd, &st))
+		die("cannot stat %s: %s\n", device, strerror(errno));
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &size))
+			die("cannot get the size of %s: %s\n", device,
+			    strerror(errno));
+	} else {
+		size = st.st_size;
+	}
+
+	nr_blocks = size / block_size;
+	if (!nr_blocks)
+		die("%s is smaller than a block\n", device);
+
+	if (posix_memalign((void **)&bufs, 4096, (size_t)depth * block_size))
+		die("out of memory\n");
+	memset(bufs, 0, (size_t)depth * block_size);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d byte random reads from %s%s, %d in flight,"
+		       " %d sec per run\n\n", block_size, device,
+		       buffered ? "" : " (O_DIRECT)", depth, runtime);
+
+	ret = run_once(RUN_AIO) || run_once(RUN_URING) ||
+	      run_once(RUN_URING_FIXED);
+
+	/* SQPOLL needs CAP_SYS_ADMIN */
+	if (!ret && !geteuid())
+		ret = run_once(RUN_URING_SQPOLL);
+
+	free(bufs);
+	close(fd);
+	return ret;
+}
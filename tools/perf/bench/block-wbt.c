@@ -0,0 +1,337 @@
+/*
+ * block-wbt.c
+ *
+ * wbt: Read latency under heavy buffered writeback
+ *
+ * A number of threads keep dirtying the page cache of a block device with
+ * large buffered writes, so that the flusher threads write back to it
+ * continuously, while one thread issues small O_DIRECT random reads and
+ * times them. This is run once with writeback throttling disabled and
+ * once with the given latency target, and the read latency distributions
+ * are compared. The contents of the device are destroyed: use a null_blk
+ * device, with a completion latency to emulate a real disk.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/fs.h>
+
+#define WBT_ALIGN		4096
+#define WBT_READ_SIZE		4096
+#define WBT_MAX_READS		(1 << 20)
+
+static const char	*device;
+static int		nr_writers	= 2;
+static int		runtime		= 10;
+static int		write_kb	= 1024;
+static int		lat_usec	= -1;
+
+static const struct option options[] = {
+	OPT_STRING('d', "device", &device, "/dev/nullb0",
+		    "Block device to run on (its contents are destroyed)"),
+	OPT_INTEGER('w', "writers", &nr_writers,
+		    "Number of buffered writer threads (default: 2)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run with each setting (default: 10)"),
+	OPT_INTEGER('b', "block", &write_kb,
+		    "Size of each buffered write, in KB (default: 1024)"),
+	OPT_INTEGER('t', "target", &lat_usec,
+		    "wbt_lat_usec to compare to no throttling (default: current)"),
+	OPT_END()
+};
+
+static const char * const bench_block_wbt_usage[] = {
+	"perf bench block wbt -d <device> <options>",
+	NULL
+};
+
+static u64 device_bytes;
+static volatile int done;
+
+static u64 *lat;		/* usecs, one per read */
+static int nr_lat;
+static u64 written;
+
+static char *queue_attr(const char *attr)
+{
+	static char path[PATH_MAX];
+	const char *disk;
+
+	disk = strrchr(device, '/');
+	disk = disk ? disk + 1 : device;
+	snprintf(path, sizeof(path), "/sys/block/%s/queue/%s", disk, attr);
+
+	return path;
+}
+
+static int read_attr(const char *attr, char *buf, size_t size)
+{
+	int fd, ret;
+
+	fd = open(queue_attr(attr), O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buf, size - 1);
+	close(fd);
+	if (ret < 0)
+		return -1;
+
+	buf[ret] = '\0';
+	return 0;
+}
+
+static int write_attr(const char *attr, long val)
+{
+	char buf[32];
+	int fd, ret;
+
+	fd = open(queue_attr(attr), O_WRONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", queue_attr(attr),
+			strerror(errno));
+		return -1;
+	}
+
+	snprintf(buf, sizeof(buf), "%ld", val);
+	ret = write(fd, buf, strlen(buf));
+	close(fd);
+
+	return ret < 0 ? -1 : 0;
+}
+
+static void *writer_thread(void *arg)
+{
+	long id = (long)arg;
+	size_t len = write_kb * 1024UL;
+	u64 area = device_bytes / nr_writers;
+	u64 off = 0;
+	void *buf;
+	ssize_t ret;
+	int fd;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0)
+		die("Failed to open %s: %s\n", device, strerror(errno));
+
+	buf = malloc(len);
+	if (!buf)
+		die("out of memory\n");
+	memset(buf, 0xaa, len);
+
+	/* each writer streams through its own part of the device */
+	while (!done) {
+		if (off + len > area)
+			off = 0;
+		ret = pwrite(fd, buf, len, id * area + off);
+		if (ret <= 0)
+			break;
+		off += ret;
+		__sync_fetch_and_add(&written, ret);
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static void *reader_thread(void *arg __used)
+{
+	struct timeval start, stop, diff;
+	u64 nr_blocks = device_bytes / WBT_READ_SIZE;
+	void *buf;
+	int fd;
+
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+		die("Failed to open %s: %s\n", device, strerror(errno));
+
+	if (posix_memalign(&buf, WBT_ALIGN, WBT_READ_SIZE))
+		die("out of memory\n");
+
+	while (!done && nr_lat < WBT_MAX_READS) {
+		off_t off = (random() % nr_blocks) * WBT_READ_SIZE;
+
+		gettimeofday(&start, NULL);
+		if (pread(fd, buf, WBT_READ_SIZE, off) < 0)
+			break;
+		gettimeofday(&stop, NULL);
+
+		timersub(&stop, &start, &diff);
+		lat[nr_lat++] = diff.tv_sec * 1000000ULL + diff.tv_usec;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_results(const char *name, const char *stat)
+{
+	double mb = written / (1024.0 * 1024.0);
+	int nr = nr_lat;
+
+	qsort(lat, nr, sizeof(*lat), cmp_u64);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s: %d reads in %d sec\n\n", name, nr, runtime);
+		printf(" %14lf MB/sec written\n", mb / runtime);
+		if (nr) {
+			printf(" %14llu usecs p50 read latency\n",
+			       (unsigned long long)lat[nr / 2]);
+			printf(" %14llu usecs p90 read latency\n",
+			       (unsigned long long)lat[nr * 90 / 100]);
+			printf(" %14llu usecs p99 read latency\n",
+			       (unsigned long long)lat[nr * 99 / 100]);
+			printf(" %14llu usecs max read latency\n",
+			       (unsigned long long)lat[nr - 1]);
+		}
+		if (stat)
+			printf(" wbt_stat: %s", stat);
+		printf("\n");
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%s %lf %llu %llu\n", name, mb / runtime,
+		       nr ? (unsigned long long)lat[nr / 2] : 0ULL,
+		       nr ? (unsigned long long)lat[nr * 99 / 100] : 0ULL);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(const char *name, long target)
+{
+	pthread_t *writers, reader;
+	char stat[256];
+	long i;
+	int fd;
+
+	if (write_attr("wbt_lat_usec", target))
+		return -1;
+
+	writers = calloc(nr_writers, sizeof(*writers));
+	if (!writers)
+		die("out of memory\n");
+
+	done = 0;
+	nr_lat = 0;
+	written = 0;
+
+	for (i = 0; i < nr_writers; i++)
+		if (pthread_create(&writers[i], NULL, writer_thread,
+				   (void *)i))
+			die("pthread_create failed\n");
+
+	/* let writeback ramp up before timing reads */
+	sleep(1);
+	written = 0;
+	if (pthread_create(&reader, NULL, reader_thread, NULL))
+		die("pthread_create failed\n");
+
+	sleep(runtime);
+	done = 1;
+	pthread_join(reader, NULL);
+	for (i = 0; i < nr_writers; i++)
+		pthread_join(writers[i], NULL);
+	free(writers);
+
+	print_results(name, read_attr("wbt_stat", stat, sizeof(stat)) ?
+		      NULL : stat);
+
+	/* start the next run without dirty pages */
+	fd = open(device, O_WRONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+
+	return 0;
+}
+
+int bench_block_wbt(int argc, const char **argv, const char *prefix __used)
+{
+	char buf[32], name[64];
+	long saved;
+	int fd, ret;
+
+	argc = parse_options(argc, argv, options, bench_block_wbt_usage, 0);
+	if (!device) {
+		/* nothing to run on, e.g. when run by "perf bench all" */
+		fprintf(stderr, "No device specified, use -d <device>\n");
+		return 1;
+	}
+
+	if (nr_writers < 1 || runtime < 1 || write_kb < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", device,
+			strerror(errno));
+		return 1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &device_bytes) < 0 ||
+	    device_bytes / nr_writers < write_kb * 1024ULL) {
+		fprintf(stderr, "%s is too small\n", device);
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	if (read_attr("wbt_lat_usec", buf, sizeof(buf))) {
+		fprintf(stderr, "%s has no writeback throttling\n", device);
+		return 1;
+	}
+	saved = atol(buf);
+	if (lat_usec < 0)
+		lat_usec = saved;
+	if (!lat_usec) {
+		fprintf(stderr, "No latency target, use -t <usecs>\n");
+		return 1;
+	}
+
+	lat = calloc(WBT_MAX_READS, sizeof(*lat));
+	if (!lat)
+		die("out of memory\n");
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d buffered writers and a random reader on %s\n\n",
+		       nr_writers, device);
+
+	ret = run_once("no throttling", 0);
+	if (!ret) {
+		snprintf(name, sizeof(name), "wbt_lat_usec=%d", lat_usec);
+		ret = run_once(name, lat_usec);
+	}
+
+	write_attr("wbt_lat_usec", saved);
+	free(lat);
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,272 @@
+/*
+ * fs-epoll-wait.c
+ *
+ * epoll-wait: event throughput of many threads waiting on epoll
+ *
+ * A number of threads wait for events on a set of eventfds, while writer
+ * threads keep signalling the eventfds in turn. Each event that a waiter
+ * consumes by reading its eventfd counts as an operation; a wakeup that
+ * finds the eventfd already drained by another thread counts as a
+ * spurious one. Either all waiters share one epoll instance, or each has
+ * its own holding all the eventfds, added with EPOLLEXCLUSIVE, which is
+ * how an accept() loop of several threads is commonly built. Reports the
+ * total rate of operations, how evenly the waiters got to run, and the
+ * spurious wakeups.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE		(1 << 28)
+#endif
+
+#define EW_MAX_EVENTS		16
+
+static int		nr_waiters;
+static int		nr_writers	= 1;
+static int		nr_fds		= 64;
+static int		runtime		= 5;
+static bool		edge;
+static bool		multiq;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nr_waiters,
+		    "Number of waiter threads (default: number of cpus)"),
+	OPT_INTEGER('w', "writers", &nr_writers,
+		    "Number of writer threads (default: 1)"),
+	OPT_INTEGER('f', "fds", &nr_fds,
+		    "Number of eventfds (default: 64)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run (default: 5)"),
+	OPT_BOOLEAN('E', "edge", &edge,
+		    "Use edge-triggered events"),
+	OPT_BOOLEAN('m', "multiq", &multiq,
+		    "One epoll instance per waiter, with EPOLLEXCLUSIVE"),
+	OPT_END()
+};
+
+static const char * const bench_fs_epoll_wait_usage[] = {
+	"perf bench fs epoll-wait <options>",
+	NULL
+};
+
+struct waiter {
+	pthread_t thread;
+	int epfd;
+	unsigned long ops;
+	unsigned long spurious;
+};
+
+static struct waiter *waiters;
+static int *fds;
+static volatile int done;
+
+static void *waiter_thread(void *arg)
+{
+	struct waiter *w = arg;
+	struct epoll_event ev[EW_MAX_EVENTS];
+	u64 val;
+	int i, n;
+
+	while (!done) {
+		n = epoll_wait(w->epfd, ev, EW_MAX_EVENTS, 100);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			die("epoll_wait failed: %s\n", strerror(errno));
+		}
+
+		for (i = 0; i < n; i++) {
+			if (read(fds[ev[i].data.u32], &val, sizeof(val)) ==
+			    sizeof(val))
+				w->ops++;
+			else
+				w->spurious++;
+		}
+	}
+
+	return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+	long id = (long)arg;
+	u64 val = 1;
+	int i = id;
+
+	while (!done) {
+		if (write(fds[i], &val, sizeof(val)) < 0 && errno != EAGAIN)
+			die("write failed: %s\n", strerror(errno));
+		i += nr_writers;
+		if (i >= nr_fds)
+			i = id;
+	}
+
+	return NULL;
+}
+
+static int add_fds(int epfd, unsigned int events)
+{
+	struct epoll_event ev;
+	int i;
+
+	for (i = 0; i < nr_fds; i++) {
+		ev.events = events;
+		ev.data.u64 = 0;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+			fprintf(stderr, "epoll_ctl failed: %s\n",
+				strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void print_results(void)
+{
+	unsigned long ops = 0, spurious = 0;
+	double avg, var = 0;
+	int i;
+
+	for (i = 0; i < nr_waiters; i++) {
+		ops += waiters[i].ops;
+		spurious += waiters[i].spurious;
+	}
+	avg = (double)ops / nr_waiters;
+	for (i = 0; i < nr_waiters; i++)
+		var += (waiters[i].ops - avg) * (waiters[i].ops - avg);
+	var /= nr_waiters;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14lf ops/sec\n", (double)ops / runtime);
+		printf(" %14lf ops/sec per waiter, +- %.2lf%%\n",
+		       avg / runtime, avg ? sqrt(var) * 100 / avg : 0);
+		printf(" %14lu spurious wakeups\n", spurious);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf %lf %lu\n", (double)ops / runtime,
+		       avg ? sqrt(var) * 100 / avg : 0, spurious);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+int bench_fs_epoll_wait(int argc, const char **argv,
+			const char *prefix __used)
+{
+	unsigned int events = EPOLLIN;
+	pthread_t *writers;
+	int epfd = -1;
+	long i;
+	int ret = 1;
+
+	argc = parse_options(argc, argv, options, bench_fs_epoll_wait_usage, 0);
+
+	if (!nr_waiters)
+		nr_waiters = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_waiters < 1 || nr_writers < 1 || nr_fds < nr_writers ||
+	    runtime < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	if (edge)
+		events |= EPOLLET;
+	if (multiq)
+		events |= EPOLLEXCLUSIVE;
+
+	fds = calloc(nr_fds, sizeof(*fds));
+	waiters = calloc(nr_waiters, sizeof(*waiters));
+	writers = calloc(nr_writers, sizeof(*writers));
+	if (!fds || !waiters || !writers)
+		die("out of memory\n");
+
+	for (i = 0; i < nr_fds; i++) {
+		fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (fds[i] < 0)
+			die("eventfd failed: %s\n", strerror(errno));
+	}
+
+	if (!multiq) {
+		epfd = epoll_create(nr_fds);
+		if (epfd < 0)
+			die("epoll_create failed: %s\n", strerror(errno));
+		if (add_fds(epfd, events))
+			goto out;
+	}
+
+	for (i = 0; i < nr_waiters; i++) {
+		if (multiq) {
+			waiters[i].epfd = epoll_create(nr_fds);
+			if (waiters[i].epfd < 0)
+				die("epoll_create failed: %s\n",
+				    strerror(errno));
+			if (add_fds(waiters[i].epfd, events))
+				goto out;
+		} else
+			waiters[i].epfd = epfd;
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d waiters on %s, %d writers, %d eventfds%s\n\n",
+		       nr_waiters, multiq ? "an epoll instance each" :
+		       "one epoll instance", nr_writers, nr_fds,
+		       edge ? ", edge-triggered" : "");
+
+	for (i = 0; i < nr_waiters; i++)
+		if (pthread_create(&waiters[i].thread, NULL, waiter_thread,
+				   &waiters[i]))
+			die("pthread_create failed\n");
+	for (i = 0; i < nr_writers; i++)
+		if (pthread_create(&writers[i], NULL, writer_thread,
+				   (void *)i))
+			die("pthread_create failed\n");
+
+	sleep(runtime);
+	done = 1;
+
+	for (i = 0; i < nr_writers; i++)
+		pthread_join(writers[i], NULL);
+	for (i = 0; i < nr_waiters; i++)
+		pthread_join(waiters[i].thread, NULL);
+
+	print_results();
+	ret = 0;
+
+out:
+	for (i = 0; multiq && i < nr_waiters; i++)
+		if (waiters[i].epfd > 0)
+			close(waiters[i].epfd);
+	if (epfd >= 0)
+		close(epfd);
+	for (i = 0; i < nr_fds; i++)
+		close(fds[i]);
+	free(writers);
+	free(waiters);
+	free(fds);
+	return ret;
+}
@@ -0,0 +1,212 @@
+/*
+ * fs-fsmark.c
+ *
+ * fsmark: small file metadata updates of many threads on one filesystem
+ *
+ * In the manner of fs_mark, each thread works in a directory of its own
+ * and for every file creates it, writes a little data to it, sets its
+ * times and closes it, optionally calling fsync() before the close. After
+ * a batch of files it unlinks them again. On a journalling filesystem
+ * every one of these steps starts and stops a journal handle, so how the
+ * rate of files grows from 1, 2, 4, ... threads up to the number asked
+ * for shows how well the journal scales.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static const char	*dir;
+static int		nr_threads;
+static int		batch		= 1000;
+static int		file_size	= 4096;
+static int		runtime		= 5;
+static bool		do_fsync;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &dir, "/mnt",
+		    "Directory to create the files in"),
+	OPT_INTEGER('t', "threads", &nr_threads,
+		    "Largest number of threads (default: number of cpus)"),
+	OPT_INTEGER('b', "batch", &batch,
+		    "Files each thread creates before unlinking them (default: 1000)"),
+	OPT_INTEGER('s', "size", &file_size,
+		    "Bytes written to each file (default: 4096)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run at each number of threads (default: 5)"),
+	OPT_BOOLEAN('S', "sync", &do_fsync,
+		    "fsync() each file before closing it"),
+	OPT_END()
+};
+
+static const char * const bench_fs_fsmark_usage[] = {
+	"perf bench fs fsmark -d <directory> <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned long files;
+};
+
+static char *buf;
+static volatile int done;
+
+static void worker_path(char *path, size_t len, int id, int file)
+{
+	if (file < 0)
+		snprintf(path, len, "%s/fsmark.%d", dir, id);
+	else
+		snprintf(path, len, "%s/fsmark.%d/%d", dir, id, file);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	char path[PATH_MAX];
+	int i, fd;
+
+	while (!done) {
+		for (i = 0; i < batch; i++) {
+			worker_path(path, sizeof(path), w->id, i);
+			fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+			if (fd < 0)
+				die("Failed to create %s: %s\n", path,
+				    strerror(errno));
+			if (file_size && write(fd, buf, file_size) != file_size)
+				die("Failed to write %s: %s\n", path,
+				    strerror(errno));
+			if (futimes(fd, NULL) < 0)
+				die("Failed to set times of %s: %s\n", path,
+				    strerror(errno));
+			if (do_fsync && fsync(fd) < 0)
+				die("Failed to fsync %s: %s\n", path,
+				    strerror(errno));
+			close(fd);
+			w->files++;
+		}
+
+		for (i = 0; i < batch; i++) {
+			worker_path(path, sizeof(path), w->id, i);
+			if (unlink(path) < 0)
+				die("Failed to unlink %s: %s\n", path,
+				    strerror(errno));
+		}
+	}
+
+	return NULL;
+}
+
+static void print_results(int threads, unsigned long files, double secs)
+{
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %5d threads: %14lf files/sec, %14lf files/sec per thread\n",
+		       threads, files / secs, files / secs / threads);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%d %lf\n", threads, files / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static void run_once(struct worker *workers, int threads)
+{
+	struct timeval start, stop, diff;
+	unsigned long files = 0;
+	int i;
+
+	done = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < threads; i++) {
+		workers[i].files = 0;
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+				   &workers[i]))
+			die("pthread_create failed\n");
+	}
+
+	sleep(runtime);
+	done = 1;
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		files += workers[i].files;
+	}
+	gettimeofday(&stop, NULL);
+
+	timersub(&stop, &start, &diff);
+	print_results(threads, files, diff.tv_sec + diff.tv_usec / 1e6);
+}
+
+int bench_fs_fsmark(int argc, const char **argv, const char *prefix __used)
+{
+	struct worker *workers;
+	char path[PATH_MAX];
+	int i, threads;
+
+	argc = parse_options(argc, argv, options, bench_fs_fsmark_usage, 0);
+	if (!dir) {
+		/* nothing to run on, e.g. when run by "perf bench all" */
+		fprintf(stderr, "No directory specified, use -d <directory>\n");
+		return 1;
+	}
+
+	if (!nr_threads)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads < 1 || batch < 1 || file_size < 0 || runtime < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	buf = calloc(1, file_size + 1);
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!buf || !workers)
+		die("out of memory\n");
+	memset(buf, 'a', file_size);
+
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].id = i;
+		worker_path(path, sizeof(path), i, -1);
+		if (mkdir(path, 0755) < 0 && errno != EEXIST)
+			die("Failed to create %s: %s\n", path, strerror(errno));
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d files of %d bytes per thread in %s%s\n\n",
+		       batch, file_size, dir, do_fsync ? ", with fsync" : "");
+
+	for (threads = 1; ; threads *= 2) {
+		if (threads > nr_threads)
+			threads = nr_threads;
+		run_once(workers, threads);
+		if (threads == nr_threads)
+			break;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		worker_path(path, sizeof(path), i, -1);
+		rmdir(path);
+	}
+	free(workers);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * fs-mballoc.c
+ *
+ * mballoc: large allocation latency of ext4 on a nearly full filesystem
+ *
+ * Fills an ext4 filesystem with preallocated files, then punches one
+ * chunk out of every few of them, so that it is left at the given level
+ * with free extents of the chunk size only. Allocations twice that size
+ * then find no group with the free extent they ask for, which is where
+ * scanning every group used to make them slow. Those are timed with
+ * mb_optimize_scan off, then on. Preallocation writes no data: the
+ * filesystem is best made on a sparse file of a few TB, mounted through
+ * a loop device, where it takes little room and has many groups.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/sysmacros.h>
+#include <sys/time.h>
+#include <linux/falloc.h>
+
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE	0x02
+#endif
+
+#define MB_FILL_FILE_SIZE	(64ULL << 30)
+
+static const char	*dir;
+static int		fill_pct	= 90;
+static int		chunk_kb	= 1024;
+static int		nr_allocs	= 1000;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &dir, "/mnt",
+		    "Directory on the ext4 filesystem to fill"),
+	OPT_INTEGER('f', "fill", &fill_pct,
+		    "Percentage of the filesystem left in use (default: 90)"),
+	OPT_INTEGER('c', "chunk", &chunk_kb,
+		    "Size of the free extents left, in KB (default: 1024)"),
+	OPT_INTEGER('n', "allocs", &nr_allocs,
+		    "Number of allocations to time (default: 1000)"),
+	OPT_END()
+};
+
+static const char * const bench_fs_mballoc_usage[] = {
+	"perf bench fs mballoc -d <directory> <options>",
+	NULL
+};
+
+static char attr_path[PATH_MAX];
+static int nr_files;
+static u64 *lat;		/* usecs, one per allocation */
+
+/*
+ * /sys/fs/ext4/<dev>/mb_optimize_scan of the filesystem dir is on
+ */
+static int find_attr(void)
+{
+	char link[PATH_MAX], target[PATH_MAX];
+	struct stat st;
+	ssize_t len;
+
+	if (stat(dir, &st) < 0) {
+		fprintf(stderr, "Failed to stat %s: %s\n", dir,
+			strerror(errno));
+		return -1;
+	}
+
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u",
+		 major(st.st_dev), minor(st.st_dev));
+	len = readlink(link, target, sizeof(target) - 1);
+	if (len < 0) {
+		fprintf(stderr, "%s is not on a block device\n", dir);
+		return -1;
+	}
+	target[len] = '\0';
+
+	snprintf(attr_path, sizeof(attr_path),
+		 "/sys/fs/ext4/%s/mb_optimize_scan", basename(target));
+	if (access(attr_path, W_OK)) {
+		fprintf(stderr, "Cannot write %s: %s\n", attr_path,
+			strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int read_attr(void)
+{
+	char buf[32];
+	int fd, ret;
+
+	fd = open(attr_path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (ret < 0)
+		return -1;
+
+	buf[ret] = '\0';
+	return atoi(buf);
+}
+
+static int write_attr(int val)
+{
+	char buf[32];
+	int fd, ret;
+
+	fd = open(attr_path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+
+	snprintf(buf, sizeof(buf), "%d", val);
+	ret = write(fd, buf, strlen(buf));
+	close(fd);
+
+	return ret < 0 ? -1 : 0;
+}
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0)
+		return;
+	if (write(fd, "3", 1) < 0)
+		fprintf(stderr, "Failed to drop caches: %s\n",
+			strerror(errno));
+	close(fd);
+}
+
+static int fs_used_pct(void)
+{
+	struct statfs sfs;
+
+	if (statfs(dir, &sfs) < 0)
+		die("statfs failed: %s\n", strerror(errno));
+
+	return 100 - (int)(sfs.f_bavail * 100 / sfs.f_blocks);
+}
+
+/*
+ * Preallocate fill files until the filesystem is full, then punch one
+ * chunk out of every stride of them to bring it down to fill_pct.
+ */
+static int fill(void)
+{
+	u64 chunk = chunk_kb * 1024ULL;
+	u64 stride = chunk * (100 / (100 - fill_pct));
+	char path[PATH_MAX];
+	u64 off, size;
+	int i, fd;
+
+	for (nr_files = 0; fs_used_pct() < 100; nr_files++) {
+		snprintf(path, sizeof(path), "%s/mballoc.fill.%d", dir,
+			 nr_files);
+		fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+		if (fd < 0)
+			die("Failed to create %s: %s\n", path,
+			    strerror(errno));
+
+		/* grow each file by 1GB at a time until out of space */
+		for (size = 0; size < MB_FILL_FILE_SIZE; size += 1ULL << 30)
+			if (fallocate(fd, 0, size, 1ULL << 30) < 0)
+				break;
+		close(fd);
+		if (!size) {
+			unlink(path);
+			break;
+		}
+	}
+
+	for (i = 0; i < nr_files; i++) {
+		struct stat st;
+
+		snprintf(path, sizeof(path), "%s/mballoc.fill.%d", dir, i);
+		fd = open(path, O_WRONLY);
+		if (fd < 0 || fstat(fd, &st) < 0)
+			die("Failed to open %s: %s\n", path, strerror(errno));
+
+		for (off = 0; off + stride <= (u64)st.st_blocks * 512;
+		     off += stride) {
+			if (fallocate(fd, FALLOC_FL_PUNCH_HOLE |
+				      FALLOC_FL_KEEP_SIZE, off, chunk) < 0) {
+				fprintf(stderr, "Failed to punch %s: %s\n",
+					path, strerror(errno));
+				close(fd);
+				return -1;
+			}
+		}
+		close(fd);
+	}
+
+	return 0;
+}
+
+static void unfill(void)
+{
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/mballoc.fill.%d", dir, i);
+		unlink(path);
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_results(const char *name, int nr, u64 total)
+{
+	qsort(lat, nr, sizeof(*lat), cmp_u64);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s: %d allocations of %d KB\n\n", name, nr,
+		       2 * chunk_kb);
+		if (nr) {
+			printf(" %14lf allocations/sec\n",
+			       nr * 1000000.0 / total);
+			printf(" %14llu usecs p50 latency\n",
+			       (unsigned long long)lat[nr / 2]);
+			printf(" %14llu usecs p99 latency\n",
+			       (unsigned long long)lat[nr * 99 / 100]);
+			printf(" %14llu usecs max latency\n",
+			       (unsigned long long)lat[nr - 1]);
+		}
+		printf("\n");
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%s %d %llu %llu\n", name, nr,
+		       nr ? (unsigned long long)lat[nr / 2] : 0ULL,
+		       nr ? (unsigned long long)lat[nr * 99 / 100] : 0ULL);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(const char *name, int optimize)
+{
+	u64 len = 2 * chunk_kb * 1024ULL;
+	struct timeval start, stop, diff;
+	char path[PATH_MAX];
+	u64 total = 0;
+	int fd, i;
+
+	if (write_attr(optimize)) {
+		fprintf(stderr, "Failed to set %s\n", attr_path);
+		return -1;
+	}
+
+	/* start from the on-disk bitmaps every time */
+	drop_caches();
+
+	snprintf(path, sizeof(path), "%s/mballoc.test", dir);
+	fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0)
+		die("Failed to create %s: %s\n", path, strerror(errno));
+
+	for (i = 0; i < nr_allocs; i++) {
+		gettimeofday(&start, NULL);
+		if (fallocate(fd, 0, i * len, len) < 0) {
+			if (errno != ENOSPC)
+				die("fallocate failed: %s\n", strerror(errno));
+			break;
+		}
+		gettimeofday(&stop, NULL);
+
+		timersub(&stop, &start, &diff);
+		lat[i] = diff.tv_sec * 1000000ULL + diff.tv_usec;
+		total += lat[i];
+	}
+
+	close(fd);
+	unlink(path);
+	sync();
+
+	print_results(name, i, total);
+	return 0;
+}
+
+int bench_fs_mballoc(int argc, const char **argv, const char *prefix __used)
+{
+	int saved, ret;
+
+	argc = parse_options(argc, argv, options, bench_fs_mballoc_usage, 0);
+	if (!dir) {
+		/* nothing to run on, e.g. when run by "perf bench all" */
+		fprintf(stderr, "No directory specified, use -d <directory>\n");
+		return 1;
+	}
+
+	if (fill_pct < 50 || fill_pct > 99 || chunk_kb < 4 || nr_allocs < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	if (find_attr())
+		return 1;
+	saved = read_attr();
+
+	lat = calloc(nr_allocs, sizeof(*lat));
+	if (!lat)
+		die("out of memory\n");
+
+	ret = fill();
+	if (ret)
+		goto out;
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %s is %d%% full, with free extents of %d KB\n\n",
+		       dir, fs_used_pct(), chunk_kb);
+
+	ret = run_once("mb_optimize_scan=0", 0);
+	if (!ret)
+		ret = run_once("mb_optimize_scan=1", 1);
+
+out:
+	unfill();
+	if (saved >= 0)
+		write_attr(saved);
+	free(lat);
+	return ret ? 1 : 0;
+}
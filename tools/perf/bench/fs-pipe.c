@@ -0,0 +1,205 @@
+/*
+ * fs-pipe.c
+ *
+ * pipe: throughput of a pipe between a producer and a consumer thread
+ *
+ * The producer fills the pipe with write(), or hands its buffer over with
+ * vmsplice(), optionally as a gift, which passes the pages themselves
+ * instead of copying them. The consumer drains it with read(), or
+ * splices it to /dev/null, which takes no copy either. Reports the rate
+ * of data through the pipe and how large the pipe has grown by the end.
+ * The data is never looked at, so the producer reuses its buffer even
+ * when it gifted it.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#ifndef F_GETPIPE_SZ
+#define F_GETPIPE_SZ		1032
+#endif
+
+static const char	*mode		= "write";
+static int		block_kb	= 64;
+static int		runtime		= 5;
+static bool		use_splice;
+
+static const struct option options[] = {
+	OPT_STRING('m', "mode", &mode, "write",
+		    "How to fill the pipe: write, vmsplice or gift (default: write)"),
+	OPT_INTEGER('b', "block", &block_kb,
+		    "KB passed per write or vmsplice (default: 64)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run (default: 5)"),
+	OPT_BOOLEAN('S', "splice", &use_splice,
+		    "Splice the pipe to /dev/null instead of reading it"),
+	OPT_END()
+};
+
+static const char * const bench_fs_pipe_usage[] = {
+	"perf bench fs pipe <options>",
+	NULL
+};
+
+enum { MODE_WRITE, MODE_VMSPLICE, MODE_GIFT };
+
+static int fill_mode;
+static int pipefd[2];
+static size_t block;
+static char *buf;
+static unsigned long long bytes;
+
+static void *consumer_thread(void *arg __used)
+{
+	int null_fd = -1;
+	ssize_t ret;
+
+	if (use_splice) {
+		null_fd = open("/dev/null", O_WRONLY);
+		if (null_fd < 0)
+			die("Failed to open /dev/null: %s\n", strerror(errno));
+	}
+
+	for (;;) {
+		if (use_splice)
+			ret = splice(pipefd[0], NULL, null_fd, NULL, block,
+				     SPLICE_F_MOVE);
+		else
+			ret = read(pipefd[0], buf + block, block);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			die("Failed to drain the pipe: %s\n", strerror(errno));
+		}
+		if (!ret)
+			break;
+		bytes += ret;
+	}
+
+	if (null_fd >= 0)
+		close(null_fd);
+	return NULL;
+}
+
+static void produce(void)
+{
+	struct iovec iov;
+	size_t done_len;
+	ssize_t ret;
+
+	for (done_len = 0; done_len < block; done_len += ret) {
+		iov.iov_base = buf + done_len;
+		iov.iov_len = block - done_len;
+
+		switch (fill_mode) {
+		case MODE_VMSPLICE:
+			ret = vmsplice(pipefd[1], &iov, 1, 0);
+			break;
+		case MODE_GIFT:
+			ret = vmsplice(pipefd[1], &iov, 1, SPLICE_F_GIFT);
+			break;
+		default:
+			ret = write(pipefd[1], iov.iov_base, iov.iov_len);
+			break;
+		}
+		if (ret < 0) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			die("Failed to fill the pipe: %s\n", strerror(errno));
+		}
+	}
+}
+
+static void print_results(double secs, int pipe_size)
+{
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %14lf MB/sec\n", bytes / secs / (1 << 20));
+		printf(" %14d KB pipe size at the end\n", pipe_size >> 10);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lf %d\n", bytes / secs / (1 << 20), pipe_size >> 10);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+int bench_fs_pipe(int argc, const char **argv, const char *prefix __used)
+{
+	struct timeval start, stop, diff;
+	pthread_t consumer;
+	int pipe_size;
+
+	argc = parse_options(argc, argv, options, bench_fs_pipe_usage, 0);
+
+	if (!strcmp(mode, "write"))
+		fill_mode = MODE_WRITE;
+	else if (!strcmp(mode, "vmsplice"))
+		fill_mode = MODE_VMSPLICE;
+	else if (!strcmp(mode, "gift"))
+		fill_mode = MODE_GIFT;
+	else
+		fill_mode = -1;
+	if (fill_mode < 0 || block_kb < 1 || runtime < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	/* page aligned, as gifts must be; the second half is read into */
+	block = block_kb * 1024;
+	buf = mmap(NULL, 2 * block, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		die("out of memory\n");
+	memset(buf, 'a', 2 * block);
+
+	if (pipe(pipefd) < 0)
+		die("pipe failed: %s\n", strerror(errno));
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d KB blocks by %s, %s\n\n", block_kb, mode,
+		       use_splice ? "spliced to /dev/null" : "read");
+
+	gettimeofday(&start, NULL);
+	if (pthread_create(&consumer, NULL, consumer_thread, NULL))
+		die("pthread_create failed\n");
+
+	gettimeofday(&stop, NULL);
+	while (stop.tv_sec - start.tv_sec < runtime) {
+		produce();
+		gettimeofday(&stop, NULL);
+	}
+
+	pipe_size = fcntl(pipefd[1], F_GETPIPE_SZ);
+	close(pipefd[1]);
+	pthread_join(consumer, NULL);
+	gettimeofday(&stop, NULL);
+	close(pipefd[0]);
+
+	timersub(&stop, &start, &diff);
+	print_results(diff.tv_sec + diff.tv_usec / 1e6, pipe_size);
+
+	munmap(buf, 2 * block);
+	return 0;
+}
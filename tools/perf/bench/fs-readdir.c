@@ -0,0 +1,276 @@
+/*
+ * fs-readdir.c
+ *
+ * readdir: scanning a directory for the attributes of its entries
+ *
+ * Reads through a directory the way backup tools and build systems do,
+ * with getdents64() and an lstat() of every entry, then with
+ * getdents_plus(), which returns the attributes along with the entries,
+ * first looking up what the dcache is missing, then only from the dcache.
+ * Reports the rate of entries at each, and how many came with their
+ * attributes. With -c the caches are dropped before each run, which is
+ * where reading the inodes ahead in a batch pays off.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+#ifndef __NR_getdents_plus
+# if defined(__x86_64__)
+#  define __NR_getdents_plus	315
+# elif defined(__i386__)
+#  define __NR_getdents_plus	352
+# else
+#  define __NR_getdents_plus	-1
+# endif
+#endif
+
+#define DIRENT_PLUS_ATTR	(1U << 0)
+#define DIRENT_PLUS_CACHED	(1U << 0)
+
+/* from <linux/dirent_plus.h> */
+struct dirent_plus_attr {
+	unsigned int	mode;
+	unsigned int	nlink;
+	unsigned int	uid;
+	unsigned int	gid;
+	unsigned int	rdev;
+	unsigned int	blksize;
+	u64		size;
+	u64		blocks;
+	long long	atime;
+	long long	mtime;
+	long long	ctime;
+	unsigned int	atime_nsec;
+	unsigned int	mtime_nsec;
+	unsigned int	ctime_nsec;
+	unsigned int	__pad;
+};
+
+struct linux_dirent_plus {
+	u64		d_ino;
+	long long	d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	unsigned char	__pad;
+	unsigned int	d_valid;
+	struct dirent_plus_attr d_attr;
+	char		d_name[0];
+};
+
+struct linux_dirent64 {
+	u64		d_ino;
+	long long	d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char		d_name[0];
+};
+
+static const char	*dir;
+static int		nr_files;
+static int		buf_kb		= 32;
+static bool		cold;
+
+static const struct option options[] = {
+	OPT_STRING('d', "directory", &dir, "/mnt",
+		    "Directory to scan"),
+	OPT_INTEGER('n', "files", &nr_files,
+		    "Create a directory of this many files in it to scan instead"),
+	OPT_INTEGER('b', "buffer", &buf_kb,
+		    "KB of entries asked for per call (default: 32)"),
+	OPT_BOOLEAN('c', "cold", &cold,
+		    "Drop the caches before each run"),
+	OPT_END()
+};
+
+static const char * const bench_fs_readdir_usage[] = {
+	"perf bench fs readdir -d <directory> <options>",
+	NULL
+};
+
+enum { SCAN_STAT, SCAN_PLUS, SCAN_PLUS_CACHED };
+
+static char scan_dir[PATH_MAX];
+static char *buf;
+
+static void drop_caches(void)
+{
+	int fd;
+
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0)
+		return;
+	if (write(fd, "3", 1) < 0)
+		fprintf(stderr, "Failed to drop caches: %s\n",
+			strerror(errno));
+	close(fd);
+}
+
+static void make_files(bool remove)
+{
+	char path[PATH_MAX];
+	int i, fd;
+
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/%d", scan_dir, i);
+		if (remove) {
+			unlink(path);
+			continue;
+		}
+		fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0)
+			die("Failed to create %s: %s\n", path, strerror(errno));
+		close(fd);
+	}
+}
+
+static int scan_stat(int dfd, unsigned long *entries, unsigned long *attrs)
+{
+	struct linux_dirent64 *de;
+	struct stat st;
+	int len, off;
+
+	while ((len = syscall(SYS_getdents64, dfd, buf, buf_kb * 1024)) > 0) {
+		for (off = 0; off < len; off += de->d_reclen) {
+			de = (struct linux_dirent64 *)(buf + off);
+			(*entries)++;
+			if (!fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW))
+				(*attrs)++;
+		}
+	}
+
+	return len;
+}
+
+static int scan_plus(int dfd, unsigned int flags, unsigned long *entries,
+		     unsigned long *attrs)
+{
+	struct linux_dirent_plus *de;
+	int len, off;
+
+	while ((len = syscall(__NR_getdents_plus, dfd, buf, buf_kb * 1024,
+			      flags)) > 0) {
+		for (off = 0; off < len; off += de->d_reclen) {
+			de = (struct linux_dirent_plus *)(buf + off);
+			(*entries)++;
+			if (de->d_valid & DIRENT_PLUS_ATTR)
+				(*attrs)++;
+		}
+	}
+
+	return len;
+}
+
+static void print_results(const char *name, unsigned long entries,
+			  unsigned long attrs, double secs)
+{
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %-20s %14lf entries/sec, %5.1lf%% with attributes\n",
+		       name, entries / secs,
+		       entries ? attrs * 100.0 / entries : 0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%s %lf %lu\n", name, entries / secs, attrs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(const char *name, int how)
+{
+	struct timeval start, stop, diff;
+	unsigned long entries = 0, attrs = 0;
+	int dfd, ret;
+
+	if (cold)
+		drop_caches();
+
+	dfd = open(scan_dir, O_RDONLY | O_DIRECTORY);
+	if (dfd < 0)
+		die("Failed to open %s: %s\n", scan_dir, strerror(errno));
+
+	gettimeofday(&start, NULL);
+	if (how == SCAN_STAT)
+		ret = scan_stat(dfd, &entries, &attrs);
+	else
+		ret = scan_plus(dfd, how == SCAN_PLUS_CACHED ?
+				DIRENT_PLUS_CACHED : 0, &entries, &attrs);
+	gettimeofday(&stop, NULL);
+	close(dfd);
+
+	if (ret < 0) {
+		fprintf(stderr, "%s failed: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	timersub(&stop, &start, &diff);
+	print_results(name, entries, attrs, diff.tv_sec + diff.tv_usec / 1e6);
+	return 0;
+}
+
+int bench_fs_readdir(int argc, const char **argv, const char *prefix __used)
+{
+	int ret;
+
+	argc = parse_options(argc, argv, options, bench_fs_readdir_usage, 0);
+	if (!dir) {
+		/* nothing to run on, e.g. when run by "perf bench all" */
+		fprintf(stderr, "No directory specified, use -d <directory>\n");
+		return 1;
+	}
+
+	if (nr_files < 0 || buf_kb < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	buf = malloc(buf_kb * 1024);
+	if (!buf)
+		die("out of memory\n");
+
+	if (nr_files) {
+		snprintf(scan_dir, sizeof(scan_dir), "%s/readdir.test", dir);
+		if (mkdir(scan_dir, 0755) < 0 && errno != EEXIST)
+			die("Failed to create %s: %s\n", scan_dir,
+			    strerror(errno));
+		make_files(false);
+	} else
+		snprintf(scan_dir, sizeof(scan_dir), "%s", dir);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# Scanning %s, %d KB per call%s\n\n", scan_dir, buf_kb,
+		       cold ? ", caches dropped" : "");
+
+	ret = run_once("getdents+lstat", SCAN_STAT);
+	if (!ret)
+		ret = run_once("getdents_plus", SCAN_PLUS);
+	if (!ret)
+		ret = run_once("getdents_plus cached", SCAN_PLUS_CACHED);
+
+	if (nr_files) {
+		make_files(true);
+		rmdir(scan_dir);
+	}
+	free(buf);
+	return ret ? 1 : 0;
+}
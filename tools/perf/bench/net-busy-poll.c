@@ -0,0 +1,328 @@
+/*
+ * net-busy-poll.c
+ *
+ * busy-poll: request/response latency with and without SO_BUSY_POLL
+ *
+ * A client sends a message to an echo server and waits for it to come
+ * back, one message at a time, and this reports the average, median and
+ * 99th percentile round trip time, first with busy polling off and then
+ * with SO_BUSY_POLL set on the client socket. By default the echo server
+ * is a thread of this process on the loopback address. Loopback has no
+ * NAPI context to busy poll, so there the second run only shows the cost
+ * of the extra checks; run the server on another machine with -S and
+ * point the client at it with -a to measure a NIC.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL	46
+#endif
+
+static const char	*addr		= "127.0.0.1";
+static int		port		= 12867;
+static int		iterations	= 100000;
+static int		msg_size	= 64;
+static int		busy_usec	= 50;
+static bool		use_tcp;
+static bool		use_poll;
+static bool		server_only;
+
+static const struct option options[] = {
+	OPT_STRING('a', "addr", &addr, "addr",
+		   "IPv4 address of the echo server (default: 127.0.0.1,"
+		   " served by this process)"),
+	OPT_INTEGER('p', "port", &port,
+		    "Port of the echo server (default: 12867)"),
+	OPT_INTEGER('n', "iterations", &iterations,
+		    "Round trips per run (default: 100000)"),
+	OPT_INTEGER('s', "size", &msg_size,
+		    "Message size in bytes (default: 64)"),
+	OPT_INTEGER('b', "busy-poll", &busy_usec,
+		    "SO_BUSY_POLL value of the second run, in usecs (default: 50)"),
+	OPT_BOOLEAN('t', "tcp", &use_tcp,
+		    "Use TCP instead of UDP"),
+	OPT_BOOLEAN('P', "poll", &use_poll,
+		    "Wait in poll() instead of a blocking read"),
+	OPT_BOOLEAN('S', "server", &server_only,
+		    "Only run the echo server, on all local addresses"),
+	OPT_END()
+};
+
+static const char * const bench_net_busy_poll_usage[] = {
+	"perf bench net busy-poll <options>",
+	NULL
+};
+
+static int set_busy_poll(int fd, int usec)
+{
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec))) {
+		fprintf(stderr, "cannot set SO_BUSY_POLL: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Reads exactly len bytes of a stream, or one datagram */
+static ssize_t read_msg(int fd, char *buf, size_t len)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	size_t done = 0;
+	ssize_t ret;
+
+	do {
+		if (use_poll && poll(&pfd, 1, -1) < 0)
+			return -1;
+
+		ret = recv(fd, buf + done, len - done, 0);
+		if (ret <= 0)
+			return ret < 0 ? -1 : (ssize_t)done;
+		done += ret;
+	} while (use_tcp && done < len);
+
+	return done;
+}
+
+static int server_socket(in_addr_t bind_addr)
+{
+	struct sockaddr_in sin;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, use_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		die("SO_REUSEADDR failed: %s\n", strerror(errno));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = bind_addr;
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("bind failed: %s\n", strerror(errno));
+	if (use_tcp && listen(fd, 1))
+		die("listen failed: %s\n", strerror(errno));
+
+	return fd;
+}
+
+/*
+ * Echoes messages back until the client goes away. A UDP server connects
+ * to its client on the first datagram: the stack only records the NAPI
+ * context of connected sockets.
+ */
+static void *server_thread(void *arg)
+{
+	int fd = (long)arg, conn = fd;
+	struct sockaddr_in peer;
+	socklen_t len = sizeof(peer);
+	char *buf;
+	ssize_t ret;
+
+	buf = malloc(msg_size);
+	if (!buf)
+		die("out of memory\n");
+
+	if (use_tcp) {
+		conn = accept(fd, NULL, NULL);
+		if (conn < 0)
+			die("accept failed: %s\n", strerror(errno));
+		close(fd);
+	} else {
+		ret = recvfrom(fd, buf, msg_size, 0, (struct sockaddr *)&peer,
+			       &len);
+		if (ret < 0 || connect(fd, (struct sockaddr *)&peer, len))
+			goto out;
+		if (send(fd, buf, ret, 0) < 0)
+			goto out;
+	}
+
+	while ((ret = read_msg(conn, buf, msg_size)) > 0)
+		if (send(conn, buf, ret, 0) < 0)
+			break;
+out:
+	close(conn);
+	free(buf);
+	return NULL;
+}
+
+static int client_socket(void)
+{
+	struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+	struct sockaddr_in sin;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, use_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+
+	/* do not wait forever for a datagram lost on the way */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		die("SO_RCVTIMEO failed: %s\n", strerror(errno));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1)
+		die("invalid address: %s\n", addr);
+	if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("connect to %s:%d failed: %s\n", addr, port,
+		    strerror(errno));
+	if (use_tcp &&
+	    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+		die("TCP_NODELAY failed: %s\n", strerror(errno));
+
+	return fd;
+}
+
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void print_results(int usec, unsigned long *lat, int nr)
+{
+	unsigned long sum = 0;
+	int i;
+
+	qsort(lat, nr, sizeof(*lat), cmp_ulong);
+	for (i = 0; i < nr; i++)
+		sum += lat[i];
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		if (usec)
+			printf(" busy poll %3d usecs", usec);
+		else
+			printf(" busy poll      off ");
+		printf("   avg %8.2lf   p50 %8.2lf   p99 %8.2lf usecs/round trip\n",
+		       sum / 1000.0 / nr, lat[nr / 2] / 1000.0,
+		       lat[nr * 99 / 100] / 1000.0);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%d %.2lf %.2lf %.2lf\n", usec, sum / 1000.0 / nr,
+		       lat[nr / 2] / 1000.0, lat[nr * 99 / 100] / 1000.0);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(int fd, int usec)
+{
+	unsigned long *lat, start;
+	char *buf;
+	int i, ret = -1;
+
+	lat = calloc(iterations, sizeof(*lat));
+	buf = calloc(1, msg_size);
+	if (!lat || !buf)
+		die("out of memory\n");
+
+	if (set_busy_poll(fd, usec))
+		goto out;
+
+	/* one round trip more to get the caches warm */
+	for (i = -1; i < iterations; i++) {
+		start = now_ns();
+		if (send(fd, buf, msg_size, 0) < 0) {
+			fprintf(stderr, "send failed: %s\n", strerror(errno));
+			goto out;
+		}
+		if (read_msg(fd, buf, msg_size) != msg_size) {
+			fprintf(stderr, "short read from the echo server\n");
+			goto out;
+		}
+		if (i >= 0)
+			lat[i] = now_ns() - start;
+	}
+
+	print_results(usec, lat, iterations);
+	ret = 0;
+out:
+	free(lat);
+	free(buf);
+	return ret;
+}
+
+int bench_net_busy_poll(int argc, const char **argv, const char *prefix __used)
+{
+	pthread_t server;
+	bool local;
+	int fd, ret;
+
+	argc = parse_options(argc, argv, options, bench_net_busy_poll_usage, 0);
+
+	if (iterations < 1 || msg_size < 1 || busy_usec < 1 || port < 1 ||
+	    port > 65535) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	if (server_only) {
+		for (;;)
+			server_thread((void *)(long)server_socket(INADDR_ANY));
+		return 0;
+	}
+
+	local = !strncmp(addr, "127.", 4);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d %s round trips of %d bytes to %s:%d%s%s\n\n",
+		       iterations, use_tcp ? "TCP" : "UDP", msg_size, addr,
+		       port, local ? " (loopback, no NAPI to poll)" : "",
+		       use_poll ? ", waiting in poll()" : "");
+
+	if (local) {
+		fd = server_socket(inet_addr(addr));
+		if (pthread_create(&server, NULL, server_thread,
+				   (void *)(long)fd))
+			die("pthread_create failed\n");
+	}
+
+	fd = client_socket();
+	ret = run_once(fd, 0) || run_once(fd, busy_usec);
+
+	/* a zero length datagram or the close tells the server to stop */
+	if (!use_tcp)
+		send(fd, "", 0, 0);
+	close(fd);
+	if (local)
+		pthread_join(server, NULL);
+
+	return ret;
+}
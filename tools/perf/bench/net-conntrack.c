@@ -0,0 +1,270 @@
+/*
+ * net-conntrack.c
+ *
+ * conntrack: connection tracking insert rate against the number of threads
+ *
+ * Each thread sends UDP datagrams over loopback, every one to a different
+ * address and port, so that every datagram creates and confirms a new
+ * conntrack entry. For 1, 2, 4, ... threads, this reports the rate of new
+ * entries from the "insert" column of /proc/net/stat/nf_conntrack, and
+ * how many inserts failed or entries were dropped for lack of room. Needs
+ * connection tracking of IPv4 (nf_conntrack_ipv4) in the current network
+ * namespace; entries it leaves behind time out like any unreplied UDP
+ * flow.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define CT_STAT_FILE	"/proc/net/stat/nf_conntrack"
+
+static int	max_threads;
+static int	runtime		= 2;
+static int	first_port	= 1024;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &max_threads,
+		    "Maximum number of sending threads (default: nr cpus)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run each configuration (default: 2)"),
+	OPT_INTEGER('p', "port", &first_port,
+		    "Lowest destination port used (default: 1024)"),
+	OPT_END()
+};
+
+static const char * const bench_net_conntrack_usage[] = {
+	"perf bench net conntrack <options>",
+	NULL
+};
+
+struct ct_stat {
+	unsigned long insert;
+	unsigned long insert_failed;
+	unsigned long drop;
+	unsigned long early_drop;
+};
+
+struct sender {
+	pthread_t thread;
+	int id;
+	unsigned long sent;
+};
+
+static volatile int done;
+
+/* Looks up the columns of interest in the header line */
+static int stat_column(char *header, const char *name)
+{
+	char *tok, *save;
+	int col = 0;
+
+	for (tok = strtok_r(header, " \n", &save); tok;
+	     tok = strtok_r(NULL, " \n", &save), col++)
+		if (!strcmp(tok, name))
+			return col;
+	return -1;
+}
+
+/* Sums up the per cpu lines, which are in hex */
+static int read_ct_stat(struct ct_stat *st)
+{
+	static const char * const names[] = {
+		"insert", "insert_failed", "drop", "early_drop",
+	};
+	unsigned long *fields[] = {
+		&st->insert, &st->insert_failed, &st->drop, &st->early_drop,
+	};
+	int cols[ARRAY_SIZE(names)];
+	char line[1024], header[1024];
+	unsigned int i;
+	FILE *f;
+
+	f = fopen(CT_STAT_FILE, "r");
+	if (!f)
+		return -1;
+
+	memset(st, 0, sizeof(*st));
+	if (!fgets(header, sizeof(header), f))
+		goto err;
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		strcpy(line, header);
+		cols[i] = stat_column(line, names[i]);
+		if (cols[i] < 0)
+			goto err;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *tok, *save;
+		int col = 0;
+
+		for (tok = strtok_r(line, " \n", &save); tok;
+		     tok = strtok_r(NULL, " \n", &save), col++)
+			for (i = 0; i < ARRAY_SIZE(names); i++)
+				if (col == cols[i])
+					*fields[i] += strtoul(tok, NULL, 16);
+	}
+
+	fclose(f);
+	return 0;
+err:
+	fclose(f);
+	return -1;
+}
+
+/*
+ * Walks through the ports of 127.<id + 1>.x.y: nothing listens there, so
+ * no one replies but an ICMP error, and every datagram is a new flow.
+ */
+static void *sender_thread(void *arg)
+{
+	struct sender *s = arg;
+	struct sockaddr_in sin;
+	unsigned int host = 0;
+	int port = first_port;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+
+	while (!done) {
+		if (++port > 65535) {
+			port = first_port;
+			host = (host + 1) & 0xffff;
+		}
+		sin.sin_port = htons(port);
+		sin.sin_addr.s_addr = htonl(0x7f000000 |
+					    ((s->id + 1) & 0xff) << 16 | host);
+
+		if (sendto(fd, "", 0, 0, (struct sockaddr *)&sin,
+			   sizeof(sin)) >= 0)
+			s->sent++;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void print_results(int nr_threads, struct ct_stat *before,
+			  struct ct_stat *after, unsigned long sent,
+			  double secs)
+{
+	unsigned long insert = after->insert - before->insert;
+	unsigned long failed = after->insert_failed - before->insert_failed;
+	unsigned long drop = (after->drop - before->drop) +
+			     (after->early_drop - before->early_drop);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %3d threads %12.0lf inserts/sec %12.0lf sent/sec"
+		       "   insert_failed %lu dropped %lu\n",
+		       nr_threads, insert / secs, sent / secs, failed, drop);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%d %.0lf %lu %lu\n", nr_threads, insert / secs,
+		       failed, drop);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(int nr_threads)
+{
+	struct timeval start, stop, diff;
+	struct ct_stat before, after;
+	struct sender *senders;
+	unsigned long sent = 0;
+	int i;
+
+	senders = calloc(nr_threads, sizeof(*senders));
+	if (!senders)
+		die("out of memory\n");
+
+	if (read_ct_stat(&before))
+		goto err;
+
+	done = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		senders[i].id = i;
+		if (pthread_create(&senders[i].thread, NULL, sender_thread,
+				   &senders[i]))
+			die("pthread_create failed\n");
+	}
+
+	sleep(runtime);
+	done = 1;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(senders[i].thread, NULL);
+		sent += senders[i].sent;
+	}
+	gettimeofday(&stop, NULL);
+
+	if (read_ct_stat(&after))
+		goto err;
+
+	timersub(&stop, &start, &diff);
+	print_results(nr_threads, &before, &after, sent,
+		      diff.tv_sec + diff.tv_usec / 1000000.0);
+
+	free(senders);
+	return 0;
+err:
+	fprintf(stderr, "cannot read %s: is nf_conntrack_ipv4 loaded?\n",
+		CT_STAT_FILE);
+	free(senders);
+	return -1;
+}
+
+int bench_net_conntrack(int argc, const char **argv, const char *prefix __used)
+{
+	int nr;
+
+	argc = parse_options(argc, argv, options, bench_net_conntrack_usage, 0);
+
+	if (!max_threads)
+		max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_threads < 1 || max_threads > 255 || runtime < 1 ||
+	    first_port < 1 || first_port > 65535) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# new UDP flows over loopback, %d sec per run\n\n",
+		       runtime);
+
+	for (nr = 1; ; nr *= 2) {
+		if (nr > max_threads)
+			nr = max_threads;
+
+		if (run_once(nr))
+			return 1;
+
+		if (nr == max_threads)
+			break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * net-reuseport.c
+ *
+ * reuseport: Loopback TCP accept rate, one shared listener vs SO_REUSEPORT
+ *
+ * Client threads connect to a port on the loopback interface as fast as
+ * they can, and worker threads accept the connections and reset them.
+ * For 1, 2, 4, ... workers, this runs once with all the workers calling
+ * accept() on one listening socket and once with one SO_REUSEPORT
+ * listener per worker, and reports the connection rate and how evenly
+ * the connections were spread over the workers.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT	15
+#endif
+
+static int	max_workers;
+static int	nr_clients	= 4;
+static int	runtime		= 5;
+static bool	use_ipv6;
+
+static const struct option options[] = {
+	OPT_INTEGER('w', "workers", &max_workers,
+		    "Maximum number of accepting threads (default: nr cpus)"),
+	OPT_INTEGER('c', "clients", &nr_clients,
+		    "Number of connecting threads (default: 4)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run each configuration (default: 5)"),
+	OPT_BOOLEAN('6', "ipv6", &use_ipv6,
+		    "Connect over ::1 instead of 127.0.0.1"),
+	OPT_END()
+};
+
+static const char * const bench_net_reuseport_usage[] = {
+	"perf bench net reuseport <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	unsigned long accepted;
+};
+
+static struct sockaddr_storage addr;
+static socklen_t addr_len;
+static volatile int done;
+static unsigned long failed;
+
+static int listen_socket(bool reuseport)
+{
+	int fd, one = 1;
+
+	fd = socket(addr.ss_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		die("SO_REUSEADDR failed: %s\n", strerror(errno));
+	if (reuseport &&
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)))
+		return -1;
+
+	if (bind(fd, (struct sockaddr *)&addr, addr_len) ||
+	    listen(fd, 1024))
+		die("bind/listen failed: %s\n", strerror(errno));
+
+	/* the first listener picks the port, the others share it */
+	if (getsockname(fd, (struct sockaddr *)&addr, &addr_len))
+		die("getsockname failed: %s\n", strerror(errno));
+
+	return fd;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+	int fd;
+
+	/* runs until the listener is shut down, after the clients are gone */
+	for (;;) {
+		fd = accept(w->fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+
+		/* reset it, so that neither side ends up in TIME_WAIT */
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+		close(fd);
+		w->accepted++;
+	}
+
+	return NULL;
+}
+
+static void *client_thread(void *arg __used)
+{
+	char c;
+	int fd;
+
+	while (!done) {
+		fd = socket(addr.ss_family, SOCK_STREAM, 0);
+		if (fd < 0)
+			die("socket failed: %s\n", strerror(errno));
+
+		if (connect(fd, (struct sockaddr *)&addr, addr_len))
+			__sync_fetch_and_add(&failed, 1);
+		else if (read(fd, &c, 1) < 0 && errno != ECONNRESET)
+			__sync_fetch_and_add(&failed, 1);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+static void print_results(int nr_workers, bool reuseport,
+			  struct worker *workers, double secs)
+{
+	unsigned long total = 0, min = ~0UL, max = 0;
+	int i;
+
+	for (i = 0; i < nr_workers; i++) {
+		total += workers[i].accepted;
+		if (workers[i].accepted < min)
+			min = workers[i].accepted;
+		if (workers[i].accepted > max)
+			max = workers[i].accepted;
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %3d workers, %-9s %12.0lf conns/sec"
+		       "   per worker min %lu max %lu\n",
+		       nr_workers, reuseport ? "reuseport" : "shared",
+		       total / secs, min, max);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%d %s %.0lf %lu %lu\n", nr_workers,
+		       reuseport ? "reuseport" : "shared", total / secs,
+		       min, max);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(int nr_workers, bool reuseport)
+{
+	struct timeval start, stop, diff;
+	struct worker *workers;
+	pthread_t *clients;
+	int i;
+
+	workers = calloc(nr_workers, sizeof(*workers));
+	clients = calloc(nr_clients, sizeof(*clients));
+	if (!workers || !clients)
+		die("out of memory\n");
+
+	if (use_ipv6)
+		((struct sockaddr_in6 *)&addr)->sin6_port = 0;
+	else
+		((struct sockaddr_in *)&addr)->sin_port = 0;
+
+	for (i = 0; i < nr_workers; i++) {
+		if (i && !reuseport) {
+			workers[i].fd = workers[0].fd;
+			continue;
+		}
+		workers[i].fd = listen_socket(reuseport);
+		if (workers[i].fd < 0) {
+			fprintf(stderr, "SO_REUSEPORT is not supported\n");
+			while (i--)
+				close(workers[i].fd);
+			free(workers);
+			free(clients);
+			return -1;
+		}
+	}
+
+	done = 0;
+	failed = 0;
+	for (i = 0; i < nr_workers; i++)
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+				   &workers[i]))
+			die("pthread_create failed\n");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_clients; i++)
+		if (pthread_create(&clients[i], NULL, client_thread, NULL))
+			die("pthread_create failed\n");
+
+	sleep(runtime);
+	done = 1;
+	for (i = 0; i < nr_clients; i++)
+		pthread_join(clients[i], NULL);
+	gettimeofday(&stop, NULL);
+
+	/* wake up the workers still sleeping in accept() */
+	for (i = 0; i < (reuseport ? nr_workers : 1); i++)
+		shutdown(workers[i].fd, SHUT_RDWR);
+	for (i = 0; i < nr_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+	for (i = 0; i < (reuseport ? nr_workers : 1); i++)
+		close(workers[i].fd);
+
+	timersub(&stop, &start, &diff);
+	print_results(nr_workers, reuseport, workers,
+		      diff.tv_sec + diff.tv_usec / 1000000.0);
+	if (failed && bench_format == BENCH_FORMAT_DEFAULT)
+		printf("     (%lu failed connections)\n", failed);
+
+	free(workers);
+	free(clients);
+	return 0;
+}
+
+int bench_net_reuseport(int argc, const char **argv,
+			const char *prefix __used)
+{
+	int nr;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_reuseport_usage, 0);
+
+	if (!max_workers)
+		max_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_workers < 1 || nr_clients < 1 || runtime < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	if (use_ipv6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_addr = in6addr_loopback;
+		addr_len = sizeof(*sin6);
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr_len = sizeof(*sin);
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d clients connecting to %s for %d sec per run\n\n",
+		       nr_clients, use_ipv6 ? "::1" : "127.0.0.1", runtime);
+
+	for (nr = 1; ; nr *= 2) {
+		if (nr > max_workers)
+			nr = max_workers;
+
+		if (run_once(nr, false))
+			return 1;
+		if (run_once(nr, true))
+			return 1;
+
+		if (nr == max_workers)
+			break;
+	}
+
+	return 0;
+}
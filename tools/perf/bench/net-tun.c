@@ -0,0 +1,397 @@
+/*
+ * net-tun.c
+ *
+ * tun: UDP round trips through a multiqueue tun device
+ *
+ * A tun device is set up with a point to point address, and client
+ * threads each keep a window of UDP datagrams in flight to the peer
+ * address, so that the stack transmits them through the device. One
+ * thread per queue reads the datagrams from its queue, swaps their
+ * addresses and ports and writes them back, so that they are received
+ * by the client socket that sent them. For 1, 2, 4, ... queues, this
+ * reports the round trip rate and how evenly it was spread over the
+ * queues. Needs CAP_NET_ADMIN.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* from linux/if_tun.h */
+#ifndef TUNSETIFF
+#define TUNSETIFF	_IOW('T', 202, int)
+#define IFF_TUN		0x0001
+#define IFF_NO_PI	0x1000
+#endif
+#ifndef IFF_MULTI_QUEUE
+#define IFF_MULTI_QUEUE	0x0100
+#endif
+
+/* RFC 2544 benchmarking addresses */
+#define TUN_LOCAL_ADDR	"198.18.0.1"
+#define TUN_PEER_ADDR	"198.18.0.2"
+
+static int	max_queues;
+static int	nr_flows	= 16;
+static int	window		= 8;
+static int	msg_size	= 64;
+static int	runtime		= 5;
+
+static const struct option options[] = {
+	OPT_INTEGER('q', "queues", &max_queues,
+		    "Maximum number of device queues (default: nr cpus)"),
+	OPT_INTEGER('f', "flows", &nr_flows,
+		    "Number of UDP flows, one thread each (default: 16)"),
+	OPT_INTEGER('w', "window", &window,
+		    "Datagrams in flight per flow (default: 8)"),
+	OPT_INTEGER('s', "size", &msg_size,
+		    "UDP payload size in bytes (default: 64)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run each configuration (default: 5)"),
+	OPT_END()
+};
+
+static const char * const bench_net_tun_usage[] = {
+	"perf bench net tun <options>",
+	NULL
+};
+
+struct queue {
+	pthread_t thread;
+	int fd;
+	unsigned long packets;
+};
+
+struct flow {
+	pthread_t thread;
+	int fd;
+	unsigned long round_trips;
+	unsigned long timeouts;
+};
+
+static volatile int done;
+
+static int tun_open_queues(char *name, struct queue *queues, int nr)
+{
+	struct ifreq ifr;
+	int i;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
+	strcpy(ifr.ifr_name, "perftun%d");
+
+	for (i = 0; i < nr; i++) {
+		queues[i].fd = open("/dev/net/tun", O_RDWR);
+		if (queues[i].fd < 0) {
+			fprintf(stderr, "cannot open /dev/net/tun: %s\n",
+				strerror(errno));
+			goto err;
+		}
+		/* the first call creates the device, the others attach to it */
+		if (ioctl(queues[i].fd, TUNSETIFF, &ifr)) {
+			fprintf(stderr, "cannot attach queue %d: %s\n", i,
+				strerror(errno));
+			if (errno == EINVAL)
+				fprintf(stderr, "multiqueue tun is not supported\n");
+			close(queues[i].fd);
+			goto err;
+		}
+	}
+
+	strcpy(name, ifr.ifr_name);
+	return 0;
+err:
+	while (i--)
+		close(queues[i].fd);
+	return -1;
+}
+
+static int tun_set_addr(const char *name)
+{
+	struct ifreq ifr;
+	struct sockaddr_in *sin = (struct sockaddr_in *)&ifr.ifr_addr;
+	int fd, err = -1;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	sin->sin_family = AF_INET;
+
+	inet_pton(AF_INET, TUN_LOCAL_ADDR, &sin->sin_addr);
+	if (ioctl(fd, SIOCSIFADDR, &ifr))
+		goto out;
+	inet_pton(AF_INET, TUN_PEER_ADDR, &sin->sin_addr);
+	if (ioctl(fd, SIOCSIFDSTADDR, &ifr))
+		goto out;
+
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr))
+		goto out;
+	ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr))
+		goto out;
+
+	err = 0;
+out:
+	if (err)
+		fprintf(stderr, "cannot configure %s: %s\n", name,
+			strerror(errno));
+	close(fd);
+	return err;
+}
+
+/* Sends back an IPv4 UDP datagram to where it came from. The checksums
+ * hold over swapped addresses and ports, so they need no update.
+ */
+static int reflect(unsigned char *pkt, ssize_t len)
+{
+	unsigned char tmp[4];
+	int ihl;
+
+	if (len < 20 || (pkt[0] >> 4) != 4 || pkt[9] != IPPROTO_UDP)
+		return -1;
+	ihl = (pkt[0] & 0xf) * 4;
+	if (len < ihl + 8)
+		return -1;
+
+	memcpy(tmp, pkt + 12, 4);
+	memcpy(pkt + 12, pkt + 16, 4);
+	memcpy(pkt + 16, tmp, 4);
+
+	memcpy(tmp, pkt + ihl, 2);
+	memcpy(pkt + ihl, pkt + ihl + 2, 2);
+	memcpy(pkt + ihl + 2, tmp, 2);
+	return 0;
+}
+
+static void *queue_thread(void *arg)
+{
+	struct queue *q = arg;
+	struct pollfd pfd = { .fd = q->fd, .events = POLLIN };
+	unsigned char buf[65536];
+	ssize_t len;
+
+	while (!done) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+
+		len = read(q->fd, buf, sizeof(buf));
+		if (len < 0)
+			break;
+		if (reflect(buf, len))
+			continue;
+		if (write(q->fd, buf, len) == len)
+			q->packets++;
+	}
+
+	return NULL;
+}
+
+static void *flow_thread(void *arg)
+{
+	struct flow *f = arg;
+	int inflight = 0;
+	char *buf;
+
+	buf = calloc(1, msg_size > 1 ? msg_size : 1);
+	if (!buf)
+		die("out of memory\n");
+
+	while (!done) {
+		while (inflight < window && send(f->fd, buf, msg_size, 0) >= 0)
+			inflight++;
+
+		if (recv(f->fd, buf, msg_size, 0) >= 0) {
+			inflight--;
+			f->round_trips++;
+		} else if (!done && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			/* lost somewhere: start over with a full window */
+			inflight = 0;
+			f->timeouts++;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int flow_socket(int port)
+{
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+	struct sockaddr_in sin;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		die("SO_RCVTIMEO failed: %s\n", strerror(errno));
+
+	/* a different port per flow for the flows to hash apart */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	inet_pton(AF_INET, TUN_PEER_ADDR, &sin.sin_addr);
+	if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("connect failed: %s\n", strerror(errno));
+
+	return fd;
+}
+
+static void print_results(int nr_queues, struct queue *queues,
+			  struct flow *flows, double secs)
+{
+	unsigned long total = 0, timeouts = 0, min = ~0UL, max = 0;
+	int i;
+
+	for (i = 0; i < nr_flows; i++) {
+		total += flows[i].round_trips;
+		timeouts += flows[i].timeouts;
+	}
+
+	for (i = 0; i < nr_queues; i++) {
+		if (queues[i].packets < min)
+			min = queues[i].packets;
+		if (queues[i].packets > max)
+			max = queues[i].packets;
+	}
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %3d queues %12.0lf round trips/sec %7.2lf MB/sec"
+		       "   per queue min %lu max %lu\n",
+		       nr_queues, total / secs,
+		       total * (double)msg_size / secs / 1024 / 1024,
+		       min, max);
+		if (timeouts)
+			printf("     (%lu flow timeouts)\n", timeouts);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%d %.0lf %lu %lu\n", nr_queues, total / secs,
+		       min, max);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(int nr_queues)
+{
+	struct timeval start, stop, diff;
+	struct queue *queues;
+	struct flow *flows;
+	char name[IFNAMSIZ];
+	int i;
+
+	queues = calloc(nr_queues, sizeof(*queues));
+	flows = calloc(nr_flows, sizeof(*flows));
+	if (!queues || !flows)
+		die("out of memory\n");
+
+	if (tun_open_queues(name, queues, nr_queues))
+		goto err;
+	if (tun_set_addr(name)) {
+		for (i = 0; i < nr_queues; i++)
+			close(queues[i].fd);
+		goto err;
+	}
+
+	done = 0;
+	for (i = 0; i < nr_queues; i++)
+		if (pthread_create(&queues[i].thread, NULL, queue_thread,
+				   &queues[i]))
+			die("pthread_create failed\n");
+
+	for (i = 0; i < nr_flows; i++)
+		flows[i].fd = flow_socket(10000 + i);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_flows; i++)
+		if (pthread_create(&flows[i].thread, NULL, flow_thread,
+				   &flows[i]))
+			die("pthread_create failed\n");
+
+	sleep(runtime);
+	done = 1;
+	for (i = 0; i < nr_flows; i++)
+		pthread_join(flows[i].thread, NULL);
+	gettimeofday(&stop, NULL);
+
+	for (i = 0; i < nr_queues; i++)
+		pthread_join(queues[i].thread, NULL);
+
+	/* closing the last queue removes the device */
+	for (i = 0; i < nr_flows; i++)
+		close(flows[i].fd);
+	for (i = 0; i < nr_queues; i++)
+		close(queues[i].fd);
+
+	timersub(&stop, &start, &diff);
+	print_results(nr_queues, queues, flows,
+		      diff.tv_sec + diff.tv_usec / 1000000.0);
+
+	free(queues);
+	free(flows);
+	return 0;
+err:
+	free(queues);
+	free(flows);
+	return -1;
+}
+
+int bench_net_tun(int argc, const char **argv, const char *prefix __used)
+{
+	int nr;
+
+	argc = parse_options(argc, argv, options, bench_net_tun_usage, 0);
+
+	if (!max_queues)
+		max_queues = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_queues < 1 || nr_flows < 1 || window < 1 || msg_size < 0 ||
+	    runtime < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d flows of %d byte datagrams, %d in flight each,"
+		       " %d sec per run\n\n",
+		       nr_flows, msg_size, window, runtime);
+
+	for (nr = 1; ; nr *= 2) {
+		if (nr > max_queues)
+			nr = max_queues;
+
+		if (run_once(nr))
+			return 1;
+
+		if (nr == max_queues)
+			break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * net-udp-gso.c
+ *
+ * udp-gso: UDP stream throughput with and without UDP_SEGMENT and UDP_GRO
+ *
+ * A sender streams datagrams of a fixed size to a sink for a while: first
+ * one datagram per send, then a batch of them per send with UDP_SEGMENT,
+ * and last with UDP_SEGMENT while the sink reads with UDP_GRO. For each
+ * run this reports the rate of datagrams sent and the cpu time the
+ * sending thread spent per GB, and for a local sink the rate of datagrams
+ * it received and of the reads that took to. By default the sink is a
+ * thread of this process on the loopback address, where the batches go up
+ * to the sink as they were sent; run the sink with -S on another machine
+ * (with -g for UDP_GRO) and point the sender at it with -a to go through
+ * a NIC.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP			17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT		103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO			104
+#endif
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD		1
+#endif
+
+#define UDP_MAX_SEGMENTS	64
+#define SINK_BUF_SIZE		(1 << 16)
+
+static const char	*addr		= "127.0.0.1";
+static int		port		= 12869;
+static int		msg_size	= 1400;
+static int		nr_segs;
+static int		runtime		= 3;
+static bool		server_only;
+static bool		server_gro;
+
+static const struct option options[] = {
+	OPT_STRING('a', "addr", &addr, "addr",
+		   "IPv4 address of the sink (default: 127.0.0.1,"
+		   " served by this process)"),
+	OPT_INTEGER('p', "port", &port,
+		    "Port of the sink (default: 12869)"),
+	OPT_INTEGER('s', "size", &msg_size,
+		    "Payload bytes per datagram (default: 1400)"),
+	OPT_INTEGER('n', "segments", &nr_segs,
+		    "Datagrams per UDP_SEGMENT send (default: as many as fit"
+		    " in 64K, at most 64)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run each configuration (default: 3)"),
+	OPT_BOOLEAN('S', "server", &server_only,
+		    "Only run the sink, on all local addresses"),
+	OPT_BOOLEAN('g', "gro", &server_gro,
+		    "Have the sink of -S read with UDP_GRO"),
+	OPT_END()
+};
+
+static const char * const bench_net_udp_gso_usage[] = {
+	"perf bench net udp-gso <options>",
+	NULL
+};
+
+struct sink {
+	pthread_t thread;
+	int fd;
+	unsigned long datagrams;
+	unsigned long reads;
+};
+
+struct gso_result {
+	unsigned long bytes;
+	unsigned long datagrams;
+	double secs;
+	double cpu_secs;
+};
+
+static int server_socket(in_addr_t bind_addr, bool gro)
+{
+	struct sockaddr_in sin;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		die("SO_REUSEADDR failed: %s\n", strerror(errno));
+	if (gro && setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one))) {
+		fprintf(stderr, "cannot set UDP_GRO: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = bind_addr;
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("bind failed: %s\n", strerror(errno));
+
+	return fd;
+}
+
+/*
+ * Counts the datagrams read until its socket is shut down. A read with
+ * UDP_GRO may return several, all but the last of the size it reports.
+ */
+static void *sink_thread(void *arg)
+{
+	struct sink *s = arg;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct iovec iov;
+	ssize_t ret;
+	int gso_size;
+	char *buf;
+
+	buf = malloc(SINK_BUF_SIZE);
+	if (!buf)
+		die("out of memory\n");
+
+	for (;;) {
+		iov.iov_base = buf;
+		iov.iov_len = SINK_BUF_SIZE;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ret = recvmsg(s->fd, &msg, 0);
+		if (ret <= 0)
+			break;
+
+		gso_size = 0;
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+			if (cm->cmsg_level == SOL_UDP &&
+			    cm->cmsg_type == UDP_GRO)
+				memcpy(&gso_size, CMSG_DATA(cm), sizeof(int));
+
+		s->reads++;
+		s->datagrams += gso_size ? (ret + gso_size - 1) / gso_size : 1;
+	}
+
+	close(s->fd);
+	free(buf);
+	return NULL;
+}
+
+static int client_socket(int gso_size)
+{
+	struct sockaddr_in sin;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+
+	if (gso_size && setsockopt(fd, SOL_UDP, UDP_SEGMENT, &gso_size,
+				   sizeof(gso_size))) {
+		fprintf(stderr, "cannot set UDP_SEGMENT: %s\n",
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1)
+		die("invalid address: %s\n", addr);
+	if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("connect to %s:%d failed: %s\n", addr, port,
+		    strerror(errno));
+
+	return fd;
+}
+
+static double tv_secs(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static double cpu_secs(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_THREAD, &ru))
+		die("getrusage failed: %s\n", strerror(errno));
+	return tv_secs(&ru.ru_utime) + tv_secs(&ru.ru_stime);
+}
+
+static void print_results(const char *name, struct gso_result *r,
+			  struct sink *s)
+{
+	double gb = r->bytes / 1024.0 / 1024 / 1024;
+	double cpu = gb ? r->cpu_secs / gb : 0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %-12s sent %10.0lf dgrams/sec %9.2lf MB/sec"
+		       " %7.3lf cpu sec/GB", name, r->datagrams / r->secs,
+		       r->bytes / 1024.0 / 1024 / r->secs, cpu);
+		if (s)
+			printf("   received %10.0lf dgrams/sec in %10.0lf"
+			       " reads/sec", s->datagrams / r->secs,
+			       s->reads / r->secs);
+		printf("\n");
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%s %.0lf %.3lf %.0lf %.0lf\n", name,
+		       r->datagrams / r->secs, cpu,
+		       s ? s->datagrams / r->secs : 0,
+		       s ? s->reads / r->secs : 0);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(const char *name, int segs, bool local, bool gro)
+{
+	struct timeval start, stop, now, diff;
+	struct sink sink;
+	struct gso_result r;
+	double cpu_start;
+	size_t len = (size_t)msg_size * segs;
+	ssize_t ret;
+	char *buf;
+	int fd;
+
+	memset(&sink, 0, sizeof(sink));
+	if (local) {
+		sink.fd = server_socket(inet_addr(addr), gro);
+		if (sink.fd < 0)
+			return -1;
+		if (pthread_create(&sink.thread, NULL, sink_thread, &sink))
+			die("pthread_create failed\n");
+	}
+
+	buf = calloc(1, len);
+	if (!buf)
+		die("out of memory\n");
+
+	fd = client_socket(segs > 1 ? msg_size : 0);
+	if (fd < 0) {
+		free(buf);
+		if (local) {
+			shutdown(sink.fd, SHUT_RDWR);
+			pthread_join(sink.thread, NULL);
+		}
+		return -1;
+	}
+
+	memset(&r, 0, sizeof(r));
+	cpu_start = cpu_secs();
+	gettimeofday(&start, NULL);
+
+	do {
+		ret = send(fd, buf, len, 0);
+		if (ret < 0) {
+			if (errno != ENOBUFS && errno != ECONNREFUSED)
+				die("send failed: %s\n", strerror(errno));
+		} else {
+			r.bytes += ret;
+			r.datagrams += segs;
+		}
+
+		gettimeofday(&now, NULL);
+		timersub(&now, &start, &diff);
+	} while (diff.tv_sec < runtime);
+
+	gettimeofday(&stop, NULL);
+	r.cpu_secs = cpu_secs() - cpu_start;
+	timersub(&stop, &start, &diff);
+	r.secs = tv_secs(&diff);
+
+	close(fd);
+	free(buf);
+
+	if (local) {
+		/* wakes up the sink, blocked in recvmsg() */
+		shutdown(sink.fd, SHUT_RDWR);
+		pthread_join(sink.thread, NULL);
+	}
+
+	print_results(name, &r, local ? &sink : NULL);
+	return 0;
+}
+
+int bench_net_udp_gso(int argc, const char **argv, const char *prefix __used)
+{
+	bool local;
+
+	argc = parse_options(argc, argv, options, bench_net_udp_gso_usage, 0);
+
+	if (!nr_segs && msg_size > 0)
+		nr_segs = min(UDP_MAX_SEGMENTS, 65507 / msg_size);
+	if (msg_size < 1 || nr_segs < 2 || nr_segs > UDP_MAX_SEGMENTS ||
+	    msg_size * nr_segs > 65507 || runtime < 1 || port < 1 ||
+	    port > 65535) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	if (server_only) {
+		struct sink sink;
+
+		memset(&sink, 0, sizeof(sink));
+		for (;;) {
+			sink.fd = server_socket(INADDR_ANY, server_gro);
+			if (sink.fd < 0)
+				return 1;
+			sink_thread(&sink);
+		}
+		return 0;
+	}
+
+	local = !strncmp(addr, "127.", 4);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# UDP datagrams of %d bytes to %s:%d, %d per"
+		       " UDP_SEGMENT send, %d sec per run\n\n", msg_size, addr,
+		       port, nr_segs, runtime);
+
+	if (run_once("send", 1, local, false) ||
+	    run_once("UDP_SEGMENT", nr_segs, local, false))
+		return 1;
+
+	/* the sink of -S was told whether to use UDP_GRO */
+	if (local && run_once("+UDP_GRO", nr_segs, local, true))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ * net-zerocopy.c
+ *
+ * zerocopy: stream throughput and sender cpu cost with and without
+ * MSG_ZEROCOPY
+ *
+ * A sender streams fixed size sends to a sink for a while, first copying
+ * them as usual and then with MSG_ZEROCOPY, reading the completions from
+ * the error queue as it goes. For each run this reports the throughput,
+ * the cpu time the sending thread spent per GB, and for MSG_ZEROCOPY how
+ * many sends completed and how many of them the kernel copied anyway. By
+ * default the sink is a thread of this process on the loopback address,
+ * where every send is copied, as it is to a sink behind a veth pair; run
+ * the sink with -S on another machine and point the sender at it with -a
+ * to see the pages go out uncopied.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY			60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY			0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY		5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD			1
+#endif
+
+#define SINK_BUF_SIZE	(1 << 16)
+
+static const char	*addr		= "127.0.0.1";
+static int		port		= 12868;
+static int		msg_size;
+static int		runtime		= 3;
+static bool		use_udp;
+static bool		server_only;
+
+static const struct option options[] = {
+	OPT_STRING('a', "addr", &addr, "addr",
+		   "IPv4 address of the sink (default: 127.0.0.1,"
+		   " served by this process)"),
+	OPT_INTEGER('p', "port", &port,
+		    "Port of the sink (default: 12868)"),
+	OPT_INTEGER('s', "size", &msg_size,
+		    "Bytes per send (default: 65536, 8192 with -u)"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Seconds to run each configuration (default: 3)"),
+	OPT_BOOLEAN('u', "udp", &use_udp,
+		    "Send UDP datagrams instead of a TCP stream"),
+	OPT_BOOLEAN('S', "server", &server_only,
+		    "Only run the sink, on all local addresses"),
+	OPT_END()
+};
+
+static const char * const bench_net_zerocopy_usage[] = {
+	"perf bench net zerocopy <options>",
+	NULL
+};
+
+struct zc_result {
+	unsigned long bytes;
+	unsigned long sends;		/* MSG_ZEROCOPY sends */
+	unsigned long completions;	/* sends reported done */
+	unsigned long copied;		/* of which the kernel copied */
+	double secs;
+	double cpu_secs;
+};
+
+static int server_socket(in_addr_t bind_addr)
+{
+	struct sockaddr_in sin;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, use_udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)))
+		die("SO_REUSEADDR failed: %s\n", strerror(errno));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = bind_addr;
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("bind failed: %s\n", strerror(errno));
+	if (!use_udp && listen(fd, 1))
+		die("listen failed: %s\n", strerror(errno));
+
+	return fd;
+}
+
+/*
+ * Reads and drops everything until its socket is shut down: a TCP sink
+ * serves one connection after the other.
+ */
+static void *sink_thread(void *arg)
+{
+	int fd = (long)arg, conn;
+	char *buf;
+
+	buf = malloc(SINK_BUF_SIZE);
+	if (!buf)
+		die("out of memory\n");
+
+	if (use_udp) {
+		while (recv(fd, buf, SINK_BUF_SIZE, 0) > 0)
+			;
+	} else {
+		while ((conn = accept(fd, NULL, NULL)) >= 0) {
+			while (recv(conn, buf, SINK_BUF_SIZE, 0) > 0)
+				;
+			close(conn);
+		}
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int client_socket(bool zerocopy)
+{
+	struct sockaddr_in sin;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, use_udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+	if (fd < 0)
+		die("socket failed: %s\n", strerror(errno));
+
+	if (zerocopy &&
+	    setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+		fprintf(stderr, "cannot set SO_ZEROCOPY: %s\n",
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1)
+		die("invalid address: %s\n", addr);
+	if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("connect to %s:%d failed: %s\n", addr, port,
+		    strerror(errno));
+
+	return fd;
+}
+
+/*
+ * Reads the completions queued on @fd, after waiting up to @timeout
+ * msecs for the first one. Each covers the range of sends ee_info to
+ * ee_data.
+ */
+static void read_completions(int fd, struct zc_result *r, int timeout)
+{
+	struct pollfd pfd = { .fd = fd, .events = 0 };
+	struct sock_extended_err *serr;
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	unsigned long nr;
+
+	if (timeout && poll(&pfd, 1, timeout) <= 0)
+		return;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			die("recvmsg errqueue failed: %s\n", strerror(errno));
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cm->cmsg_level != SOL_IP ||
+			    cm->cmsg_type != IP_RECVERR)
+				continue;
+
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+			    serr->ee_errno)
+				continue;
+
+			nr = (unsigned int)(serr->ee_data - serr->ee_info) + 1;
+			r->completions += nr;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				r->copied += nr;
+		}
+	}
+}
+
+static double tv_secs(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static double cpu_secs(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_THREAD, &ru))
+		die("getrusage failed: %s\n", strerror(errno));
+	return tv_secs(&ru.ru_utime) + tv_secs(&ru.ru_stime);
+}
+
+static void print_results(bool zerocopy, struct zc_result *r)
+{
+	double gb = r->bytes / 1024.0 / 1024 / 1024;
+	double cpu = gb ? r->cpu_secs / gb : 0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf(" %-12s %10.2lf MB/sec %8.3lf cpu sec/GB",
+		       zerocopy ? "MSG_ZEROCOPY" : "copy",
+		       r->bytes / 1024.0 / 1024 / r->secs, cpu);
+		if (zerocopy)
+			printf("   completed %lu/%lu, %.1lf%% copied",
+			       r->completions, r->sends,
+			       r->completions ?
+			       100.0 * r->copied / r->completions : 0);
+		printf("\n");
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%d %.2lf %.3lf %lu %lu\n", zerocopy,
+		       r->bytes / 1024.0 / 1024 / r->secs, cpu,
+		       r->completions, r->copied);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+static int run_once(bool zerocopy)
+{
+	struct timeval start, stop, now, diff;
+	struct zc_result r;
+	double cpu_start;
+	ssize_t ret;
+	char *buf;
+	int fd, i;
+
+	/*
+	 * With MSG_ZEROCOPY the buffer must not change until its send
+	 * completes; this one never does.
+	 */
+	buf = calloc(1, msg_size);
+	if (!buf)
+		die("out of memory\n");
+
+	fd = client_socket(zerocopy);
+	if (fd < 0) {
+		free(buf);
+		return -1;
+	}
+
+	memset(&r, 0, sizeof(r));
+	cpu_start = cpu_secs();
+	gettimeofday(&start, NULL);
+
+	do {
+		ret = send(fd, buf, msg_size, zerocopy ? MSG_ZEROCOPY : 0);
+		if (ret < 0) {
+			/* too many completions pending, or no room in sndbuf */
+			if (errno == ENOBUFS && zerocopy)
+				read_completions(fd, &r, 10);
+			else if (errno != ENOBUFS && errno != ECONNREFUSED)
+				die("send failed: %s\n", strerror(errno));
+		} else {
+			r.bytes += ret;
+			if (zerocopy) {
+				r.sends++;
+				read_completions(fd, &r, 0);
+			}
+		}
+
+		gettimeofday(&now, NULL);
+		timersub(&now, &start, &diff);
+	} while (diff.tv_sec < runtime);
+
+	/* give the last sends a second to complete */
+	for (i = 0; i < 100 && r.completions < r.sends; i++)
+		read_completions(fd, &r, 10);
+
+	gettimeofday(&stop, NULL);
+	r.cpu_secs = cpu_secs() - cpu_start;
+	timersub(&stop, &start, &diff);
+	r.secs = tv_secs(&diff);
+
+	close(fd);
+	free(buf);
+
+	print_results(zerocopy, &r);
+	return 0;
+}
+
+int bench_net_zerocopy(int argc, const char **argv, const char *prefix __used)
+{
+	pthread_t sink;
+	bool local;
+	int fd = -1, ret;
+
+	argc = parse_options(argc, argv, options, bench_net_zerocopy_usage, 0);
+
+	if (!msg_size)
+		msg_size = use_udp ? 8192 : 65536;
+	if (msg_size < 1 || (use_udp && msg_size > 65507) || runtime < 1 ||
+	    port < 1 || port > 65535) {
+		fprintf(stderr, "Invalid options\n");
+		return 1;
+	}
+
+	if (server_only) {
+		for (;;)
+			sink_thread((void *)(long)server_socket(INADDR_ANY));
+		return 0;
+	}
+
+	local = !strncmp(addr, "127.", 4);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %s sends of %d bytes to %s:%d, %d sec per run%s\n\n",
+		       use_udp ? "UDP" : "TCP", msg_size, addr, port, runtime,
+		       local ? " (loopback, always copied)" : "");
+
+	if (local) {
+		fd = server_socket(inet_addr(addr));
+		if (pthread_create(&sink, NULL, sink_thread, (void *)(long)fd))
+			die("pthread_create failed\n");
+	}
+
+	ret = run_once(false) || run_once(true);
+
+	if (local) {
+		/* wakes up the sink, blocked in accept() or recv() */
+		shutdown(fd, SHUT_RDWR);
+		pthread_join(sink, NULL);
+	}
+
+	return ret;
+}
@@ -13,6 +13,9 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  block ... block layer and I/O scheduler performance
+ *  net   ... networking stack performance
+ *  fs    ... filesystem performance
  *
  */
 
@@ -58,6 +61,72 @@ static struct bench_suite mem_suites[] = {
 	  NULL             }
 };
 
+static struct bench_suite block_suites[] = {
+	{ "replay",
+	  "Replay a block trace under several I/O schedulers",
+	  bench_block_replay },
+	{ "wbt",
+	  "Read latency under buffered writeback, with and without throttling",
+	  bench_block_wbt },
+	{ "uring",
+	  "Random read IOPS per cpu of io_uring against AIO",
+	  bench_block_uring },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL               }
+};
+
+static struct bench_suite net_suites[] = {
+	{ "reuseport",
+	  "Loopback TCP accept rate, shared listener vs SO_REUSEPORT",
+	  bench_net_reuseport },
+	{ "tun",
+	  "UDP round trips through a multiqueue tun device",
+	  bench_net_tun },
+	{ "busy-poll",
+	  "Request/response latency with and without SO_BUSY_POLL",
+	  bench_net_busy_poll },
+	{ "conntrack",
+	  "Connection tracking insert rate against the number of threads",
+	  bench_net_conntrack },
+	{ "zerocopy",
+	  "Stream throughput and sender cpu cost with and without MSG_ZEROCOPY",
+	  bench_net_zerocopy },
+	{ "udp-gso",
+	  "UDP stream throughput with and without UDP_SEGMENT and UDP_GRO",
+	  bench_net_udp_gso },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL                }
+};
+
+static struct bench_suite fs_suites[] = {
+	{ "mballoc",
+	  "Large allocation latency of ext4 on a nearly full filesystem",
+	  bench_fs_mballoc },
+	{ "epoll-wait",
+	  "Event rate of threads waiting on shared or exclusive epoll sets",
+	  bench_fs_epoll_wait },
+	{ "create",
+	  "Rate of file creates and unlinks as threads are added",
+	  bench_fs_create },
+	{ "fsmark",
+	  "Small file creates, writes and time updates as threads are added",
+	  bench_fs_fsmark },
+	{ "pipe",
+	  "Throughput of a pipe filled by write or vmsplice",
+	  bench_fs_pipe },
+	{ "readdir",
+	  "Directory scan by getdents and lstat, or by getdents_plus",
+	  bench_fs_readdir },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL             }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +140,15 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "block",
+	  "block layer and I/O scheduler performance",
+	  block_suites },
+	{ "net",
+	  "networking stack performance",
+	  net_suites },
+	{ "fs",
+	  "filesystem performance",
+	  fs_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },